@@ -0,0 +1,240 @@
+// The MIT License (MIT)
+// Circuit breakers for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#include "WinHttpBreaker.h"
+#include "WinHttpMetrics.h"
+#include "WinHttpWrapper.h"
+#include <algorithm>
+
+namespace
+{
+	const wchar_t* StateName(WinHttpWrapper::BreakerState state)
+	{
+		switch (state)
+		{
+		case WinHttpWrapper::BREAKER_OPEN: return L"open";
+		case WinHttpWrapper::BREAKER_HALF_OPEN: return L"half-open";
+		default: return L"closed";
+		}
+	}
+}
+
+void WinHttpWrapper::CircuitBreakers::Ticket::Report(bool failed, ULONGLONG latencyMs)
+{
+	if (m_Breakers)
+	{
+		m_Breakers->Report(m_Host, m_Probe, failed, latencyMs);
+		m_Breakers = NULL;
+	}
+}
+
+void WinHttpWrapper::CircuitBreakers::Ticket::Release()
+{
+	if (m_Breakers)
+	{
+		if (m_Probe)
+			m_Breakers->Abandon(m_Host);
+		m_Breakers = NULL;
+	}
+}
+
+WinHttpWrapper::CircuitBreakers& WinHttpWrapper::CircuitBreakers::Instance()
+{
+	static CircuitBreakers instance;
+	return instance;
+}
+
+WinHttpWrapper::CircuitBreakers::CircuitBreakers()
+	: m_Enabled(false)
+{
+}
+
+void WinHttpWrapper::CircuitBreakers::SetEnabled(bool enabled)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Enabled = enabled;
+	if (!enabled)
+		m_Breakers.clear();
+}
+
+void WinHttpWrapper::CircuitBreakers::SetOptions(const BreakerOptions& options)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Options = options;
+	m_Options.minCalls = (std::max)(1, options.minCalls);
+	m_Options.halfOpenProbes = (std::max)(1, options.halfOpenProbes);
+	m_Options.windowMs = (std::max)(static_cast<DWORD>(kBuckets), options.windowMs);
+	// The buckets were for the old window
+	for (auto& entry : m_Breakers)
+	{
+		for (Bucket& bucket : entry.second.buckets)
+			bucket = Bucket();
+	}
+}
+
+long long WinHttpWrapper::CircuitBreakers::Epoch(std::chrono::steady_clock::time_point now) const
+{
+	const long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+	return ms / (m_Options.windowMs / kBuckets);
+}
+
+void WinHttpWrapper::CircuitBreakers::Totals(const Breaker& breaker, long long epoch,
+	ULONGLONG& calls, ULONGLONG& failures, ULONGLONG& slow) const
+{
+	calls = failures = slow = 0;
+	for (const Bucket& bucket : breaker.buckets)
+	{
+		if (bucket.epoch > epoch - kBuckets)
+		{
+			calls += bucket.calls;
+			failures += bucket.failures;
+			slow += bucket.slow;
+		}
+	}
+}
+
+void WinHttpWrapper::CircuitBreakers::Change(const std::wstring& host, Breaker& breaker, BreakerState state,
+	std::chrono::steady_clock::time_point now)
+{
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[BREAKER] '%s' %s -> %s", host.c_str(), StateName(breaker.state), StateName(state));
+	}
+	breaker.state = state;
+	breaker.changed = now;
+	breaker.probes = 0;
+	breaker.probeSuccesses = 0;
+	if (state == BREAKER_OPEN)
+		++breaker.opened;
+	else if (state == BREAKER_CLOSED)
+	{
+		// A fresh window: what opened it is over
+		for (Bucket& bucket : breaker.buckets)
+			bucket = Bucket();
+	}
+}
+
+WinHttpWrapper::CircuitBreakers::Ticket WinHttpWrapper::CircuitBreakers::Acquire(const std::wstring& host)
+{
+	Ticket ticket;
+	if (!m_Enabled.load(std::memory_order_relaxed))
+		return ticket;
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	auto it = m_Breakers.find(host);
+	if (it == m_Breakers.end())
+	{
+		it = m_Breakers.emplace(host, Breaker()).first;
+		it->second.changed = now;
+	}
+	Breaker& breaker = it->second;
+
+	if (breaker.state == BREAKER_OPEN)
+	{
+		if (now - breaker.changed < std::chrono::milliseconds(m_Options.openMs))
+		{
+			++breaker.rejected;
+			ticket.m_Allowed = false;
+			return ticket;
+		}
+		Change(host, breaker, BREAKER_HALF_OPEN, now);
+	}
+	if (breaker.state == BREAKER_HALF_OPEN)
+	{
+		if (breaker.probes >= m_Options.halfOpenProbes)
+		{
+			++breaker.rejected;
+			ticket.m_Allowed = false;
+			return ticket;
+		}
+		++breaker.probes;
+		ticket.m_Probe = true;
+	}
+	ticket.m_Breakers = this;
+	ticket.m_Host = host;
+	return ticket;
+}
+
+void WinHttpWrapper::CircuitBreakers::Report(const std::wstring& host, bool probe, bool failed, ULONGLONG latencyMs)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	auto it = m_Breakers.find(host);
+	if (it == m_Breakers.end())
+		return;
+	Breaker& breaker = it->second;
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	const bool slow = m_Options.slowCallMs > 0 && latencyMs > m_Options.slowCallMs;
+
+	if (probe)
+	{
+		if (breaker.state != BREAKER_HALF_OPEN)
+			return;
+		--breaker.probes;
+		if (failed || slow)
+			Change(host, breaker, BREAKER_OPEN, now);
+		else if (++breaker.probeSuccesses >= m_Options.halfOpenProbes)
+			Change(host, breaker, BREAKER_CLOSED, now);
+		return;
+	}
+
+	// Requests sent before the breaker opened say nothing new
+	if (breaker.state != BREAKER_CLOSED)
+		return;
+
+	const long long epoch = Epoch(now);
+	Bucket& bucket = breaker.buckets[epoch % kBuckets];
+	if (bucket.epoch != epoch)
+	{
+		bucket = Bucket();
+		bucket.epoch = epoch;
+	}
+	++bucket.calls;
+	if (failed)
+		++bucket.failures;
+	if (slow)
+		++bucket.slow;
+
+	ULONGLONG calls, failures, slowCalls;
+	Totals(breaker, epoch, calls, failures, slowCalls);
+	if (calls < static_cast<ULONGLONG>(m_Options.minCalls))
+		return;
+	if ((m_Options.failureRate > 0 && failures >= m_Options.failureRate * calls)
+		|| (m_Options.slowCallMs > 0 && m_Options.slowCallRate > 0 && slowCalls >= m_Options.slowCallRate * calls))
+	{
+		Change(host, breaker, BREAKER_OPEN, now);
+	}
+}
+
+void WinHttpWrapper::CircuitBreakers::Abandon(const std::wstring& host)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	auto it = m_Breakers.find(host);
+	if (it != m_Breakers.end() && it->second.state == BREAKER_HALF_OPEN && it->second.probes > 0)
+		--it->second.probes;
+}
+
+void WinHttpWrapper::CircuitBreakers::FillMetrics(Metrics& metrics)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	const long long epoch = Epoch(now);
+	for (const auto& entry : m_Breakers)
+	{
+		const Breaker& breaker = entry.second;
+		ULONGLONG calls, failures, slow;
+		Totals(breaker, epoch, calls, failures, slow);
+
+		BreakerMetrics breakerMetrics;
+		breakerMetrics.host = entry.first;
+		breakerMetrics.state = breaker.state;
+		breakerMetrics.stateMs = std::chrono::duration_cast<std::chrono::milliseconds>(now - breaker.changed).count();
+		breakerMetrics.failureRate = calls ? static_cast<double>(failures) / calls : 0.0;
+		breakerMetrics.slowCallRate = calls ? static_cast<double>(slow) / calls : 0.0;
+		breakerMetrics.calls = calls;
+		breakerMetrics.opened = breaker.opened;
+		breakerMetrics.rejected = breaker.rejected;
+		metrics.breakers.push_back(breakerMetrics);
+	}
+}
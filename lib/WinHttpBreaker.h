@@ -0,0 +1,166 @@
+// The MIT License (MIT)
+// Circuit breakers for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include "WinHttpPlatform.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace WinHttpWrapper
+{
+	struct Metrics;
+
+	enum BreakerState
+	{
+		BREAKER_CLOSED = 0,         // Requests go through
+		BREAKER_OPEN,               // Requests fail right away
+		BREAKER_HALF_OPEN           // A few probe requests go through
+	};
+
+	struct BreakerOptions
+	{
+		BreakerOptions()
+			: failureRate(0.5), slowCallMs(0), slowCallRate(0.5), minCalls(10),
+			windowMs(10000), openMs(5000), halfOpenProbes(1) {}
+
+		double failureRate;         // Share of failed requests opening the breaker
+		DWORD slowCallMs;           // Time to the response headers past which a request is slow, 0 for none
+		double slowCallRate;        // Share of slow requests opening the breaker
+		int minCalls;               // Requests within the window before the rates count
+		DWORD windowMs;             // The rates are those of the requests of the last windowMs
+		DWORD openMs;               // Time open before probing again
+		int halfOpenProbes;         // Probes at once when half-open, all succeeding closes the breaker
+	};
+
+	// State of the breaker of one server
+	struct BreakerMetrics
+	{
+		std::wstring host;          // host:port
+		BreakerState state;
+		ULONGLONG stateMs;          // Time since the last change of state
+		double failureRate;         // Within the window
+		double slowCallRate;
+		ULONGLONG calls;            // Within the window
+		ULONGLONG opened;           // Times it opened
+		ULONGLONG rejected;         // Requests failed right away
+	};
+
+	// One breaker per server (host:port, an endpoint of a group when routed)
+	// so that requests to a server that is down fail right away instead of
+	// each waiting for the connect timeout. Transport failures, 5xx and 429
+	// count as failures, and past slowCallMs as slow. When either share over
+	// the window crosses its threshold, the breaker opens: requests fail with
+	// kCircuitOpenError for openMs. It then lets halfOpenProbes requests
+	// through at once, and closes when they all succeed, or opens again on
+	// the first that does not.
+	class CircuitBreakers
+	{
+	public:
+		// Right to send a request; reports its outcome, or frees its probe
+		// slot when destroyed without a report (a cancelled request)
+		class Ticket
+		{
+		public:
+			Ticket() : m_Breakers(NULL), m_Probe(false), m_Allowed(true) {}
+			Ticket(Ticket&& other)
+				: m_Breakers(other.m_Breakers)
+				, m_Host(std::move(other.m_Host))
+				, m_Probe(other.m_Probe)
+				, m_Allowed(other.m_Allowed)
+			{
+				other.m_Breakers = NULL;
+			}
+			Ticket& operator=(Ticket&& other)
+			{
+				if (this != &other)
+				{
+					Release();
+					m_Breakers = other.m_Breakers;
+					m_Host = std::move(other.m_Host);
+					m_Probe = other.m_Probe;
+					m_Allowed = other.m_Allowed;
+					other.m_Breakers = NULL;
+				}
+				return *this;
+			}
+			~Ticket()
+			{
+				Release();
+			}
+
+			// False when the breaker is open
+			bool Allowed() const { return m_Allowed; }
+			void Report(bool failed, ULONGLONG latencyMs);
+			void Release();
+
+		private:
+			friend class CircuitBreakers;
+			Ticket(const Ticket&) = delete;
+			Ticket& operator=(const Ticket&) = delete;
+
+			CircuitBreakers* m_Breakers;    // NULL once reported, or when not tracked
+			std::wstring m_Host;
+			bool m_Probe;
+			bool m_Allowed;
+		};
+
+		static CircuitBreakers& Instance();
+
+		// Off by default; turning them off forgets every breaker
+		void SetEnabled(bool enabled);
+		void SetOptions(const BreakerOptions& options);
+
+		Ticket Acquire(const std::wstring& host);
+
+		void FillMetrics(Metrics& metrics);
+
+	private:
+		CircuitBreakers();
+
+		static const int kBuckets = 10;
+
+		// Requests of one tenth of the window
+		struct Bucket
+		{
+			Bucket() : epoch(-1), calls(0), failures(0), slow(0) {}
+
+			long long epoch;
+			ULONGLONG calls;
+			ULONGLONG failures;
+			ULONGLONG slow;
+		};
+
+		struct Breaker
+		{
+			Breaker() : state(BREAKER_CLOSED), probes(0), probeSuccesses(0), opened(0), rejected(0) {}
+
+			BreakerState state;
+			std::chrono::steady_clock::time_point changed;
+			Bucket buckets[kBuckets];
+			int probes;                 // Probes in flight
+			int probeSuccesses;
+			ULONGLONG opened;
+			ULONGLONG rejected;
+		};
+
+		void Report(const std::wstring& host, bool probe, bool failed, ULONGLONG latencyMs);
+		void Abandon(const std::wstring& host);
+		long long Epoch(std::chrono::steady_clock::time_point now) const;
+		// Calls, failures and slow calls within the window
+		void Totals(const Breaker& breaker, long long epoch, ULONGLONG& calls, ULONGLONG& failures, ULONGLONG& slow) const;
+		void Change(const std::wstring& host, Breaker& breaker, BreakerState state, std::chrono::steady_clock::time_point now);
+
+		std::mutex m_Mutex;
+		std::atomic<bool> m_Enabled;    // Checked without the lock
+		BreakerOptions m_Options;
+		std::unordered_map<std::wstring, Breaker> m_Breakers;
+	};
+
+}
@@ -0,0 +1,108 @@
+// The MIT License (MIT)
+// Native buffers for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#include "WinHttpBuffer.h"
+#include "WinHttpWrapper.h"
+#include "WinHttpUtf.h"
+#include <limits>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+WinHttpWrapper::NativeBuffer::NativeBuffer()
+	: m_View(NULL)
+	, m_Size(0)
+	, m_Mapped(false)
+{
+}
+
+WinHttpWrapper::NativeBuffer::NativeBuffer(std::vector<uint8_t>&& data)
+	: m_Data(std::move(data))
+	, m_View(NULL)
+	, m_Size(0)
+	, m_Mapped(false)
+{
+	data.clear();
+	m_View = m_Data.data();
+	m_Size = m_Data.size();
+}
+
+WinHttpWrapper::NativeBuffer::~NativeBuffer()
+{
+	if (!m_Mapped)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(m_View);
+#else
+	munmap(m_View, m_Size);
+#endif
+}
+
+std::unique_ptr<WinHttpWrapper::NativeBuffer> WinHttpWrapper::NativeBuffer::MapFile(const std::wstring& path)
+{
+	std::unique_ptr<NativeBuffer> buffer(new NativeBuffer());
+
+#ifdef _WIN32
+	HANDLE hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+		NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return std::unique_ptr<NativeBuffer>();
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(hFile, &size) || static_cast<ULONGLONG>(size.QuadPart) > (std::numeric_limits<size_t>::max)())
+	{
+		CloseHandle(hFile);
+		return std::unique_ptr<NativeBuffer>();
+	}
+	// Empty files cannot be mapped, and need not be
+	if (size.QuadPart > 0)
+	{
+		// The view keeps the mapping alive once the handles are closed
+		HANDLE hMapping = CreateFileMappingW(hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+		void* view = hMapping ? MapViewOfFile(hMapping, FILE_MAP_COPY, 0, 0, 0) : NULL;
+		if (hMapping)
+			CloseHandle(hMapping);
+		if (!view)
+		{
+			CloseHandle(hFile);
+			return std::unique_ptr<NativeBuffer>();
+		}
+		buffer->m_View = static_cast<uint8_t*>(view);
+		buffer->m_Size = static_cast<size_t>(size.QuadPart);
+		buffer->m_Mapped = true;
+	}
+	CloseHandle(hFile);
+#else
+	int fd = open(WideToUtf8(path).c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return std::unique_ptr<NativeBuffer>();
+	struct stat info;
+	if (fstat(fd, &info) != 0 || static_cast<ULONGLONG>(info.st_size) > (std::numeric_limits<size_t>::max)())
+	{
+		close(fd);
+		return std::unique_ptr<NativeBuffer>();
+	}
+	if (info.st_size > 0)
+	{
+		void* view = mmap(NULL, static_cast<size_t>(info.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (view == MAP_FAILED)
+		{
+			close(fd);
+			return std::unique_ptr<NativeBuffer>();
+		}
+		buffer->m_View = static_cast<uint8_t*>(view);
+		buffer->m_Size = static_cast<size_t>(info.st_size);
+		buffer->m_Mapped = true;
+	}
+	close(fd);
+#endif
+
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[BUFFER] Mapped '%s', %zu bytes", path.c_str(), buffer->m_Size);
+	}
+	return buffer;
+}
@@ -0,0 +1,46 @@
+// The MIT License (MIT)
+// Native buffers for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include "WinHttpPlatform.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace WinHttpWrapper
+{
+	// Bytes kept in native memory for bindings whose runtime has a garbage
+	// collected heap: large bodies handed over this way never get copied
+	// into it. Either owns the body of a response, taken without copying, or
+	// maps a file (such as a finished download) copy-on-write: writes
+	// through Data() stay private to the buffer and never reach the file.
+	// Data() is valid until the buffer is destroyed.
+	class NativeBuffer
+	{
+	public:
+		// Takes over the bytes of data, leaving it empty
+		explicit NativeBuffer(std::vector<uint8_t>&& data);
+		~NativeBuffer();
+
+		// NULL when the file cannot be opened or mapped
+		static std::unique_ptr<NativeBuffer> MapFile(const std::wstring& path);
+
+		uint8_t* Data() { return m_View; }
+		size_t Size() const { return m_Size; }
+		bool IsMapped() const { return m_Mapped; }
+
+	private:
+		NativeBuffer();
+		NativeBuffer(const NativeBuffer&) = delete;
+		NativeBuffer& operator=(const NativeBuffer&) = delete;
+
+		std::vector<uint8_t> m_Data;
+		uint8_t* m_View;
+		size_t m_Size;
+		bool m_Mapped;
+	};
+
+}
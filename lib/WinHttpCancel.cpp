@@ -0,0 +1,161 @@
+// The MIT License (MIT)
+// Request cancellation for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#include "WinHttpCancel.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <thread>
+
+struct WinHttpWrapper::CancellationToken::State
+{
+	State() : cancelled(false), nextId(1), running(false) {}
+
+	std::atomic<bool> cancelled;
+	std::mutex mutex;
+	std::condition_variable done;
+	std::map<unsigned long long, std::function<void()>> callbacks;
+	std::vector<std::weak_ptr<State>> children;
+	unsigned long long nextId;
+	bool running;                   // Callbacks taken by Cancel() still running
+	std::thread::id canceller;
+};
+
+WinHttpWrapper::CancellationToken::CancellationToken()
+	: m_State(std::make_shared<State>())
+{
+}
+
+WinHttpWrapper::CancellationToken WinHttpWrapper::CancellationToken::Child() const
+{
+	std::shared_ptr<State> child = std::make_shared<State>();
+	{
+		std::lock_guard<std::mutex> lock(m_State->mutex);
+		if (!m_State->cancelled)
+		{
+			// Forget the children gone meanwhile
+			m_State->children.erase(std::remove_if(m_State->children.begin(), m_State->children.end(),
+				[](const std::weak_ptr<State>& state) { return state.expired(); }), m_State->children.end());
+			m_State->children.push_back(child);
+			return CancellationToken(child);
+		}
+	}
+	child->cancelled = true;
+	return CancellationToken(child);
+}
+
+void WinHttpWrapper::CancellationToken::Cancel()
+{
+	std::map<unsigned long long, std::function<void()>> callbacks;
+	std::vector<std::weak_ptr<State>> children;
+	{
+		std::lock_guard<std::mutex> lock(m_State->mutex);
+		if (m_State->cancelled)
+			return;
+		m_State->cancelled = true;
+		callbacks.swap(m_State->callbacks);
+		children.swap(m_State->children);
+		m_State->running = true;
+		m_State->canceller = std::this_thread::get_id();
+	}
+
+	for (auto& callback : callbacks)
+		callback.second();
+
+	{
+		std::lock_guard<std::mutex> lock(m_State->mutex);
+		m_State->running = false;
+	}
+	m_State->done.notify_all();
+
+	for (const std::weak_ptr<State>& state : children)
+	{
+		std::shared_ptr<State> child = state.lock();
+		if (child)
+			CancellationToken(child).Cancel();
+	}
+}
+
+bool WinHttpWrapper::CancellationToken::IsCancelled() const
+{
+	return m_State->cancelled.load(std::memory_order_acquire);
+}
+
+WinHttpWrapper::CancellationToken::Registration WinHttpWrapper::CancellationToken::OnCancel(std::function<void()> callback) const
+{
+	Registration registration;
+	{
+		std::lock_guard<std::mutex> lock(m_State->mutex);
+		if (!m_State->cancelled)
+		{
+			registration.m_State = m_State;
+			registration.m_Id = m_State->nextId++;
+			m_State->callbacks[registration.m_Id] = std::move(callback);
+			return registration;
+		}
+	}
+	callback();
+	return registration;
+}
+
+void WinHttpWrapper::CancellationToken::Registration::Reset()
+{
+	if (!m_State)
+		return;
+
+	std::unique_lock<std::mutex> lock(m_State->mutex);
+	// Not registered anymore: Cancel() took the callback, wait until it
+	// returned (unless this is the callback's own thread)
+	if (m_State->callbacks.erase(m_Id) == 0 && m_State->canceller != std::this_thread::get_id())
+	{
+		std::shared_ptr<State> state = m_State;
+		state->done.wait(lock, [&state] { return !state->running; });
+	}
+	lock.unlock();
+	m_State.reset();
+}
+
+#ifdef _WIN32
+
+WinHttpWrapper::CancellableHandles::CancellableHandles(const CancellationToken* token)
+	: m_Cancelled(false)
+{
+	if (token)
+		m_Registration = token->OnCancel([this] { CloseAll(); });
+}
+
+bool WinHttpWrapper::CancellableHandles::Add(HINTERNET hRequest)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (m_Cancelled)
+	{
+		WinHttpCloseHandle(hRequest);
+		return false;
+	}
+	m_Open.push_back(hRequest);
+	return true;
+}
+
+void WinHttpWrapper::CancellableHandles::Close(HINTERNET hRequest)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	auto it = std::find(m_Open.begin(), m_Open.end(), hRequest);
+	if (it == m_Open.end())
+		return;
+	m_Open.erase(it);
+	WinHttpCloseHandle(hRequest);
+}
+
+void WinHttpWrapper::CancellableHandles::CloseAll()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Cancelled = true;
+	for (HINTERNET hRequest : m_Open)
+		WinHttpCloseHandle(hRequest);
+	m_Open.clear();
+}
+
+#endif
@@ -0,0 +1,106 @@
+// The MIT License (MIT)
+// Request cancellation for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include "WinHttpPlatform.h"
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace WinHttpWrapper
+{
+	// Cancels requests from any thread. Copies share one state, and a child
+	// is cancelled along with its parent (not the other way around), so one
+	// token can stand for a screen, a batch or a client while each request
+	// gets its own child. Whatever a request is blocked on is aborted by
+	// callbacks registered with OnCancel(): the scheduler queue, the WinHTTP
+	// request handle, the socket wait of PosixTransport. Cancelled requests
+	// fail with response.cancelled set.
+	class CancellationToken
+	{
+		struct State;
+
+	public:
+		CancellationToken();
+
+		CancellationToken Child() const;
+
+		void Cancel();
+		bool IsCancelled() const;
+
+		// Unregisters its callback when destroyed, waiting for it to return
+		// if another thread is running it
+		class Registration
+		{
+		public:
+			Registration() : m_Id(0) {}
+			Registration(Registration&& other) : m_State(std::move(other.m_State)), m_Id(other.m_Id) {}
+			Registration& operator=(Registration&& other)
+			{
+				if (this != &other)
+				{
+					Reset();
+					m_State = std::move(other.m_State);
+					m_Id = other.m_Id;
+				}
+				return *this;
+			}
+			~Registration()
+			{
+				Reset();
+			}
+			void Reset();
+
+		private:
+			friend class CancellationToken;
+			Registration(const Registration&) = delete;
+			Registration& operator=(const Registration&) = delete;
+
+			std::shared_ptr<State> m_State;
+			unsigned long long m_Id;
+		};
+
+		// callback runs once, on the thread calling Cancel(), or right away
+		// when the token is already cancelled. It must not block on the
+		// request it aborts.
+		Registration OnCancel(std::function<void()> callback) const;
+
+	private:
+		explicit CancellationToken(std::shared_ptr<State> state) : m_State(state) {}
+
+		std::shared_ptr<State> m_State;
+	};
+
+#ifdef _WIN32
+	// WinHTTP request handles closed by a cancellation from its own thread,
+	// which makes the calls blocked on them (connect, send, receive, read)
+	// fail right away. The owner closes them through Close() otherwise.
+	class CancellableHandles
+	{
+	public:
+		explicit CancellableHandles(const CancellationToken* token);
+
+		// False, with the handle closed, when already cancelled
+		bool Add(HINTERNET hRequest);
+		// Close a handle given to Add(), unless the cancellation did
+		void Close(HINTERNET hRequest);
+
+	private:
+		CancellableHandles(const CancellableHandles&) = delete;
+		CancellableHandles& operator=(const CancellableHandles&) = delete;
+
+		void CloseAll();
+
+		std::mutex m_Mutex;
+		std::vector<HINTERNET> m_Open;
+		bool m_Cancelled;
+		// Last, so that it is unregistered before the rest is destroyed
+		CancellationToken::Registration m_Registration;
+	};
+#endif
+
+}
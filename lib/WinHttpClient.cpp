@@ -0,0 +1,177 @@
+// The MIT License (MIT)
+// Reusable client for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#include "WinHttpClient.h"
+
+namespace
+{
+	// With the Content-Type of source, as HttpRequest::Upload() sends it
+	std::wstring UploadHeaders(const std::wstring& headers, const WinHttpWrapper::BodySource& source)
+	{
+		const std::wstring contentType = source.ContentType();
+		return contentType.empty() ? headers : headers + L"Content-Type: " + contentType + L"\r\n";
+	}
+}
+
+WinHttpWrapper::HttpClient::HttpClient(const HttpRequest& prototype,
+	const std::wstring& basePath,
+	const std::wstring& headers)
+	: m_Request(prototype)
+	, m_BasePath(basePath)
+	, m_Headers(headers)
+	, m_Cancel(NewToken())
+{
+	// "/" alone adds nothing, and a trailing one is supplied by the paths
+	while (!m_BasePath.empty() && m_BasePath.back() == L'/')
+		m_BasePath.pop_back();
+}
+
+std::wstring WinHttpWrapper::HttpClient::JoinPath(const std::wstring& path) const
+{
+	if (path.empty())
+		return m_BasePath.empty() ? L"/" : m_BasePath;
+	if (path[0] == L'/')
+		return m_BasePath + path;
+	return m_BasePath + L"/" + path;
+}
+
+int WinHttpWrapper::HttpClient::Prepare(const std::wstring& verb,
+	const std::wstring& pathTemplate,
+	const std::wstring& headers)
+{
+	std::shared_ptr<PreparedRequest> prepared = std::make_shared<PreparedRequest>();
+	prepared->verb = verb;
+	prepared->headers = m_Headers + headers;
+
+	std::wstring path = JoinPath(pathTemplate);
+	size_t start = 0;
+	for (size_t pos = path.find(L"{}"); pos != std::wstring::npos; pos = path.find(L"{}", start))
+	{
+		prepared->pieces.push_back(path.substr(start, pos - start));
+		start = pos + 2;
+	}
+	prepared->pieces.push_back(path.substr(start));
+
+	std::lock_guard<std::mutex> lock(m_PreparedMutex);
+	m_Prepared.push_back(prepared);
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[CLIENT] Prepared request %zu: %s '%s' (%zu parameter(s))",
+			m_Prepared.size() - 1, verb.c_str(), path.c_str(), prepared->pieces.size() - 1);
+	}
+	return static_cast<int>(m_Prepared.size() - 1);
+}
+
+std::shared_ptr<const WinHttpWrapper::HttpClient::PreparedRequest>
+WinHttpWrapper::HttpClient::Resolve(int id,
+	const std::vector<std::wstring>& params,
+	std::wstring& path,
+	HttpResponse& response)
+{
+	std::shared_ptr<const PreparedRequest> prepared;
+	{
+		std::lock_guard<std::mutex> lock(m_PreparedMutex);
+		if (id >= 0 && static_cast<size_t>(id) < m_Prepared.size())
+			prepared = m_Prepared[id];
+	}
+	if (!prepared)
+	{
+		response.error = L"Unknown prepared request!";
+		return NULL;
+	}
+	if (params.size() + 1 != prepared->pieces.size())
+	{
+		response.error = L"Wrong number of path parameters!";
+		return NULL;
+	}
+
+	size_t length = 0;
+	for (const std::wstring& piece : prepared->pieces)
+		length += piece.size();
+	for (const std::wstring& param : params)
+		length += param.size();
+
+	path.clear();
+	path.reserve(length);
+	path += prepared->pieces[0];
+	for (size_t i = 0; i < params.size(); ++i)
+	{
+		path += params[i];
+		path += prepared->pieces[i + 1];
+	}
+	return prepared;
+}
+
+bool WinHttpWrapper::HttpClient::Send(int id,
+	const std::vector<std::wstring>& params,
+	const std::string& body,
+	HttpResponse& response)
+{
+	std::wstring path;
+	std::shared_ptr<const PreparedRequest> prepared = Resolve(id, params, path, response);
+	if (!prepared)
+		return false;
+
+	const CancellationToken token = CurrentToken();
+	return m_Request.Request(prepared->verb, path, prepared->headers, body, response, NULL, &token);
+}
+
+bool WinHttpWrapper::HttpClient::Send(const std::wstring& verb,
+	const std::wstring& path,
+	const std::wstring& headers,
+	const std::string& body,
+	HttpResponse& response)
+{
+	const CancellationToken token = CurrentToken();
+	return m_Request.Request(verb, JoinPath(path), m_Headers + headers, body, response, NULL, &token);
+}
+
+bool WinHttpWrapper::HttpClient::Send(int id,
+	const std::vector<std::wstring>& params,
+	BodySource& source,
+	HttpResponse& response)
+{
+	std::wstring path;
+	std::shared_ptr<const PreparedRequest> prepared = Resolve(id, params, path, response);
+	if (!prepared)
+		return false;
+
+	const CancellationToken token = CurrentToken();
+	return m_Request.Request(prepared->verb, path, UploadHeaders(prepared->headers, source), std::string(), response, &source, &token);
+}
+
+bool WinHttpWrapper::HttpClient::Send(const std::wstring& verb,
+	const std::wstring& path,
+	const std::wstring& headers,
+	BodySource& source,
+	HttpResponse& response)
+{
+	const CancellationToken token = CurrentToken();
+	return m_Request.Request(verb, JoinPath(path), UploadHeaders(m_Headers + headers, source), std::string(), response, &source, &token);
+}
+
+void WinHttpWrapper::HttpClient::CancelAll()
+{
+	CancellationToken cancelled;
+	{
+		std::lock_guard<std::mutex> lock(m_CancelMutex);
+		cancelled = m_Cancel;
+		m_Cancel = NewToken();
+	}
+	if (IsDebugLoggingEnabled()) {
+		DebugLog(L"[CLIENT] Cancelling all requests");
+	}
+	cancelled.Cancel();
+}
+
+WinHttpWrapper::CancellationToken WinHttpWrapper::HttpClient::CurrentToken()
+{
+	std::lock_guard<std::mutex> lock(m_CancelMutex);
+	return m_Cancel;
+}
+
+WinHttpWrapper::CancellationToken WinHttpWrapper::HttpClient::NewToken() const
+{
+	return m_Request.m_Cancel ? m_Request.m_Cancel->Child() : CancellationToken();
+}
@@ -0,0 +1,94 @@
+// The MIT License (MIT)
+// Reusable client for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include "WinHttpWrapper.h"
+#include <memory>
+
+namespace WinHttpWrapper
+{
+	// Connection settings converted once, for callers sending many requests
+	// to the same server. A prepared request keeps its path split around
+	// "{}" placeholders and its headers merged with the client ones, so
+	// sending it only fills in the parameters.
+	// Sending is thread-safe, reconfiguring Prototype() while sending is not.
+	class HttpClient
+	{
+	public:
+		// basePath is prepended to every request path, headers are sent with
+		// every request ("Name: value\r\n" lines)
+		HttpClient(const HttpRequest& prototype,
+			const std::wstring& basePath = L"",
+			const std::wstring& headers = L"");
+
+		// Server, proxy, credentials, priority, ... shared by all requests
+		HttpRequest& Prototype() { return m_Request; }
+
+		// Returns the id to pass to Send(). Parameters are substituted as
+		// given: percent-encode them first if they may contain reserved
+		// characters.
+		int Prepare(const std::wstring& verb,
+			const std::wstring& pathTemplate,
+			const std::wstring& headers = L"");
+
+		bool Send(int id,
+			const std::vector<std::wstring>& params,
+			const std::string& body,
+			HttpResponse& response);
+
+		// One-off request, relative to the base path
+		bool Send(const std::wstring& verb,
+			const std::wstring& path,
+			const std::wstring& headers,
+			const std::string& body,
+			HttpResponse& response);
+
+		// Same two, with the body sent from source as HttpRequest::Upload()
+		// does: a MemorySource sends caller memory without copying it
+		bool Send(int id,
+			const std::vector<std::wstring>& params,
+			BodySource& source,
+			HttpResponse& response);
+		bool Send(const std::wstring& verb,
+			const std::wstring& path,
+			const std::wstring& headers,
+			BodySource& source,
+			HttpResponse& response);
+
+		// Abort every request in flight or queued, which fail with
+		// response.cancelled set; later requests are sent as usual
+		void CancelAll();
+
+	private:
+		struct PreparedRequest
+		{
+			std::wstring verb;
+			std::vector<std::wstring> pieces;   // Literal path parts between placeholders
+			std::wstring headers;
+		};
+
+		std::wstring JoinPath(const std::wstring& path) const;
+		// The prepared request id with its path filled in, or NULL with
+		// response.error set
+		std::shared_ptr<const PreparedRequest> Resolve(int id,
+			const std::vector<std::wstring>& params,
+			std::wstring& path,
+			HttpResponse& response);
+		// Token of the requests sent from now on
+		CancellationToken CurrentToken();
+		// Fresh token, a child of the prototype's one when it has one
+		CancellationToken NewToken() const;
+
+		HttpRequest m_Request;
+		std::wstring m_BasePath;
+		std::wstring m_Headers;
+		std::mutex m_PreparedMutex;
+		std::vector<std::shared_ptr<const PreparedRequest>> m_Prepared;
+		std::mutex m_CancelMutex;
+		CancellationToken m_Cancel;     // Replaced by each CancelAll()
+	};
+
+}
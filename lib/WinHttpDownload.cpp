@@ -0,0 +1,1061 @@
+// The MIT License (MIT)
+// Segmented downloads for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+// Segmented downloads: HttpRequest::Download() probes the resource with a
+// first Range request, splits the rest into byte ranges fetched in parallel
+// over the connections of one WinHTTP session, and writes every chunk
+// directly at its offset in a preallocated file or buffer.
+//
+// Resumable downloads: with DownloadOptions::resume, progress is kept in a
+// "<file>.download" sidecar (URL, validator, size, completed ranges). A
+// later call only requests the missing ranges, with If-Range so that a
+// changed resource comes back whole and the download restarts cleanly.
+
+#ifdef _WIN32
+
+#include "WinHttpWrapper.h"
+#include "WinHttpUtf.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <thread>
+
+namespace
+{
+	const DWORD kReadChunkSize = 64 * 1024;
+	const int kSegmentAttempts = 3;
+	const ULONGLONG kOpenEnded = ~0ULL;
+
+	typedef std::pair<ULONGLONG, ULONGLONG> ByteRange;  // [first, end)
+
+	// Destination of a download: a file written at explicit offsets, or an
+	// in-memory buffer. Writes to disjoint ranges may happen concurrently
+	// once the size is known and Preallocate() succeeded.
+	class DownloadTarget
+	{
+	public:
+		DownloadTarget(const std::wstring& filePath, std::vector<uint8_t>& buffer)
+			: m_FilePath(filePath)
+			, m_Buffer(buffer)
+			, m_File(INVALID_HANDLE_VALUE)
+		{}
+
+		~DownloadTarget()
+		{
+			Close();
+		}
+
+		bool IsFile() const
+		{
+			return !m_FilePath.empty();
+		}
+
+		// keep: reopen the file as is, to resume a previous download
+		bool Open(bool keep)
+		{
+			if (!IsFile())
+			{
+				m_Buffer.clear();
+				return true;
+			}
+			m_File = CreateFileW(m_FilePath.c_str(), GENERIC_READ | GENERIC_WRITE,
+				FILE_SHARE_READ, NULL, keep ? OPEN_ALWAYS : CREATE_ALWAYS,
+				FILE_ATTRIBUTE_NORMAL, NULL);
+			return m_File != INVALID_HANDLE_VALUE;
+		}
+
+		ULONGLONG Size() const
+		{
+			if (!IsFile())
+				return m_Buffer.size();
+			LARGE_INTEGER li;
+			if (m_File == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_File, &li))
+				return 0;
+			return static_cast<ULONGLONG>(li.QuadPart);
+		}
+
+		bool Preallocate(ULONGLONG size)
+		{
+			if (!IsFile())
+			{
+				m_Buffer.resize(static_cast<size_t>(size));
+				return true;
+			}
+			LARGE_INTEGER li;
+			li.QuadPart = static_cast<LONGLONG>(size);
+			return SetFilePointerEx(m_File, li, NULL, FILE_BEGIN) && SetEndOfFile(m_File);
+		}
+
+		bool Write(ULONGLONG offset, const uint8_t* data, DWORD size)
+		{
+			if (!IsFile())
+			{
+				if (offset + size > m_Buffer.size())
+				{
+					// Only single-stream downloads of unknown length get here
+					m_Buffer.resize(static_cast<size_t>(offset + size));
+				}
+				memcpy(m_Buffer.data() + offset, data, size);
+				return true;
+			}
+			// A synchronous handle honours the OVERLAPPED offset, which lets
+			// several segments write concurrently without sharing a file pointer
+			OVERLAPPED ov;
+			ZeroMemory(&ov, sizeof(ov));
+			ov.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+			ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+			DWORD written = 0;
+			return WriteFile(m_File, data, size, &written, &ov) && written == size;
+		}
+
+		bool Read(ULONGLONG offset, uint8_t* data, DWORD size, DWORD& read)
+		{
+			if (!IsFile())
+			{
+				read = offset < m_Buffer.size()
+					? static_cast<DWORD>((std::min)(static_cast<ULONGLONG>(size), m_Buffer.size() - offset))
+					: 0;
+				memcpy(data, m_Buffer.data() + offset, read);
+				return true;
+			}
+			OVERLAPPED ov;
+			ZeroMemory(&ov, sizeof(ov));
+			ov.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+			ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+			read = 0;
+			return ReadFile(m_File, data, size, &read, &ov) != FALSE;
+		}
+
+		void Close()
+		{
+			if (m_File != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(m_File);
+				m_File = INVALID_HANDLE_VALUE;
+			}
+		}
+
+		// Close and remove whatever was written so far
+		void Discard()
+		{
+			Close();
+			if (IsFile())
+				DeleteFileW(m_FilePath.c_str());
+			else
+				m_Buffer.clear();
+		}
+
+	private:
+		std::wstring m_FilePath;
+		std::vector<uint8_t>& m_Buffer;
+		HANDLE m_File;
+	};
+
+	// Sidecar file recording the progress of a resumable download
+	class DownloadCheckpoint
+	{
+	public:
+		DownloadCheckpoint() : total(kOpenEnded) {}
+
+		std::wstring url;
+		std::wstring validator;     // Strong ETag or Last-Modified, sent as If-Range
+		ULONGLONG total;
+		std::vector<ByteRange> done;
+
+		void Reset()
+		{
+			validator.clear();
+			total = kOpenEnded;
+			done.clear();
+		}
+
+		// Record a completed range, merging it with its neighbours
+		void Add(ULONGLONG first, ULONGLONG end)
+		{
+			if (end <= first)
+				return;
+			done.push_back(ByteRange(first, end));
+			std::sort(done.begin(), done.end());
+			std::vector<ByteRange> merged;
+			for (const ByteRange& range : done)
+			{
+				if (!merged.empty() && range.first <= merged.back().second)
+					merged.back().second = (std::max)(merged.back().second, range.second);
+				else
+					merged.push_back(range);
+			}
+			done.swap(merged);
+		}
+
+		// Ranges still to download, or everything when the size is unknown
+		std::vector<ByteRange> Missing() const
+		{
+			std::vector<ByteRange> missing;
+			ULONGLONG pos = 0;
+			for (const ByteRange& range : done)
+			{
+				if (range.first > pos)
+					missing.push_back(ByteRange(pos, range.first));
+				pos = (std::max)(pos, range.second);
+			}
+			if (total == kOpenEnded || pos < total)
+				missing.push_back(ByteRange(pos, total));
+			return missing;
+		}
+
+		bool Load(const std::wstring& path)
+		{
+			HANDLE hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+				NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (hFile == INVALID_HANDLE_VALUE)
+				return false;
+
+			std::string content;
+			char buffer[4096];
+			DWORD dwRead = 0;
+			while (ReadFile(hFile, buffer, sizeof(buffer), &dwRead, NULL) && dwRead > 0)
+				content.append(buffer, dwRead);
+			CloseHandle(hFile);
+
+			Reset();
+			url.clear();
+			std::wstring text = WinHttpWrapper::Utf8ToWide(content);
+			size_t pos = 0;
+			while (pos < text.size())
+			{
+				size_t eol = text.find(L'\n', pos);
+				if (eol == std::wstring::npos)
+					eol = text.size();
+				std::wstring line = text.substr(pos, eol - pos);
+				pos = eol + 1;
+
+				size_t eq = line.find(L'=');
+				if (eq == std::wstring::npos)
+					continue;
+				std::wstring key = line.substr(0, eq);
+				std::wstring value = line.substr(eq + 1);
+				if (key == L"url")
+					url = value;
+				else if (key == L"validator")
+					validator = value;
+				else if (key == L"total")
+					total = wcstoull(value.c_str(), NULL, 10);
+				else if (key == L"done")
+				{
+					wchar_t* next = NULL;
+					ULONGLONG first = wcstoull(value.c_str(), &next, 10);
+					if (next && *next == L'-')
+						Add(first, wcstoull(next + 1, NULL, 10));
+				}
+			}
+			return !url.empty() && total != 0;
+		}
+
+		// Written to a temporary file first, so that a crash while saving
+		// never leaves a truncated checkpoint behind
+		bool Save(const std::wstring& path) const
+		{
+			std::wstring text = L"url=" + url + L"\n";
+			text += L"validator=" + validator + L"\n";
+			text += L"total=" + std::to_wstring(total) + L"\n";
+			for (const ByteRange& range : done)
+				text += L"done=" + std::to_wstring(range.first) + L"-" + std::to_wstring(range.second) + L"\n";
+			std::string content = WinHttpWrapper::WideToUtf8(text);
+
+			std::wstring tempPath = path + L".tmp";
+			HANDLE hFile = CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0,
+				NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (hFile == INVALID_HANDLE_VALUE)
+				return false;
+			DWORD written = 0;
+			BOOL ok = WriteFile(hFile, content.data(), static_cast<DWORD>(content.size()), &written, NULL);
+			CloseHandle(hFile);
+			return ok && MoveFileExW(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+		}
+	};
+
+	std::wstring QueryHeader(HINTERNET hRequest, const wchar_t* name)
+	{
+		DWORD dwSize = 0;
+		WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_CUSTOM, name,
+			WINHTTP_NO_OUTPUT_BUFFER, &dwSize, WINHTTP_NO_HEADER_INDEX);
+		if (GetLastError() != ERROR_INSUFFICIENT_BUFFER || dwSize == 0)
+			return L"";
+
+		std::wstring value(dwSize / sizeof(wchar_t), L'\0');
+		if (!WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_CUSTOM, name,
+			&value[0], &dwSize, WINHTTP_NO_HEADER_INDEX))
+			return L"";
+		value.resize(dwSize / sizeof(wchar_t));
+		return value;
+	}
+
+	std::wstring QueryRawHeaders(HINTERNET hRequest)
+	{
+		DWORD dwSize = 0;
+		WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_RAW_HEADERS_CRLF,
+			WINHTTP_HEADER_NAME_BY_INDEX, WINHTTP_NO_OUTPUT_BUFFER,
+			&dwSize, WINHTTP_NO_HEADER_INDEX);
+		if (GetLastError() != ERROR_INSUFFICIENT_BUFFER || dwSize == 0)
+			return L"";
+
+		std::wstring headers(dwSize / sizeof(wchar_t), L'\0');
+		if (!WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_RAW_HEADERS_CRLF,
+			WINHTTP_HEADER_NAME_BY_INDEX, &headers[0], &dwSize, WINHTTP_NO_HEADER_INDEX))
+			return L"";
+		headers.resize(dwSize / sizeof(wchar_t));
+		return headers;
+	}
+
+	// Validator usable in If-Range: weak ETags are not allowed there
+	std::wstring QueryValidator(HINTERNET hRequest)
+	{
+		std::wstring etag = QueryHeader(hRequest, L"ETag");
+		if (!etag.empty() && etag.compare(0, 2, L"W/") != 0)
+			return etag;
+		return QueryHeader(hRequest, L"Last-Modified");
+	}
+
+	// Parse "bytes first-last/total" ("total" may be "*")
+	bool ParseContentRange(const std::wstring& value, ULONGLONG& first, ULONGLONG& total)
+	{
+		size_t pos = value.find(L"bytes");
+		if (pos == std::wstring::npos)
+			return false;
+		pos += 5;
+		while (pos < value.size() && value[pos] == L' ')
+			++pos;
+
+		size_t dash = value.find(L'-', pos);
+		size_t slash = value.find(L'/', pos);
+		if (dash == std::wstring::npos || slash == std::wstring::npos || slash < dash)
+			return false;
+
+		first = wcstoull(value.c_str() + pos, NULL, 10);
+		if (value[slash + 1] == L'*')
+			total = kOpenEnded;
+		else
+			total = wcstoull(value.c_str() + slash + 1, NULL, 10);
+		return true;
+	}
+}
+
+bool WinHttpWrapper::HttpRequest::Download(
+	const std::wstring& rest_of_path,
+	const std::wstring& requestHeader,
+	const DownloadOptions& options,
+	HttpResponse& response)
+{
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[DOWNLOAD] Starting download of '%s%s' to %s",
+			m_Domain.c_str(), rest_of_path.c_str(),
+			options.filePath.empty() ? L"memory" : options.filePath.c_str());
+	}
+
+	// A download from an endpoint group is a download from one of its
+	// endpoints (which is no group itself)
+	Endpoint endpoint;
+	if (EndpointGroups::Instance().Choose(m_Domain, endpoint))
+	{
+		HttpRequest routed(*this);
+		routed.m_Domain = endpoint.domain;
+		routed.m_Port = endpoint.port;
+		routed.m_Secure = endpoint.secure;
+		const bool result = routed.Download(rest_of_path, requestHeader, options, response);
+		if (!response.cancelled)
+		{
+			EndpointGroups::Instance().Report(m_Domain, endpoint, result, response.statusCode, response.timing,
+				response.contentLength);
+		}
+		return result;
+	}
+
+	TraceRequestScope traceScope;
+	TraceSpan downloadSpan("download");
+	// Spans of the segment threads belong to this download too
+	const ULONGLONG traceRequest = TraceRequestScope::Current();
+
+	const int minSegments = (std::max)(1, options.minSegments);
+	const int maxSegments = (std::max)(minSegments, options.maxSegments);
+	// A single connection streams each missing range in one request
+	const ULONGLONG segmentSize = maxSegments == 1
+		? kOpenEnded
+		: (std::max)(static_cast<ULONGLONG>(options.segmentSize), static_cast<ULONGLONG>(kReadChunkSize));
+
+	response.statusCode = 0;
+	response.contentLength = 0;
+	response.isBinary = options.filePath.empty();
+	response.digest.clear();
+	response.timing.Reset();
+
+	// Resuming only makes sense for files
+	const bool resumable = options.resume && !options.filePath.empty();
+	const std::wstring checkpointPath = options.filePath + L".download";
+	DownloadCheckpoint checkpoint;
+	checkpoint.url = (m_Secure ? L"https://" : L"http://") + m_Domain + L":" + std::to_wstring(m_Port) + rest_of_path;
+	bool resuming = false;
+	if (resumable)
+	{
+		DownloadCheckpoint saved;
+		resuming = saved.Load(checkpointPath) && saved.url == checkpoint.url
+			&& !saved.validator.empty() && saved.total != kOpenEnded
+			&& !saved.Missing().empty();
+		if (resuming)
+			checkpoint = saved;
+	}
+
+	HINTERNET hSession = OpenSession(m_UserAgent, m_ProxyUrl, m_ProxyUsername);
+	if (!hSession)
+	{
+		response.error = L"Failed to open HTTP session!";
+		return false;
+	}
+
+	// Segments share the session, so let it open as many connections as
+	// there can be segments in flight
+	DWORD dwMaxConns = static_cast<DWORD>(maxSegments);
+	WinHttpSetOption(hSession, WINHTTP_OPTION_MAX_CONNS_PER_SERVER, &dwMaxConns, sizeof(dwMaxConns));
+
+	HINTERNET hConnect = WinHttpConnect(hSession, m_Domain.c_str(), m_Port, 0);
+	if (!hConnect)
+	{
+		WinHttpCloseHandle(hSession);
+		response.error = L"Failed to connect to server!";
+		return false;
+	}
+
+	DownloadTarget target(options.filePath, response.binaryData);
+	bool opened = target.Open(resuming);
+	if (opened && resuming && target.Size() != checkpoint.total)
+	{
+		// The partial file is gone or was modified: its ranges cannot be trusted
+		target.Close();
+		resuming = false;
+		opened = target.Open(false);
+	}
+	if (!opened)
+	{
+		WinHttpCloseHandle(hConnect);
+		WinHttpCloseHandle(hSession);
+		response.error = L"Failed to open download file!";
+		return false;
+	}
+	if (!resuming)
+		checkpoint.Reset();
+
+	if (resumable && IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[DOWNLOAD] %s", resuming ? L"Resuming from checkpoint" : L"No usable checkpoint, starting from zero");
+	}
+
+	const DWORD flag = m_Secure ? WINHTTP_FLAG_SECURE : 0;
+
+	// Cancelling closes every request of the download, which fails the
+	// reads blocked on them; the checkpoint is kept for a later resume
+	const CancellationToken* cancel = m_Cancel.get();
+	CancellableHandles handles(cancel);
+	const BandwidthThrottle::Meter meter(m_Domain, m_Priority, cancel);
+
+	// Every connection of the download takes its own scheduler slot: this
+	// one covers the probe and the worker that inherits its request
+	TraceSpan probeQueueSpan("queue");
+	const std::chrono::steady_clock::time_point queued = std::chrono::steady_clock::now();
+	RequestScheduler::Slot probeSlot = RequestScheduler::Instance().Acquire(HostKey(), m_Priority, cancel);
+	const std::chrono::steady_clock::time_point sent = std::chrono::steady_clock::now();
+	response.timing.queueUs = std::chrono::duration_cast<std::chrono::microseconds>(sent - queued).count();
+	probeQueueSpan.End();
+
+	// Send a GET for [first, last] (or without Range when first is kOpenEnded)
+	// and wait for the response headers. When a validator is known it is sent
+	// as If-Range: the server then answers 200 with the whole resource if it
+	// changed since, instead of a 206 mixing old and new bytes.
+	auto sendRange = [&](ULONGLONG first, ULONGLONG last, DWORD& dwStatusCode) -> HINTERNET
+	{
+		HINTERNET hRequest = WinHttpOpenRequest(hConnect, L"GET", rest_of_path.c_str(),
+			NULL, WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES,
+			WINHTTP_FLAG_REFRESH | flag);
+		// Add() closes the handle itself when it fails
+		if (!hRequest || !handles.Add(hRequest))
+			return NULL;
+
+		ApplyCachedCredentials(hRequest, m_Domain, m_Port,
+			m_ProxyUsername, m_ProxyPassword,
+			m_ServerUsername, m_ServerPassword,
+			m_ProxyUrl);
+
+		std::wstring headers;
+		if (first != kOpenEnded)
+		{
+			headers = L"Range: bytes=" + std::to_wstring(first) + L"-";
+			if (last != kOpenEnded)
+				headers += std::to_wstring(last);
+			headers += L"\r\n";
+			if (!checkpoint.validator.empty())
+				headers += L"If-Range: " + checkpoint.validator + L"\r\n";
+		}
+		headers += requestHeader;
+
+		// Sending and waiting for the headers, WinHTTP does both at once here
+		TraceSpan rangeSpan("range request");
+		DWORD dwSize = sizeof(dwStatusCode);
+		if (!WinHttpSendRequest(hRequest,
+				headers.empty() ? WINHTTP_NO_ADDITIONAL_HEADERS : headers.c_str(),
+				static_cast<DWORD>(headers.size()),
+				WINHTTP_NO_REQUEST_DATA, 0, 0, 0) ||
+			!WinHttpReceiveResponse(hRequest, NULL) ||
+			!WinHttpQueryHeaders(hRequest,
+				WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+				WINHTTP_HEADER_NAME_BY_INDEX, &dwStatusCode, &dwSize,
+				WINHTTP_NO_HEADER_INDEX))
+		{
+			handles.Close(hRequest);
+			return NULL;
+		}
+		return hRequest;
+	};
+
+	// A body kept in memory counts against the memory budget, a file does not
+	const ULONGLONG maxSize = MaxResponseSize();
+	MemoryBudget::Lease lease;
+	bool tooLarge = false;
+
+	// Bytes are hashed as they arrive while they continue what was hashed so
+	// far; those written ahead of that frontier by other segments (or by an
+	// earlier, resumed attempt) are read back from the target at the end
+	BodyHasher hasher(m_Hash);
+	std::mutex hashMutex;
+	ULONGLONG hashedTo = 0;
+	ULONGLONG bodySize = 0;
+
+	// Read a response body into the target starting at pos; pos is advanced
+	// as data is written so that a failed segment can resume where it stopped
+	std::atomic<ULONGLONG> bytesDone(0);
+	auto readBody = [&](HINTERNET hRequest, ULONGLONG& pos, ULONGLONG end, std::vector<uint8_t>& chunk) -> bool
+	{
+		for (;;)
+		{
+			DWORD dwToRead = kReadChunkSize;
+			if (end != kOpenEnded)
+			{
+				if (pos >= end)
+					return true;
+				dwToRead = static_cast<DWORD>((std::min)(end - pos, static_cast<ULONGLONG>(kReadChunkSize)));
+			}
+
+			// Paced by the bandwidth limits, shared by all the segments
+			dwToRead = static_cast<DWORD>(meter.Take(dwToRead));
+			if (dwToRead == 0)
+				return false;
+
+			TraceSpan readSpan("read");
+			DWORD dwDownloaded = 0;
+			if (!WinHttpReadData(hRequest, chunk.data(), dwToRead, &dwDownloaded))
+				return false;
+			readSpan.SetArg("bytes", dwDownloaded);
+			readSpan.End();
+			meter.Refund(dwToRead - dwDownloaded);
+			if (dwDownloaded == 0)
+				return end == kOpenEnded || pos >= end;
+			if (maxSize && pos + dwDownloaded > maxSize)
+			{
+				tooLarge = true;
+				return false;
+			}
+			// Only grows for bodies of unknown length, read by a single stream
+			if (!target.IsFile() && pos + dwDownloaded > lease.Held())
+				lease.Reserve(pos + dwDownloaded - lease.Held());
+			if (!target.Write(pos, chunk.data(), dwDownloaded))
+				return false;
+			if (m_Hash != HASH_NONE)
+			{
+				std::lock_guard<std::mutex> lock(hashMutex);
+				if (pos == hashedTo)
+				{
+					hasher.Update(chunk.data(), dwDownloaded);
+					hashedTo += dwDownloaded;
+				}
+			}
+			pos += dwDownloaded;
+			bytesDone += dwDownloaded;
+		}
+	};
+
+	std::vector<uint8_t> chunk(kReadChunkSize);
+	bool result = true;
+	bool errorStatus = false;
+
+	// The probe is the first missing segment itself: a 206 tells us the total
+	// size and that ranges are supported without spending an extra round-trip.
+	// A resumed download whose resource changed gets a second, clean pass.
+	DWORD dwStatusCode = 0;
+	HINTERNET hProbe = NULL;
+	std::vector<ByteRange> missing;
+	ULONGLONG total = kOpenEnded;
+	bool ranged = false;
+	for (int pass = 0; pass < 2 && probeSlot.Granted(); ++pass)
+	{
+		missing = checkpoint.Missing();
+		const ULONGLONG probeFirst = missing.front().first;
+		const ULONGLONG probeEnd = (segmentSize == kOpenEnded || missing.front().second - probeFirst <= segmentSize)
+			? missing.front().second
+			: probeFirst + segmentSize;
+
+		hProbe = sendRange(probeFirst, probeEnd == kOpenEnded ? kOpenEnded : probeEnd - 1, dwStatusCode);
+		if (hProbe && dwStatusCode == 416 && !resuming)
+		{
+			// Empty resources cannot satisfy any range, ask for the whole thing
+			handles.Close(hProbe);
+			hProbe = sendRange(kOpenEnded, kOpenEnded, dwStatusCode);
+		}
+		if (!hProbe)
+			break;
+
+		ULONGLONG first = 0;
+		total = kOpenEnded;
+		ranged = dwStatusCode == 206
+			&& ParseContentRange(QueryHeader(hProbe, L"Content-Range"), first, total)
+			&& first == probeFirst && total != kOpenEnded;
+
+		if (!resuming || (ranged && total == checkpoint.total))
+		{
+			if (ranged && !resuming)
+			{
+				// Replace the "everything" placeholder now that the size is known
+				checkpoint.total = total;
+				checkpoint.validator = QueryValidator(hProbe);
+				missing = checkpoint.Missing();
+			}
+			break;
+		}
+
+		// Only a 200 (If-Range failed) or a 206 for other bytes says that the
+		// resource changed. Any other status is handed back as an error, and
+		// the partial file and its checkpoint are kept for a later attempt.
+		if (dwStatusCode != 200 && dwStatusCode != 206)
+		{
+			if (IsDebugLoggingEnabled()) {
+				DebugLogFormat(L"[DOWNLOAD] Resume failed with status %lu, keeping the checkpoint", dwStatusCode);
+			}
+			break;
+		}
+
+		// The resource changed since the checkpoint: start over from zero
+		if (IsDebugLoggingEnabled()) {
+			DebugLog(L"[DOWNLOAD] Resource changed since the checkpoint, restarting");
+		}
+		handles.Close(hProbe);
+		hProbe = NULL;
+		target.Close();
+		resuming = false;
+		checkpoint.Reset();
+		DeleteFileW(checkpointPath.c_str());
+		if (!target.Open(false))
+			break;
+	}
+
+	if (!hProbe)
+	{
+		target.Close();
+		WinHttpCloseHandle(hConnect);
+		WinHttpCloseHandle(hSession);
+		response.cancelled = cancel && cancel->IsCancelled();
+		response.error = response.cancelled ? kCancelledError : L"Failed to send HTTP request!";
+		return false;
+	}
+
+	response.header = QueryRawHeaders(hProbe);
+	response.timing.MarkHeaders();
+
+	if (ranged)
+	{
+		if (IsDebugLoggingEnabled()) {
+			DebugLogFormat(L"[DOWNLOAD] Server supports ranges, total size: %llu bytes, %zu range(s) missing",
+				total, missing.size());
+		}
+
+		// Split the missing ranges into segments, the first one being the probe
+		std::deque<ByteRange> pending;
+		for (const ByteRange& range : missing)
+		{
+			for (ULONGLONG start = range.first; start < range.second; )
+			{
+				ULONGLONG end = (segmentSize == kOpenEnded || range.second - start <= segmentSize)
+					? range.second
+					: start + segmentSize;
+				pending.push_back(ByteRange(start, end));
+				start = end;
+			}
+		}
+		const ByteRange probeSegment = pending.front();
+		pending.pop_front();
+
+		std::mutex stateMutex;
+		std::condition_variable stateChanged;
+		int running = 0;
+		bool failed = false;
+		bool changed = false;
+		auto lastSave = std::chrono::steady_clock::now();
+
+		if (maxSize && total > maxSize)
+		{
+			response.error = L"Response body exceeds the size limit!";
+			result = false;
+		}
+		else
+		{
+			// Wait for room in the memory budget for the whole buffer
+			if (!target.IsFile())
+				lease.Reserve(total);
+			// A resumed file already has its final size
+			if (!resuming && !target.Preallocate(total))
+			{
+				response.error = L"Failed to preallocate download destination!";
+				result = false;
+			}
+		}
+		if (resumable && result)
+			checkpoint.Save(checkpointPath);
+
+		// Workers still queued for a slot give up through this token once
+		// there is nothing left for them: every segment was taken, or the
+		// download failed. It is cancelled along with the download too.
+		CancellationToken surplus = cancel ? cancel->Child() : CancellationToken();
+
+		auto fail = [&](const std::wstring& message)
+		{
+			{
+				std::lock_guard<std::mutex> lock(stateMutex);
+				if (!failed)
+					response.error = message;
+				failed = true;
+			}
+			surplus.Cancel();
+		};
+
+		// Record progress, saving the checkpoint at most once per second
+		auto complete = [&](ULONGLONG start, ULONGLONG end)
+		{
+			if (!resumable)
+				return;
+			std::lock_guard<std::mutex> lock(stateMutex);
+			checkpoint.Add(start, end);
+			auto now = std::chrono::steady_clock::now();
+			if (now - lastSave >= std::chrono::seconds(1))
+			{
+				checkpoint.Save(checkpointPath);
+				lastSave = now;
+			}
+		};
+
+		// Fetch one segment, reconnecting from the last written byte on error
+		auto fetchSegment = [&](HINTERNET hRequest, ULONGLONG start, ULONGLONG end, std::vector<uint8_t>& buffer) -> bool
+		{
+			TraceSpan segmentSpan("segment");
+			segmentSpan.SetArg("offset", static_cast<long long>(start));
+			ULONGLONG pos = start;
+			for (int attempt = 0; attempt < kSegmentAttempts; ++attempt)
+			{
+				if (cancel && cancel->IsCancelled())
+				{
+					if (hRequest)
+						handles.Close(hRequest);
+					break;
+				}
+				if (!hRequest)
+				{
+					DWORD dwSegmentStatus = 0;
+					hRequest = sendRange(pos, end - 1, dwSegmentStatus);
+					if (hRequest && dwSegmentStatus != 206)
+					{
+						handles.Close(hRequest);
+						hRequest = NULL;
+						if (dwSegmentStatus == 200)
+						{
+							// If-Range failed: the resource changed mid-download
+							std::lock_guard<std::mutex> lock(stateMutex);
+							changed = true;
+							break;
+						}
+					}
+					if (!hRequest)
+						continue;
+				}
+				bool ok = readBody(hRequest, pos, end, buffer);
+				handles.Close(hRequest);
+				hRequest = NULL;
+				if (ok)
+				{
+					complete(start, end);
+					return true;
+				}
+			}
+			complete(start, pos);
+			return false;
+		};
+
+		// The worker given the probe request also gets the probe slot, and
+		// holds it until it exits: a per-host limit of one must not leave the
+		// other workers waiting for a slot that is only freed at the end
+		auto worker = [&](HINTERNET hFirst, RequestScheduler::Slot slot)
+		{
+			TraceRequestScope workerScope(traceRequest);
+			std::vector<uint8_t> buffer(kReadChunkSize);
+			bool ok = true;
+			if (hFirst)
+			{
+				ok = fetchSegment(hFirst, probeSegment.first, probeSegment.second, buffer);
+			}
+			else
+			{
+				TraceSpan queueSpan("queue");
+				slot = RequestScheduler::Instance().Acquire(HostKey(), m_Priority, &surplus);
+				ok = slot.Granted();
+			}
+			while (ok)
+			{
+				ByteRange segment;
+				{
+					std::lock_guard<std::mutex> lock(stateMutex);
+					if (failed || pending.empty())
+						break;
+					segment = pending.front();
+					pending.pop_front();
+				}
+				ok = fetchSegment(NULL, segment.first, segment.second, buffer);
+			}
+			if (ok)
+				surplus.Cancel();
+			// Not granted a slot without the download being cancelled: the
+			// other workers were done first, which is no failure
+			else if (slot.Granted() || (cancel && cancel->IsCancelled()))
+				fail(L"Failed to download segment!");
+			slot.Release();
+
+			std::lock_guard<std::mutex> lock(stateMutex);
+			--running;
+			stateChanged.notify_all();
+		};
+
+		std::vector<std::thread> workers;
+		if (result)
+		{
+			std::unique_lock<std::mutex> lock(stateMutex);
+			running = 1;
+			workers.emplace_back(worker, hProbe, std::move(probeSlot));
+			hProbe = NULL;
+			for (int i = 1; i < minSegments && i <= static_cast<int>(pending.size()); ++i)
+			{
+				++running;
+				workers.emplace_back(worker, (HINTERNET)NULL, RequestScheduler::Slot());
+			}
+
+			// Adapt the segment count to measured throughput: keep adding a
+			// connection while the last one added improved throughput by more
+			// than 10%, and stop at the first plateau
+			auto lastSample = std::chrono::steady_clock::now();
+			ULONGLONG lastBytes = bytesDone.load();
+			double lastRate = 0.0;
+			bool growing = static_cast<int>(workers.size()) < maxSegments;
+			while (running > 0)
+			{
+				stateChanged.wait_for(lock, std::chrono::milliseconds(500));
+				if (!growing || failed || running == 0)
+					continue;
+
+				auto now = std::chrono::steady_clock::now();
+				double seconds = std::chrono::duration<double>(now - lastSample).count();
+				if (seconds < 0.5)
+					continue;
+
+				ULONGLONG bytes = bytesDone.load();
+				double rate = (bytes - lastBytes) / seconds;
+				lastSample = now;
+				lastBytes = bytes;
+
+				if (lastRate > 0.0 && rate < lastRate * 1.1)
+				{
+					if (IsDebugLoggingEnabled()) {
+						DebugLogFormat(L"[DOWNLOAD] Throughput plateaued at %zu segments", workers.size());
+					}
+					growing = false;
+					continue;
+				}
+				lastRate = rate;
+
+				if (static_cast<int>(workers.size()) < maxSegments && !pending.empty())
+				{
+					++running;
+					workers.emplace_back(worker, (HINTERNET)NULL, RequestScheduler::Slot());
+				}
+				else
+				{
+					growing = false;
+				}
+			}
+		}
+
+		for (auto& t : workers)
+			t.join();
+
+		if (failed)
+			result = false;
+		if (changed)
+			response.error = L"Resource changed during download, restart it!";
+
+		if (result)
+		{
+			// The assembled entity is the full resource, report it as such
+			response.statusCode = 200;
+			if (resumable)
+				DeleteFileW(checkpointPath.c_str());
+		}
+		else if (resumable)
+		{
+			// Keep the checkpoint for the next attempt, unless the resource
+			// changed: the next attempt must then restart from zero
+			if (changed)
+				DeleteFileW(checkpointPath.c_str());
+			else
+				checkpoint.Save(checkpointPath);
+		}
+		response.contentLength = static_cast<DWORD>((std::min)(total, static_cast<ULONGLONG>(MAXDWORD)));
+		bodySize = total;
+	}
+	else if (dwStatusCode == 200 || dwStatusCode == 206)
+	{
+		// No usable range support: fall back to a single stream
+		if (IsDebugLoggingEnabled()) {
+			DebugLog(L"[DOWNLOAD] Server does not support ranges, using a single stream");
+		}
+		if (dwStatusCode == 206)
+		{
+			handles.Close(hProbe);
+			hProbe = sendRange(kOpenEnded, kOpenEnded, dwStatusCode);
+		}
+
+		ULONGLONG pos = 0;
+		if (!hProbe || dwStatusCode != 200)
+		{
+			response.error = L"Failed to send HTTP request!";
+			result = false;
+		}
+		else
+		{
+			response.header = QueryRawHeaders(hProbe);
+			std::wstring length = QueryHeader(hProbe, L"Content-Length");
+			ULONGLONG announced = length.empty() ? kOpenEnded : wcstoull(length.c_str(), NULL, 10);
+			if (maxSize && announced != kOpenEnded && announced > maxSize)
+			{
+				response.error = L"Response body exceeds the size limit!";
+				result = false;
+			}
+			else
+			{
+				if (announced != kOpenEnded)
+				{
+					if (!target.IsFile())
+						lease.Reserve(announced);
+					target.Preallocate(announced);
+				}
+
+				if (!readBody(hProbe, pos, kOpenEnded, chunk))
+				{
+					response.error = tooLarge ? L"Response body exceeds the size limit!" : L"Error reading response data!";
+					result = false;
+				}
+			}
+		}
+		response.statusCode = dwStatusCode;
+		response.contentLength = static_cast<DWORD>((std::min)(pos, static_cast<ULONGLONG>(MAXDWORD)));
+		if (!target.IsFile() && response.binaryData.size() > pos)
+			response.binaryData.resize(static_cast<size_t>(pos));
+		bodySize = pos;
+	}
+	else
+	{
+		// Error status: hand back the body as text, not in the destination
+		errorStatus = true;
+		if (!resuming)
+			target.Discard();
+		response.statusCode = dwStatusCode;
+		response.isBinary = false;
+		DWORD dwDownloaded = 0;
+		while (WinHttpReadData(hProbe, chunk.data(), kReadChunkSize, &dwDownloaded) && dwDownloaded > 0)
+		{
+			response.text.append(reinterpret_cast<const char*>(chunk.data()), dwDownloaded);
+			hasher.Update(chunk.data(), dwDownloaded);
+		}
+		response.contentLength = static_cast<DWORD>(response.text.size());
+		hashedTo = bodySize = response.text.size();
+	}
+
+	if (result && m_Hash != HASH_NONE)
+	{
+		TraceSpan verifySpan("verify");
+		for (ULONGLONG offset = hashedTo; offset < bodySize; )
+		{
+			const DWORD dwToRead = static_cast<DWORD>((std::min)(bodySize - offset, static_cast<ULONGLONG>(kReadChunkSize)));
+			DWORD dwRead = 0;
+			if (!target.Read(offset, chunk.data(), dwToRead, dwRead) || dwRead == 0)
+			{
+				response.error = L"Failed to read back download destination!";
+				result = false;
+				break;
+			}
+			hasher.Update(chunk.data(), dwRead);
+			offset += dwRead;
+		}
+		if (IsDebugLoggingEnabled()) {
+			DebugLogFormat(L"[DOWNLOAD] Hashed %llu bytes as they arrived, %llu read back",
+				hashedTo, bodySize - hashedTo);
+		}
+
+		if (result)
+		{
+			response.digest = hasher.Finish();
+			if (!m_ExpectedDigest.empty() && !BodyHasher::Matches(response.digest, m_ExpectedDigest))
+			{
+				if (IsDebugLoggingEnabled()) {
+					DebugLog(L"[DOWNLOAD] Body does not match the expected digest, deleting it");
+				}
+				// An error body never reached the destination, which may
+				// still hold the partial file of a resumed download
+				if (!errorStatus)
+				{
+					target.Discard();
+					if (resumable)
+						DeleteFileW(checkpointPath.c_str());
+				}
+				response.text.clear();
+				response.error = kDigestMismatchError;
+				result = false;
+			}
+		}
+	}
+
+	if (hProbe)
+		handles.Close(hProbe);
+	WinHttpCloseHandle(hConnect);
+	WinHttpCloseHandle(hSession);
+	target.Close();
+	response.timing.Finish(sent);
+
+	// Whatever failed after a cancellation failed because of it
+	if (!result && cancel && cancel->IsCancelled())
+	{
+		response.error = kCancelledError;
+		response.cancelled = true;
+	}
+
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[DOWNLOAD] Download finished - Success: %s, Status: %lu, Bytes: %llu",
+			result ? L"Yes" : L"No", response.statusCode, bytesDone.load());
+	}
+	return result;
+}
+
+#endif
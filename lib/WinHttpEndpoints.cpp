@@ -0,0 +1,239 @@
+// The MIT License (MIT)
+// Endpoint groups for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#include "WinHttpEndpoints.h"
+#include "WinHttpMetrics.h"
+#include "WinHttpWrapper.h"
+#include <algorithm>
+
+namespace
+{
+	// Weight of the latest request in the moving averages
+	const double kAverageWeight = 0.2;
+	// Bodies smaller than this say little about the throughput
+	const ULONGLONG kMinThroughputBytes = 16 * 1024;
+	// Ejections in a row past which the ejection stops growing (8 times)
+	const int kMaxEjectionDoublings = 3;
+	// What a failed request costs the caller, in ms
+	const double kFailureCostMs = 1000.0;
+
+	std::wstring GroupName(const std::wstring& host)
+	{
+		std::wstring name = host;
+		for (wchar_t& c : name)
+		{
+			if (c >= L'A' && c <= L'Z')
+				c = static_cast<wchar_t>(c - L'A' + L'a');
+		}
+		return name;
+	}
+
+	void Average(double& average, double sample, bool first)
+	{
+		average = first ? sample : average + kAverageWeight * (sample - average);
+	}
+}
+
+WinHttpWrapper::EndpointGroups& WinHttpWrapper::EndpointGroups::Instance()
+{
+	static EndpointGroups instance;
+	return instance;
+}
+
+WinHttpWrapper::EndpointGroups::EndpointGroups()
+	: m_Enabled(false)
+	, m_Exploration(0.05)
+	, m_EjectAfter(3)
+	, m_EjectionMs(10000)
+	, m_Random(static_cast<unsigned int>(std::chrono::steady_clock::now().time_since_epoch().count()))
+{
+}
+
+bool WinHttpWrapper::EndpointGroups::SetGroup(const std::wstring& name, const std::vector<Endpoint>& endpoints)
+{
+	const std::wstring key = GroupName(name);
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (endpoints.empty())
+	{
+		m_Groups.erase(key);
+		m_Enabled = !m_Groups.empty();
+		return true;
+	}
+
+	for (const Endpoint& endpoint : endpoints)
+	{
+		const std::wstring domain = GroupName(endpoint.domain);
+		if (domain == key || m_Groups.count(domain))
+			return false;
+	}
+	for (const auto& group : m_Groups)
+	{
+		for (const State& state : group.second.endpoints)
+		{
+			if (GroupName(state.endpoint.domain) == key)
+				return false;
+		}
+	}
+
+	Group& group = m_Groups[key];
+	std::vector<State> states;
+	for (const Endpoint& endpoint : endpoints)
+	{
+		auto it = std::find_if(group.endpoints.begin(), group.endpoints.end(),
+			[&](const State& state) { return state.endpoint == endpoint; });
+		states.push_back(it != group.endpoints.end() ? *it : State());
+		states.back().endpoint = endpoint;
+	}
+	group.endpoints.swap(states);
+	m_Enabled = true;
+
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[ENDPOINTS] Group '%s' has %zu endpoint(s)", key.c_str(), endpoints.size());
+	}
+	return true;
+}
+
+void WinHttpWrapper::EndpointGroups::SetExploration(double share)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Exploration = (std::min)(1.0, (std::max)(0.0, share));
+}
+
+void WinHttpWrapper::EndpointGroups::SetEjection(int failures, unsigned int ejectionMs)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_EjectAfter = (std::max)(1, failures);
+	m_EjectionMs = ejectionMs;
+}
+
+double WinHttpWrapper::EndpointGroups::Cost(const Group& group, const State& state)
+{
+	// Endpoints never measured come first, so that all get measured
+	if (state.requests == 0)
+		return 0.0;
+	double cost = state.latencyMs + state.errorRate * kFailureCostMs;
+	if (state.bytesPerSecond > 0)
+		cost += group.averageBytes * 1000.0 / state.bytesPerSecond;
+	return cost;
+}
+
+bool WinHttpWrapper::EndpointGroups::Choose(const std::wstring& host, Endpoint& endpoint)
+{
+	if (!m_Enabled.load(std::memory_order_relaxed))
+		return false;
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	auto it = m_Groups.find(GroupName(host));
+	if (it == m_Groups.end())
+		return false;
+	const Group& group = it->second;
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+	std::vector<const State*> available;
+	const State* best = NULL;
+	const State* soonest = NULL;
+	for (const State& state : group.endpoints)
+	{
+		if (state.ejectedUntil > now)
+		{
+			if (!soonest || state.ejectedUntil < soonest->ejectedUntil)
+				soonest = &state;
+			continue;
+		}
+		available.push_back(&state);
+		if (!best || Cost(group, state) < Cost(group, *best))
+			best = &state;
+	}
+
+	// With every endpoint ejected, the one coming back first is the best bet
+	if (!best)
+	{
+		endpoint = soonest->endpoint;
+		return true;
+	}
+
+	if (available.size() > 1 && std::uniform_real_distribution<double>(0.0, 1.0)(m_Random) < m_Exploration)
+	{
+		// Any other endpoint: available.size() - 1 candidates, best skipped
+		size_t pick = std::uniform_int_distribution<size_t>(0, available.size() - 2)(m_Random);
+		if (available[pick] == best)
+			pick = available.size() - 1;
+		endpoint = available[pick]->endpoint;
+		return true;
+	}
+	endpoint = best->endpoint;
+	return true;
+}
+
+void WinHttpWrapper::EndpointGroups::Report(const std::wstring& host, const Endpoint& endpoint,
+	bool sent, DWORD statusCode, const RequestTiming& timing, ULONGLONG bytes)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	auto it = m_Groups.find(GroupName(host));
+	if (it == m_Groups.end())
+		return;
+	Group& group = it->second;
+	auto state = std::find_if(group.endpoints.begin(), group.endpoints.end(),
+		[&](const State& candidate) { return candidate.endpoint == endpoint; });
+	if (state == group.endpoints.end())
+		return;
+
+	const bool failed = !sent || statusCode >= 500 || statusCode == 429;
+	const bool first = state->requests == 0;
+	++state->requests;
+	Average(state->errorRate, failed ? 1.0 : 0.0, first);
+
+	if (!failed)
+	{
+		state->failuresInRow = 0;
+		state->ejectionsInRow = 0;
+		Average(state->latencyMs, timing.waitUs / 1000.0, state->requests - state->failures == 1);
+		const ULONGLONG transferUs = timing.totalUs - timing.waitUs;
+		if (bytes >= kMinThroughputBytes && transferUs > 0)
+			Average(state->bytesPerSecond, bytes * 1000000.0 / transferUs, state->bytesPerSecond == 0);
+		Average(group.averageBytes, static_cast<double>(bytes), group.averageBytes == 0);
+		return;
+	}
+
+	++state->failures;
+	if (++state->failuresInRow < m_EjectAfter)
+		return;
+
+	// One more failure once back ejects it again, for longer
+	state->failuresInRow = m_EjectAfter - 1;
+	const int doublings = (std::min)(state->ejectionsInRow, kMaxEjectionDoublings);
+	++state->ejectionsInRow;
+	++state->ejections;
+	const std::chrono::milliseconds ejection(static_cast<long long>(m_EjectionMs) << doublings);
+	state->ejectedUntil = std::chrono::steady_clock::now() + ejection;
+
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[ENDPOINTS] Ejecting %s:%d from '%s' for %lld ms",
+			endpoint.domain.c_str(), endpoint.port, it->first.c_str(), static_cast<long long>(ejection.count()));
+	}
+}
+
+void WinHttpWrapper::EndpointGroups::FillMetrics(Metrics& metrics)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	for (const auto& group : m_Groups)
+	{
+		for (const State& state : group.second.endpoints)
+		{
+			EndpointMetrics entry;
+			entry.group = group.first;
+			entry.endpoint = state.endpoint;
+			entry.latencyMs = state.latencyMs;
+			entry.bytesPerSecond = state.bytesPerSecond;
+			entry.errorRate = state.errorRate;
+			entry.requests = state.requests;
+			entry.failures = state.failures;
+			entry.ejections = state.ejections;
+			entry.ejected = state.ejectedUntil > now;
+			metrics.endpoints.push_back(entry);
+		}
+	}
+}
@@ -0,0 +1,124 @@
+// The MIT License (MIT)
+// Endpoint groups for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include "WinHttpPlatform.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace WinHttpWrapper
+{
+	struct Metrics;
+	struct RequestTiming;
+
+	struct Endpoint
+	{
+		Endpoint() : port(0), secure(false) {}
+		Endpoint(const std::wstring& domain, int port, bool secure)
+			: domain(domain), port(port), secure(secure) {}
+
+		bool operator==(const Endpoint& other) const
+		{
+			return domain == other.domain && port == other.port && secure == other.secure;
+		}
+
+		std::wstring domain;
+		int port;
+		bool secure;
+	};
+
+	// State of one endpoint of a group
+	struct EndpointMetrics
+	{
+		std::wstring group;
+		Endpoint endpoint;
+		double latencyMs;               // Moving average of the time to the response headers
+		double bytesPerSecond;          // Moving average of the body throughput, 0 until measured
+		double errorRate;               // Moving average of the failures, from 0 to 1
+		ULONGLONG requests;
+		ULONGLONG failures;
+		ULONGLONG ejections;
+		bool ejected;
+	};
+
+	// Equivalent mirrors behind one logical host name. A request whose
+	// domain is the name of a group goes to the endpoint with the lowest
+	// expected time, from moving averages of the latency, throughput and
+	// failures of the requests already sent to each (RequestTiming). A
+	// share of the requests goes to another endpoint so that the averages
+	// of the others stay current. An endpoint failing several times in a
+	// row is ejected for a while, twice as long on each ejection in a row.
+	class EndpointGroups
+	{
+	public:
+		static EndpointGroups& Instance();
+
+		// Replace the endpoints of a group, no endpoints removing it.
+		// Endpoints already in the group keep their averages. Groups do not
+		// nest: false when an endpoint is a group, or name an endpoint.
+		bool SetGroup(const std::wstring& name, const std::vector<Endpoint>& endpoints);
+		// Share of the requests sent to an endpoint other than the best one
+		// (default 0.05)
+		void SetExploration(double share);
+		// Eject an endpoint after failures failures in a row, for ejectionMs
+		// (defaults 3 and 10 s), doubling up to 8 times as long
+		void SetEjection(int failures, unsigned int ejectionMs);
+
+		// Endpoint to send a request for host to, false when host is no group
+		bool Choose(const std::wstring& host, Endpoint& endpoint);
+		// Outcome of a request sent where Choose() said. Transport failures,
+		// 5xx and 429 count as failures; cancelled requests are not reported.
+		void Report(const std::wstring& host, const Endpoint& endpoint,
+			bool sent, DWORD statusCode, const RequestTiming& timing, ULONGLONG bytes);
+
+		void FillMetrics(Metrics& metrics);
+
+	private:
+		EndpointGroups();
+
+		struct State
+		{
+			State() : latencyMs(0), bytesPerSecond(0), errorRate(0), requests(0), failures(0),
+				ejections(0), failuresInRow(0), ejectionsInRow(0) {}
+
+			Endpoint endpoint;
+			double latencyMs;
+			double bytesPerSecond;
+			double errorRate;
+			ULONGLONG requests;
+			ULONGLONG failures;
+			ULONGLONG ejections;
+			int failuresInRow;
+			int ejectionsInRow;
+			std::chrono::steady_clock::time_point ejectedUntil;
+		};
+
+		struct Group
+		{
+			Group() : averageBytes(0) {}
+
+			std::vector<State> endpoints;
+			double averageBytes;        // Moving average of the body sizes
+		};
+
+		// Expected time of a request of the group's average size, in ms
+		static double Cost(const Group& group, const State& state);
+
+		std::mutex m_Mutex;
+		std::atomic<bool> m_Enabled;    // Whether any group is set, checked without the lock
+		std::unordered_map<std::wstring, Group> m_Groups;
+		double m_Exploration;
+		int m_EjectAfter;
+		unsigned int m_EjectionMs;
+		std::minstd_rand m_Random;
+	};
+
+}
@@ -0,0 +1,471 @@
+// The MIT License (MIT)
+// Server-Sent Events for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#ifdef _WIN32
+
+#include "WinHttpEventSource.h"
+#include "WinHttpUtf.h"
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+	const DWORD kReadChunkSize = 16 * 1024;
+	const DWORD kDefaultReconnectDelay = 3000;
+	const DWORD kMaxReconnectDelay = 60000;
+	const size_t kDefaultMaxQueuedEvents = 1024;
+
+	bool FieldIs(const std::string& line, size_t length, const char* name)
+	{
+		return line.compare(0, length, name) == 0 && name[length] == '\0';
+	}
+
+	bool StartsWithNoCase(const std::wstring& value, const wchar_t* prefix)
+	{
+		size_t i = 0;
+		for (; prefix[i]; ++i)
+		{
+			if (i >= value.size() || static_cast<wchar_t>(towlower(value[i])) != prefix[i])
+				return false;
+		}
+		return true;
+	}
+}
+
+WinHttpWrapper::EventStreamParser::EventStreamParser(size_t maxEventSize)
+	: m_MaxEventSize(maxEventSize)
+	, m_SkipLF(false)
+	, m_Start(true)
+	, m_Overflow(false)
+	, m_LineHasData(false)
+	, m_Retry(0)
+	, m_Discarded(0)
+{
+}
+
+void WinHttpWrapper::EventStreamParser::Reset()
+{
+	m_Line.clear();
+	m_Type.clear();
+	m_Data.clear();
+	m_SkipLF = false;
+	m_Start = true;
+	m_Overflow = false;
+	m_LineHasData = false;
+}
+
+void WinHttpWrapper::EventStreamParser::Feed(const char* data, size_t size, const Callback& onEvent)
+{
+	const char* p = data;
+	const char* end = data + size;
+	while (p < end)
+	{
+		// CRLF is one line break, even when split between two chunks
+		if (m_SkipLF)
+		{
+			m_SkipLF = false;
+			if (*p == '\n')
+			{
+				++p;
+				continue;
+			}
+		}
+
+		const char* q = p;
+		while (q < end && *q != '\n' && *q != '\r')
+			++q;
+
+		if (m_Overflow)
+		{
+			m_LineHasData = m_LineHasData || q > p;
+		}
+		else if (m_Line.size() + m_Data.size() + static_cast<size_t>(q - p) > m_MaxEventSize)
+		{
+			// Skip the rest of this event, up to its blank line
+			m_Overflow = true;
+			m_LineHasData = true;
+			m_Line.clear();
+			m_Type.clear();
+			m_Data.clear();
+			++m_Discarded;
+		}
+		else
+		{
+			m_Line.append(p, q - p);
+		}
+
+		if (q == end)
+			break;
+		m_SkipLF = *q == '\r';
+		ProcessLine(onEvent);
+		p = q + 1;
+	}
+}
+
+void WinHttpWrapper::EventStreamParser::ProcessLine(const Callback& onEvent)
+{
+	if (m_Start)
+	{
+		m_Start = false;
+		if (m_Line.compare(0, 3, "\xEF\xBB\xBF") == 0)
+			m_Line.erase(0, 3);
+	}
+
+	if (m_Overflow)
+	{
+		if (!m_LineHasData)
+			m_Overflow = false;
+		m_LineHasData = false;
+		return;
+	}
+
+	if (m_Line.empty())
+	{
+		// Blank line: dispatch, unless no data line was seen
+		if (m_Data.empty())
+		{
+			m_Type.clear();
+			return;
+		}
+		m_Data.pop_back();
+
+		ServerSentEvent event;
+		event.type = m_Type.empty() ? "message" : m_Type;
+		event.data.swap(m_Data);
+		event.id = m_LastEventId;
+		m_Type.clear();
+		onEvent(event);
+		return;
+	}
+
+	// Comments are used as keep-alives
+	if (m_Line[0] == ':')
+	{
+		m_Line.clear();
+		return;
+	}
+
+	size_t colon = m_Line.find(':');
+	size_t nameLength = colon == std::string::npos ? m_Line.size() : colon;
+	size_t valueStart = colon == std::string::npos ? m_Line.size() : colon + 1;
+	if (valueStart < m_Line.size() && m_Line[valueStart] == ' ')
+		++valueStart;
+
+	if (FieldIs(m_Line, nameLength, "data"))
+	{
+		m_Data.append(m_Line, valueStart, std::string::npos);
+		m_Data += '\n';
+	}
+	else if (FieldIs(m_Line, nameLength, "event"))
+	{
+		m_Type.assign(m_Line, valueStart, std::string::npos);
+	}
+	else if (FieldIs(m_Line, nameLength, "id"))
+	{
+		if (m_Line.find('\0', valueStart) == std::string::npos)
+			m_LastEventId.assign(m_Line, valueStart, std::string::npos);
+	}
+	else if (FieldIs(m_Line, nameLength, "retry"))
+	{
+		// Only ASCII digits are allowed
+		ULONGLONG retry = 0;
+		size_t i = valueStart;
+		for (; i < m_Line.size() && m_Line[i] >= '0' && m_Line[i] <= '9'; ++i)
+			retry = (std::min)(retry * 10 + (m_Line[i] - '0'), static_cast<ULONGLONG>(MAXDWORD));
+		if (i == m_Line.size() && i > valueStart)
+			m_Retry = static_cast<DWORD>(retry);
+	}
+
+	m_Line.clear();
+}
+
+WinHttpWrapper::EventSource::EventSource(const HttpRequest& request,
+	const std::wstring& rest_of_path,
+	const std::wstring& requestHeader)
+	: m_Request(request)
+	, m_Path(rest_of_path)
+	, m_Headers(requestHeader)
+	, m_ReconnectDelay(kDefaultReconnectDelay)
+	, m_MaxQueuedEvents(kDefaultMaxQueuedEvents)
+	, m_Active(NULL)
+	, m_Open(false)
+	, m_Connected(false)
+	, m_Stopping(false)
+	, m_StatusCode(0)
+{
+}
+
+WinHttpWrapper::EventSource::~EventSource()
+{
+	Close();
+}
+
+bool WinHttpWrapper::EventSource::Start()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (m_Thread.joinable() || m_Stopping)
+		return false;
+	m_Open = true;
+	m_Thread = std::thread(&EventSource::Run, this);
+	return true;
+}
+
+bool WinHttpWrapper::EventSource::IsOpen() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Open;
+}
+
+bool WinHttpWrapper::EventSource::IsConnected() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Connected;
+}
+
+DWORD WinHttpWrapper::EventSource::StatusCode() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_StatusCode;
+}
+
+std::wstring WinHttpWrapper::EventSource::Error() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Error;
+}
+
+bool WinHttpWrapper::EventSource::Poll(ServerSentEvent& event)
+{
+	return Wait(event, 0);
+}
+
+bool WinHttpWrapper::EventSource::Wait(ServerSentEvent& event, DWORD timeoutMs)
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	auto ready = [this] { return !m_Queue.empty() || !m_Open; };
+	if (timeoutMs == INFINITE)
+		m_Changed.wait(lock, ready);
+	else if (timeoutMs > 0)
+		m_Changed.wait_for(lock, std::chrono::milliseconds(timeoutMs), ready);
+
+	if (m_Queue.empty())
+		return false;
+
+	event = std::move(m_Queue.front());
+	m_Queue.pop_front();
+	// The receiving thread may be waiting for room in the queue
+	m_Changed.notify_all();
+	return true;
+}
+
+void WinHttpWrapper::EventSource::Close()
+{
+	HINTERNET hRequest;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stopping = true;
+		hRequest = m_Active;
+		m_Active = NULL;
+		m_Changed.notify_all();
+	}
+
+	// Closing the request makes a pending read return
+	if (hRequest)
+		WinHttpCloseHandle(hRequest);
+	if (m_Thread.joinable())
+		m_Thread.join();
+}
+
+void WinHttpWrapper::EventSource::Finish(DWORD statusCode, const std::wstring& error)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (!m_Open)
+		return;
+	m_Open = false;
+	m_Connected = false;
+	if (statusCode)
+		m_StatusCode = statusCode;
+	m_Error = error;
+	m_Changed.notify_all();
+
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[SSE] Subscription to '%s' ended, status %lu%s%s", m_Path.c_str(), m_StatusCode,
+			error.empty() ? L"" : L": ", error.c_str());
+	}
+}
+
+bool WinHttpWrapper::EventSource::Pause(DWORD milliseconds)
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_Changed.wait_for(lock, std::chrono::milliseconds(milliseconds), [this] { return m_Stopping; });
+	return !m_Stopping;
+}
+
+void WinHttpWrapper::EventSource::Deliver(const ServerSentEvent& event)
+{
+	if (m_Callback)
+	{
+		m_Callback(event);
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_Changed.wait(lock, [this] { return m_Queue.size() < m_MaxQueuedEvents || m_Stopping; });
+	if (m_Stopping)
+		return;
+	m_Queue.push_back(event);
+	m_Changed.notify_all();
+}
+
+void WinHttpWrapper::EventSource::Run()
+{
+	// The subscription is long-lived, so it does not take a scheduler slot
+	HINTERNET hSession = HttpRequest::OpenSession(m_Request.m_UserAgent, m_Request.m_ProxyUrl, m_Request.m_ProxyUsername);
+	HINTERNET hConnect = hSession ? WinHttpConnect(hSession, m_Request.m_Domain.c_str(), m_Request.m_Port, 0) : NULL;
+	if (!hConnect)
+	{
+		if (hSession)
+			WinHttpCloseHandle(hSession);
+		Finish(0, L"Failed to connect to server!");
+		return;
+	}
+
+	int failures = 0;
+	for (;;)
+	{
+		bool streamed = false;
+		if (!Stream(hConnect, streamed))
+			break;
+
+		// Back off while the server cannot be reached at all
+		failures = streamed ? 0 : failures + 1;
+		DWORD delay = m_Parser.Retry() ? m_Parser.Retry() : m_ReconnectDelay;
+		for (int i = 1; i < failures && delay < kMaxReconnectDelay; ++i)
+			delay *= 2;
+		if (failures > 1)
+			delay = (std::min)(delay, kMaxReconnectDelay);
+
+		if (IsDebugLoggingEnabled()) {
+			DebugLogFormat(L"[SSE] Reconnecting to '%s' in %lu ms", m_Path.c_str(), delay);
+		}
+		if (!Pause(delay))
+			break;
+	}
+
+	WinHttpCloseHandle(hConnect);
+	WinHttpCloseHandle(hSession);
+	Finish(0, L"");
+}
+
+bool WinHttpWrapper::EventSource::Stream(HINTERNET hConnect, bool& streamed)
+{
+	m_Parser.Reset();
+
+	std::wstring headers = m_Headers;
+	headers += L"Accept: text/event-stream\r\nCache-Control: no-cache\r\n";
+	if (!m_Parser.LastEventId().empty())
+		headers += L"Last-Event-ID: " + Utf8ToWide(m_Parser.LastEventId()) + L"\r\n";
+
+	HINTERNET hRequest = WinHttpOpenRequest(hConnect, L"GET", m_Path.c_str(),
+		NULL, WINHTTP_NO_REFERER,
+		WINHTTP_DEFAULT_ACCEPT_TYPES,
+		WINHTTP_FLAG_REFRESH | (m_Request.m_Secure ? WINHTTP_FLAG_SECURE : 0));
+	if (!hRequest)
+		return true;
+
+	HttpRequest::ApplyCachedCredentials(hRequest, m_Request.m_Domain, m_Request.m_Port,
+		m_Request.m_ProxyUsername, m_Request.m_ProxyPassword,
+		m_Request.m_ServerUsername, m_Request.m_ServerPassword, m_Request.m_ProxyUrl);
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (m_Stopping)
+		{
+			WinHttpCloseHandle(hRequest);
+			return false;
+		}
+		m_Active = hRequest;
+	}
+
+	// Whoever takes the handle out of m_Active closes it
+	auto release = [this, hRequest]
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_Connected = false;
+		if (m_Active == hRequest)
+		{
+			m_Active = NULL;
+			lock.unlock();
+			WinHttpCloseHandle(hRequest);
+		}
+	};
+
+	DWORD dwStatusCode = 0;
+	DWORD dwSize = sizeof(dwStatusCode);
+	if (!WinHttpSendRequest(hRequest, headers.c_str(), static_cast<DWORD>(-1),
+			WINHTTP_NO_REQUEST_DATA, 0, 0, 0) ||
+		!WinHttpReceiveResponse(hRequest, NULL) ||
+		!WinHttpQueryHeaders(hRequest,
+			WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+			WINHTTP_HEADER_NAME_BY_INDEX, &dwStatusCode, &dwSize,
+			WINHTTP_NO_HEADER_INDEX))
+	{
+		if (IsDebugLoggingEnabled()) {
+			DebugLogFormat(L"[SSE] Request to '%s' failed, error code: %lu", m_Path.c_str(), GetLastError());
+		}
+		release();
+		return true;
+	}
+
+	// 204 is the server asking not to reconnect
+	if (dwStatusCode != 200)
+	{
+		release();
+		Finish(dwStatusCode, dwStatusCode == 204 ? L"" : L"Unexpected status for an event stream!");
+		return false;
+	}
+
+	wchar_t contentType[128] = L"";
+	dwSize = sizeof(contentType);
+	WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_CONTENT_TYPE,
+		WINHTTP_HEADER_NAME_BY_INDEX, contentType, &dwSize, WINHTTP_NO_HEADER_INDEX);
+	if (!StartsWithNoCase(contentType, L"text/event-stream"))
+	{
+		release();
+		Finish(dwStatusCode, L"Response is not an event stream!");
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Connected = true;
+		m_StatusCode = dwStatusCode;
+		m_Changed.notify_all();
+	}
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[SSE] Streaming events from '%s'", m_Path.c_str());
+	}
+
+	// Read whatever has arrived as soon as it has, events must not wait
+	// for a buffer to fill up
+	std::vector<char> buffer(kReadChunkSize);
+	auto deliver = [this](const ServerSentEvent& event) { Deliver(event); };
+	for (;;)
+	{
+		DWORD dwAvailable = 0;
+		DWORD dwRead = 0;
+		if (!WinHttpQueryDataAvailable(hRequest, &dwAvailable) || dwAvailable == 0)
+			break;
+		if (!WinHttpReadData(hRequest, buffer.data(), (std::min)(dwAvailable, kReadChunkSize), &dwRead) || dwRead == 0)
+			break;
+		streamed = true;
+		m_Parser.Feed(buffer.data(), dwRead, deliver);
+	}
+
+	release();
+	return true;
+}
+
+#endif
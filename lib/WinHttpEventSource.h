@@ -0,0 +1,138 @@
+// The MIT License (MIT)
+// Server-Sent Events for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include "WinHttpWrapper.h"
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+namespace WinHttpWrapper
+{
+	struct ServerSentEvent
+	{
+		std::string type;           // "message" unless the server named it
+		std::string data;           // Data lines joined with '\n'
+		std::string id;             // Last event ID when it was dispatched
+	};
+
+	// Incremental text/event-stream parser: bytes are fed as they arrive,
+	// in chunks split anywhere, and events are passed to the callback as
+	// soon as their blank line is seen. Events larger than maxEventSize are
+	// discarded, so a misbehaving stream cannot grow memory without bound.
+	class EventStreamParser
+	{
+	public:
+		typedef std::function<void(const ServerSentEvent& event)> Callback;
+
+		explicit EventStreamParser(size_t maxEventSize = 1024 * 1024);
+
+		void SetMaxEventSize(size_t bytes) { m_MaxEventSize = bytes; }
+
+		void Feed(const char* data, size_t size, const Callback& onEvent);
+
+		// New connection: drops any partial event, keeps the last event ID
+		void Reset();
+
+		const std::string& LastEventId() const { return m_LastEventId; }
+		void SetLastEventId(const std::string& id) { m_LastEventId = id; }
+
+		// Reconnection delay sent by the server, 0 if none was
+		DWORD Retry() const { return m_Retry; }
+
+		// Events dropped for being too large
+		size_t Discarded() const { return m_Discarded; }
+
+	private:
+		void ProcessLine(const Callback& onEvent);
+
+		size_t m_MaxEventSize;
+		std::string m_Line;         // Current line, without its terminator
+		bool m_SkipLF;              // Last line ended with CR, a LF may follow
+		bool m_Start;               // A leading BOM is still to be skipped
+		bool m_Overflow;            // Current event too large, skip to its end
+		bool m_LineHasData;         // Skipped line was not blank
+		std::string m_Type;
+		std::string m_Data;
+		std::string m_LastEventId;
+		DWORD m_Retry;
+		size_t m_Discarded;
+	};
+
+	// Server-Sent Events subscription. A background thread keeps a GET
+	// request open, parses the stream and either passes events to the
+	// callback (on that thread) or queues them for Poll() and Wait().
+	// Dropped connections are reopened after the retry delay with a
+	// Last-Event-ID header; a response other than 200 text/event-stream
+	// ends the subscription, as does 204. Reading pauses while the queue
+	// is full.
+	class EventSource
+	{
+	public:
+		EventSource(const HttpRequest& request,
+			const std::wstring& rest_of_path,
+			const std::wstring& requestHeader = L"");
+		~EventSource();
+
+		// Settings read by Start()
+		// Called on the receiving thread instead of queueing events
+		void SetCallback(EventStreamParser::Callback callback) { m_Callback = callback; }
+		// Delay before reconnecting until the server sends its own, in ms
+		void SetReconnectDelay(DWORD milliseconds) { m_ReconnectDelay = milliseconds; }
+		void SetMaxEventSize(size_t bytes) { m_Parser.SetMaxEventSize(bytes); }
+		void SetMaxQueuedEvents(size_t count) { m_MaxQueuedEvents = count; }
+		// Resume a stream from an event seen by an earlier subscription
+		void SetLastEventId(const std::string& id) { m_Parser.SetLastEventId(id); }
+
+		bool Start();
+
+		// Take the next event without waiting, false when none is queued
+		bool Poll(ServerSentEvent& event);
+
+		// Wait up to timeoutMs (or INFINITE) for an event
+		bool Wait(ServerSentEvent& event, DWORD timeoutMs);
+
+		// False once the subscription ended, see StatusCode() and Error()
+		bool IsOpen() const;
+		// Whether a response is currently being streamed
+		bool IsConnected() const;
+		DWORD StatusCode() const;
+		std::wstring Error() const;
+
+		void Close();
+
+	private:
+		EventSource(const EventSource&) = delete;
+		EventSource& operator=(const EventSource&) = delete;
+
+		void Run();
+		// Returns false when the subscription must end
+		bool Stream(HINTERNET hConnect, bool& streamed);
+		bool Pause(DWORD milliseconds);
+		void Deliver(const ServerSentEvent& event);
+		void Finish(DWORD statusCode, const std::wstring& error);
+
+		HttpRequest m_Request;
+		std::wstring m_Path;
+		std::wstring m_Headers;
+		EventStreamParser::Callback m_Callback;
+		DWORD m_ReconnectDelay;
+		size_t m_MaxQueuedEvents;
+		EventStreamParser m_Parser;  // Receiving thread only
+		std::thread m_Thread;
+
+		mutable std::mutex m_Mutex;
+		std::condition_variable m_Changed;
+		std::deque<ServerSentEvent> m_Queue;
+		HINTERNET m_Active;          // Request being read, closed to cancel it
+		bool m_Open;
+		bool m_Connected;
+		bool m_Stopping;
+		DWORD m_StatusCode;
+		std::wstring m_Error;
+	};
+
+}
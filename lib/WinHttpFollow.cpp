@@ -0,0 +1,202 @@
+// The MIT License (MIT)
+// Following append-only resources for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+// Follow mode: each HttpRequest::Follow() call asks for "Range: bytes=N-",
+// N being a few bytes before the end of what was read, so the transfer
+// costs only the appended data. The overlap is compared with the bytes
+// kept in the cursor: a resource rotated or rewritten to at least the same
+// size is noticed even though its new Content-Range looks valid. The
+// validator is sent as If-None-Match (or If-Modified-Since) to get a bodiless
+// 304 when nothing changed.
+
+#include "WinHttpWrapper.h"
+#include <algorithm>
+#include <cstring>
+#include <cwchar>
+#include <cwctype>
+
+namespace
+{
+	// Bytes read again before the cursor to recognize the resource
+	const size_t kFollowOverlap = 64;
+
+	// Value of a header of the raw response headers, empty when missing
+	std::wstring FindHeader(const std::wstring& headers, const wchar_t* name)
+	{
+		const size_t length = wcslen(name);
+		size_t line = 0;
+		while (line < headers.size())
+		{
+			size_t end = headers.find(L'\n', line);
+			if (end == std::wstring::npos)
+				end = headers.size();
+			if (end - line > length && headers[line + length] == L':')
+			{
+				bool same = true;
+				for (size_t i = 0; i < length && same; ++i)
+					same = towlower(headers[line + i]) == towlower(name[i]);
+				if (same)
+				{
+					size_t first = line + length + 1;
+					size_t last = end;
+					while (first < last && iswspace(headers[first]))
+						++first;
+					while (last > first && iswspace(headers[last - 1]))
+						--last;
+					return headers.substr(first, last - first);
+				}
+			}
+			line = end + 1;
+		}
+		return std::wstring();
+	}
+
+	// Parse "bytes first-last/total" or "bytes */total" ("total" may be "*")
+	bool ParseContentRange(const std::wstring& value, ULONGLONG& first, ULONGLONG& total)
+	{
+		if (value.compare(0, 5, L"bytes") != 0)
+			return false;
+		size_t pos = 5;
+		while (pos < value.size() && value[pos] == L' ')
+			++pos;
+		size_t slash = value.find(L'/', pos);
+		if (slash == std::wstring::npos || slash + 1 >= value.size())
+			return false;
+		first = value[pos] == L'*' ? 0 : wcstoull(value.c_str() + pos, NULL, 10);
+		total = value[slash + 1] == L'*' ? ~0ULL : wcstoull(value.c_str() + slash + 1, NULL, 10);
+		return true;
+	}
+
+	const uint8_t* BodyData(const WinHttpWrapper::HttpResponse& response)
+	{
+		return response.isBinary
+			? response.binaryData.data()
+			: reinterpret_cast<const uint8_t*>(response.text.data());
+	}
+
+	size_t BodySize(const WinHttpWrapper::HttpResponse& response)
+	{
+		return response.isBinary ? response.binaryData.size() : response.text.size();
+	}
+
+	void DropBodyFront(WinHttpWrapper::HttpResponse& response, size_t count)
+	{
+		if (response.isBinary)
+			response.binaryData.erase(response.binaryData.begin(), response.binaryData.begin() + count);
+		else
+			response.text.erase(0, count);
+	}
+
+	// Whether the bytes at offset of the body are the tail of the last read
+	bool MatchesTail(const WinHttpWrapper::HttpResponse& response, size_t offset, const std::string& tail)
+	{
+		return BodySize(response) >= offset + tail.size()
+			&& (tail.empty() || memcmp(BodyData(response) + offset, tail.data(), tail.size()) == 0);
+	}
+
+	// Move the cursor past the body, which holds only new bytes
+	void Advance(WinHttpWrapper::FollowCursor& cursor, const WinHttpWrapper::HttpResponse& response)
+	{
+		const size_t size = BodySize(response);
+		const char* data = reinterpret_cast<const char*>(BodyData(response));
+		if (size >= kFollowOverlap)
+			cursor.tail.assign(data + size - kFollowOverlap, kFollowOverlap);
+		else
+		{
+			cursor.tail.append(data, size);
+			if (cursor.tail.size() > kFollowOverlap)
+				cursor.tail.erase(0, cursor.tail.size() - kFollowOverlap);
+		}
+		cursor.offset += size;
+
+		cursor.validator = FindHeader(response.header, L"ETag");
+		if (cursor.validator.empty())
+			cursor.validator = FindHeader(response.header, L"Last-Modified");
+	}
+}
+
+bool WinHttpWrapper::HttpRequest::Follow(
+	const std::wstring& rest_of_path,
+	const std::wstring& requestHeader,
+	FollowCursor& cursor,
+	HttpResponse& response)
+{
+	cursor.restarted = false;
+
+	// A second pass reads a replaced or truncated resource from the start
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		const ULONGLONG first = cursor.offset - cursor.tail.size();
+		std::wstring headers = L"Range: bytes=" + std::to_wstring(first) + L"-\r\n";
+		if (!cursor.validator.empty())
+		{
+			const bool entityTag = cursor.validator[0] == L'"' || cursor.validator.compare(0, 2, L"W/") == 0;
+			headers += (entityTag ? L"If-None-Match: " : L"If-Modified-Since: ") + cursor.validator + L"\r\n";
+		}
+		headers += requestHeader;
+
+		if (!Get(rest_of_path, headers, response))
+			return false;
+
+		bool replaced = false;
+		if (response.statusCode == 304)
+		{
+			DropBodyFront(response, BodySize(response));
+			return true;
+		}
+		else if (response.statusCode == 206)
+		{
+			ULONGLONG start = 0;
+			ULONGLONG total = 0;
+			replaced = !ParseContentRange(FindHeader(response.header, L"Content-Range"), start, total)
+				|| start != first || !MatchesTail(response, 0, cursor.tail);
+			if (!replaced)
+				DropBodyFront(response, cursor.tail.size());
+		}
+		else if (response.statusCode == 416)
+		{
+			// Nothing at or after first: the resource is empty, or shorter
+			// than what was read
+			DropBodyFront(response, BodySize(response));
+			if (cursor.offset == 0)
+				return true;
+			replaced = true;
+		}
+		else if (response.statusCode == 200)
+		{
+			// The whole resource: the server ignored the range, or the
+			// resource changed in a way it would not apply the range to
+			if (cursor.offset > 0 && MatchesTail(response, static_cast<size_t>(first), cursor.tail))
+				DropBodyFront(response, static_cast<size_t>(cursor.offset));
+			else if (cursor.offset > 0)
+			{
+				cursor = FollowCursor();
+				cursor.restarted = true;
+			}
+		}
+		else
+		{
+			// Errors leave the cursor where it was
+			return true;
+		}
+
+		if (replaced)
+		{
+			if (IsDebugLoggingEnabled()) {
+				DebugLogFormat(L"[FOLLOW] '%s' was replaced or truncated, reading it again from the start", rest_of_path.c_str());
+			}
+			cursor = FollowCursor();
+			cursor.restarted = true;
+			continue;
+		}
+
+		Advance(cursor, response);
+		if (IsDebugLoggingEnabled()) {
+			DebugLogFormat(L"[FOLLOW] %zu new bytes of '%s', now at %llu", BodySize(response), rest_of_path.c_str(), cursor.offset);
+		}
+		return true;
+	}
+	return true;
+}
@@ -0,0 +1,435 @@
+// The MIT License (MIT)
+// Body hashing for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#include "WinHttpHash.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define WINHTTP_HASH_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define WINHTTP_HASH_TARGET(features)
+#else
+#include <cpuid.h>
+#define WINHTTP_HASH_TARGET(features) __attribute__((target(features)))
+#endif
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+namespace
+{
+	const uint32_t kSha256K[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+	};
+
+	const uint64_t kXxhPrime1 = 11400714785074694791ULL;
+	const uint64_t kXxhPrime2 = 14029467366897019727ULL;
+	const uint64_t kXxhPrime3 = 1609587929392839161ULL;
+	const uint64_t kXxhPrime4 = 9650029242287828579ULL;
+	const uint64_t kXxhPrime5 = 2870177450012600261ULL;
+
+	inline uint32_t RotateRight(uint32_t value, int bits)
+	{
+		return (value >> bits) | (value << (32 - bits));
+	}
+
+	inline uint64_t RotateLeft(uint64_t value, int bits)
+	{
+		return (value << bits) | (value >> (64 - bits));
+	}
+
+	inline uint32_t LoadBigEndian32(const uint8_t* data)
+	{
+		return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16)
+			| (static_cast<uint32_t>(data[2]) << 8) | static_cast<uint32_t>(data[3]);
+	}
+
+	inline uint64_t LoadLittleEndian64(const uint8_t* data)
+	{
+		uint64_t value = 0;
+		for (int i = 7; i >= 0; --i)
+			value = (value << 8) | data[i];
+		return value;
+	}
+
+	inline uint32_t LoadLittleEndian32(const uint8_t* data)
+	{
+		return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8)
+			| (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+	}
+
+	void Sha256Portable(uint32_t state[8], const uint8_t* data, size_t blocks)
+	{
+		uint32_t w[64];
+		for (; blocks > 0; --blocks, data += 64)
+		{
+			for (int i = 0; i < 16; ++i)
+				w[i] = LoadBigEndian32(data + i * 4);
+			for (int i = 16; i < 64; ++i)
+			{
+				const uint32_t s0 = RotateRight(w[i - 15], 7) ^ RotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+				const uint32_t s1 = RotateRight(w[i - 2], 17) ^ RotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+				w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+			}
+
+			uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+			uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+			for (int i = 0; i < 64; ++i)
+			{
+				const uint32_t s1 = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+				const uint32_t t1 = h + s1 + ((e & f) ^ (~e & g)) + kSha256K[i] + w[i];
+				const uint32_t s0 = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+				const uint32_t t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+				h = g; g = f; f = e; e = d + t1;
+				d = c; c = b; b = a; a = t1 + t2;
+			}
+			state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+			state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+		}
+	}
+
+	uint32_t g_CrcTable[256];
+
+	bool InitCrcTable()
+	{
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t crc = i;
+			for (int bit = 0; bit < 8; ++bit)
+				crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+			g_CrcTable[i] = crc;
+		}
+		return true;
+	}
+
+	uint32_t Crc32cPortable(uint32_t crc, const uint8_t* data, size_t size)
+	{
+		static const bool initialized = InitCrcTable();
+		(void)initialized;
+		for (size_t i = 0; i < size; ++i)
+			crc = g_CrcTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+		return crc;
+	}
+
+#ifdef WINHTTP_HASH_X86
+	struct CpuFeatures
+	{
+		CpuFeatures() : sse42(false), sha(false)
+		{
+#ifdef _MSC_VER
+			int info[4];
+			__cpuid(info, 0);
+			const int maxLeaf = info[0];
+			__cpuid(info, 1);
+			const bool sse41 = (info[2] & (1 << 19)) != 0;
+			const bool ssse3 = (info[2] & (1 << 9)) != 0;
+			sse42 = (info[2] & (1 << 20)) != 0;
+			if (maxLeaf >= 7)
+			{
+				__cpuidex(info, 7, 0);
+				sha = sse41 && ssse3 && (info[1] & (1 << 29)) != 0;
+			}
+#else
+			unsigned int eax, ebx, ecx, edx;
+			if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+			{
+				const bool sse41 = (ecx & (1u << 19)) != 0;
+				const bool ssse3 = (ecx & (1u << 9)) != 0;
+				sse42 = (ecx & (1u << 20)) != 0;
+				if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+					sha = sse41 && ssse3 && (ebx & (1u << 29)) != 0;
+			}
+#endif
+		}
+
+		bool sse42;
+		bool sha;
+	};
+
+	const CpuFeatures& Cpu()
+	{
+		static const CpuFeatures features;
+		return features;
+	}
+
+	// Four rounds of SHA-256 from the message words in w[group % 4],
+	// scheduling the words of the next groups on the way
+	WINHTTP_HASH_TARGET("sha,sse4.1,ssse3")
+	void Sha256Ni(uint32_t state[8], const uint8_t* data, size_t blocks)
+	{
+		const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+		// The instructions work on the state as ABEF and CDGH
+		__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0])), 0xB1);
+		__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4])), 0x1B);
+		__m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+		state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+		for (; blocks > 0; --blocks, data += 64)
+		{
+			const __m128i abefSave = state0;
+			const __m128i cdghSave = state1;
+			__m128i w[4];
+			for (int group = 0; group < 16; ++group)
+			{
+				if (group < 4)
+					w[group] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + group * 16)), byteSwap);
+
+				__m128i message = _mm_add_epi32(w[group % 4], _mm_loadu_si128(reinterpret_cast<const __m128i*>(&kSha256K[group * 4])));
+				state1 = _mm_sha256rnds2_epu32(state1, state0, message);
+				if (group >= 3 && group <= 14)
+				{
+					__m128i& next = w[(group + 1) % 4];
+					next = _mm_add_epi32(next, _mm_alignr_epi8(w[group % 4], w[(group + 3) % 4], 4));
+					next = _mm_sha256msg2_epu32(next, w[group % 4]);
+				}
+				message = _mm_shuffle_epi32(message, 0x0E);
+				state0 = _mm_sha256rnds2_epu32(state0, state1, message);
+				if (group >= 1 && group <= 12)
+					w[(group + 3) % 4] = _mm_sha256msg1_epu32(w[(group + 3) % 4], w[group % 4]);
+			}
+			state0 = _mm_add_epi32(state0, abefSave);
+			state1 = _mm_add_epi32(state1, cdghSave);
+		}
+
+		tmp = _mm_shuffle_epi32(state0, 0x1B);
+		state1 = _mm_shuffle_epi32(state1, 0xB1);
+		state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+		state1 = _mm_alignr_epi8(state1, tmp, 8);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+	}
+
+	WINHTTP_HASH_TARGET("sse4.2")
+	uint32_t Crc32cSse42(uint32_t crc, const uint8_t* data, size_t size)
+	{
+#if defined(__x86_64__) || defined(_M_X64)
+		uint64_t crc64 = crc;
+		for (; size >= 8; size -= 8, data += 8)
+		{
+			uint64_t word;
+			memcpy(&word, data, sizeof(word));
+			crc64 = _mm_crc32_u64(crc64, word);
+		}
+		crc = static_cast<uint32_t>(crc64);
+#endif
+		for (; size >= 4; size -= 4, data += 4)
+		{
+			uint32_t word;
+			memcpy(&word, data, sizeof(word));
+			crc = _mm_crc32_u32(crc, word);
+		}
+		for (; size > 0; --size, ++data)
+			crc = _mm_crc32_u8(crc, *data);
+		return crc;
+	}
+#endif
+
+	void Sha256Blocks(uint32_t state[8], const uint8_t* data, size_t blocks)
+	{
+#ifdef WINHTTP_HASH_X86
+		if (Cpu().sha)
+		{
+			Sha256Ni(state, data, blocks);
+			return;
+		}
+#endif
+		Sha256Portable(state, data, blocks);
+	}
+
+	uint32_t Crc32c(uint32_t crc, const uint8_t* data, size_t size)
+	{
+#if defined(WINHTTP_HASH_X86)
+		if (Cpu().sse42)
+			return Crc32cSse42(crc, data, size);
+#elif defined(__ARM_FEATURE_CRC32)
+		for (; size >= 8; size -= 8, data += 8)
+		{
+			uint64_t word;
+			memcpy(&word, data, sizeof(word));
+			crc = __crc32cd(crc, word);
+		}
+		for (; size > 0; --size, ++data)
+			crc = __crc32cb(crc, *data);
+		return crc;
+#endif
+		return Crc32cPortable(crc, data, size);
+	}
+
+	inline uint64_t XxhRound(uint64_t acc, uint64_t input)
+	{
+		acc += input * kXxhPrime2;
+		acc = RotateLeft(acc, 31);
+		return acc * kXxhPrime1;
+	}
+
+	inline uint64_t XxhMerge(uint64_t acc, uint64_t value)
+	{
+		acc ^= XxhRound(0, value);
+		return acc * kXxhPrime1 + kXxhPrime4;
+	}
+
+	void AppendHex(std::string& out, uint64_t value, int bytes)
+	{
+		static const char digits[] = "0123456789abcdef";
+		for (int i = bytes * 2 - 1; i >= 0; --i)
+			out += digits[(value >> (i * 4)) & 0xf];
+	}
+}
+
+WinHttpWrapper::BodyHasher::BodyHasher(HashAlgorithm algorithm)
+	: m_Algorithm(algorithm)
+{
+	Reset();
+}
+
+void WinHttpWrapper::BodyHasher::Reset()
+{
+	static const uint32_t shaInit[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	memcpy(m_Sha, shaInit, sizeof(m_Sha));
+	m_Xxh[0] = kXxhPrime1 + kXxhPrime2;
+	m_Xxh[1] = kXxhPrime2;
+	m_Xxh[2] = 0;
+	m_Xxh[3] = 0 - kXxhPrime1;
+	m_Crc = 0xffffffff;
+	m_Buffered = 0;
+	m_Length = 0;
+}
+
+void WinHttpWrapper::BodyHasher::Block(const uint8_t* data, size_t blocks)
+{
+	if (m_Algorithm == HASH_SHA256)
+	{
+		Sha256Blocks(m_Sha, data, blocks);
+		return;
+	}
+	for (; blocks > 0; --blocks, data += 32)
+	{
+		for (int lane = 0; lane < 4; ++lane)
+			m_Xxh[lane] = XxhRound(m_Xxh[lane], LoadLittleEndian64(data + lane * 8));
+	}
+}
+
+void WinHttpWrapper::BodyHasher::Update(const void* data, size_t size)
+{
+	if (m_Algorithm == HASH_NONE || size == 0)
+		return;
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	m_Length += size;
+	if (m_Algorithm == HASH_CRC32C)
+	{
+		m_Crc = Crc32c(m_Crc, bytes, size);
+		return;
+	}
+
+	// Whole blocks go straight from the body, the rest waits in m_Buffer
+	const size_t blockSize = m_Algorithm == HASH_SHA256 ? 64 : 32;
+	if (m_Buffered > 0)
+	{
+		const size_t taken = (std::min)(blockSize - m_Buffered, size);
+		memcpy(m_Buffer + m_Buffered, bytes, taken);
+		m_Buffered += taken;
+		bytes += taken;
+		size -= taken;
+		if (m_Buffered < blockSize)
+			return;
+		Block(m_Buffer, 1);
+		m_Buffered = 0;
+	}
+	const size_t blocks = size / blockSize;
+	if (blocks > 0)
+		Block(bytes, blocks);
+	m_Buffered = size - blocks * blockSize;
+	memcpy(m_Buffer, bytes + blocks * blockSize, m_Buffered);
+}
+
+std::string WinHttpWrapper::BodyHasher::Finish()
+{
+	std::string digest;
+	if (m_Algorithm == HASH_SHA256)
+	{
+		// Padding: 0x80, zeros, then the length in bits, big-endian
+		const ULONGLONG bits = m_Length * 8;
+		uint8_t padding[72] = { 0x80 };
+		const size_t padLength = (m_Buffered < 56 ? 56 : 120) - m_Buffered;
+		for (int i = 0; i < 8; ++i)
+			padding[padLength + i] = static_cast<uint8_t>(bits >> (56 - i * 8));
+		Update(padding, padLength + 8);
+		for (int i = 0; i < 8; ++i)
+			AppendHex(digest, m_Sha[i], 4);
+	}
+	else if (m_Algorithm == HASH_XXH64)
+	{
+		uint64_t hash;
+		if (m_Length >= 32)
+		{
+			hash = RotateLeft(m_Xxh[0], 1) + RotateLeft(m_Xxh[1], 7) + RotateLeft(m_Xxh[2], 12) + RotateLeft(m_Xxh[3], 18);
+			for (int lane = 0; lane < 4; ++lane)
+				hash = XxhMerge(hash, m_Xxh[lane]);
+		}
+		else
+			hash = kXxhPrime5;
+		hash += m_Length;
+
+		const uint8_t* tail = m_Buffer;
+		size_t remaining = m_Buffered;
+		for (; remaining >= 8; remaining -= 8, tail += 8)
+		{
+			hash ^= XxhRound(0, LoadLittleEndian64(tail));
+			hash = RotateLeft(hash, 27) * kXxhPrime1 + kXxhPrime4;
+		}
+		if (remaining >= 4)
+		{
+			hash ^= static_cast<uint64_t>(LoadLittleEndian32(tail)) * kXxhPrime1;
+			hash = RotateLeft(hash, 23) * kXxhPrime2 + kXxhPrime3;
+			remaining -= 4;
+			tail += 4;
+		}
+		for (; remaining > 0; --remaining, ++tail)
+		{
+			hash ^= *tail * kXxhPrime5;
+			hash = RotateLeft(hash, 11) * kXxhPrime1;
+		}
+
+		hash ^= hash >> 33;
+		hash *= kXxhPrime2;
+		hash ^= hash >> 29;
+		hash *= kXxhPrime3;
+		hash ^= hash >> 32;
+		AppendHex(digest, hash, 8);
+	}
+	else if (m_Algorithm == HASH_CRC32C)
+	{
+		AppendHex(digest, ~m_Crc, 4);
+	}
+	return digest;
+}
+
+bool WinHttpWrapper::BodyHasher::Matches(const std::string& digest, const std::string& expected)
+{
+	if (digest.size() != expected.size())
+		return false;
+	for (size_t i = 0; i < digest.size(); ++i)
+	{
+		char c = expected[i];
+		if (c >= 'A' && c <= 'F')
+			c = static_cast<char>(c - 'A' + 'a');
+		if (c != digest[i])
+			return false;
+	}
+	return true;
+}
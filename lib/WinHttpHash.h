@@ -0,0 +1,54 @@
+// The MIT License (MIT)
+// Body hashing for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include "WinHttpPlatform.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace WinHttpWrapper
+{
+	enum HashAlgorithm
+	{
+		HASH_NONE = 0,
+		HASH_SHA256,    // SHA-NI instructions when the CPU has them
+		HASH_XXH64,     // xxHash 64-bit, seed 0, not cryptographic
+		HASH_CRC32C     // Castagnoli CRC, SSE 4.2 / ARMv8 CRC instructions when available
+	};
+
+	// Incremental digest of a body, fed with its chunks as they are read so
+	// that verifying a download takes no second pass over it
+	class BodyHasher
+	{
+	public:
+		explicit BodyHasher(HashAlgorithm algorithm = HASH_NONE);
+
+		HashAlgorithm Algorithm() const { return m_Algorithm; }
+
+		// Start over, for a body read again from its start
+		void Reset();
+		void Update(const void* data, size_t size);
+		// Lowercase hex digest, in the usual byte order of each algorithm
+		// (as printed by sha256sum, xxhsum, ...). Ends the hashing.
+		std::string Finish();
+
+		// Case-insensitive comparison of hex digests
+		static bool Matches(const std::string& digest, const std::string& expected);
+
+	private:
+		void Block(const uint8_t* data, size_t blocks);
+
+		HashAlgorithm m_Algorithm;
+		uint8_t m_Buffer[64];       // Partial block
+		size_t m_Buffered;
+		ULONGLONG m_Length;
+		uint32_t m_Sha[8];
+		uint64_t m_Xxh[4];
+		uint32_t m_Crc;
+	};
+
+}
@@ -0,0 +1,425 @@
+// The MIT License (MIT)
+// JSON parser for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#include "WinHttpJson.h"
+#include <cstdlib>
+
+namespace
+{
+	typedef WinHttpWrapper::JsonDocument::Node Node;
+
+	const int kMaxDepth = 512;
+
+	// Exactly representable powers of ten, for the fast number path
+	const double kPow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	inline bool IsDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	inline int HexValue(char c)
+	{
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		return -1;
+	}
+
+	void AppendUtf8(std::string& out, uint32_t cp)
+	{
+		if (cp < 0x80)
+		{
+			out += static_cast<char>(cp);
+		}
+		else if (cp < 0x800)
+		{
+			out += static_cast<char>(0xC0 | (cp >> 6));
+			out += static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		else if (cp < 0x10000)
+		{
+			out += static_cast<char>(0xE0 | (cp >> 12));
+			out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		else
+		{
+			out += static_cast<char>(0xF0 | (cp >> 18));
+			out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+			out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (cp & 0x3F));
+		}
+	}
+
+	// Recursive descent over the whole body, appending nodes as values are
+	// recognized. Containers get their element count patched in at the end.
+	class Parser
+	{
+	public:
+		Parser(const char* data, size_t size, std::vector<Node>& nodes, std::string& strings)
+			: m_Pos(data)
+			, m_End(data + size)
+			, m_Nodes(nodes)
+			, m_Strings(strings)
+		{}
+
+		bool ParseDocument()
+		{
+			SkipSpace();
+			if (!ParseValue(0))
+				return false;
+			SkipSpace();
+			return m_Pos == m_End;
+		}
+
+	private:
+		void SkipSpace()
+		{
+			while (m_Pos < m_End && (*m_Pos == ' ' || *m_Pos == '\n' || *m_Pos == '\r' || *m_Pos == '\t'))
+				++m_Pos;
+		}
+
+		size_t Push(WinHttpWrapper::JsonDocument::NodeType type)
+		{
+			Node node;
+			node.type = type;
+			node.count = 0;
+			node.number = 0.0;
+			m_Nodes.push_back(node);
+			return m_Nodes.size() - 1;
+		}
+
+		bool Literal(const char* word, size_t length, WinHttpWrapper::JsonDocument::NodeType type)
+		{
+			if (static_cast<size_t>(m_End - m_Pos) < length)
+				return false;
+			for (size_t i = 0; i < length; ++i)
+			{
+				if (m_Pos[i] != word[i])
+					return false;
+			}
+			m_Pos += length;
+			Push(type);
+			return true;
+		}
+
+		bool ParseValue(int depth)
+		{
+			if (m_Pos >= m_End)
+				return false;
+			switch (*m_Pos)
+			{
+			case '{': return ParseObject(depth);
+			case '[': return ParseArray(depth);
+			case '"': return ParseString();
+			case 't': return Literal("true", 4, WinHttpWrapper::JsonDocument::JSON_TRUE);
+			case 'f': return Literal("false", 5, WinHttpWrapper::JsonDocument::JSON_FALSE);
+			case 'n': return Literal("null", 4, WinHttpWrapper::JsonDocument::JSON_NULL);
+			default: return ParseNumber();
+			}
+		}
+
+		bool ParseArray(int depth)
+		{
+			if (depth >= kMaxDepth)
+				return false;
+			++m_Pos;
+			size_t index = Push(WinHttpWrapper::JsonDocument::JSON_ARRAY);
+			uint32_t count = 0;
+
+			SkipSpace();
+			if (m_Pos < m_End && *m_Pos == ']')
+			{
+				++m_Pos;
+				return true;
+			}
+			for (;;)
+			{
+				SkipSpace();
+				if (!ParseValue(depth + 1))
+					return false;
+				++count;
+				SkipSpace();
+				if (m_Pos >= m_End)
+					return false;
+				if (*m_Pos == ']')
+					break;
+				if (*m_Pos != ',')
+					return false;
+				++m_Pos;
+			}
+			++m_Pos;
+			m_Nodes[index].count = count;
+			return true;
+		}
+
+		bool ParseObject(int depth)
+		{
+			if (depth >= kMaxDepth)
+				return false;
+			++m_Pos;
+			size_t index = Push(WinHttpWrapper::JsonDocument::JSON_OBJECT);
+			uint32_t count = 0;
+
+			SkipSpace();
+			if (m_Pos < m_End && *m_Pos == '}')
+			{
+				++m_Pos;
+				return true;
+			}
+			for (;;)
+			{
+				SkipSpace();
+				if (m_Pos >= m_End || *m_Pos != '"' || !ParseString())
+					return false;
+				SkipSpace();
+				if (m_Pos >= m_End || *m_Pos != ':')
+					return false;
+				++m_Pos;
+				SkipSpace();
+				if (!ParseValue(depth + 1))
+					return false;
+				++count;
+				SkipSpace();
+				if (m_Pos >= m_End)
+					return false;
+				if (*m_Pos == '}')
+					break;
+				if (*m_Pos != ',')
+					return false;
+				++m_Pos;
+			}
+			++m_Pos;
+			m_Nodes[index].count = count;
+			return true;
+		}
+
+		bool ParseHex4(uint32_t& value)
+		{
+			if (m_End - m_Pos < 4)
+				return false;
+			value = 0;
+			for (int i = 0; i < 4; ++i)
+			{
+				int digit = HexValue(m_Pos[i]);
+				if (digit < 0)
+					return false;
+				value = (value << 4) | static_cast<uint32_t>(digit);
+			}
+			m_Pos += 4;
+			return true;
+		}
+
+		bool ParseString()
+		{
+			++m_Pos;
+			size_t offset = m_Strings.size();
+			for (;;)
+			{
+				// Copy the run of plain characters in one go
+				const char* run = m_Pos;
+				while (m_Pos < m_End && *m_Pos != '"' && *m_Pos != '\\' && static_cast<unsigned char>(*m_Pos) >= 0x20)
+					++m_Pos;
+				m_Strings.append(run, static_cast<size_t>(m_Pos - run));
+
+				if (m_Pos >= m_End)
+					return false;
+				char c = *m_Pos++;
+				if (c == '"')
+					break;
+				if (c != '\\' || m_Pos >= m_End)
+					return false;     // Unescaped control character
+
+				c = *m_Pos++;
+				switch (c)
+				{
+				case '"': m_Strings += '"'; break;
+				case '\\': m_Strings += '\\'; break;
+				case '/': m_Strings += '/'; break;
+				case 'b': m_Strings += '\b'; break;
+				case 'f': m_Strings += '\f'; break;
+				case 'n': m_Strings += '\n'; break;
+				case 'r': m_Strings += '\r'; break;
+				case 't': m_Strings += '\t'; break;
+				case 'u':
+				{
+					uint32_t cp;
+					if (!ParseHex4(cp))
+						return false;
+					if (cp >= 0xD800 && cp <= 0xDBFF)
+					{
+						uint32_t low;
+						const char* save = m_Pos;
+						if (m_End - m_Pos >= 6 && m_Pos[0] == '\\' && m_Pos[1] == 'u' &&
+							(m_Pos += 2, ParseHex4(low)) && low >= 0xDC00 && low <= 0xDFFF)
+						{
+							cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+						}
+						else
+						{
+							m_Pos = save;
+							cp = 0xFFFD;
+						}
+					}
+					else if (cp >= 0xDC00 && cp <= 0xDFFF)
+					{
+						cp = 0xFFFD;
+					}
+					AppendUtf8(m_Strings, cp);
+					break;
+				}
+				default:
+					return false;
+				}
+			}
+
+			size_t length = m_Strings.size() - offset;
+			if (m_Strings.size() > 0xFFFFFFFFu)
+				return false;
+			size_t index = Push(WinHttpWrapper::JsonDocument::JSON_STRING);
+			m_Nodes[index].str.offset = static_cast<uint32_t>(offset);
+			m_Nodes[index].str.length = static_cast<uint32_t>(length);
+			return true;
+		}
+
+		bool ParseNumber()
+		{
+			const char* start = m_Pos;
+			bool negative = false;
+			if (*m_Pos == '-')
+			{
+				negative = true;
+				++m_Pos;
+			}
+			if (m_Pos >= m_End || !IsDigit(*m_Pos))
+				return false;
+
+			uint64_t mantissa = 0;
+			int digits = 0;                 // Significant digits in mantissa
+			int exponent = 0;
+			bool integer = true;
+
+			if (*m_Pos == '0')
+			{
+				++m_Pos;
+			}
+			else
+			{
+				while (m_Pos < m_End && IsDigit(*m_Pos))
+				{
+					if (digits < 19)
+					{
+						mantissa = mantissa * 10 + static_cast<uint64_t>(*m_Pos - '0');
+						++digits;
+					}
+					else
+					{
+						++exponent;
+						digits = 20;        // Too precise for the fast path
+					}
+					++m_Pos;
+				}
+			}
+
+			if (m_Pos < m_End && *m_Pos == '.')
+			{
+				integer = false;
+				++m_Pos;
+				if (m_Pos >= m_End || !IsDigit(*m_Pos))
+					return false;
+				while (m_Pos < m_End && IsDigit(*m_Pos))
+				{
+					if (digits < 19)
+					{
+						mantissa = mantissa * 10 + static_cast<uint64_t>(*m_Pos - '0');
+						if (mantissa != 0)
+							++digits;
+						--exponent;
+					}
+					else
+					{
+						digits = 20;
+					}
+					++m_Pos;
+				}
+			}
+
+			if (m_Pos < m_End && (*m_Pos == 'e' || *m_Pos == 'E'))
+			{
+				integer = false;
+				++m_Pos;
+				bool negativeExponent = false;
+				if (m_Pos < m_End && (*m_Pos == '+' || *m_Pos == '-'))
+					negativeExponent = *m_Pos++ == '-';
+				if (m_Pos >= m_End || !IsDigit(*m_Pos))
+					return false;
+				int value = 0;
+				while (m_Pos < m_End && IsDigit(*m_Pos))
+				{
+					if (value < 100000)
+						value = value * 10 + (*m_Pos - '0');
+					++m_Pos;
+				}
+				exponent += negativeExponent ? -value : value;
+			}
+
+			if (integer && digits <= 10)
+			{
+				int64_t value = negative ? -static_cast<int64_t>(mantissa) : static_cast<int64_t>(mantissa);
+				if (value >= INT32_MIN && value <= INT32_MAX)
+				{
+					size_t index = Push(WinHttpWrapper::JsonDocument::JSON_INT);
+					m_Nodes[index].integer = static_cast<int32_t>(value);
+					return true;
+				}
+			}
+
+			double number;
+			if (digits <= 15 && exponent >= -22 && exponent <= 22)
+			{
+				// Both operands are exact, so the result is correctly rounded
+				number = static_cast<double>(mantissa);
+				number = exponent < 0 ? number / kPow10[-exponent] : number * kPow10[exponent];
+				if (negative)
+					number = -number;
+			}
+			else
+			{
+				std::string literal(start, static_cast<size_t>(m_Pos - start));
+				number = strtod(literal.c_str(), NULL);
+			}
+
+			size_t index = Push(WinHttpWrapper::JsonDocument::JSON_NUMBER);
+			m_Nodes[index].number = number;
+			return true;
+		}
+
+		const char* m_Pos;
+		const char* m_End;
+		std::vector<Node>& m_Nodes;
+		std::string& m_Strings;
+	};
+}
+
+bool WinHttpWrapper::JsonDocument::Parse(const char* data, size_t size)
+{
+	m_Nodes.clear();
+	m_Strings.clear();
+	// Rough guess: one node per 8 bytes of input avoids most regrowth
+	m_Nodes.reserve(size / 8 + 1);
+
+	Parser parser(data, size, m_Nodes, m_Strings);
+	if (!parser.ParseDocument())
+	{
+		m_Nodes.clear();
+		m_Strings.clear();
+		return false;
+	}
+	return true;
+}
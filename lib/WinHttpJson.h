@@ -0,0 +1,63 @@
+// The MIT License (MIT)
+// JSON parser for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace WinHttpWrapper
+{
+	// Parsed JSON document, kept as a flat list of nodes in document order:
+	// an array is followed by its elements, an object by alternating key and
+	// value nodes. Nothing in it is GC-managed, so it can be built while the
+	// calling thread is outside the hxcpp GC and converted afterwards.
+	class JsonDocument
+	{
+	public:
+		enum NodeType
+		{
+			JSON_NULL,
+			JSON_FALSE,
+			JSON_TRUE,
+			JSON_INT,       // Integer literal that fits in 32 bits
+			JSON_NUMBER,
+			JSON_STRING,
+			JSON_ARRAY,
+			JSON_OBJECT
+		};
+
+		struct Node
+		{
+			NodeType type;
+			uint32_t count;         // Elements of an array, members of an object
+			union
+			{
+				double number;
+				int32_t integer;
+				struct
+				{
+					uint32_t offset;    // Into Strings(), UTF-8
+					uint32_t length;
+				} str;
+			};
+		};
+
+		// Returns false on invalid JSON (or nesting deeper than 512 levels),
+		// leaving the document empty
+		bool Parse(const char* data, size_t size);
+
+		bool Empty() const { return m_Nodes.empty(); }
+		const std::vector<Node>& Nodes() const { return m_Nodes; }
+		const char* Strings() const { return m_Strings.data(); }
+
+	private:
+		std::vector<Node> m_Nodes;
+		std::string m_Strings;  // Unescaped string and key contents
+	};
+
+}
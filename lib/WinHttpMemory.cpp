@@ -0,0 +1,115 @@
+// The MIT License (MIT)
+// Memory budget for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#include "WinHttpMemory.h"
+#include "WinHttpMetrics.h"
+#include "WinHttpWrapper.h"
+#include <algorithm>
+
+void WinHttpWrapper::MemoryBudget::Lease::Reserve(ULONGLONG bytes)
+{
+	if (bytes == 0)
+		return;
+	MemoryBudget::Instance().Acquire(bytes, m_Held);
+	m_Held += bytes;
+}
+
+void WinHttpWrapper::MemoryBudget::Lease::ReleaseAll()
+{
+	if (m_Held > 0)
+	{
+		MemoryBudget::Instance().Release(m_Held);
+		m_Held = 0;
+	}
+}
+
+WinHttpWrapper::MemoryBudget& WinHttpWrapper::MemoryBudget::Instance()
+{
+	static MemoryBudget instance;
+	return instance;
+}
+
+WinHttpWrapper::MemoryBudget::MemoryBudget()
+	: m_Limit(0)
+	, m_DefaultMaxResponseSize(0)
+	, m_Current(0)
+	, m_Peak(0)
+	, m_Waits(0)
+	, m_Holders(0)
+	, m_WaitingHolders(0)
+{
+}
+
+void WinHttpWrapper::MemoryBudget::SetLimit(ULONGLONG bytes)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Limit = bytes;
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[MEMORY] Budget set to %llu bytes", bytes);
+	}
+	m_Released.notify_all();
+}
+
+void WinHttpWrapper::MemoryBudget::SetDefaultMaxResponseSize(ULONGLONG bytes)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_DefaultMaxResponseSize = bytes;
+}
+
+ULONGLONG WinHttpWrapper::MemoryBudget::GetDefaultMaxResponseSize()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_DefaultMaxResponseSize;
+}
+
+void WinHttpWrapper::MemoryBudget::Acquire(ULONGLONG bytes, ULONGLONG held)
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	auto canProceed = [&]
+	{
+		return m_Limit == 0
+			|| m_Current + bytes <= m_Limit
+			|| m_Current == held                                   // Alone in the budget
+			|| (held > 0 && m_WaitingHolders >= m_Holders);        // Everyone holding memory is stuck
+	};
+
+	if (held > 0)
+		++m_WaitingHolders;
+	if (!canProceed())
+	{
+		++m_Waits;
+		if (IsDebugLoggingEnabled()) {
+			DebugLogFormat(L"[MEMORY] Budget exhausted (%llu / %llu bytes), pausing read of %llu bytes",
+				m_Current, m_Limit, bytes);
+		}
+		// The other waiters may now all be stuck
+		m_Released.notify_all();
+		m_Released.wait(lock, canProceed);
+	}
+	if (held > 0)
+		--m_WaitingHolders;
+
+	if (held == 0)
+		++m_Holders;
+	m_Current += bytes;
+	m_Peak = (std::max)(m_Peak, m_Current);
+}
+
+void WinHttpWrapper::MemoryBudget::Release(ULONGLONG bytes)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Current -= (std::min)(bytes, m_Current);
+	if (m_Holders > 0)
+		--m_Holders;
+	m_Released.notify_all();
+}
+
+void WinHttpWrapper::MemoryBudget::FillMetrics(Metrics& metrics)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	metrics.bufferedBytes = m_Current;
+	metrics.peakBufferedBytes = m_Peak;
+	metrics.budgetWaits = m_Waits;
+}
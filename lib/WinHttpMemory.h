@@ -0,0 +1,76 @@
+// The MIT License (MIT)
+// Memory budget for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include "WinHttpPlatform.h"
+
+namespace WinHttpWrapper
+{
+	struct Metrics;
+
+	// Process-wide budget for response bodies being read into memory. A read
+	// that would go over the budget waits until other responses complete,
+	// which leaves the data in the socket and lets TCP flow control push back
+	// on the servers. When every response holding memory is waiting, the
+	// oldest ones are let through anyway (overshooting by one read) rather
+	// than deadlocking.
+	class MemoryBudget
+	{
+	public:
+		// Bytes reserved by one response, given back when destroyed.
+		// Not thread-safe: each lease belongs to one reader.
+		class Lease
+		{
+		public:
+			Lease() : m_Held(0) {}
+			~Lease()
+			{
+				ReleaseAll();
+			}
+
+			// Blocks while the budget is exhausted
+			void Reserve(ULONGLONG bytes);
+			void ReleaseAll();
+			ULONGLONG Held() const { return m_Held; }
+
+		private:
+			Lease(const Lease&) = delete;
+			Lease& operator=(const Lease&) = delete;
+
+			ULONGLONG m_Held;
+		};
+
+		static MemoryBudget& Instance();
+
+		// 0 means unlimited (the default)
+		void SetLimit(ULONGLONG bytes);
+
+		// Body size limit for requests that do not set their own, 0 for none
+		void SetDefaultMaxResponseSize(ULONGLONG bytes);
+		ULONGLONG GetDefaultMaxResponseSize();
+
+		void FillMetrics(Metrics& metrics);
+
+	private:
+		MemoryBudget();
+
+		void Acquire(ULONGLONG bytes, ULONGLONG held);
+		void Release(ULONGLONG bytes);
+
+		std::mutex m_Mutex;
+		std::condition_variable m_Released;
+		ULONGLONG m_Limit;
+		ULONGLONG m_DefaultMaxResponseSize;
+		ULONGLONG m_Current;
+		ULONGLONG m_Peak;
+		ULONGLONG m_Waits;              // Reads that had to wait for the budget
+		unsigned int m_Holders;         // Leases holding bytes
+		unsigned int m_WaitingHolders;  // ... and waiting for more
+	};
+
+}
@@ -0,0 +1,39 @@
+// The MIT License (MIT)
+// Metrics for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#include "WinHttpMetrics.h"
+#include "WinHttpRetry.h"
+#include "WinHttpThrottle.h"
+
+WinHttpWrapper::Metrics::Metrics()
+	: activeRequests(0)
+	, queuedRequests(0)
+{
+	for (int p = 0; p < PRIORITY_COUNT; ++p)
+	{
+		dispatched[p] = 0;
+		queueTimeTotalUs[p] = 0;
+		queueTimeMaxUs[p] = 0;
+	}
+	bufferedBytes = 0;
+	peakBufferedBytes = 0;
+	budgetWaits = 0;
+	throttleWaits = 0;
+	throttleWaitTimeUs = 0;
+	retries = 0;
+	retriesOverBudget = 0;
+}
+
+WinHttpWrapper::Metrics WinHttpWrapper::GetMetrics()
+{
+	Metrics metrics;
+	RequestScheduler::Instance().FillMetrics(metrics);
+	MemoryBudget::Instance().FillMetrics(metrics);
+	BandwidthThrottle::Instance().FillMetrics(metrics);
+	EndpointGroups::Instance().FillMetrics(metrics);
+	RetryBudget::Instance().FillMetrics(metrics);
+	CircuitBreakers::Instance().FillMetrics(metrics);
+	return metrics;
+}
@@ -0,0 +1,64 @@
+// The MIT License (MIT)
+// Metrics for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include "WinHttpScheduler.h"
+#include "WinHttpMemory.h"
+#include "WinHttpEndpoints.h"
+#include "WinHttpBreaker.h"
+#include <string>
+#include <vector>
+
+namespace WinHttpWrapper
+{
+	// State of one bandwidth limit
+	struct BandwidthBucketMetrics
+	{
+		std::wstring host;              // Empty for the global and priority limits
+		int priority;                   // -1 unless a priority limit
+		ULONGLONG bytesPerSecond;
+		ULONGLONG burst;
+		double tokens;                  // Bytes that may go through right now
+		ULONGLONG bytes;                // Bytes that went through
+		ULONGLONG waits;                // Transfers it paused
+	};
+
+	// Point-in-time snapshot of the counters kept by each subsystem
+	struct Metrics
+	{
+		Metrics();
+
+		// Scheduler
+		unsigned int activeRequests;
+		unsigned int queuedRequests;
+		ULONGLONG dispatched[PRIORITY_COUNT];           // Requests started, per priority
+		ULONGLONG queueTimeTotalUs[PRIORITY_COUNT];     // Time spent waiting for a slot
+		ULONGLONG queueTimeMaxUs[PRIORITY_COUNT];
+
+		// Memory budget
+		ULONGLONG bufferedBytes;        // Response bodies being read into memory
+		ULONGLONG peakBufferedBytes;
+		ULONGLONG budgetWaits;          // Reads paused by the budget
+
+		// Bandwidth throttle
+		std::vector<BandwidthBucketMetrics> bandwidthBuckets;
+		ULONGLONG throttleWaits;        // Reads and writes paused by a limit
+		ULONGLONG throttleWaitTimeUs;
+
+		// Endpoint groups, one entry per endpoint
+		std::vector<EndpointMetrics> endpoints;
+
+		// Retries
+		ULONGLONG retries;              // Requests sent again after a transient failure
+		ULONGLONG retriesOverBudget;    // Retries dropped because their host's budget was spent
+
+		// Circuit breakers, one entry per server
+		std::vector<BreakerMetrics> breakers;
+	};
+
+	Metrics GetMetrics();
+
+}
@@ -0,0 +1,338 @@
+// The MIT License (MIT)
+// MIME classification for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#include "WinHttpMime.h"
+#include <cstring>
+
+namespace
+{
+	struct KnownType
+	{
+		const char* type;           // Lowercase
+		bool binary;
+	};
+
+	// Types whose class cannot be told from their top-level type or suffix,
+	// plus the most common binary ones so they are settled by one lookup
+	constexpr KnownType kKnownTypes[] = {
+		{ "application/javascript", false },
+		{ "application/ecmascript", false },
+		{ "application/x-javascript", false },
+		{ "application/json", false },
+		{ "application/x-ndjson", false },
+		{ "application/jsonl", false },
+		{ "application/xml", false },
+		{ "application/rtf", false },
+		{ "application/x-perl", false },
+		{ "application/x-sh", false },
+		{ "application/sql", false },
+		{ "application/graphql", false },
+		{ "application/yaml", false },
+		{ "application/x-yaml", false },
+		{ "application/toml", false },
+		{ "application/csv", false },
+		{ "application/x-www-form-urlencoded", false },
+		{ "application/atom+xml", false },
+		{ "application/rss+xml", false },
+		{ "application/xhtml+xml", false },
+		{ "application/xspf+xml", false },
+		{ "image/svg+xml", false },
+		{ "application/octet-stream", true },
+		{ "application/pdf", true },
+		{ "application/zip", true },
+		{ "application/gzip", true },
+		{ "application/wasm", true },
+		{ "application/x-protobuf", true },
+		{ "application/msgpack", true },
+	};
+	constexpr size_t kKnownCount = sizeof(kKnownTypes) / sizeof(kKnownTypes[0]);
+
+	// FNV-1a, with the seed picked so that the top kSlotBits bits of the hash
+	// are distinct for every known type (checked by the static_assert below)
+	constexpr unsigned kSlotBits = 6;
+	constexpr size_t kSlotCount = size_t(1) << kSlotBits;
+	constexpr uint32_t kHashSeed = 0x811C9DA5u;
+
+	constexpr uint32_t HashStep(uint32_t hash, uint32_t c)
+	{
+		return (hash ^ c) * 16777619u;
+	}
+
+	constexpr uint32_t HashLiteral(const char* s)
+	{
+		uint32_t hash = kHashSeed;
+		while (*s)
+			hash = HashStep(hash, static_cast<unsigned char>(*s++));
+		return hash;
+	}
+
+	constexpr size_t SlotOf(uint32_t hash)
+	{
+		return hash >> (32 - kSlotBits);
+	}
+
+	constexpr bool IsPerfectHash()
+	{
+		for (size_t i = 0; i < kKnownCount; ++i)
+			for (size_t j = i + 1; j < kKnownCount; ++j)
+				if (SlotOf(HashLiteral(kKnownTypes[i].type)) == SlotOf(HashLiteral(kKnownTypes[j].type)))
+					return false;
+		return true;
+	}
+	static_assert(IsPerfectHash(), "MIME table collides, pick another kHashSeed");
+
+	struct SlotTable
+	{
+		int8_t index[kSlotCount];   // Into kKnownTypes, -1 when empty
+	};
+
+	constexpr SlotTable BuildSlotTable()
+	{
+		SlotTable table{};
+		for (size_t s = 0; s < kSlotCount; ++s)
+			table.index[s] = -1;
+		for (size_t i = 0; i < kKnownCount; ++i)
+			table.index[SlotOf(HashLiteral(kKnownTypes[i].type))] = static_cast<int8_t>(i);
+		return table;
+	}
+	constexpr SlotTable kSlots = BuildSlotTable();
+
+	inline wchar_t LowerAscii(wchar_t c)
+	{
+		return (c >= L'A' && c <= L'Z') ? static_cast<wchar_t>(c + (L'a' - L'A')) : c;
+	}
+
+	inline bool IsSpace(wchar_t c)
+	{
+		return c == L' ' || c == L'\t' || c == L'\r' || c == L'\n';
+	}
+
+	bool EqualsNoCase(const wchar_t* s, size_t n, const char* literal)
+	{
+		for (size_t i = 0; i < n; ++i, ++literal)
+		{
+			if (*literal == '\0' || LowerAscii(s[i]) != static_cast<wchar_t>(static_cast<unsigned char>(*literal)))
+				return false;
+		}
+		return *literal == '\0';
+	}
+
+	bool EqualsNoCase(const wchar_t* s, size_t n, const std::wstring& lower)
+	{
+		if (n != lower.size())
+			return false;
+		for (size_t i = 0; i < n; ++i)
+		{
+			if (LowerAscii(s[i]) != lower[i])
+				return false;
+		}
+		return true;
+	}
+
+	bool StartsWithNoCase(const wchar_t* s, size_t n, const char* literal)
+	{
+		size_t len = strlen(literal);
+		return n >= len && EqualsNoCase(s, len, literal);
+	}
+
+	// Returns -1 when the type is not in the table
+	int FindKnownType(const wchar_t* s, size_t n)
+	{
+		uint32_t hash = kHashSeed;
+		for (size_t i = 0; i < n; ++i)
+		{
+			wchar_t c = LowerAscii(s[i]);
+			if (c > 0x7F)
+				return -1;
+			hash = HashStep(hash, static_cast<uint32_t>(c));
+		}
+		int index = kSlots.index[SlotOf(hash)];
+		if (index < 0 || !EqualsNoCase(s, n, kKnownTypes[index].type))
+			return -1;
+		return index;
+	}
+
+	bool HasCharset(const wchar_t* s, size_t n)
+	{
+		for (size_t i = 0; i + 8 <= n; ++i)
+		{
+			if (EqualsNoCase(s + i, 8, "charset="))
+				return true;
+		}
+		return false;
+	}
+
+	struct Signature
+	{
+		size_t offset;
+		const char* bytes;
+		size_t size;
+	};
+
+	const Signature kBinarySignatures[] = {
+		{ 0, "\x89PNG", 4 },
+		{ 0, "\xFF\xD8\xFF", 3 },
+		{ 0, "GIF8", 4 },
+		{ 0, "%PDF-", 5 },
+		{ 0, "PK\x03\x04", 4 },
+		{ 0, "\x1F\x8B", 2 },
+		{ 0, "\x28\xB5\x2F\xFD", 4 },   // zstd
+		{ 0, "7z\xBC\xAF", 4 },
+		{ 0, "\0asm", 4 },
+		{ 0, "RIFF", 4 },
+		{ 0, "OggS", 4 },
+		{ 0, "ID3", 3 },
+		{ 0, "wOFF", 4 },
+		{ 0, "wOF2", 4 },
+		{ 4, "ftyp", 4 },               // MP4, MOV, HEIF
+	};
+
+	const size_t kSniffLength = 512;
+}
+
+WinHttpWrapper::MimeClassifier& WinHttpWrapper::MimeClassifier::Default()
+{
+	static MimeClassifier classifier;
+	return classifier;
+}
+
+void WinHttpWrapper::MimeClassifier::Add(const std::wstring& type, bool binary)
+{
+	Override entry;
+	entry.binary = binary;
+	for (wchar_t c : type)
+	{
+		if (!IsSpace(c))
+			entry.type += LowerAscii(c);
+	}
+	if (entry.type.empty())
+		return;
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	std::shared_ptr<Overrides> overrides = m_Overrides
+		? std::make_shared<Overrides>(*m_Overrides) : std::make_shared<Overrides>();
+	bool replaced = false;
+	for (Override& existing : *overrides)
+	{
+		if (existing.type == entry.type)
+		{
+			existing.binary = binary;
+			replaced = true;
+			break;
+		}
+	}
+	if (!replaced)
+		overrides->push_back(entry);
+	m_Overrides = overrides;
+	m_HasOverrides = true;
+}
+
+bool WinHttpWrapper::MimeClassifier::IsBinary(const std::wstring& contentType) const
+{
+	// Isolate the media type from its parameters and surrounding spaces
+	const wchar_t* begin = contentType.c_str();
+	const wchar_t* params = begin;
+	while (*params && *params != L';')
+		++params;
+	const wchar_t* end = params;
+	while (begin < end && IsSpace(*begin))
+		++begin;
+	while (end > begin && IsSpace(end[-1]))
+		--end;
+	size_t n = static_cast<size_t>(end - begin);
+	if (n == 0)
+		return false;
+
+	// Suffix after the last '+' of the subtype, if any
+	const wchar_t* suffix = NULL;
+	for (const wchar_t* p = end; p > begin && p[-1] != L'/'; --p)
+	{
+		if (p[-1] == L'+')
+		{
+			suffix = p - 1;
+			break;
+		}
+	}
+
+	if (m_HasOverrides.load(std::memory_order_acquire))
+	{
+		std::shared_ptr<const Overrides> overrides;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			overrides = m_Overrides;
+		}
+		for (const Override& entry : *overrides)
+		{
+			if (EqualsNoCase(begin, n, entry.type) ||
+				(suffix && entry.type[0] == L'+' && EqualsNoCase(suffix, static_cast<size_t>(end - suffix), entry.type)))
+			{
+				return entry.binary;
+			}
+		}
+	}
+
+	int known = FindKnownType(begin, n);
+	if (known >= 0)
+		return kKnownTypes[known].binary;
+
+	if (StartsWithNoCase(begin, n, "text/"))
+		return false;
+
+	if (suffix)
+	{
+		size_t suffixLength = static_cast<size_t>(end - suffix);
+		if (EqualsNoCase(suffix, suffixLength, "+json") ||
+			EqualsNoCase(suffix, suffixLength, "+xml") ||
+			EqualsNoCase(suffix, suffixLength, "+yaml"))
+		{
+			return false;
+		}
+	}
+
+	// A charset only makes sense for text
+	if (*params && HasCharset(params, contentType.size() - static_cast<size_t>(params - contentType.c_str())))
+		return false;
+
+	return true;
+}
+
+bool WinHttpWrapper::MimeClassifier::SniffBinary(const uint8_t* data, size_t size)
+{
+	for (const Signature& signature : kBinarySignatures)
+	{
+		if (size >= signature.offset + signature.size &&
+			memcmp(data + signature.offset, signature.bytes, signature.size) == 0)
+		{
+			return true;
+		}
+	}
+
+	size_t n = size < kSniffLength ? size : kSniffLength;
+	size_t i = 0;
+	while (i < n)
+	{
+		uint8_t c = data[i];
+		if (c < 0x80)
+		{
+			// Control bytes other than whitespace, form feed and escape
+			if (c < 0x20 && c != '\t' && c != '\n' && c != '\r' && c != '\f' && c != 0x1B)
+				return true;
+			++i;
+			continue;
+		}
+
+		size_t length = (c >= 0xC2 && c <= 0xDF) ? 2 : (c >= 0xE0 && c <= 0xEF) ? 3 : (c >= 0xF0 && c <= 0xF4) ? 4 : 0;
+		if (length == 0)
+			return true;
+		// A sequence cut by the end of the sniffed window is not an error
+		for (size_t k = 1; k < length && i + k < n; ++k)
+		{
+			if ((data[i + k] & 0xC0) != 0x80)
+				return true;
+		}
+		i += length;
+	}
+	return false;
+}
@@ -0,0 +1,66 @@
+// The MIT License (MIT)
+// MIME classification for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace WinHttpWrapper
+{
+	// Decides whether a response body is text or binary. The Content-Type is
+	// looked up in a compile-time perfect hash of well-known types, then
+	// checked against structured syntax suffixes (+json, +xml, ...) and a
+	// charset parameter. Classification never allocates.
+	class MimeClassifier
+	{
+	public:
+		MimeClassifier() : m_HasOverrides(false), m_Sniffing(true) {}
+
+		// Used by requests that were not given a classifier of their own
+		static MimeClassifier& Default();
+
+		// Override the built-in rules for an exact type ("application/x-foo")
+		// or for a suffix ("+cbor"). Safe while requests using this classifier
+		// are running: responses classified afterwards see the new rule.
+		void Add(const std::wstring& type, bool binary);
+
+		// When enabled (the default), a response without Content-Type is
+		// classified from its first bytes instead of being assumed to be text
+		void SetSniffing(bool enabled) { m_Sniffing = enabled; }
+		bool IsSniffing() const { return m_Sniffing; }
+
+		// An empty content type is reported as text; see SniffBinary()
+		bool IsBinary(const std::wstring& contentType) const;
+
+		// Known binary signatures, control bytes or invalid UTF-8 in the
+		// first bytes of a body mean binary
+		static bool SniffBinary(const uint8_t* data, size_t size);
+
+	private:
+		MimeClassifier(const MimeClassifier&) = delete;
+		MimeClassifier& operator=(const MimeClassifier&) = delete;
+
+		struct Override
+		{
+			std::wstring type;      // Lowercase, "+suffix" for suffix rules
+			bool binary;
+		};
+		typedef std::vector<Override> Overrides;
+
+		// Replaced, never modified, by Add(): a classification holds on to
+		// the rules it started with
+		mutable std::mutex m_Mutex;
+		std::shared_ptr<const Overrides> m_Overrides;
+		std::atomic<bool> m_HasOverrides;   // Checked without the lock
+		std::atomic<bool> m_Sniffing;
+	};
+
+}
@@ -0,0 +1,209 @@
+// The MIT License (MIT)
+// multipart/form-data bodies for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#ifdef _WIN32
+
+#include "WinHttpMultipart.h"
+#include "WinHttpUtf.h"
+#include <algorithm>
+#include <random>
+
+namespace
+{
+	// Quotes and line breaks cannot appear in a quoted header parameter
+	std::string EscapeParameter(const std::string& value)
+	{
+		std::string result;
+		result.reserve(value.size());
+		for (char c : value)
+		{
+			if (c == '"')
+				result += "%22";
+			else if (c == '\r')
+				result += "%0D";
+			else if (c == '\n')
+				result += "%0A";
+			else
+				result += c;
+		}
+		return result;
+	}
+
+	std::string MakeBoundary()
+	{
+		static const char kHex[] = "0123456789abcdef";
+		std::random_device device;
+		std::mt19937 generator(device());
+		std::string boundary = "----WinHttpFormBoundary";
+		for (int i = 0; i < 16; ++i)
+			boundary += kHex[generator() & 0xF];
+		return boundary;
+	}
+}
+
+WinHttpWrapper::MultipartForm::MultipartForm()
+	: m_Boundary(MakeBoundary())
+	, m_Piece(0)
+	, m_Offset(0)
+	, m_File(INVALID_HANDLE_VALUE)
+{
+	m_Closing = "--" + m_Boundary + "--\r\n";
+	m_Length = m_Closing.size();
+}
+
+WinHttpWrapper::MultipartForm::~MultipartForm()
+{
+	CloseFile();
+}
+
+std::wstring WinHttpWrapper::MultipartForm::ContentType() const
+{
+	return L"multipart/form-data; boundary=" + Utf8ToWide(m_Boundary);
+}
+
+void WinHttpWrapper::MultipartForm::AddBytes(std::string data)
+{
+	m_Length += data.size();
+	// Consecutive in-memory bytes share one piece
+	if (!m_Pieces.empty() && m_Pieces.back().path.empty())
+	{
+		m_Pieces.back().data += data;
+		m_Pieces.back().size = m_Pieces.back().data.size();
+		return;
+	}
+	Piece piece;
+	piece.size = data.size();
+	piece.data = std::move(data);
+	m_Pieces.push_back(std::move(piece));
+}
+
+void WinHttpWrapper::MultipartForm::AddPart(const std::string& name, const std::string* fileName,
+	const std::string& contentType)
+{
+	std::string header = "--" + m_Boundary + "\r\n";
+	header += "Content-Disposition: form-data; name=\"" + EscapeParameter(name) + "\"";
+	if (fileName)
+		header += "; filename=\"" + EscapeParameter(*fileName) + "\"";
+	header += "\r\n";
+	if (!contentType.empty())
+		header += "Content-Type: " + contentType + "\r\n";
+	header += "\r\n";
+	AddBytes(std::move(header));
+}
+
+void WinHttpWrapper::MultipartForm::AddField(const std::string& name, const std::string& value)
+{
+	AddPart(name, NULL, "");
+	AddBytes(value + "\r\n");
+}
+
+void WinHttpWrapper::MultipartForm::AddData(const std::string& name, const std::string& fileName,
+	const std::string& contentType, const uint8_t* data, size_t size)
+{
+	AddPart(name, &fileName, contentType.empty() ? "application/octet-stream" : contentType);
+	std::string bytes(reinterpret_cast<const char*>(data), size);
+	bytes += "\r\n";
+	AddBytes(std::move(bytes));
+}
+
+bool WinHttpWrapper::MultipartForm::AddFile(const std::string& name, const std::wstring& path,
+	const std::string& fileName, const std::string& contentType)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &attributes) ||
+		(attributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+	{
+		if (IsDebugLoggingEnabled()) {
+			DebugLogFormat(L"[MULTIPART] Cannot add '%s': file not found", path.c_str());
+		}
+		return false;
+	}
+
+	std::string partFileName = fileName;
+	if (partFileName.empty())
+	{
+		size_t slash = path.find_last_of(L"\\/");
+		partFileName = WideToUtf8(slash == std::wstring::npos ? path : path.substr(slash + 1));
+	}
+	AddPart(name, &partFileName, contentType.empty() ? "application/octet-stream" : contentType);
+
+	Piece piece;
+	piece.path = path;
+	piece.size = (static_cast<ULONGLONG>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+	m_Length += piece.size;
+	m_Pieces.push_back(std::move(piece));
+
+	AddBytes("\r\n");
+	return true;
+}
+
+void WinHttpWrapper::MultipartForm::CloseFile()
+{
+	if (m_File != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_File);
+		m_File = INVALID_HANDLE_VALUE;
+	}
+}
+
+bool WinHttpWrapper::MultipartForm::Rewind()
+{
+	CloseFile();
+	m_Piece = 0;
+	m_Offset = 0;
+	return true;
+}
+
+bool WinHttpWrapper::MultipartForm::Read(uint8_t* buffer, DWORD size, DWORD& read)
+{
+	read = 0;
+	while (read < size && m_Piece <= m_Pieces.size())
+	{
+		// The closing delimiter comes after the last piece
+		const bool closing = m_Piece == m_Pieces.size();
+		const ULONGLONG pieceSize = closing ? m_Closing.size() : m_Pieces[m_Piece].size;
+		if (m_Offset >= pieceSize)
+		{
+			CloseFile();
+			++m_Piece;
+			m_Offset = 0;
+			continue;
+		}
+
+		DWORD count = static_cast<DWORD>((std::min)(pieceSize - m_Offset, static_cast<ULONGLONG>(size - read)));
+		if (closing || m_Pieces[m_Piece].path.empty())
+		{
+			const std::string& data = closing ? m_Closing : m_Pieces[m_Piece].data;
+			memcpy(buffer + read, data.data() + m_Offset, count);
+		}
+		else
+		{
+			if (m_File == INVALID_HANDLE_VALUE)
+			{
+				m_File = CreateFileW(m_Pieces[m_Piece].path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+					NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+				if (m_File == INVALID_HANDLE_VALUE)
+				{
+					if (IsDebugLoggingEnabled()) {
+						DebugLogFormat(L"[MULTIPART] Failed to open '%s'", m_Pieces[m_Piece].path.c_str());
+					}
+					return false;
+				}
+			}
+			DWORD dwRead = 0;
+			if (!ReadFile(m_File, buffer + read, count, &dwRead, NULL) || dwRead == 0)
+			{
+				// Shorter than when it was added: the announced length is wrong
+				return false;
+			}
+			count = dwRead;
+		}
+		read += count;
+		m_Offset += count;
+	}
+	return true;
+}
+
+#endif
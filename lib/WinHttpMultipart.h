@@ -0,0 +1,66 @@
+// The MIT License (MIT)
+// multipart/form-data bodies for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include "WinHttpWrapper.h"
+
+namespace WinHttpWrapper
+{
+	// multipart/form-data body made of fields, in-memory data and files.
+	// Files are only opened while the body is sent, and read a chunk at a
+	// time, so memory use does not depend on their size. Their size is taken
+	// when they are added, which lets the Content-Length be sent up front.
+	class MultipartForm : public BodySource
+	{
+	public:
+		MultipartForm();
+		~MultipartForm();
+
+		// Values are UTF-8
+		void AddField(const std::string& name, const std::string& value);
+
+		void AddData(const std::string& name, const std::string& fileName,
+			const std::string& contentType, const uint8_t* data, size_t size);
+
+		// fileName defaults to the last component of path, contentType to
+		// application/octet-stream. Fails if the file cannot be found.
+		bool AddFile(const std::string& name, const std::wstring& path,
+			const std::string& fileName = "", const std::string& contentType = "");
+
+		ULONGLONG Length() const override { return m_Length; }
+		std::wstring ContentType() const override;
+		bool Rewind() override;
+		bool Read(uint8_t* buffer, DWORD size, DWORD& read) override;
+
+	private:
+		// Consecutive pieces of the body: bytes held in memory, or a file
+		struct Piece
+		{
+			std::string data;
+			std::wstring path;
+			ULONGLONG size;
+		};
+
+		MultipartForm(const MultipartForm&) = delete;
+		MultipartForm& operator=(const MultipartForm&) = delete;
+
+		void AddPart(const std::string& name, const std::string* fileName,
+			const std::string& contentType);
+		void AddBytes(std::string data);
+		void CloseFile();
+
+		std::string m_Boundary;
+		std::vector<Piece> m_Pieces;    // Without the closing delimiter
+		std::string m_Closing;
+		ULONGLONG m_Length;
+
+		// Read position
+		size_t m_Piece;
+		ULONGLONG m_Offset;
+		HANDLE m_File;
+	};
+
+}
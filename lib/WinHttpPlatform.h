@@ -0,0 +1,48 @@
+// The MIT License (MIT)
+// Platform types for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#ifdef _WIN32
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <winhttp.h>
+
+#else
+
+// Outside Windows only the transport-independent parts of the wrapper are
+// built (scheduling, memory budget, MIME, pooling, record/replay, metrics,
+// WebSockets) on top of PosixTransport. They keep the Win32 type names; DWORD stays
+// unsigned long so that the "%lu" log formats remain correct.
+#include <cstdint>
+
+typedef unsigned long DWORD;
+typedef unsigned long long ULONGLONG;
+typedef unsigned short USHORT;
+typedef unsigned char BYTE;
+typedef int BOOL;
+typedef void* HANDLE;
+typedef void* HINTERNET;
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+#define MAXDWORD 0xffffffff
+#define INFINITE 0xffffffff
+
+// WebSocket close statuses, as named by WinHTTP
+#define WINHTTP_WEB_SOCKET_SUCCESS_CLOSE_STATUS 1000
+#define WINHTTP_WEB_SOCKET_PROTOCOL_ERROR_CLOSE_STATUS 1002
+#define WINHTTP_WEB_SOCKET_EMPTY_CLOSE_STATUS 1005
+#define WINHTTP_WEB_SOCKET_ABORTED_CLOSE_STATUS 1006
+#define WINHTTP_WEB_SOCKET_MESSAGE_TOO_BIG_CLOSE_STATUS 1009
+
+#endif
@@ -0,0 +1,1327 @@
+// The MIT License (MIT)
+// POSIX socket transport for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#ifndef _WIN32
+
+#include "WinHttpPosixTransport.h"
+#include "WinHttpReplay.h"
+#include "WinHttpUtf.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+#ifdef WINHTTP_WRAPPER_OPENSSL
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace
+{
+	const size_t kReadChunkSize = 64 * 1024;
+	const size_t kMaxHeadSize = 64 * 1024;
+	const size_t kMaxLineSize = 8 * 1024;
+	// Bodies up to this size go out in the same send as the request head
+	const size_t kInlineBodySize = 64 * 1024;
+	// Most memory reserved up front from a Content-Length
+	const ULONGLONG kMaxBodyReserve = 16 * 1024 * 1024;
+
+	std::string BasicCredentials(const std::wstring& username, const std::wstring& password)
+	{
+		return "Basic " + WinHttpWrapper::Base64Encode(WinHttpWrapper::WideToUtf8(username + L":" + password));
+	}
+
+	std::string ToLower(std::string text)
+	{
+		for (char& c : text)
+		{
+			if (c >= 'A' && c <= 'Z')
+				c = static_cast<char>(c - 'A' + 'a');
+		}
+		return text;
+	}
+
+	std::string Trim(const std::string& text)
+	{
+		size_t begin = text.find_first_not_of(" \t");
+		if (begin == std::string::npos)
+			return std::string();
+		size_t end = text.find_last_not_of(" \t");
+		return text.substr(begin, end - begin + 1);
+	}
+
+	// Whether a comma separated header value lists token
+	bool HasToken(const std::string& value, const char* token)
+	{
+		std::string list = ToLower(value);
+		size_t start = 0;
+		while (start <= list.size())
+		{
+			size_t comma = list.find(',', start);
+			if (comma == std::string::npos)
+				comma = list.size();
+			if (Trim(list.substr(start, comma - start)) == token)
+				return true;
+			start = comma + 1;
+		}
+		return false;
+	}
+
+	// "host:port" of a proxy as stored by HttpRequest::SetProxy
+	void SplitHostPort(const std::wstring& hostPort, std::string& host, std::string& port)
+	{
+		size_t colon = hostPort.rfind(L':');
+		if (colon == std::wstring::npos)
+		{
+			host = WinHttpWrapper::WideToUtf8(hostPort);
+			port = "8080";
+			return;
+		}
+		host = WinHttpWrapper::WideToUtf8(hostPort.substr(0, colon));
+		port = WinHttpWrapper::WideToUtf8(hostPort.substr(colon + 1));
+	}
+
+	std::string Authority(const WinHttpWrapper::TransportRequest& request)
+	{
+		std::string authority = WinHttpWrapper::WideToUtf8(request.domain);
+		if (request.port != (request.secure ? 443 : 80))
+			authority += ":" + std::to_string(request.port);
+		return authority;
+	}
+
+	struct ResponseHead
+	{
+		ResponseHead() : minorVersion(1), statusCode(0), contentLength(-1), chunked(false), close(false), keepAlive(false) {}
+
+		int minorVersion;
+		DWORD statusCode;
+		long long contentLength;    // -1 when not sent
+		bool chunked;
+		bool close;
+		bool keepAlive;
+		std::string contentType;
+	};
+
+	bool ParseHead(const std::string& head, ResponseHead& parsed)
+	{
+		parsed = ResponseHead();
+
+		// "HTTP/1.1 200 OK"
+		if (head.size() < 12 || head.compare(0, 7, "HTTP/1.") != 0 || head[8] != ' ')
+			return false;
+		parsed.minorVersion = head[7] - '0';
+		char* end = NULL;
+		unsigned long status = strtoul(head.c_str() + 9, &end, 10);
+		if (end != head.c_str() + 12 || status < 100 || status > 999)
+			return false;
+		parsed.statusCode = static_cast<DWORD>(status);
+
+		size_t pos = head.find("\r\n");
+		while (pos != std::string::npos && pos + 2 < head.size())
+		{
+			size_t lineStart = pos + 2;
+			pos = head.find("\r\n", lineStart);
+			std::string line = head.substr(lineStart, (pos == std::string::npos ? head.size() : pos) - lineStart);
+			size_t colon = line.find(':');
+			if (colon == std::string::npos)
+				continue;
+
+			std::string name = ToLower(Trim(line.substr(0, colon)));
+			std::string value = Trim(line.substr(colon + 1));
+			if (name == "content-length")
+			{
+				long long length = strtoll(value.c_str(), &end, 10);
+				if (*end != '\0' || length < 0 || (parsed.contentLength >= 0 && parsed.contentLength != length))
+					return false;
+				parsed.contentLength = length;
+			}
+			else if (name == "transfer-encoding")
+				parsed.chunked = HasToken(value, "chunked");
+			else if (name == "connection")
+			{
+				parsed.close = parsed.close || HasToken(value, "close");
+				parsed.keepAlive = parsed.keepAlive || HasToken(value, "keep-alive");
+			}
+			else if (name == "content-type")
+				parsed.contentType = value;
+		}
+		return true;
+	}
+
+	// Response body being read into text or binaryData, under the size
+	// limit and the memory budget
+	class BodySink
+	{
+	public:
+		BodySink(WinHttpWrapper::HttpResponse& response, ULONGLONG maxSize,
+			WinHttpWrapper::RecordedExchange* record, WinHttpWrapper::BodyHasher* hasher)
+			: m_Response(response)
+			, m_MaxSize(maxSize)
+			, m_Record(record)
+			, m_Hasher(hasher)
+			, m_Size(0)
+		{
+			// A retried exchange reads the body again
+			if (m_Hasher)
+				m_Hasher->Reset();
+		}
+
+		void Reserve(ULONGLONG announced)
+		{
+			const size_t reserveSize = static_cast<size_t>((std::min)(announced, kMaxBodyReserve));
+			if (m_Response.isBinary)
+				m_Response.binaryData.reserve(reserveSize);
+			else
+				m_Response.text.reserve(reserveSize);
+		}
+
+		// False once the body is over the size limit
+		bool Append(const char* data, size_t size)
+		{
+			m_Size += size;
+			if (m_MaxSize && m_Size > m_MaxSize)
+				return false;
+
+			// Pauses while the memory budget is exhausted
+			m_Lease.Reserve(size);
+			if (m_Response.isBinary)
+				m_Response.binaryData.insert(m_Response.binaryData.end(), data, data + size);
+			else
+				m_Response.text.append(data, size);
+			if (m_Record)
+				m_Record->AddChunk(static_cast<DWORD>(size));
+			if (m_Hasher)
+				m_Hasher->Update(data, size);
+			return true;
+		}
+
+		ULONGLONG Size() const { return m_Size; }
+
+	private:
+		WinHttpWrapper::HttpResponse& m_Response;
+		ULONGLONG m_MaxSize;
+		WinHttpWrapper::RecordedExchange* m_Record;
+		WinHttpWrapper::BodyHasher* m_Hasher;
+		ULONGLONG m_Size;
+		WinHttpWrapper::MemoryBudget::Lease m_Lease;
+	};
+
+	// Becomes readable once signalled, which wakes the connection waits
+	// watching it: an eventfd on Linux, a pipe elsewhere
+	class WakeEvent
+	{
+	public:
+		WakeEvent() : m_Read(-1), m_Write(-1)
+		{
+#ifdef __linux__
+			m_Read = m_Write = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+#else
+			int fds[2];
+			if (pipe(fds) == 0)
+			{
+				for (int fd : fds)
+				{
+					fcntl(fd, F_SETFD, FD_CLOEXEC);
+					fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+				}
+				m_Read = fds[0];
+				m_Write = fds[1];
+			}
+#endif
+		}
+		~WakeEvent()
+		{
+			if (m_Write >= 0 && m_Write != m_Read)
+				close(m_Write);
+			if (m_Read >= 0)
+				close(m_Read);
+		}
+
+		// -1 when it could not be created
+		int Fd() const { return m_Read; }
+
+		void Signal()
+		{
+			if (m_Write < 0)
+				return;
+#ifdef __linux__
+			uint64_t one = 1;
+			ssize_t written = write(m_Write, &one, sizeof(one));
+#else
+			char byte = 0;
+			ssize_t written = write(m_Write, &byte, 1);
+#endif
+			(void)written;
+		}
+
+	private:
+		WakeEvent(const WakeEvent&) = delete;
+		WakeEvent& operator=(const WakeEvent&) = delete;
+
+		int m_Read;
+		int m_Write;
+	};
+}
+
+std::string WinHttpWrapper::Base64Encode(const std::string& data)
+{
+	static const char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string out;
+	out.reserve((data.size() + 2) / 3 * 4);
+	size_t i = 0;
+	for (; i + 2 < data.size(); i += 3)
+	{
+		unsigned int n = (static_cast<unsigned char>(data[i]) << 16) |
+			(static_cast<unsigned char>(data[i + 1]) << 8) | static_cast<unsigned char>(data[i + 2]);
+		out += kAlphabet[(n >> 18) & 63];
+		out += kAlphabet[(n >> 12) & 63];
+		out += kAlphabet[(n >> 6) & 63];
+		out += kAlphabet[n & 63];
+	}
+	if (i < data.size())
+	{
+		unsigned int n = static_cast<unsigned char>(data[i]) << 16;
+		if (i + 1 < data.size())
+			n |= static_cast<unsigned char>(data[i + 1]) << 8;
+		out += kAlphabet[(n >> 18) & 63];
+		out += kAlphabet[(n >> 12) & 63];
+		out += (i + 1 < data.size()) ? kAlphabet[(n >> 6) & 63] : '=';
+		out += '=';
+	}
+	return out;
+}
+
+struct WinHttpWrapper::PosixTransport::Connection
+{
+	Connection() : fd(-1), poller(-1), events(0), wake(-1), tls(NULL), timedOut(false), cancelled(false) {}
+	~Connection()
+	{
+#ifdef WINHTTP_WRAPPER_OPENSSL
+		if (tls)
+			SSL_free(static_cast<SSL*>(tls));
+#endif
+		if (poller >= 0)
+			close(poller);
+		if (fd >= 0)
+			close(fd);
+	}
+
+	// Watch the wake fd of a request (or stop with -1) in the waits
+	void Attach(int wakeFd)
+	{
+#ifdef __linux__
+		if (wake >= 0)
+			epoll_ctl(poller, EPOLL_CTL_DEL, wake, NULL);
+		if (wakeFd >= 0)
+		{
+			epoll_event event;
+			memset(&event, 0, sizeof(event));
+			event.events = EPOLLIN;
+			event.data.fd = wakeFd;
+			if (epoll_ctl(poller, EPOLL_CTL_ADD, wakeFd, &event) != 0)
+				wakeFd = -1;
+		}
+#endif
+		wake = wakeFd;
+	}
+
+	// Wait for fd to become readable (or writable), false on timeout or
+	// when the wake fd fired
+	bool Wait(bool writable, int timeout)
+	{
+		if (cancelled)
+			return false;
+#ifdef __linux__
+		// Level triggered, re-armed only when the direction changes
+		const uint32_t wanted = writable ? EPOLLOUT : EPOLLIN;
+		if (events != wanted)
+		{
+			epoll_event event;
+			memset(&event, 0, sizeof(event));
+			event.events = wanted;
+			event.data.fd = fd;
+			if (epoll_ctl(poller, EPOLL_CTL_MOD, fd, &event) != 0)
+				return false;
+			events = wanted;
+		}
+		epoll_event ready[2];
+		int count;
+		do
+			count = epoll_wait(poller, ready, 2, timeout);
+		while (count < 0 && errno == EINTR);
+		for (int i = 0; i < count; ++i)
+		{
+			if (ready[i].data.fd == wake)
+				cancelled = true;
+		}
+#else
+		pollfd ready[2];
+		ready[0].fd = fd;
+		ready[0].events = writable ? POLLOUT : POLLIN;
+		ready[0].revents = 0;
+		ready[1].fd = wake;
+		ready[1].events = POLLIN;
+		ready[1].revents = 0;
+		int count;
+		do
+			count = poll(ready, wake >= 0 ? 2 : 1, timeout);
+		while (count < 0 && errno == EINTR);
+		if (count > 0 && ready[1].revents != 0)
+			cancelled = true;
+#endif
+		if (count == 0)
+			timedOut = true;
+		return count > 0 && !cancelled;
+	}
+
+	// Bytes read, 0 at the end of the stream, -1 on error or timeout
+	long Receive(char* buffer, size_t size, int timeout)
+	{
+		for (;;)
+		{
+#ifdef WINHTTP_WRAPPER_OPENSSL
+			if (tls)
+			{
+				SSL* ssl = static_cast<SSL*>(tls);
+				int read = SSL_read(ssl, buffer, static_cast<int>((std::min)(size, static_cast<size_t>(INT_MAX))));
+				if (read > 0)
+					return read;
+				int status = SSL_get_error(ssl, read);
+				if (status == SSL_ERROR_ZERO_RETURN)
+					return 0;
+				if ((status != SSL_ERROR_WANT_READ && status != SSL_ERROR_WANT_WRITE) ||
+					!Wait(status == SSL_ERROR_WANT_WRITE, timeout))
+					return -1;
+				continue;
+			}
+#endif
+			ssize_t read = recv(fd, buffer, size, 0);
+			if (read >= 0)
+				return static_cast<long>(read);
+			if (errno == EINTR)
+				continue;
+			if ((errno != EAGAIN && errno != EWOULDBLOCK) || !Wait(false, timeout))
+				return -1;
+		}
+	}
+
+	bool SendAll(const char* data, size_t size, int timeout)
+	{
+		while (size > 0)
+		{
+#ifdef WINHTTP_WRAPPER_OPENSSL
+			if (tls)
+			{
+				SSL* ssl = static_cast<SSL*>(tls);
+				int written = SSL_write(ssl, data, static_cast<int>((std::min)(size, static_cast<size_t>(INT_MAX))));
+				if (written > 0)
+				{
+					data += written;
+					size -= written;
+					continue;
+				}
+				int status = SSL_get_error(ssl, written);
+				if ((status != SSL_ERROR_WANT_READ && status != SSL_ERROR_WANT_WRITE) ||
+					!Wait(status == SSL_ERROR_WANT_WRITE, timeout))
+					return false;
+				continue;
+			}
+#endif
+			ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+			if (written >= 0)
+			{
+				data += written;
+				size -= written;
+				continue;
+			}
+			if (errno == EINTR)
+				continue;
+			if ((errno != EAGAIN && errno != EWOULDBLOCK) || !Wait(true, timeout))
+				return false;
+		}
+		return true;
+	}
+
+	// Buffered bytes first, then the socket
+	long ReadSome(char* buffer, size_t size, int timeout)
+	{
+		if (pending.empty())
+			return Receive(buffer, size, timeout);
+		size_t count = (std::min)(size, pending.size());
+		memcpy(buffer, pending.data(), count);
+		pending.erase(0, count);
+		return static_cast<long>(count);
+	}
+
+	// Read into pending until it holds delimiter, at most maxSize bytes
+	// before it; received is set once any byte arrived
+	bool Fill(const char* delimiter, size_t maxSize, int timeout, size_t& found, bool& received)
+	{
+		size_t from = 0;
+		const size_t delimiterSize = strlen(delimiter);
+		while ((found = pending.find(delimiter, from)) == std::string::npos)
+		{
+			if (pending.size() > maxSize)
+				return false;
+			from = pending.size() >= delimiterSize ? pending.size() - delimiterSize + 1 : 0;
+
+			char buffer[16 * 1024];
+			long read = Receive(buffer, sizeof(buffer), timeout);
+			if (read <= 0)
+				return false;
+			received = true;
+			pending.append(buffer, static_cast<size_t>(read));
+		}
+		return found <= maxSize;
+	}
+
+	// Response head, up to and including its blank line
+	bool ReadHead(std::string& head, int timeout, bool& received)
+	{
+		size_t found = 0;
+		if (!Fill("\r\n\r\n", kMaxHeadSize, timeout, found, received))
+			return false;
+		head.assign(pending, 0, found + 4);
+		pending.erase(0, found + 4);
+		return true;
+	}
+
+	// One CRLF terminated line, without its terminator
+	bool ReadLine(std::string& line, int timeout)
+	{
+		size_t found = 0;
+		bool received = false;
+		if (!Fill("\r\n", kMaxLineSize, timeout, found, received))
+			return false;
+		line.assign(pending, 0, found);
+		pending.erase(0, found + 2);
+		return true;
+	}
+
+	// Whether the server closed the connection (or sent something
+	// unexpected) while it was idle
+	bool IsStale()
+	{
+		if (!pending.empty())
+			return true;
+		char byte;
+		ssize_t peeked = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+		if (peeked == 0)
+			return true;
+		if (peeked < 0)
+			return errno != EAGAIN && errno != EWOULDBLOCK;
+		// TLS connections may get session tickets after a response
+		return tls == NULL;
+	}
+
+	std::string key;
+	int fd;
+	int poller;                 // epoll instance watching fd
+	uint32_t events;            // What poller waits for
+	int wake;                   // Wake fd of the current request, or -1
+	void* tls;                  // SSL, NULL for plain connections
+	std::string pending;        // Received but not consumed yet
+	bool timedOut;
+	bool cancelled;             // The wake fd fired
+};
+
+// Reads and writes of an upgraded connection may come from two threads, so
+// its waits use poll() on their own instead of the connection's epoll set,
+// and the socket (or SSL object) is used by one of them at a time
+struct WinHttpWrapper::PosixTransport::UpgradedStream : public WinHttpWrapper::PosixTransport::Stream
+{
+	explicit UpgradedStream(std::unique_ptr<Connection> upgraded)
+		: connection(std::move(upgraded))
+		, interrupted(false)
+	{
+	}
+
+	long Read(char* buffer, size_t size, int timeout, bool& timedOut) override
+	{
+		timedOut = false;
+		for (;;)
+		{
+			bool writable = false;
+			{
+				std::lock_guard<std::mutex> lock(io);
+				if (interrupted)
+					return -1;
+
+				// Bytes received right after the response head come first
+				if (!connection->pending.empty())
+					return connection->ReadSome(buffer, size, timeout);
+#ifdef WINHTTP_WRAPPER_OPENSSL
+				if (connection->tls)
+				{
+					SSL* ssl = static_cast<SSL*>(connection->tls);
+					int read = SSL_read(ssl, buffer, static_cast<int>((std::min)(size, static_cast<size_t>(INT_MAX))));
+					if (read > 0)
+						return read;
+					int status = SSL_get_error(ssl, read);
+					if (status == SSL_ERROR_ZERO_RETURN)
+						return 0;
+					if (status != SSL_ERROR_WANT_READ && status != SSL_ERROR_WANT_WRITE)
+						return -1;
+					writable = status == SSL_ERROR_WANT_WRITE;
+				}
+				else
+#endif
+				{
+					ssize_t read = recv(connection->fd, buffer, size, 0);
+					if (read >= 0)
+						return static_cast<long>(read);
+					if (errno == EINTR)
+						continue;
+					if (errno != EAGAIN && errno != EWOULDBLOCK)
+						return -1;
+				}
+			}
+			if (!Wait(writable, timeout, timedOut))
+				return -1;
+		}
+	}
+
+	bool Write(const void* data, size_t size, int timeout) override
+	{
+		const char* bytes = static_cast<const char*>(data);
+		while (size > 0)
+		{
+			bool writable = true;
+			{
+				std::lock_guard<std::mutex> lock(io);
+				if (interrupted)
+					return false;
+#ifdef WINHTTP_WRAPPER_OPENSSL
+				if (connection->tls)
+				{
+					SSL* ssl = static_cast<SSL*>(connection->tls);
+					int written = SSL_write(ssl, bytes, static_cast<int>((std::min)(size, static_cast<size_t>(INT_MAX))));
+					if (written > 0)
+					{
+						bytes += written;
+						size -= written;
+						continue;
+					}
+					int status = SSL_get_error(ssl, written);
+					if (status != SSL_ERROR_WANT_READ && status != SSL_ERROR_WANT_WRITE)
+						return false;
+					writable = status == SSL_ERROR_WANT_WRITE;
+				}
+				else
+#endif
+				{
+					ssize_t written = send(connection->fd, bytes, size, MSG_NOSIGNAL);
+					if (written >= 0)
+					{
+						bytes += written;
+						size -= written;
+						continue;
+					}
+					if (errno == EINTR)
+						continue;
+					if (errno != EAGAIN && errno != EWOULDBLOCK)
+						return false;
+				}
+			}
+			bool timedOut = false;
+			if (!Wait(writable, timeout, timedOut))
+				return false;
+		}
+		return true;
+	}
+
+	void Interrupt() override
+	{
+		interrupted = true;
+		interrupt.Signal();
+	}
+
+	// Wait for the socket, false on timeout or once interrupted
+	bool Wait(bool writable, int timeout, bool& timedOut)
+	{
+		pollfd ready[2];
+		ready[0].fd = connection->fd;
+		ready[0].events = writable ? POLLOUT : POLLIN;
+		ready[0].revents = 0;
+		ready[1].fd = interrupt.Fd();
+		ready[1].events = POLLIN;
+		ready[1].revents = 0;
+		int count;
+		do
+			count = poll(ready, ready[1].fd >= 0 ? 2 : 1, timeout);
+		while (count < 0 && errno == EINTR);
+		timedOut = count == 0;
+		return count > 0 && ready[1].revents == 0 && !interrupted;
+	}
+
+	std::unique_ptr<Connection> connection;
+	WakeEvent interrupt;
+	std::atomic<bool> interrupted;
+	std::mutex io;              // Held while using the socket, not while waiting
+};
+
+WinHttpWrapper::PosixTransport::PosixTransport()
+	: m_MaxIdle(6)
+	, m_Timeout(30000)
+	, m_Verify(true)
+	, m_Tls(NULL)
+{
+}
+
+WinHttpWrapper::PosixTransport::~PosixTransport()
+{
+	CloseIdleConnections();
+#ifdef WINHTTP_WRAPPER_OPENSSL
+	if (m_Tls)
+		SSL_CTX_free(static_cast<SSL_CTX*>(m_Tls));
+#endif
+}
+
+void WinHttpWrapper::PosixTransport::SetMaxIdleConnections(size_t count)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_MaxIdle = count;
+	for (auto& idle : m_Idle)
+	{
+		if (idle.second.size() > count)
+			idle.second.erase(idle.second.begin(), idle.second.end() - count);
+	}
+}
+
+void WinHttpWrapper::PosixTransport::CloseIdleConnections()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Idle.clear();
+}
+
+void* WinHttpWrapper::PosixTransport::TlsContext()
+{
+#ifdef WINHTTP_WRAPPER_OPENSSL
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (!m_Tls)
+	{
+		SSL_CTX* context = SSL_CTX_new(TLS_client_method());
+		if (!context)
+			return NULL;
+		SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+		SSL_CTX_set_default_verify_paths(context);
+		SSL_CTX_set_mode(context, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+		// Servers often close without close_notify after the last response
+		SSL_CTX_set_options(context, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+		m_Tls = context;
+	}
+	return m_Tls;
+#else
+	return NULL;
+#endif
+}
+
+std::unique_ptr<WinHttpWrapper::PosixTransport::Connection> WinHttpWrapper::PosixTransport::Checkout(
+	const TransportRequest& request, int wake, bool& reused, std::wstring& error)
+{
+	std::string key = request.secure ? "https://" : "http://";
+	key += WideToUtf8(request.domain) + ":" + std::to_string(request.port);
+	if (!request.proxyUrl.empty())
+		key += " via " + WideToUtf8(request.proxyUrl);
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		auto it = m_Idle.find(key);
+		while (it != m_Idle.end() && !it->second.empty())
+		{
+			std::unique_ptr<Connection> connection = std::move(it->second.back());
+			it->second.pop_back();
+			if (!connection->IsStale())
+			{
+				connection->Attach(wake);
+				reused = true;
+				return connection;
+			}
+		}
+	}
+
+	reused = false;
+	return Connect(request, key, wake, error);
+}
+
+void WinHttpWrapper::PosixTransport::Checkin(std::unique_ptr<Connection> connection)
+{
+	connection->Attach(-1);
+	connection->timedOut = false;
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (m_MaxIdle == 0)
+		return;
+	std::vector<std::unique_ptr<Connection>>& idle = m_Idle[connection->key];
+	if (idle.size() >= m_MaxIdle)
+		idle.erase(idle.begin());
+	idle.push_back(std::move(connection));
+}
+
+int WinHttpWrapper::PosixTransport::Timeout(const TransportRequest& request) const
+{
+	const int timeout = m_Timeout;
+	if (request.timeoutMs == 0 || (timeout >= 0 && request.timeoutMs >= static_cast<DWORD>(timeout)))
+		return timeout;
+	return static_cast<int>((std::min)(request.timeoutMs, static_cast<DWORD>(INT_MAX)));
+}
+
+std::unique_ptr<WinHttpWrapper::PosixTransport::Connection> WinHttpWrapper::PosixTransport::Connect(
+	const TransportRequest& request, const std::string& key, int wake, std::wstring& error)
+{
+	const int timeout = Timeout(request);
+	const bool viaProxy = !request.proxyUrl.empty();
+
+	std::string host;
+	std::string port;
+	if (viaProxy)
+		SplitHostPort(request.proxyUrl, host, port);
+	else
+	{
+		host = WideToUtf8(request.domain);
+		port = std::to_string(request.port);
+	}
+
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* addresses = NULL;
+	TraceSpan resolveSpan("resolve");
+	int resolved = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses);
+	resolveSpan.End();
+	if (resolved != 0)
+	{
+		if (IsDebugLoggingEnabled()) {
+			DebugLogFormat(L"[POSIX] Failed to resolve '%s': %s", Utf8ToWide(host).c_str(),
+				Utf8ToWide(gai_strerror(resolved)).c_str());
+		}
+		error = L"Failed to connect to server!";
+		return std::unique_ptr<Connection>();
+	}
+	if (request.cancel && request.cancel->IsCancelled())
+	{
+		freeaddrinfo(addresses);
+		error = kCancelledError;
+		return std::unique_ptr<Connection>();
+	}
+
+	// Try each address in turn
+	TraceSpan connectSpan("connect");
+	std::unique_ptr<Connection> connection;
+	for (addrinfo* address = addresses; address; address = address->ai_next)
+	{
+		std::unique_ptr<Connection> candidate(new Connection());
+		candidate->fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		if (candidate->fd < 0)
+			continue;
+		fcntl(candidate->fd, F_SETFD, FD_CLOEXEC);
+		fcntl(candidate->fd, F_SETFL, fcntl(candidate->fd, F_GETFL) | O_NONBLOCK);
+		int on = 1;
+		setsockopt(candidate->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+#ifdef SO_NOSIGPIPE
+		setsockopt(candidate->fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+#ifdef __linux__
+		candidate->poller = epoll_create1(EPOLL_CLOEXEC);
+		epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLOUT;
+		event.data.fd = candidate->fd;
+		if (candidate->poller < 0 || epoll_ctl(candidate->poller, EPOLL_CTL_ADD, candidate->fd, &event) != 0)
+			continue;
+		candidate->events = EPOLLOUT;
+#endif
+		candidate->Attach(wake);
+
+		if (connect(candidate->fd, address->ai_addr, address->ai_addrlen) != 0)
+		{
+			if (errno != EINPROGRESS || !candidate->Wait(true, timeout))
+			{
+				if (candidate->cancelled)
+					break;
+				continue;
+			}
+			int status = 0;
+			socklen_t size = sizeof(status);
+			if (getsockopt(candidate->fd, SOL_SOCKET, SO_ERROR, &status, &size) != 0 || status != 0)
+				continue;
+		}
+		connection = std::move(candidate);
+		break;
+	}
+	freeaddrinfo(addresses);
+	connectSpan.End();
+
+	if (!connection)
+	{
+		if (IsDebugLoggingEnabled()) {
+			DebugLogFormat(L"[POSIX] Failed to connect to '%s:%s'", Utf8ToWide(host).c_str(), Utf8ToWide(port).c_str());
+		}
+		error = L"Failed to connect to server!";
+		return connection;
+	}
+	connection->key = key;
+
+	if (!request.secure)
+		return connection;
+
+	// Tunnel through the proxy
+	if (viaProxy)
+	{
+		TraceSpan tunnelSpan("proxy tunnel");
+		std::string authority = WideToUtf8(request.domain) + ":" + std::to_string(request.port);
+		std::string tunnel = "CONNECT " + authority + " HTTP/1.1\r\nHost: " + authority + "\r\n";
+		if (!request.proxyUsername.empty())
+			tunnel += "Proxy-Authorization: " + BasicCredentials(request.proxyUsername, request.proxyPassword) + "\r\n";
+		tunnel += "\r\n";
+
+		std::string head;
+		ResponseHead parsed;
+		bool received = false;
+		if (!connection->SendAll(tunnel.data(), tunnel.size(), timeout) ||
+			!connection->ReadHead(head, timeout, received) || !ParseHead(head, parsed))
+		{
+			error = L"Failed to connect to proxy!";
+			return std::unique_ptr<Connection>();
+		}
+		if (parsed.statusCode / 100 != 2)
+		{
+			if (IsDebugLoggingEnabled()) {
+				DebugLogFormat(L"[POSIX] Proxy refused the tunnel with status %lu", parsed.statusCode);
+			}
+			error = parsed.statusCode == 407 ? L"Proxy authentication failed!" : L"Failed to connect to proxy!";
+			return std::unique_ptr<Connection>();
+		}
+	}
+
+#ifdef WINHTTP_WRAPPER_OPENSSL
+	SSL_CTX* context = static_cast<SSL_CTX*>(TlsContext());
+	SSL* ssl = context ? SSL_new(context) : NULL;
+	if (!ssl)
+	{
+		error = L"Failed to initialize TLS!";
+		return std::unique_ptr<Connection>();
+	}
+	connection->tls = ssl;
+	const std::string serverName = WideToUtf8(request.domain);
+	SSL_set_fd(ssl, connection->fd);
+	SSL_set_tlsext_host_name(ssl, serverName.c_str());
+	if (m_Verify)
+	{
+		SSL_set_verify(ssl, SSL_VERIFY_PEER, NULL);
+		SSL_set1_host(ssl, serverName.c_str());
+	}
+	else
+		SSL_set_verify(ssl, SSL_VERIFY_NONE, NULL);
+
+	TraceSpan tlsSpan("tls");
+	for (;;)
+	{
+		int result = SSL_connect(ssl);
+		if (result == 1)
+			break;
+		int status = SSL_get_error(ssl, result);
+		if ((status != SSL_ERROR_WANT_READ && status != SSL_ERROR_WANT_WRITE) ||
+			!connection->Wait(status == SSL_ERROR_WANT_WRITE, timeout))
+		{
+			long verified = SSL_get_verify_result(ssl);
+			if (IsDebugLoggingEnabled()) {
+				DebugLogFormat(L"[POSIX] TLS handshake failed, verify result %ld", verified);
+			}
+			ERR_clear_error();
+			error = verified != X509_V_OK ? L"Server certificate is not trusted!" : L"Failed to establish a secure connection!";
+			return std::unique_ptr<Connection>();
+		}
+	}
+	return connection;
+#else
+	error = L"HTTPS is not available: build with WINHTTP_WRAPPER_OPENSSL!";
+	return std::unique_ptr<Connection>();
+#endif
+}
+
+bool WinHttpWrapper::PosixTransport::Send(const TransportRequest& request, HttpResponse& response)
+{
+	return Perform(request, response, NULL);
+}
+
+bool WinHttpWrapper::PosixTransport::Upgrade(const TransportRequest& request, HttpResponse& response,
+	std::unique_ptr<Stream>& stream)
+{
+	stream.reset();
+	return Perform(request, response, &stream);
+}
+
+bool WinHttpWrapper::PosixTransport::Perform(const TransportRequest& request, HttpResponse& response,
+	std::unique_ptr<Stream>* upgraded)
+{
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[POSIX] %s '%s:%d%s'", request.verb.c_str(), request.domain.c_str(),
+			request.port, request.path.c_str());
+	}
+
+	// Cancelling wakes whatever wait the request is blocked in; the event
+	// outlives the registration signalling it
+	std::unique_ptr<WakeEvent> wake;
+	CancellationToken::Registration registration;
+	if (request.cancel)
+	{
+		wake.reset(new WakeEvent());
+		WakeEvent* event = wake.get();
+		registration = request.cancel->OnCancel([event] { event->Signal(); });
+	}
+	const int wakeFd = wake ? wake->Fd() : -1;
+
+	for (int attempt = 0; ; ++attempt)
+	{
+		bool reused = false;
+		std::unique_ptr<Connection> connection = Checkout(request, wakeFd, reused, response.error);
+		if (!connection)
+			return false;
+
+		bool reusable = false;
+		bool received = false;
+		bool result = Exchange(*connection, request, response, reusable, received);
+
+		// The server may have dropped the idle connection just as it was
+		// reused: try once more on a new one
+		if (!result && reused && !received && !connection->timedOut && !connection->cancelled && attempt == 0)
+		{
+			if (IsDebugLoggingEnabled()) {
+				DebugLog(L"[POSIX] Kept-alive connection was closed, reconnecting");
+			}
+			response.error.clear();
+			continue;
+		}
+
+		const bool upgrade = result && upgraded && response.statusCode == 101;
+		if (upgrade)
+		{
+			connection->Attach(-1);
+			upgraded->reset(new UpgradedStream(std::move(connection)));
+		}
+		else if (result && reusable)
+			Checkin(std::move(connection));
+
+		if (IsDebugLoggingEnabled()) {
+			if (result) {
+				DebugLogFormat(L"[POSIX] Request succeeded - Status: %lu, Content length: %lu, Connection %s",
+					response.statusCode, response.contentLength, upgrade ? L"upgraded" : reusable ? L"kept alive" : L"closed");
+			}
+			else {
+				DebugLogFormat(L"[POSIX] Request failed with error: '%s'", response.error.c_str());
+			}
+		}
+		return result;
+	}
+}
+
+bool WinHttpWrapper::PosixTransport::Exchange(Connection& connection, const TransportRequest& request,
+	HttpResponse& response, bool& reusable, bool& received)
+{
+	const int timeout = Timeout(request);
+	const bool viaProxy = !request.proxyUrl.empty() && !request.secure;
+	reusable = false;
+	received = false;
+
+	// Request head
+	std::string head = WideToUtf8(request.verb);
+	head += ' ';
+	if (viaProxy)
+		head += "http://" + Authority(request);
+	if (request.path.empty() || request.path[0] != L'/')
+		head += '/';
+	head += WideToUtf8(request.path);
+	head += " HTTP/1.1\r\nHost: " + Authority(request) + "\r\n";
+	if (!request.userAgent.empty())
+		head += "User-Agent: " + WideToUtf8(request.userAgent) + "\r\n";
+	if (!request.serverUsername.empty())
+		head += "Authorization: " + BasicCredentials(request.serverUsername, request.serverPassword) + "\r\n";
+	if (viaProxy && !request.proxyUsername.empty())
+		head += "Proxy-Authorization: " + BasicCredentials(request.proxyUsername, request.proxyPassword) + "\r\n";
+
+	const ULONGLONG bodyLength = request.source ? request.source->Length() : request.body.size();
+	if (bodyLength > 0 || request.verb == L"POST" || request.verb == L"PUT")
+		head += "Content-Length: " + std::to_string(bodyLength) + "\r\n";
+	if (!request.headers.empty())
+	{
+		head += WideToUtf8(request.headers);
+		if (head.compare(head.size() - 2, 2, "\r\n") != 0)
+			head += "\r\n";
+	}
+	head += "\r\n";
+
+	// Body bytes go out as fast as the bandwidth limits allow
+	auto sendPaced = [&](const char* data, size_t size) -> bool
+	{
+		while (size > 0)
+		{
+			const size_t allowed = request.meter.Take(size);
+			if (allowed == 0 || !connection.SendAll(data, allowed, timeout))
+				return false;
+			data += allowed;
+			size -= allowed;
+		}
+		return true;
+	};
+
+	// Small bodies go out with the head, unless they are paced
+	TraceSpan sendSpan("send");
+	bool sent;
+	if (!request.source && request.body.size() <= kInlineBodySize && !request.meter.IsLimited())
+	{
+		head += request.body;
+		sent = connection.SendAll(head.data(), head.size(), timeout);
+	}
+	else
+	{
+		sent = connection.SendAll(head.data(), head.size(), timeout);
+		if (sent && !request.source)
+			sent = sendPaced(request.body.data(), request.body.size());
+		else if (sent && request.source->Data())
+			sent = sendPaced(reinterpret_cast<const char*>(request.source->Data()), static_cast<size_t>(bodyLength));
+		else if (sent)
+		{
+			if (!request.source->Rewind())
+			{
+				response.error = L"Failed to read request body!";
+				return false;
+			}
+			std::vector<uint8_t> chunk(kReadChunkSize);
+			ULONGLONG written = 0;
+			for (;;)
+			{
+				DWORD dwRead = 0;
+				if (!request.source->Read(chunk.data(), static_cast<DWORD>(chunk.size()), dwRead))
+				{
+					response.error = L"Failed to read request body!";
+					return false;
+				}
+				if (dwRead == 0)
+					break;
+				if (!sendPaced(reinterpret_cast<const char*>(chunk.data()), dwRead))
+				{
+					response.error = L"Failed to send request body!";
+					return false;
+				}
+				written += dwRead;
+			}
+
+			// The announced Content-Length must match, or the server waits for more
+			if (written != bodyLength)
+			{
+				response.error = L"Request body size changed while sending!";
+				return false;
+			}
+		}
+	}
+	if (!sent)
+	{
+		response.error = L"Failed to send HTTP request!";
+		return false;
+	}
+
+	sendSpan.End();
+
+	// Response head, after any interim 1xx response
+	TraceSpan waitSpan("wait");
+	std::string raw;
+	ResponseHead parsed;
+	do
+	{
+		if (!connection.ReadHead(raw, timeout, received))
+		{
+			response.error = connection.timedOut ? L"The operation timed out!" : L"Failed to receive HTTP response!";
+			return false;
+		}
+		if (!ParseHead(raw, parsed))
+		{
+			response.error = L"Invalid HTTP response!";
+			return false;
+		}
+	}
+	while (parsed.statusCode < 200 && parsed.statusCode != 101);
+	waitSpan.End();
+	response.timing.MarkHeaders();
+
+	response.statusCode = parsed.statusCode;
+	Utf8ToWide(raw.data(), raw.size(), response.header);
+
+	// Without a Content-Type, read the body as binary and decide from its first bytes
+	const std::wstring contentType = Utf8ToWide(parsed.contentType);
+	const bool sniff = contentType.empty() && request.mime.IsSniffing();
+	response.isBinary = sniff || request.mime.IsBinary(contentType);
+
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[POSIX] Status: %lu, Content-Type: '%s', Binary: %s", parsed.statusCode,
+			contentType.c_str(), sniff ? L"Sniffed" : response.isBinary ? L"Yes" : L"No");
+	}
+
+	// Refuse a body announced as larger than the limit without reading it
+	if (request.maxResponseSize && parsed.contentLength > 0 &&
+		static_cast<ULONGLONG>(parsed.contentLength) > request.maxResponseSize)
+	{
+		if (IsDebugLoggingEnabled()) {
+			DebugLogFormat(L"[POSIX] Content-Length is over the %llu bytes limit, not reading the body", request.maxResponseSize);
+		}
+		response.error = L"Response body exceeds the size limit!";
+		return false;
+	}
+
+	BodySink sink(response, request.maxResponseSize, request.record, request.hasher);
+	char buffer[kReadChunkSize];
+
+	// Body bytes read as fast as the bandwidth limits allow, -1 once cancelled
+	auto readPaced = [&](size_t size) -> long
+	{
+		const size_t allowed = request.meter.Take(size);
+		if (allowed == 0)
+			return -1;
+		TraceSpan readSpan("read");
+		long read = connection.ReadSome(buffer, allowed, timeout);
+		readSpan.SetArg("bytes", read);
+		readSpan.End();
+		request.meter.Refund(read > 0 ? allowed - static_cast<size_t>(read) : allowed);
+		return read;
+	};
+
+	const bool hasBody = request.verb != L"HEAD" && parsed.statusCode != 101 &&
+		parsed.statusCode != 204 && parsed.statusCode != 304;
+	bool complete = true;
+	bool overLimit = false;
+
+	if (hasBody && parsed.chunked)
+	{
+		for (;;)
+		{
+			std::string line;
+			if (!connection.ReadLine(line, timeout))
+			{
+				complete = false;
+				break;
+			}
+			char* end = NULL;
+			unsigned long long size = strtoull(line.c_str(), &end, 16);
+			if (end == line.c_str())
+			{
+				complete = false;
+				break;
+			}
+
+			// Last chunk: skip the trailers up to the blank line
+			if (size == 0)
+			{
+				while (connection.ReadLine(line, timeout) && !line.empty())
+					;
+				complete = line.empty() && !connection.timedOut;
+				break;
+			}
+
+			while (size > 0)
+			{
+				long read = readPaced(static_cast<size_t>((std::min)(size, static_cast<unsigned long long>(sizeof(buffer)))));
+				if (read <= 0)
+					break;
+				if (!sink.Append(buffer, static_cast<size_t>(read)))
+				{
+					overLimit = true;
+					break;
+				}
+				size -= static_cast<unsigned long long>(read);
+			}
+			if (size > 0 || overLimit || !connection.ReadLine(line, timeout) || !line.empty())
+			{
+				complete = false;
+				break;
+			}
+		}
+	}
+	else if (hasBody && parsed.contentLength >= 0)
+	{
+		sink.Reserve(static_cast<ULONGLONG>(parsed.contentLength));
+		ULONGLONG remaining = static_cast<ULONGLONG>(parsed.contentLength);
+		while (remaining > 0)
+		{
+			long read = readPaced(static_cast<size_t>((std::min)(remaining, static_cast<ULONGLONG>(sizeof(buffer)))));
+			if (read <= 0)
+				break;
+			if (!sink.Append(buffer, static_cast<size_t>(read)))
+			{
+				overLimit = true;
+				break;
+			}
+			remaining -= static_cast<ULONGLONG>(read);
+		}
+		complete = remaining == 0;
+	}
+	else if (hasBody)
+	{
+		// Delimited by the end of the connection
+		for (;;)
+		{
+			long read = readPaced(sizeof(buffer));
+			if (read == 0)
+				break;
+			if (read < 0)
+			{
+				complete = false;
+				break;
+			}
+			if (!sink.Append(buffer, static_cast<size_t>(read)))
+			{
+				overLimit = true;
+				break;
+			}
+		}
+		parsed.close = true;
+	}
+
+	if (overLimit)
+	{
+		if (IsDebugLoggingEnabled()) {
+			DebugLogFormat(L"[POSIX] Body is over the %llu bytes limit, aborting", request.maxResponseSize);
+		}
+		response.error = L"Response body exceeds the size limit!";
+		return false;
+	}
+	if (!complete)
+	{
+		response.error = connection.timedOut ? L"The operation timed out!" : L"Error reading response data!";
+		return false;
+	}
+
+	if (sniff && !MimeClassifier::SniffBinary(response.binaryData.data(), response.binaryData.size()))
+	{
+		response.text.assign(response.binaryData.begin(), response.binaryData.end());
+		response.binaryData.clear();
+		response.isBinary = false;
+	}
+	response.contentLength = static_cast<DWORD>(sink.Size());
+
+	// Anything left over was not asked for: do not reuse the connection
+	reusable = !parsed.close && (parsed.minorVersion >= 1 || parsed.keepAlive) &&
+		parsed.statusCode != 101 && connection.pending.empty();
+	return true;
+}
+
+#endif
@@ -0,0 +1,100 @@
+// The MIT License (MIT)
+// POSIX socket transport for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include "WinHttpTransport.h"
+#include <atomic>
+#include <memory>
+
+namespace WinHttpWrapper
+{
+	// HTTP/1.1 over non-blocking sockets, the default transport outside
+	// Windows. Connections are kept alive and reused per server (and proxy);
+	// every connect, send and receive waits in epoll (poll outside Linux) so
+	// that it gives up after the timeout, or as soon as the request's
+	// CancellationToken is cancelled. Bodies may be delimited by
+	// Content-Length, chunked or end with the connection.
+	//
+	// https needs OpenSSL: build with WINHTTP_WRAPPER_OPENSSL defined and
+	// link libssl/libcrypto, https requests fail otherwise (OpenSSL writes
+	// can raise SIGPIPE, which the application should ignore). Credentials are
+	// sent as Basic authentication up front, there is no negotiation. Plain
+	// requests go through the proxy directly, https ones through CONNECT;
+	// without an explicit proxy, requests go straight to the server.
+	class PosixTransport : public Transport
+	{
+	public:
+		// Connection taken over by another protocol after a 101 response.
+		// One thread may read while another writes.
+		class Stream
+		{
+		public:
+			virtual ~Stream() {}
+
+			// Bytes read, 0 once the server closed the connection, -1 on
+			// error or once interrupted; timedOut is set when nothing came
+			// within timeout ms (-1 waits for ever)
+			virtual long Read(char* buffer, size_t size, int timeout, bool& timedOut) = 0;
+			virtual bool Write(const void* data, size_t size, int timeout) = 0;
+			// Make pending and later reads and writes fail, from any thread
+			virtual void Interrupt() = 0;
+		};
+
+		PosixTransport();
+		~PosixTransport();
+
+		bool Send(const TransportRequest& request, HttpResponse& response) override;
+
+		// Send a request asking to switch protocols. On a 101 response its
+		// connection is handed over in stream instead of being kept;
+		// other responses are read as by Send().
+		bool Upgrade(const TransportRequest& request, HttpResponse& response, std::unique_ptr<Stream>& stream);
+
+		// Longest wait to connect, send or receive the next bytes, in ms
+		void SetTimeout(int milliseconds) { m_Timeout = milliseconds; }
+		// Idle connections kept per server (default 6, 0 to close each one)
+		void SetMaxIdleConnections(size_t count);
+		// Check https certificates and host names (the default)
+		void SetVerifyCertificates(bool verify) { m_Verify = verify; }
+
+		void CloseIdleConnections();
+
+	private:
+		PosixTransport(const PosixTransport&) = delete;
+		PosixTransport& operator=(const PosixTransport&) = delete;
+
+		struct Connection;
+		struct UpgradedStream;
+
+		// Send() and Upgrade(): upgraded, when set, receives the connection
+		// of a 101 response
+		bool Perform(const TransportRequest& request, HttpResponse& response, std::unique_ptr<Stream>* upgraded);
+		// Idle connection to the request's server, or a new one, its waits
+		// also watching wake (-1 for none)
+		std::unique_ptr<Connection> Checkout(const TransportRequest& request, int wake, bool& reused, std::wstring& error);
+		void Checkin(std::unique_ptr<Connection> connection);
+		std::unique_ptr<Connection> Connect(const TransportRequest& request, const std::string& key, int wake, std::wstring& error);
+		// One request/response on connection; received is false when nothing
+		// of the response was received, so the request can be retried
+		bool Exchange(Connection& connection, const TransportRequest& request, HttpResponse& response,
+			bool& reusable, bool& received);
+		// Shared SSL_CTX, NULL without OpenSSL
+		void* TlsContext();
+		// Timeout of the waits of request, the shorter of its own and ours
+		int Timeout(const TransportRequest& request) const;
+
+		std::mutex m_Mutex;
+		std::unordered_map<std::string, std::vector<std::unique_ptr<Connection>>> m_Idle;
+		size_t m_MaxIdle;
+		std::atomic<int> m_Timeout;
+		std::atomic<bool> m_Verify;
+		void* m_Tls;                // SSL_CTX, created on first https request
+	};
+
+	// Base64 with padding, as in Basic credentials
+	std::string Base64Encode(const std::string& data);
+
+}
@@ -0,0 +1,537 @@
+// The MIT License (MIT)
+// WebSockets over PosixTransport for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#ifndef _WIN32
+
+#include "WinHttpWebSocket.h"
+#include "WinHttpTransport.h"
+#include "WinHttpUtf.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <random>
+
+namespace
+{
+	const size_t kFrameChunkSize = 64 * 1024;
+	const size_t kReadBufferSize = 16 * 1024;
+	const DWORD kDefaultKeepAlive = 30000;
+	// Longest wait for the server to take a frame
+	const int kSendTimeout = 30000;
+
+	const BYTE kContinuationFrame = 0x0;
+	const BYTE kTextFrame = 0x1;
+	const BYTE kBinaryFrame = 0x2;
+	const BYTE kCloseFrame = 0x8;
+	const BYTE kPingFrame = 0x9;
+	const BYTE kPongFrame = 0xA;
+
+	// Appended to Sec-WebSocket-Key before hashing it (RFC 6455)
+	const char kAcceptGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+	uint32_t RotateLeft(uint32_t value, int bits)
+	{
+		return (value << bits) | (value >> (32 - bits));
+	}
+
+	// SHA-1 digest, only used for Sec-WebSocket-Accept
+	std::string Sha1(const std::string& data)
+	{
+		uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+		std::string padded = data;
+		padded += '\x80';
+		while (padded.size() % 64 != 56)
+			padded += '\0';
+		const uint64_t bits = static_cast<uint64_t>(data.size()) * 8;
+		for (int shift = 56; shift >= 0; shift -= 8)
+			padded += static_cast<char>((bits >> shift) & 0xFF);
+
+		for (size_t block = 0; block < padded.size(); block += 64)
+		{
+			uint32_t w[80];
+			for (int i = 0; i < 16; ++i)
+			{
+				const unsigned char* word = reinterpret_cast<const unsigned char*>(padded.data() + block + i * 4);
+				w[i] = (static_cast<uint32_t>(word[0]) << 24) | (static_cast<uint32_t>(word[1]) << 16) |
+					(static_cast<uint32_t>(word[2]) << 8) | word[3];
+			}
+			for (int i = 16; i < 80; ++i)
+				w[i] = RotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+			uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+			for (int i = 0; i < 80; ++i)
+			{
+				uint32_t f, k;
+				if (i < 20)
+				{
+					f = (b & c) | (~b & d);
+					k = 0x5A827999;
+				}
+				else if (i < 40)
+				{
+					f = b ^ c ^ d;
+					k = 0x6ED9EBA1;
+				}
+				else if (i < 60)
+				{
+					f = (b & c) | (b & d) | (c & d);
+					k = 0x8F1BBCDC;
+				}
+				else
+				{
+					f = b ^ c ^ d;
+					k = 0xCA62C1D6;
+				}
+				const uint32_t t = RotateLeft(a, 5) + f + e + k + w[i];
+				e = d;
+				d = c;
+				c = RotateLeft(b, 30);
+				b = a;
+				a = t;
+			}
+			h[0] += a;
+			h[1] += b;
+			h[2] += c;
+			h[3] += d;
+			h[4] += e;
+		}
+
+		std::string digest;
+		for (uint32_t word : h)
+		{
+			for (int shift = 24; shift >= 0; shift -= 8)
+				digest += static_cast<char>((word >> shift) & 0xFF);
+		}
+		return digest;
+	}
+
+	// Value of Sec-WebSocket-Accept in the raw response headers, empty when missing
+	std::string AcceptHeader(const std::wstring& headers)
+	{
+		const std::string raw = WinHttpWrapper::WideToUtf8(headers);
+		std::string lower = raw;
+		for (char& c : lower)
+		{
+			if (c >= 'A' && c <= 'Z')
+				c = static_cast<char>(c - 'A' + 'a');
+		}
+
+		const char kName[] = "\r\nsec-websocket-accept:";
+		size_t start = lower.find(kName);
+		if (start == std::string::npos)
+			return std::string();
+		start += sizeof(kName) - 1;
+		size_t end = raw.find("\r\n", start);
+		if (end == std::string::npos)
+			end = raw.size();
+		while (start < end && (raw[start] == ' ' || raw[start] == '\t'))
+			++start;
+		while (end > start && (raw[end - 1] == ' ' || raw[end - 1] == '\t'))
+			--end;
+		return raw.substr(start, end - start);
+	}
+}
+
+void WinHttpWrapper::WebSocket::Start(std::unique_ptr<PosixTransport::Stream> stream)
+{
+	m_Stream = std::move(stream);
+	m_Open = true;
+	m_Receiver = std::thread(&WebSocket::ReceiveLoop, this);
+}
+
+bool WinHttpWrapper::WebSocket::SendFrame(BYTE opcode, const void* data, size_t size, bool final)
+{
+	// Clients mask every frame, with a new key each time
+	thread_local std::mt19937 random(std::random_device{}());
+	const uint32_t key = static_cast<uint32_t>(random());
+	const BYTE mask[4] = {
+		static_cast<BYTE>(key >> 24), static_cast<BYTE>(key >> 16),
+		static_cast<BYTE>(key >> 8), static_cast<BYTE>(key)
+	};
+
+	m_Frame.clear();
+	m_Frame.push_back(static_cast<char>((final ? 0x80 : 0) | opcode));
+	if (size < 126)
+		m_Frame.push_back(static_cast<char>(0x80 | size));
+	else if (size <= 0xFFFF)
+	{
+		m_Frame.push_back(static_cast<char>(0x80 | 126));
+		m_Frame.push_back(static_cast<char>(size >> 8));
+		m_Frame.push_back(static_cast<char>(size & 0xFF));
+	}
+	else
+	{
+		m_Frame.push_back(static_cast<char>(0x80 | 127));
+		for (int shift = 56; shift >= 0; shift -= 8)
+			m_Frame.push_back(static_cast<char>((static_cast<uint64_t>(size) >> shift) & 0xFF));
+	}
+	m_Frame.insert(m_Frame.end(), mask, mask + 4);
+
+	const size_t start = m_Frame.size();
+	m_Frame.resize(start + size);
+	const BYTE* bytes = static_cast<const BYTE*>(data);
+	for (size_t i = 0; i < size; ++i)
+		m_Frame[start + i] = static_cast<char>(bytes[i] ^ mask[i & 3]);
+
+	return m_Stream->Write(m_Frame.data(), m_Frame.size(), kSendTimeout);
+}
+
+bool WinHttpWrapper::WebSocket::SendClose(USHORT status, const std::string& reason)
+{
+	if (!m_Stream)
+		return false;
+
+	// 1005 only tells that the server sent no status, it is not sent back
+	std::string payload;
+	if (status != WINHTTP_WEB_SOCKET_EMPTY_CLOSE_STATUS)
+	{
+		payload += static_cast<char>(status >> 8);
+		payload += static_cast<char>(status & 0xFF);
+		// Close reasons are limited to 123 bytes by the protocol
+		payload += reason.substr(0, 123);
+	}
+	return SendFrame(kCloseFrame, payload.data(), payload.size(), true);
+}
+
+bool WinHttpWrapper::WebSocket::Send(const void* data, size_t size, bool binary)
+{
+	std::lock_guard<std::mutex> sendLock(m_SendMutex);
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (!m_Open || m_Closing || !m_Stream)
+			return false;
+	}
+
+	// Fragments when the message does not fit in one chunk
+	const BYTE* bytes = static_cast<const BYTE*>(data);
+	size_t offset = 0;
+	do
+	{
+		const size_t count = (std::min)(size - offset, kFrameChunkSize);
+		const bool last = offset + count == size;
+		const BYTE opcode = offset > 0 ? kContinuationFrame : binary ? kBinaryFrame : kTextFrame;
+		if (!SendFrame(opcode, bytes + offset, count, last))
+		{
+			if (IsDebugLoggingEnabled()) {
+				DebugLog(L"[WEBSOCKET] Send failed");
+			}
+			return false;
+		}
+		offset += count;
+	} while (offset < size);
+
+	return true;
+}
+
+void WinHttpWrapper::WebSocket::Close(USHORT status, const std::string& reason, DWORD timeoutMs)
+{
+	{
+		std::lock_guard<std::mutex> sendLock(m_SendMutex);
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		if (m_Open && !m_Closing)
+		{
+			m_Closing = true;
+			lock.unlock();
+			SendClose(status, reason);
+		}
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_Changed.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] { return !m_Open; });
+	}
+
+	Abort();
+}
+
+void WinHttpWrapper::WebSocket::Abort()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stopping = true;
+		m_Changed.notify_all();
+	}
+
+	// Interrupting the stream makes a pending receive or send return
+	if (m_Stream)
+		m_Stream->Interrupt();
+	if (m_Receiver.joinable())
+		m_Receiver.join();
+	{
+		std::lock_guard<std::mutex> sendLock(m_SendMutex);
+		m_Stream.reset();
+	}
+
+	Finish(WINHTTP_WEB_SOCKET_ABORTED_CLOSE_STATUS, "", L"");
+}
+
+void WinHttpWrapper::WebSocket::ReceiveLoop()
+{
+	const int keepAlive = static_cast<int>((std::min)(m_KeepAlive ? m_KeepAlive : kDefaultKeepAlive,
+		static_cast<DWORD>(INT_MAX)));
+
+	// Frame heads and small payloads are read through buffer; larger
+	// payloads straight into the message they belong to
+	std::vector<char> buffer(kReadBufferSize);
+	size_t buffered = 0;
+	size_t consumed = 0;
+	auto receive = [&](char* out, size_t size) -> bool
+	{
+		const size_t available = (std::min)(size, buffered - consumed);
+		memcpy(out, buffer.data() + consumed, available);
+		consumed += available;
+		out += available;
+		size -= available;
+
+		while (size > 0)
+		{
+			const bool direct = size >= kReadBufferSize;
+			bool timedOut = false;
+			long read = m_Stream->Read(direct ? out : buffer.data(), direct ? size : kReadBufferSize, keepAlive, timedOut);
+			if (read < 0 && timedOut)
+			{
+				// Nothing from the server for a while: check that it is still there
+				std::lock_guard<std::mutex> sendLock(m_SendMutex);
+				bool closing;
+				{
+					std::lock_guard<std::mutex> lock(m_Mutex);
+					closing = m_Closing;
+				}
+				if (!closing && !SendFrame(kPingFrame, NULL, 0, true))
+					return false;
+				continue;
+			}
+			if (read <= 0)
+				return false;
+
+			const size_t count = static_cast<size_t>(read);
+			if (direct)
+			{
+				out += count;
+				size -= count;
+			}
+			else
+			{
+				const size_t used = (std::min)(size, count);
+				memcpy(out, buffer.data(), used);
+				out += used;
+				size -= used;
+				buffered = count;
+				consumed = used;
+			}
+		}
+		return true;
+	};
+
+	auto lost = [&]
+	{
+		bool stopping;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			stopping = m_Stopping;
+		}
+		if (!stopping)
+			Finish(WINHTTP_WEB_SOCKET_ABORTED_CLOSE_STATUS, "", L"WebSocket connection lost!");
+	};
+
+	// Close with status on our side, as the server broke the protocol
+	auto fail = [&](USHORT status, const std::wstring& error)
+	{
+		bool closing;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			closing = m_Closing;
+			m_Closing = true;
+		}
+		if (!closing)
+		{
+			std::lock_guard<std::mutex> sendLock(m_SendMutex);
+			SendClose(status, "");
+		}
+		Finish(status, "", error);
+	};
+
+	WebSocketMessage message;
+	bool fragmented = false;    // Continuation frames expected
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Changed.wait(lock, [this] { return m_QueuedBytes < m_MaxQueuedBytes || m_Stopping; });
+			if (m_Stopping)
+				return;
+		}
+
+		unsigned char head[2];
+		if (!receive(reinterpret_cast<char*>(head), 2))
+			return lost();
+		const bool final = (head[0] & 0x80) != 0;
+		const BYTE opcode = head[0] & 0x0F;
+		ULONGLONG length = head[1] & 0x7F;
+		if (length >= 126)
+		{
+			unsigned char extended[8];
+			const size_t size = length == 126 ? 2 : 8;
+			if (!receive(reinterpret_cast<char*>(extended), size))
+				return lost();
+			length = 0;
+			for (size_t i = 0; i < size; ++i)
+				length = (length << 8) | extended[i];
+		}
+
+		// No extension is negotiated and servers do not mask their frames
+		bool valid = (head[0] & 0x70) == 0 && (head[1] & 0x80) == 0 && (length >> 63) == 0;
+		if (opcode >= kCloseFrame)
+			valid = valid && opcode <= kPongFrame && final && length <= 125 && !(opcode == kCloseFrame && length == 1);
+		else if (opcode == kContinuationFrame)
+			valid = valid && fragmented;
+		else
+			valid = valid && !fragmented && (opcode == kTextFrame || opcode == kBinaryFrame);
+		if (!valid)
+			return fail(WINHTTP_WEB_SOCKET_PROTOCOL_ERROR_CLOSE_STATUS, L"Invalid WebSocket frame!");
+
+		if (opcode >= kCloseFrame)
+		{
+			char payload[125];
+			if (!receive(payload, static_cast<size_t>(length)))
+				return lost();
+
+			if (opcode == kPingFrame)
+			{
+				std::lock_guard<std::mutex> sendLock(m_SendMutex);
+				bool closing;
+				{
+					std::lock_guard<std::mutex> lock(m_Mutex);
+					closing = m_Closing;
+				}
+				if (!closing && !SendFrame(kPongFrame, payload, static_cast<size_t>(length), true))
+					return lost();
+			}
+			else if (opcode == kCloseFrame)
+			{
+				const USHORT status = length >= 2
+					? static_cast<USHORT>((static_cast<unsigned char>(payload[0]) << 8) | static_cast<unsigned char>(payload[1]))
+					: static_cast<USHORT>(WINHTTP_WEB_SOCKET_EMPTY_CLOSE_STATUS);
+				const std::string reason = length > 2 ? std::string(payload + 2, static_cast<size_t>(length) - 2) : std::string();
+
+				// Complete the handshake when the server started it
+				bool closing;
+				{
+					std::lock_guard<std::mutex> lock(m_Mutex);
+					closing = m_Closing;
+					m_Closing = true;
+				}
+				if (!closing)
+				{
+					std::lock_guard<std::mutex> sendLock(m_SendMutex);
+					SendClose(status, "");
+				}
+
+				Finish(status, reason, L"");
+				return;
+			}
+			continue;
+		}
+
+		if (opcode != kContinuationFrame)
+			message.binary = opcode == kBinaryFrame;
+		if (m_MaxMessageSize && message.data.size() + length > m_MaxMessageSize)
+			return fail(WINHTTP_WEB_SOCKET_MESSAGE_TOO_BIG_CLOSE_STATUS, L"WebSocket message exceeds the size limit!");
+
+		// Grown as the payload arrives rather than from its announced length
+		while (length > 0)
+		{
+			const size_t count = static_cast<size_t>((std::min)(length, static_cast<ULONGLONG>(kFrameChunkSize)));
+			const size_t used = message.data.size();
+			message.data.resize(used + count);
+			if (!receive(&message.data[used], count))
+				return lost();
+			length -= count;
+		}
+
+		fragmented = !final;
+		if (final)
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_QueuedBytes += message.data.size();
+			m_Queue.push_back(std::move(message));
+			m_Changed.notify_all();
+
+			message = WebSocketMessage();
+		}
+	}
+}
+
+bool WinHttpWrapper::HttpRequest::OpenWebSocket(const std::wstring& rest_of_path,
+	const std::wstring& requestHeader,
+	WebSocket& socket,
+	HttpResponse& response)
+{
+	response.Reset();
+
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[WEBSOCKET] Opening '%s:%d%s'", m_Domain.c_str(), m_Port, rest_of_path.c_str());
+	}
+
+	// The server proves that it speaks the protocol by hashing this key
+	std::random_device device;
+	std::string nonce;
+	for (int i = 0; i < 4; ++i)
+	{
+		const uint32_t bits = device();
+		nonce.append(reinterpret_cast<const char*>(&bits), sizeof(bits));
+	}
+	const std::string key = Base64Encode(nonce);
+
+	const std::wstring verb = L"GET";
+	const std::string body;
+	const std::wstring headers = L"Upgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Version: 13\r\n"
+		L"Sec-WebSocket-Key: " + Utf8ToWide(key) + L"\r\n" + requestHeader;
+	const BandwidthThrottle::Meter meter(m_Domain, m_Priority, m_Cancel.get());
+	const TransportRequest request = {
+		verb, m_UserAgent, m_Domain,
+		rest_of_path, m_Port, m_Secure,
+		headers, body, NULL,
+		m_ProxyUrl, m_ProxyUsername, m_ProxyPassword,
+		m_ServerUsername, m_ServerPassword,
+		m_Mime ? *m_Mime : MimeClassifier::Default(),
+		MaxResponseSize(), NULL, m_Cancel.get(), meter, NULL,
+		m_TimeoutMs
+	};
+
+	// The connection is long-lived, so it does not take a scheduler slot.
+	// A PosixTransport set on the request applies its timeout and
+	// certificate settings to the handshake.
+	std::shared_ptr<PosixTransport> transport =
+		std::dynamic_pointer_cast<PosixTransport>(m_Transport ? m_Transport : Transport::Default());
+	if (!transport)
+		transport = std::make_shared<PosixTransport>();
+
+	std::unique_ptr<PosixTransport::Stream> stream;
+	if (!transport->Upgrade(request, response, stream))
+	{
+		if (IsDebugLoggingEnabled()) {
+			DebugLogFormat(L"[WEBSOCKET] Upgrade request failed: %s", response.error.c_str());
+		}
+		return false;
+	}
+	if (response.statusCode != 101)
+	{
+		response.error = L"WebSocket upgrade refused!";
+		return false;
+	}
+	if (!stream || AcceptHeader(response.header) != Base64Encode(Sha1(key + kAcceptGuid)))
+	{
+		response.error = L"Failed to complete WebSocket upgrade!";
+		return false;
+	}
+
+	socket.Start(std::move(stream));
+	return true;
+}
+
+#endif
@@ -0,0 +1,376 @@
+// The MIT License (MIT)
+// Traffic record/replay for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#include "WinHttpReplay.h"
+#include "WinHttpUtf.h"
+#include <algorithm>
+#include <memory>
+#include <thread>
+#ifndef _WIN32
+#include <cstdio>
+#endif
+
+namespace
+{
+	const char kMagic[4] = { 'W', 'H', 'T', 'L' };
+	const char kVersion = 1;
+
+	void PutVarint(std::string& out, ULONGLONG value)
+	{
+		while (value >= 0x80)
+		{
+			out += static_cast<char>((value & 0x7F) | 0x80);
+			value >>= 7;
+		}
+		out += static_cast<char>(value);
+	}
+
+	void PutBytes(std::string& out, const std::string& bytes)
+	{
+		PutVarint(out, bytes.size());
+		out += bytes;
+	}
+
+	void PutText(std::string& out, const std::wstring& text)
+	{
+		PutBytes(out, WinHttpWrapper::WideToUtf8(text));
+	}
+
+	// Reads stay within [pos, end) and fail instead of running past it
+	bool GetVarint(const std::string& data, size_t& pos, size_t end, ULONGLONG& value)
+	{
+		value = 0;
+		for (int shift = 0; shift < 64 && pos < end; shift += 7)
+		{
+			unsigned char byte = static_cast<unsigned char>(data[pos++]);
+			value |= static_cast<ULONGLONG>(byte & 0x7F) << shift;
+			if (!(byte & 0x80))
+				return true;
+		}
+		return false;
+	}
+
+	bool GetBytes(const std::string& data, size_t& pos, size_t end, std::string& bytes)
+	{
+		ULONGLONG size = 0;
+		if (!GetVarint(data, pos, end, size) || size > end - pos)
+			return false;
+		bytes.assign(data, pos, static_cast<size_t>(size));
+		pos += static_cast<size_t>(size);
+		return true;
+	}
+
+	bool GetText(const std::string& data, size_t& pos, size_t end, std::wstring& text)
+	{
+		std::string bytes;
+		if (!GetBytes(data, pos, end, bytes))
+			return false;
+		WinHttpWrapper::Utf8ToWide(bytes.data(), bytes.size(), text);
+		return true;
+	}
+
+	template <typename T>
+	bool GetNumber(const std::string& data, size_t& pos, size_t end, T& number)
+	{
+		ULONGLONG value = 0;
+		if (!GetVarint(data, pos, end, value))
+			return false;
+		number = static_cast<T>(value);
+		return true;
+	}
+
+	// Log files, through stdio outside Windows
+	HANDLE CreateLog(const std::wstring& path)
+	{
+#ifdef _WIN32
+		return CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ,
+			NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+#else
+		FILE* file = fopen(WinHttpWrapper::WideToUtf8(path).c_str(), "wb");
+		return file ? static_cast<HANDLE>(file) : INVALID_HANDLE_VALUE;
+#endif
+	}
+
+	bool WriteLog(HANDLE hFile, const std::string& data)
+	{
+#ifdef _WIN32
+		DWORD written = 0;
+		return WriteFile(hFile, data.data(), static_cast<DWORD>(data.size()), &written, NULL) && written == data.size();
+#else
+		FILE* file = static_cast<FILE*>(hFile);
+		return fwrite(data.data(), 1, data.size(), file) == data.size() && fflush(file) == 0;
+#endif
+	}
+
+	void CloseLogFile(HANDLE hFile)
+	{
+#ifdef _WIN32
+		CloseHandle(hFile);
+#else
+		fclose(static_cast<FILE*>(hFile));
+#endif
+	}
+
+	bool ReadLog(const std::wstring& path, std::string& data)
+	{
+		char buffer[64 * 1024];
+#ifdef _WIN32
+		HANDLE hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+			NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (hFile == INVALID_HANDLE_VALUE)
+			return false;
+
+		DWORD dwRead = 0;
+		while (ReadFile(hFile, buffer, sizeof(buffer), &dwRead, NULL) && dwRead > 0)
+			data.append(buffer, dwRead);
+		CloseHandle(hFile);
+#else
+		FILE* file = fopen(WinHttpWrapper::WideToUtf8(path).c_str(), "rb");
+		if (!file)
+			return false;
+
+		size_t read = 0;
+		while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+			data.append(buffer, read);
+		fclose(file);
+#endif
+		return true;
+	}
+}
+
+void WinHttpWrapper::RecordedExchange::AddChunk(DWORD size)
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	Chunk chunk;
+	chunk.size = size;
+	chunk.delay = static_cast<DWORD>((std::min)(
+		static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(now - last).count()),
+		static_cast<long long>(MAXDWORD)));
+	chunks.push_back(chunk);
+	last = now;
+}
+
+WinHttpWrapper::TrafficLog& WinHttpWrapper::TrafficLog::Instance()
+{
+	static TrafficLog instance;
+	return instance;
+}
+
+WinHttpWrapper::TrafficLog::TrafficLog()
+	: m_Mode(MODE_OFF)
+	, m_File(INVALID_HANDLE_VALUE)
+	, m_Paced(false)
+{
+}
+
+WinHttpWrapper::TrafficLog::~TrafficLog()
+{
+	CloseLog();
+}
+
+void WinHttpWrapper::TrafficLog::CloseLog()
+{
+	if (m_File != INVALID_HANDLE_VALUE)
+	{
+		CloseLogFile(m_File);
+		m_File = INVALID_HANDLE_VALUE;
+	}
+}
+
+std::wstring WinHttpWrapper::TrafficLog::Key(const std::wstring& verb, const std::wstring& host, int port, const std::wstring& path)
+{
+	return verb + L" " + host + L":" + std::to_wstring(port) + path;
+}
+
+bool WinHttpWrapper::TrafficLog::StartRecording(const std::wstring& path)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Mode = MODE_OFF;
+	CloseLog();
+	m_Pending.clear();
+
+	m_File = CreateLog(path);
+	if (m_File == INVALID_HANDLE_VALUE)
+		return false;
+
+	std::string header(kMagic, sizeof(kMagic));
+	header += kVersion;
+	if (!WriteLog(m_File, header))
+	{
+		CloseLog();
+		return false;
+	}
+
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[REPLAY] Recording traffic to '%s'", path.c_str());
+	}
+	m_Mode = MODE_RECORD;
+	return true;
+}
+
+bool WinHttpWrapper::TrafficLog::StartReplay(const std::wstring& path, bool paced)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Mode = MODE_OFF;
+	CloseLog();
+	m_Pending.clear();
+
+	std::string data;
+	if (!ReadLog(path, data))
+		return false;
+
+	if (data.size() < sizeof(kMagic) + 1 || data.compare(0, sizeof(kMagic), kMagic, sizeof(kMagic)) != 0 ||
+		data[sizeof(kMagic)] != kVersion)
+		return false;
+
+	// A log cut short by a crash keeps its complete records
+	size_t pos = sizeof(kMagic) + 1;
+	size_t count = 0;
+	std::shared_ptr<RecordedExchange> exchange = std::make_shared<RecordedExchange>();
+	while (Parse(data, pos, *exchange))
+	{
+		m_Pending[Key(exchange->verb, exchange->host, exchange->port, exchange->path)].push_back(exchange);
+		exchange = std::make_shared<RecordedExchange>();
+		++count;
+	}
+
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[REPLAY] Replaying %zu exchange(s) from '%s'%s",
+			count, path.c_str(), paced ? L" at the recorded pace" : L"");
+	}
+	m_Paced = paced;
+	m_Mode = MODE_REPLAY;
+	return true;
+}
+
+void WinHttpWrapper::TrafficLog::Stop()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Mode = MODE_OFF;
+	CloseLog();
+	m_Pending.clear();
+}
+
+void WinHttpWrapper::TrafficLog::Record(const RecordedExchange& exchange)
+{
+	std::string record;
+	Serialize(exchange, record);
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (m_File == INVALID_HANDLE_VALUE)
+		return;
+	WriteLog(m_File, record);
+}
+
+bool WinHttpWrapper::TrafficLog::Replay(const std::wstring& verb, const std::wstring& host, int port,
+	const std::wstring& path, HttpResponse& response)
+{
+	// Shared, so that stopping the replay meanwhile does not free it
+	std::shared_ptr<const RecordedExchange> exchange;
+	bool paced;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		auto it = m_Pending.find(Key(verb, host, port, path));
+		if (it != m_Pending.end() && !it->second.empty())
+		{
+			exchange = it->second.front();
+			it->second.pop_front();
+		}
+		paced = m_Paced;
+	}
+
+	if (!exchange)
+	{
+		if (IsDebugLoggingEnabled()) {
+			DebugLogFormat(L"[REPLAY] No recorded exchange left for %s '%s:%d%s'",
+				verb.c_str(), host.c_str(), port, path.c_str());
+		}
+		response.error = L"No recorded exchange for this request!";
+		return false;
+	}
+
+	if (paced)
+	{
+		for (const RecordedExchange::Chunk& chunk : exchange->chunks)
+			std::this_thread::sleep_for(std::chrono::microseconds(chunk.delay));
+	}
+
+	response.statusCode = exchange->statusCode;
+	response.header = exchange->responseHeaders;
+	response.isBinary = exchange->isBinary;
+	response.contentLength = static_cast<DWORD>(exchange->responseBody.size());
+	response.error = exchange->error;
+	if (exchange->isBinary)
+		response.binaryData.assign(exchange->responseBody.begin(), exchange->responseBody.end());
+	else
+		response.text = exchange->responseBody;
+	return exchange->succeeded;
+}
+
+void WinHttpWrapper::TrafficLog::Serialize(const RecordedExchange& exchange, std::string& out)
+{
+	std::string record;
+	PutText(record, exchange.verb);
+	PutText(record, exchange.host);
+	PutVarint(record, static_cast<ULONGLONG>(exchange.port));
+	PutVarint(record, exchange.secure ? 1 : 0);
+	PutText(record, exchange.path);
+	PutText(record, exchange.requestHeaders);
+	PutBytes(record, exchange.requestBody);
+	PutVarint(record, exchange.succeeded ? 1 : 0);
+	PutVarint(record, exchange.statusCode);
+	PutText(record, exchange.responseHeaders);
+	PutVarint(record, exchange.isBinary ? 1 : 0);
+	PutBytes(record, exchange.responseBody);
+	PutVarint(record, exchange.chunks.size());
+	for (const RecordedExchange::Chunk& chunk : exchange.chunks)
+	{
+		PutVarint(record, chunk.size);
+		PutVarint(record, chunk.delay);
+	}
+	PutText(record, exchange.error);
+
+	PutVarint(out, record.size());
+	out += record;
+}
+
+bool WinHttpWrapper::TrafficLog::Parse(const std::string& data, size_t& pos, RecordedExchange& exchange)
+{
+	size_t p = pos;
+	ULONGLONG length = 0;
+	if (!GetVarint(data, p, data.size(), length) || length > data.size() - p)
+		return false;
+	const size_t end = p + static_cast<size_t>(length);
+
+	ULONGLONG chunkCount = 0;
+	if (!GetText(data, p, end, exchange.verb) ||
+		!GetText(data, p, end, exchange.host) ||
+		!GetNumber(data, p, end, exchange.port) ||
+		!GetNumber(data, p, end, exchange.secure) ||
+		!GetText(data, p, end, exchange.path) ||
+		!GetText(data, p, end, exchange.requestHeaders) ||
+		!GetBytes(data, p, end, exchange.requestBody) ||
+		!GetNumber(data, p, end, exchange.succeeded) ||
+		!GetNumber(data, p, end, exchange.statusCode) ||
+		!GetText(data, p, end, exchange.responseHeaders) ||
+		!GetNumber(data, p, end, exchange.isBinary) ||
+		!GetBytes(data, p, end, exchange.responseBody) ||
+		!GetVarint(data, p, end, chunkCount) ||
+		chunkCount > end - p)
+		return false;
+
+	exchange.chunks.resize(static_cast<size_t>(chunkCount));
+	for (RecordedExchange::Chunk& chunk : exchange.chunks)
+	{
+		if (!GetNumber(data, p, end, chunk.size) || !GetNumber(data, p, end, chunk.delay))
+			return false;
+	}
+	if (!GetText(data, p, end, exchange.error))
+		return false;
+
+	// Fields added by later versions are skipped
+	pos = end;
+	return true;
+}
@@ -0,0 +1,104 @@
+// The MIT License (MIT)
+// Traffic record/replay for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include "WinHttpWrapper.h"
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+
+namespace WinHttpWrapper
+{
+	// One request and its response, as captured by TrafficLog
+	struct RecordedExchange
+	{
+		RecordedExchange() : port(0), secure(false), succeeded(false), statusCode(0), isBinary(false) {}
+
+		struct Chunk
+		{
+			DWORD size;
+			DWORD delay;            // Microseconds since the previous chunk (or the request start)
+		};
+
+		// Chunk delays are measured from here
+		void Start() { last = std::chrono::steady_clock::now(); }
+		void AddChunk(DWORD size);
+
+		std::wstring verb;
+		std::wstring host;
+		int port;
+		bool secure;
+		std::wstring path;
+		std::wstring requestHeaders;
+		std::string requestBody;    // Empty for bodies streamed from a BodySource not in memory
+
+		bool succeeded;
+		DWORD statusCode;
+		std::wstring responseHeaders;
+		bool isBinary;
+		std::string responseBody;
+		std::vector<Chunk> chunks;  // How the body arrived
+		std::wstring error;
+
+		std::chrono::steady_clock::time_point last;
+	};
+
+	// Process-wide record/replay switch under HttpRequest. While recording,
+	// every request sent through Get/Post/Put/Delete/Upload is appended to a
+	// binary log. While replaying, the same requests are answered from the
+	// log without any network access, matched by verb, host, port and path
+	// in recorded order, either at the recorded pace or as fast as possible.
+	// Scheduling and response handling run as usual, so the rest of the
+	// stack can be benchmarked against identical traffic.
+	class TrafficLog
+	{
+	public:
+		enum Mode
+		{
+			MODE_OFF,
+			MODE_RECORD,
+			MODE_REPLAY
+		};
+
+		static TrafficLog& Instance();
+
+		// Truncates the log
+		bool StartRecording(const std::wstring& path);
+		// paced: wait the recorded delays between body chunks
+		bool StartReplay(const std::wstring& path, bool paced);
+		void Stop();
+
+		Mode GetMode() const { return static_cast<Mode>(m_Mode.load(std::memory_order_relaxed)); }
+
+		// Used by HttpRequest
+		void Record(const RecordedExchange& exchange);
+		// False, with response.error set, when no recorded exchange is left
+		// for this request
+		bool Replay(const std::wstring& verb, const std::wstring& host, int port,
+			const std::wstring& path, HttpResponse& response);
+
+		// Log format: "WHTL", a version byte, then one length-prefixed record
+		// per exchange; integers are LEB128 varints, strings UTF-8
+		static void Serialize(const RecordedExchange& exchange, std::string& out);
+		static bool Parse(const std::string& data, size_t& pos, RecordedExchange& exchange);
+
+	private:
+		TrafficLog();
+		~TrafficLog();
+
+		static std::wstring Key(const std::wstring& verb, const std::wstring& host, int port, const std::wstring& path);
+		void CloseLog();
+
+		std::atomic<int> m_Mode;
+		std::mutex m_Mutex;
+		HANDLE m_File;              // Log being recorded
+		bool m_Paced;
+		// Exchanges left to replay, per request
+		std::unordered_map<std::wstring, std::deque<std::shared_ptr<const RecordedExchange>>> m_Pending;
+	};
+
+}
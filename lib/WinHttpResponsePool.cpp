@@ -0,0 +1,61 @@
+// The MIT License (MIT)
+// Response recycling for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#include "WinHttpResponsePool.h"
+#include <atomic>
+#include <memory>
+
+namespace
+{
+	std::atomic<size_t> g_maxPooled(4);
+	std::atomic<size_t> g_maxRetainedBytes(1024 * 1024);
+
+	// Freed with the thread
+	thread_local std::vector<std::unique_ptr<WinHttpWrapper::HttpResponse>> t_pool;
+}
+
+WinHttpWrapper::ResponsePool::Lease& WinHttpWrapper::ResponsePool::Lease::operator=(Lease&& other)
+{
+	if (this != &other)
+	{
+		if (m_Response)
+			Release(m_Response);
+		m_Response = other.m_Response;
+		other.m_Response = NULL;
+	}
+	return *this;
+}
+
+WinHttpWrapper::ResponsePool::Lease::~Lease()
+{
+	if (m_Response)
+		Release(m_Response);
+}
+
+WinHttpWrapper::ResponsePool::Lease WinHttpWrapper::ResponsePool::Acquire()
+{
+	if (t_pool.empty())
+		return Lease(new HttpResponse());
+
+	HttpResponse* response = t_pool.back().release();
+	t_pool.pop_back();
+	return Lease(response);
+}
+
+void WinHttpWrapper::ResponsePool::Release(HttpResponse* response)
+{
+	std::unique_ptr<HttpResponse> owned(response);
+	if (t_pool.size() >= g_maxPooled.load(std::memory_order_relaxed))
+		return;
+
+	owned->Recycle(g_maxRetainedBytes.load(std::memory_order_relaxed));
+	t_pool.push_back(std::move(owned));
+}
+
+void WinHttpWrapper::ResponsePool::SetLimits(size_t maxPooled, size_t maxRetainedBytes)
+{
+	g_maxPooled = maxPooled;
+	g_maxRetainedBytes = maxRetainedBytes;
+}
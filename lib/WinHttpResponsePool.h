@@ -0,0 +1,54 @@
+// The MIT License (MIT)
+// Response recycling for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include "WinHttpWrapper.h"
+
+namespace WinHttpWrapper
+{
+	// Per-thread cache of HttpResponse objects. A response taken from it
+	// keeps the buffer capacity of its earlier uses, so a thread sending many
+	// requests stops allocating once its buffers fit the usual response.
+	// Buffers over the retention cap are freed when the response comes back,
+	// so one large body does not stay pinned for the life of the thread.
+	class ResponsePool
+	{
+	public:
+		// Response taken from the pool, returned to the releasing thread's
+		// pool when destroyed
+		class Lease
+		{
+		public:
+			Lease() : m_Response(NULL) {}
+			Lease(Lease&& other) : m_Response(other.m_Response) { other.m_Response = NULL; }
+			Lease& operator=(Lease&& other);
+			~Lease();
+
+			HttpResponse& operator*() const { return *m_Response; }
+			HttpResponse* operator->() const { return m_Response; }
+
+		private:
+			friend class ResponsePool;
+
+			explicit Lease(HttpResponse* response) : m_Response(response) {}
+			Lease(const Lease&) = delete;
+			Lease& operator=(const Lease&) = delete;
+
+			HttpResponse* m_Response;
+		};
+
+		// The response is reset, ready to pass to a request
+		static Lease Acquire();
+
+		// Responses kept per thread, and capacity kept per buffer (bytes).
+		// Applies to every thread from its next release.
+		static void SetLimits(size_t maxPooled, size_t maxRetainedBytes);
+
+	private:
+		static void Release(HttpResponse* response);
+	};
+
+}
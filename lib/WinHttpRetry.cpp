@@ -0,0 +1,213 @@
+// The MIT License (MIT)
+// Retries for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#include "WinHttpRetry.h"
+#include "WinHttpCancel.h"
+#include "WinHttpMetrics.h"
+#include "WinHttpWrapper.h"
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <cwctype>
+#include <random>
+#include <thread>
+
+namespace
+{
+	// Retries a host may save up
+	const double kMaxBudget = 10.0;
+
+	bool SameText(const std::wstring& text, size_t offset, const wchar_t* name, size_t length)
+	{
+		if (text.size() < offset + length)
+			return false;
+		for (size_t i = 0; i < length; ++i)
+		{
+			if (towlower(text[offset + i]) != towlower(name[i]))
+				return false;
+		}
+		return true;
+	}
+
+	// Seconds since 1970 of an IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT")
+	bool ParseHttpDate(const std::wstring& value, long long& seconds)
+	{
+		static const wchar_t* const months[] = { L"Jan", L"Feb", L"Mar", L"Apr", L"May", L"Jun",
+			L"Jul", L"Aug", L"Sep", L"Oct", L"Nov", L"Dec" };
+		const size_t comma = value.find(L',');
+		if (comma == std::wstring::npos)
+			return false;
+		wchar_t month[4] = {};
+		int day = 0, year = 0, hour = 0, minute = 0, second = 0;
+		if (swscanf(value.c_str() + comma + 1, L"%d %3ls %d %d:%d:%d", &day, month, &year, &hour, &minute, &second) != 6)
+			return false;
+		int m = 0;
+		while (m < 12 && !SameText(months[m], 0, month, 3))
+			++m;
+		if (m == 12 || day < 1 || day > 31 || year < 1970)
+			return false;
+
+		// Days since 1970-01-01 of the civil date, March-based years
+		const int y = m < 2 ? year - 1 : year;
+		const int era = y / 400;
+		const int yearOfEra = y - era * 400;
+		const int dayOfYear = (153 * (m < 2 ? m + 10 : m - 2) + 2) / 5 + day - 1;
+		const int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+		const long long days = static_cast<long long>(era) * 146097 + dayOfEra - 719468;
+		seconds = days * 86400 + hour * 3600 + minute * 60 + second;
+		return true;
+	}
+}
+
+bool WinHttpWrapper::RetryPolicy::IsIdempotent(const std::wstring& verb)
+{
+	return verb == L"GET" || verb == L"HEAD" || verb == L"PUT" || verb == L"DELETE"
+		|| verb == L"OPTIONS" || verb == L"TRACE";
+}
+
+bool WinHttpWrapper::RetryPolicy::IsTransient(bool result, const HttpResponse& response)
+{
+	if (response.cancelled || response.circuitOpen)
+		return false;
+	// A failure after the response came in (a body over the size limit, a
+	// digest mismatch) would fail the same way again
+	if (!result)
+		return response.statusCode == 0;
+	return response.statusCode == 429 || response.statusCode == 502
+		|| response.statusCode == 503 || response.statusCode == 504;
+}
+
+DWORD WinHttpWrapper::RetryPolicy::Backoff(int retry) const
+{
+	thread_local std::minstd_rand random(static_cast<unsigned int>(
+		std::chrono::steady_clock::now().time_since_epoch().count()
+		^ std::hash<std::thread::id>()(std::this_thread::get_id())));
+	ULONGLONG cap = baseDelayMs;
+	for (int i = 1; i < retry && cap < maxDelayMs; ++i)
+		cap *= 2;
+	cap = (std::min)(cap, static_cast<ULONGLONG>(maxDelayMs));
+	return static_cast<DWORD>(std::uniform_int_distribution<ULONGLONG>(0, cap)(random));
+}
+
+bool WinHttpWrapper::RetryPolicy::RetryAfter(const std::wstring& headers, DWORD& delayMs)
+{
+	static const wchar_t name[] = L"Retry-After:";
+	const size_t length = sizeof(name) / sizeof(name[0]) - 1;
+	size_t line = 0;
+	while (line < headers.size() && !SameText(headers, line, name, length))
+	{
+		line = headers.find(L'\n', line);
+		if (line == std::wstring::npos)
+			return false;
+		++line;
+	}
+	if (line >= headers.size())
+		return false;
+
+	size_t end = headers.find_first_of(L"\r\n", line);
+	std::wstring value = headers.substr(line + length, end == std::wstring::npos ? std::wstring::npos : end - line - length);
+	value.erase(0, value.find_first_not_of(L" \t"));
+
+	if (!value.empty() && iswdigit(value[0]))
+	{
+		const unsigned long long seconds = wcstoull(value.c_str(), NULL, 10);
+		delayMs = static_cast<DWORD>((std::min)(seconds, 4000000ULL) * 1000);
+		return true;
+	}
+	long long date = 0;
+	if (!ParseHttpDate(value, date))
+		return false;
+	const long long seconds = date - static_cast<long long>(time(NULL));
+	delayMs = seconds > 0 ? static_cast<DWORD>((std::min)(seconds, 4000000LL) * 1000) : 0;
+	return true;
+}
+
+WinHttpWrapper::RetryBudget& WinHttpWrapper::RetryBudget::Instance()
+{
+	static RetryBudget instance;
+	return instance;
+}
+
+WinHttpWrapper::RetryBudget::RetryBudget()
+	: m_Ratio(0.1)
+	, m_MinPerSecond(1.0)
+	, m_Retries(0)
+	, m_OverBudget(0)
+{
+}
+
+void WinHttpWrapper::RetryBudget::SetLimits(double ratio, double minPerSecond)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Ratio = (std::max)(0.0, ratio);
+	m_MinPerSecond = (std::max)(0.0, minPerSecond);
+}
+
+WinHttpWrapper::RetryBudget::Budget& WinHttpWrapper::RetryBudget::Find(const std::wstring& host,
+	std::chrono::steady_clock::time_point now)
+{
+	auto it = m_Budgets.find(host);
+	if (it == m_Budgets.end())
+	{
+		// A host not seen yet starts with a full budget
+		Budget& budget = m_Budgets[host];
+		budget.tokens = kMaxBudget;
+		budget.refilled = now;
+		return budget;
+	}
+	Budget& budget = it->second;
+	const double elapsed = std::chrono::duration<double>(now - budget.refilled).count();
+	budget.tokens = (std::min)(kMaxBudget, budget.tokens + elapsed * m_MinPerSecond);
+	budget.refilled = now;
+	return budget;
+}
+
+void WinHttpWrapper::RetryBudget::Deposit(const std::wstring& host)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	Budget& budget = Find(host, std::chrono::steady_clock::now());
+	budget.tokens = (std::min)(kMaxBudget, budget.tokens + m_Ratio);
+}
+
+bool WinHttpWrapper::RetryBudget::Withdraw(const std::wstring& host)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	Budget& budget = Find(host, std::chrono::steady_clock::now());
+	if (budget.tokens < 1.0)
+	{
+		++m_OverBudget;
+		if (IsDebugLoggingEnabled()) {
+			DebugLogFormat(L"[RETRY] Retry budget of '%s' spent, not retrying", host.c_str());
+		}
+		return false;
+	}
+	budget.tokens -= 1.0;
+	++m_Retries;
+	return true;
+}
+
+bool WinHttpWrapper::RetryBudget::Wait(DWORD delayMs, const CancellationToken* cancel)
+{
+	CancellationToken::Registration registration;
+	if (cancel)
+	{
+		registration = cancel->OnCancel([this]
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Cancelled.notify_all();
+		});
+	}
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	return !m_Cancelled.wait_for(lock, std::chrono::milliseconds(delayMs),
+		[cancel] { return cancel && cancel->IsCancelled(); });
+}
+
+void WinHttpWrapper::RetryBudget::FillMetrics(Metrics& metrics)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	metrics.retries = m_Retries;
+	metrics.retriesOverBudget = m_OverBudget;
+}
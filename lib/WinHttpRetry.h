@@ -0,0 +1,92 @@
+// The MIT License (MIT)
+// Retries for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include "WinHttpPlatform.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace WinHttpWrapper
+{
+	struct Metrics;
+	struct HttpResponse;
+	class CancellationToken;
+
+	// When HttpRequest sends an idempotent request again (GET, HEAD, PUT,
+	// DELETE, OPTIONS, TRACE): after a transport failure, or a 429, 502,
+	// 503 or 504. Before retry n it waits a random time between 0 and
+	// baseDelayMs * 2^(n-1), at most maxDelayMs ("full jitter"), or what the
+	// Retry-After header of the response says. A Retry-After longer than
+	// maxDelayMs, or a wait ending past the request timeout, ends the retries.
+	struct RetryPolicy
+	{
+		RetryPolicy() : maxAttempts(1), baseDelayMs(100), maxDelayMs(10000) {}
+		RetryPolicy(int maxAttempts, DWORD baseDelayMs, DWORD maxDelayMs)
+			: maxAttempts(maxAttempts), baseDelayMs(baseDelayMs), maxDelayMs(maxDelayMs) {}
+
+		int maxAttempts;        // Including the first one, 1 for no retries
+		DWORD baseDelayMs;
+		DWORD maxDelayMs;
+
+		static bool IsIdempotent(const std::wstring& verb);
+		// Whether the outcome of an attempt is worth another one
+		static bool IsTransient(bool result, const HttpResponse& response);
+		// Random wait before retry (1 for the first one)
+		DWORD Backoff(int retry) const;
+		// Wait asked for by the Retry-After header of the response (seconds
+		// or HTTP date), false when there is none
+		static bool RetryAfter(const std::wstring& headers, DWORD& delayMs);
+	};
+
+	// Retries each host may get, so that retries do not multiply the load
+	// of a server already failing. Each request with retries adds ratio of
+	// a retry to the budget of its host, each retry takes one, and a host
+	// also gets minPerSecond retries a second. Budgets hold at most 10
+	// retries.
+	class RetryBudget
+	{
+	public:
+		static RetryBudget& Instance();
+
+		// Defaults 0.1 and 1: retries add about 10% to the requests of a
+		// host that fails them all
+		void SetLimits(double ratio, double minPerSecond);
+
+		// A request that may be retried is sent to host
+		void Deposit(const std::wstring& host);
+		// Take a retry from the budget of host, false when it is empty
+		bool Withdraw(const std::wstring& host);
+		// Sleep before a retry, false when cancel is cancelled first
+		bool Wait(DWORD delayMs, const CancellationToken* cancel);
+
+		void FillMetrics(Metrics& metrics);
+
+	private:
+		RetryBudget();
+
+		struct Budget
+		{
+			Budget() : tokens(0) {}
+
+			double tokens;
+			std::chrono::steady_clock::time_point refilled;
+		};
+
+		Budget& Find(const std::wstring& host, std::chrono::steady_clock::time_point now);
+
+		std::mutex m_Mutex;
+		std::condition_variable m_Cancelled;
+		std::unordered_map<std::wstring, Budget> m_Budgets;
+		double m_Ratio;
+		double m_MinPerSecond;
+		ULONGLONG m_Retries;            // Retries sent
+		ULONGLONG m_OverBudget;         // Retries dropped for want of budget
+	};
+
+}
@@ -0,0 +1,230 @@
+// The MIT License (MIT)
+// Request scheduler for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#include "WinHttpScheduler.h"
+#include "WinHttpCancel.h"
+#include "WinHttpMetrics.h"
+#include "WinHttpWrapper.h"
+#include <algorithm>
+
+void WinHttpWrapper::RequestScheduler::Slot::Release()
+{
+	if (m_Scheduler)
+	{
+		m_Scheduler->Release(m_Host, m_Priority);
+		m_Scheduler = NULL;
+	}
+}
+
+WinHttpWrapper::RequestScheduler& WinHttpWrapper::RequestScheduler::Instance()
+{
+	static RequestScheduler instance;
+	return instance;
+}
+
+WinHttpWrapper::RequestScheduler::RequestScheduler()
+	: m_MaxGlobal(32)
+	, m_MaxPerHost(8)
+	, m_Active(0)
+	, m_ActiveBulk(0)
+	, m_Queued(0)
+{
+	for (int p = 0; p < PRIORITY_COUNT; ++p)
+	{
+		m_Dispatched[p] = 0;
+		m_QueueTimeTotalUs[p] = 0;
+		m_QueueTimeMaxUs[p] = 0;
+	}
+}
+
+void WinHttpWrapper::RequestScheduler::SetLimits(int maxGlobal, int maxPerHost)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (maxGlobal > 0)
+		m_MaxGlobal = maxGlobal;
+	if (maxPerHost > 0)
+		m_MaxPerHost = maxPerHost;
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[SCHEDULER] Limits set - Global: %d, Per host: %d", m_MaxGlobal, m_MaxPerHost);
+	}
+
+	// Raised limits may let waiting requests start right away
+	Dispatch();
+	m_Granted.notify_all();
+}
+
+WinHttpWrapper::RequestScheduler::Slot WinHttpWrapper::RequestScheduler::Acquire(
+	const std::wstring& host, RequestPriority priority, const CancellationToken* cancel)
+{
+	if (priority < 0 || priority >= PRIORITY_COUNT)
+		priority = PRIORITY_NORMAL;
+
+	if (cancel && cancel->IsCancelled())
+		return Slot();
+
+	Waiter waiter;
+	waiter.host = host;
+	waiter.priority = priority;
+	waiter.granted = false;
+	waiter.enqueued = std::chrono::steady_clock::now();
+
+	// Wake the wait below when cancelled; declared before the lock so that
+	// it is unregistered after the lock is released
+	CancellationToken::Registration registration;
+	if (cancel)
+	{
+		registration = cancel->OnCancel([this]
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Granted.notify_all();
+		});
+	}
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	auto& queue = m_Queues[priority][host];
+	if (queue.empty())
+		m_HostOrder[priority].push_back(host);
+	queue.push_back(&waiter);
+	++m_Queued;
+
+	Dispatch();
+	if (!waiter.granted)
+	{
+		if (IsDebugLoggingEnabled()) {
+			DebugLogFormat(L"[SCHEDULER] Request to '%s' queued (priority %d, %d active)",
+				host.c_str(), static_cast<int>(priority), m_Active);
+		}
+		m_Granted.wait(lock, [&waiter, cancel] { return waiter.granted || (cancel && cancel->IsCancelled()); });
+
+		if (!waiter.granted)
+		{
+			Withdraw(&waiter);
+			if (IsDebugLoggingEnabled()) {
+				DebugLogFormat(L"[SCHEDULER] Request to '%s' cancelled while queued", host.c_str());
+			}
+			return Slot();
+		}
+	}
+
+	Slot slot;
+	slot.m_Scheduler = this;
+	slot.m_Host = host;
+	slot.m_Priority = priority;
+	return slot;
+}
+
+void WinHttpWrapper::RequestScheduler::Release(const std::wstring& host, RequestPriority priority)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	--m_Active;
+	if (priority == PRIORITY_BULK)
+		--m_ActiveBulk;
+	auto it = m_ActivePerHost.find(host);
+	if (it != m_ActivePerHost.end() && --it->second <= 0)
+		m_ActivePerHost.erase(it);
+
+	Dispatch();
+	m_Granted.notify_all();
+}
+
+bool WinHttpWrapper::RequestScheduler::CanStart(const std::wstring& host, RequestPriority priority) const
+{
+	if (m_Active >= m_MaxGlobal)
+		return false;
+
+	// Keep a quarter of the global slots (at least one) out of reach of bulk
+	// transfers, so a large batch never delays interactive requests
+	if (priority == PRIORITY_BULK)
+	{
+		int reserved = (std::max)(1, m_MaxGlobal / 4);
+		if (m_MaxGlobal > 1 && m_ActiveBulk >= m_MaxGlobal - reserved)
+			return false;
+	}
+
+	auto it = m_ActivePerHost.find(host);
+	return it == m_ActivePerHost.end() || it->second < m_MaxPerHost;
+}
+
+void WinHttpWrapper::RequestScheduler::Grant(Waiter* waiter)
+{
+	++m_Active;
+	if (waiter->priority == PRIORITY_BULK)
+		++m_ActiveBulk;
+	++m_ActivePerHost[waiter->host];
+	--m_Queued;
+	waiter->granted = true;
+
+	ULONGLONG waitedUs = static_cast<ULONGLONG>(std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - waiter->enqueued).count());
+	++m_Dispatched[waiter->priority];
+	m_QueueTimeTotalUs[waiter->priority] += waitedUs;
+	m_QueueTimeMaxUs[waiter->priority] = (std::max)(m_QueueTimeMaxUs[waiter->priority], waitedUs);
+}
+
+// Take a waiter that gave up out of its queue
+void WinHttpWrapper::RequestScheduler::Withdraw(Waiter* waiter)
+{
+	auto it = m_Queues[waiter->priority].find(waiter->host);
+	if (it == m_Queues[waiter->priority].end())
+		return;
+	std::deque<Waiter*>& queue = it->second;
+	queue.erase(std::remove(queue.begin(), queue.end(), waiter), queue.end());
+	--m_Queued;
+	if (queue.empty())
+	{
+		m_Queues[waiter->priority].erase(it);
+		std::deque<std::wstring>& order = m_HostOrder[waiter->priority];
+		order.erase(std::remove(order.begin(), order.end(), waiter->host), order.end());
+	}
+}
+
+// Start as many waiting requests as the limits allow: highest priority first,
+// and within a priority one request per host in turn
+void WinHttpWrapper::RequestScheduler::Dispatch()
+{
+	bool granted = true;
+	while (granted)
+	{
+		granted = false;
+		for (int p = 0; p < PRIORITY_COUNT && !granted; ++p)
+		{
+			auto& order = m_HostOrder[p];
+			for (size_t i = 0, n = order.size(); i < n; ++i)
+			{
+				std::wstring host = order.front();
+				order.pop_front();
+
+				auto it = m_Queues[p].find(host);
+				if (!CanStart(host, static_cast<RequestPriority>(p)))
+				{
+					order.push_back(host);
+					continue;
+				}
+
+				Grant(it->second.front());
+				it->second.pop_front();
+				if (it->second.empty())
+					m_Queues[p].erase(it);
+				else
+					order.push_back(host);
+				granted = true;
+				break;
+			}
+		}
+	}
+}
+
+void WinHttpWrapper::RequestScheduler::FillMetrics(Metrics& metrics)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	metrics.activeRequests = static_cast<unsigned int>(m_Active);
+	metrics.queuedRequests = m_Queued;
+	for (int p = 0; p < PRIORITY_COUNT; ++p)
+	{
+		metrics.dispatched[p] = m_Dispatched[p];
+		metrics.queueTimeTotalUs[p] = m_QueueTimeTotalUs[p];
+		metrics.queueTimeMaxUs[p] = m_QueueTimeMaxUs[p];
+	}
+}
@@ -0,0 +1,125 @@
+// The MIT License (MIT)
+// Request scheduler for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <unordered_map>
+#include "WinHttpPlatform.h"
+
+namespace WinHttpWrapper
+{
+	struct Metrics;
+	class CancellationToken;
+
+	enum RequestPriority
+	{
+		PRIORITY_INTERACTIVE = 0,   // Latency critical API calls
+		PRIORITY_NORMAL = 1,
+		PRIORITY_BULK = 2,          // Large transfers that can wait
+		PRIORITY_COUNT = 3
+	};
+
+	// Admission control in front of the transport: every request waits here
+	// for a slot under the global and per-host concurrency limits. Waiting
+	// requests are served by priority, and round-robin across hosts within a
+	// priority so that one busy host cannot monopolize the slots. Bulk
+	// requests never take the last slots, which stay free for the others.
+	class RequestScheduler
+	{
+	public:
+		// Releases its slot when destroyed
+		class Slot
+		{
+		public:
+			Slot() : m_Scheduler(NULL), m_Priority(PRIORITY_NORMAL) {}
+			Slot(Slot&& other)
+				: m_Scheduler(other.m_Scheduler)
+				, m_Host(std::move(other.m_Host))
+				, m_Priority(other.m_Priority)
+			{
+				other.m_Scheduler = NULL;
+			}
+			Slot& operator=(Slot&& other)
+			{
+				if (this != &other)
+				{
+					Release();
+					m_Scheduler = other.m_Scheduler;
+					m_Host = std::move(other.m_Host);
+					m_Priority = other.m_Priority;
+					other.m_Scheduler = NULL;
+				}
+				return *this;
+			}
+			~Slot()
+			{
+				Release();
+			}
+			void Release();
+
+			// False when the wait was cancelled
+			bool Granted() const { return m_Scheduler != NULL; }
+
+		private:
+			friend class RequestScheduler;
+			Slot(const Slot&) = delete;
+			Slot& operator=(const Slot&) = delete;
+
+			RequestScheduler* m_Scheduler;
+			std::wstring m_Host;
+			RequestPriority m_Priority;
+		};
+
+		static RequestScheduler& Instance();
+
+		// maxGlobal / maxPerHost <= 0 keep the current value
+		void SetLimits(int maxGlobal, int maxPerHost);
+
+		// Block until the request may start, or until cancel is cancelled
+		Slot Acquire(const std::wstring& host, RequestPriority priority,
+			const CancellationToken* cancel = NULL);
+
+		void FillMetrics(Metrics& metrics);
+
+	private:
+		RequestScheduler();
+
+		struct Waiter
+		{
+			std::wstring host;
+			RequestPriority priority;
+			bool granted;
+			std::chrono::steady_clock::time_point enqueued;
+		};
+
+		void Release(const std::wstring& host, RequestPriority priority);
+		bool CanStart(const std::wstring& host, RequestPriority priority) const;
+		void Grant(Waiter* waiter);
+		void Withdraw(Waiter* waiter);
+		void Dispatch();
+
+		std::mutex m_Mutex;
+		std::condition_variable m_Granted;
+		int m_MaxGlobal;
+		int m_MaxPerHost;
+		int m_Active;
+		int m_ActiveBulk;
+		unsigned int m_Queued;
+		std::unordered_map<std::wstring, int> m_ActivePerHost;
+		// Hosts with waiting requests, in round-robin order, per priority
+		std::deque<std::wstring> m_HostOrder[PRIORITY_COUNT];
+		std::unordered_map<std::wstring, std::deque<Waiter*>> m_Queues[PRIORITY_COUNT];
+
+		ULONGLONG m_Dispatched[PRIORITY_COUNT];
+		ULONGLONG m_QueueTimeTotalUs[PRIORITY_COUNT];
+		ULONGLONG m_QueueTimeMaxUs[PRIORITY_COUNT];
+	};
+
+}
@@ -0,0 +1,279 @@
+// The MIT License (MIT)
+// Bandwidth throttling for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#include "WinHttpThrottle.h"
+#include "WinHttpCancel.h"
+#include "WinHttpMetrics.h"
+#include "WinHttpTrace.h"
+#include "WinHttpWrapper.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	// Smallest grant worth waking up for, unless less is wanted or the
+	// burst is smaller
+	const size_t kMinGrant = 4 * 1024;
+
+	std::wstring HostName(const std::wstring& host)
+	{
+		std::wstring name = host;
+		for (wchar_t& c : name)
+		{
+			if (c >= L'A' && c <= L'Z')
+				c = static_cast<wchar_t>(c - L'A' + L'a');
+		}
+		return name;
+	}
+}
+
+WinHttpWrapper::BandwidthThrottle::Meter::Meter(const std::wstring& host, RequestPriority priority, const CancellationToken* cancel)
+	: m_Host(HostName(host))
+	, m_Priority(priority)
+	, m_Cancel(cancel)
+{
+}
+
+size_t WinHttpWrapper::BandwidthThrottle::Meter::Take(size_t wanted) const
+{
+	return BandwidthThrottle::Instance().Take(m_Host, m_Priority, wanted, m_Cancel);
+}
+
+void WinHttpWrapper::BandwidthThrottle::Meter::Refund(size_t bytes) const
+{
+	BandwidthThrottle::Instance().Refund(m_Host, m_Priority, bytes);
+}
+
+bool WinHttpWrapper::BandwidthThrottle::Meter::IsLimited() const
+{
+	return BandwidthThrottle::Instance().IsLimited(m_Host, m_Priority);
+}
+
+void WinHttpWrapper::BandwidthThrottle::Bucket::Refill(std::chrono::steady_clock::time_point now)
+{
+	const double elapsed = std::chrono::duration<double>(now - refilled).count();
+	if (elapsed > 0)
+		tokens = (std::min)(static_cast<double>(burst), tokens + elapsed * static_cast<double>(rate));
+	refilled = now;
+}
+
+WinHttpWrapper::BandwidthThrottle& WinHttpWrapper::BandwidthThrottle::Instance()
+{
+	static BandwidthThrottle instance;
+	return instance;
+}
+
+WinHttpWrapper::BandwidthThrottle::BandwidthThrottle()
+	: m_Enabled(false)
+	, m_Waits(0)
+	, m_WaitTimeUs(0)
+{
+}
+
+void WinHttpWrapper::BandwidthThrottle::SetLimit(Bucket& bucket, ULONGLONG bytesPerSecond, ULONGLONG burst)
+{
+	const bool wasLimited = bucket.rate != 0;
+	bucket.Refill(std::chrono::steady_clock::now());
+	bucket.rate = bytesPerSecond;
+	bucket.burst = bytesPerSecond == 0 ? 0 : (burst ? burst : bytesPerSecond);
+	// A new limit starts with a full bucket, a changed one keeps its level
+	bucket.tokens = wasLimited ? (std::min)(bucket.tokens, static_cast<double>(bucket.burst)) : static_cast<double>(bucket.burst);
+}
+
+void WinHttpWrapper::BandwidthThrottle::UpdateEnabled()
+{
+	bool enabled = m_Global.rate != 0 || !m_Hosts.empty();
+	for (int p = 0; p < PRIORITY_COUNT; ++p)
+		enabled = enabled || m_Priorities[p].rate != 0;
+	m_Enabled = enabled;
+
+	// Waiting transfers re-check against the new limits
+	m_Changed.notify_all();
+}
+
+void WinHttpWrapper::BandwidthThrottle::SetGlobalLimit(ULONGLONG bytesPerSecond, ULONGLONG burst)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	SetLimit(m_Global, bytesPerSecond, burst);
+	UpdateEnabled();
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[THROTTLE] Global limit set to %llu bytes/s (burst %llu)", m_Global.rate, m_Global.burst);
+	}
+}
+
+void WinHttpWrapper::BandwidthThrottle::SetHostLimit(const std::wstring& host, ULONGLONG bytesPerSecond, ULONGLONG burst)
+{
+	const std::wstring name = HostName(host);
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (bytesPerSecond == 0)
+		m_Hosts.erase(name);
+	else
+		SetLimit(m_Hosts[name], bytesPerSecond, burst);
+	UpdateEnabled();
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[THROTTLE] Limit of '%s' set to %llu bytes/s", name.c_str(), bytesPerSecond);
+	}
+}
+
+void WinHttpWrapper::BandwidthThrottle::SetPriorityLimit(RequestPriority priority, ULONGLONG bytesPerSecond, ULONGLONG burst)
+{
+	if (priority < 0 || priority >= PRIORITY_COUNT)
+		return;
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	SetLimit(m_Priorities[priority], bytesPerSecond, burst);
+	UpdateEnabled();
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[THROTTLE] Limit of priority %d set to %llu bytes/s", priority, bytesPerSecond);
+	}
+}
+
+int WinHttpWrapper::BandwidthThrottle::Limits(const std::wstring& host, RequestPriority priority, Bucket* buckets[3])
+{
+	int count = 0;
+	if (m_Global.rate)
+		buckets[count++] = &m_Global;
+	auto it = m_Hosts.find(host);
+	if (it != m_Hosts.end())
+		buckets[count++] = &it->second;
+	if (m_Priorities[priority].rate)
+		buckets[count++] = &m_Priorities[priority];
+	return count;
+}
+
+bool WinHttpWrapper::BandwidthThrottle::IsLimited(const std::wstring& host, RequestPriority priority)
+{
+	if (!m_Enabled)
+		return false;
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	Bucket* buckets[3];
+	return Limits(host, priority, buckets) > 0;
+}
+
+size_t WinHttpWrapper::BandwidthThrottle::Take(const std::wstring& host, RequestPriority priority,
+	size_t wanted, const CancellationToken* cancel)
+{
+	// Unlimited, the common case, stays off the lock
+	if (wanted == 0 || !m_Enabled)
+		return wanted;
+
+	// Wake the wait on cancellation (registered before taking the lock,
+	// which the callback needs)
+	CancellationToken::Registration registration;
+	if (cancel)
+	{
+		registration = cancel->OnCancel([this]
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Changed.notify_all();
+		});
+	}
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	bool waited = false;
+	std::chrono::steady_clock::time_point waitStart;
+	long long traceStart = -1;
+	for (;;)
+	{
+		Bucket* buckets[3];
+		const int count = Limits(host, priority, buckets);
+		if (count == 0)
+			return wanted;
+
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		double available = static_cast<double>(wanted);
+		size_t needed = (std::min)(wanted, kMinGrant);
+		for (int i = 0; i < count; ++i)
+		{
+			buckets[i]->Refill(now);
+			available = (std::min)(available, buckets[i]->tokens);
+			needed = static_cast<size_t>((std::min)(static_cast<ULONGLONG>(needed), buckets[i]->burst));
+		}
+
+		if (available >= static_cast<double>(needed))
+		{
+			const size_t granted = (std::min)(wanted, static_cast<size_t>(available));
+			for (int i = 0; i < count; ++i)
+			{
+				buckets[i]->tokens -= static_cast<double>(granted);
+				buckets[i]->bytes += granted;
+			}
+			if (waited)
+				m_WaitTimeUs += std::chrono::duration_cast<std::chrono::microseconds>(now - waitStart).count();
+			if (traceStart >= 0)
+				Tracer::Record("throttle", "http", traceStart, Tracer::Now(), "bytes", static_cast<long long>(granted));
+			return granted;
+		}
+
+		if (cancel && cancel->IsCancelled())
+			return 0;
+
+		// Sleep until the emptiest bucket holds enough
+		double seconds = 0;
+		for (int i = 0; i < count; ++i)
+		{
+			const double missing = static_cast<double>(needed) - buckets[i]->tokens;
+			if (missing <= 0)
+				continue;
+			seconds = (std::max)(seconds, missing / static_cast<double>(buckets[i]->rate));
+			if (!waited)
+				++buckets[i]->waits;
+		}
+		if (!waited)
+		{
+			waited = true;
+			waitStart = now;
+			++m_Waits;
+			if (Tracer::IsEnabled())
+				traceStart = Tracer::Now();
+		}
+		m_Changed.wait_for(lock, std::chrono::microseconds(static_cast<long long>(std::ceil(seconds * 1e6)) + 1));
+	}
+}
+
+void WinHttpWrapper::BandwidthThrottle::Refund(const std::wstring& host, RequestPriority priority, size_t bytes)
+{
+	if (bytes == 0 || !m_Enabled)
+		return;
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	Bucket* buckets[3];
+	const int count = Limits(host, priority, buckets);
+	for (int i = 0; i < count; ++i)
+	{
+		buckets[i]->tokens = (std::min)(static_cast<double>(buckets[i]->burst), buckets[i]->tokens + static_cast<double>(bytes));
+		buckets[i]->bytes -= (std::min)(static_cast<ULONGLONG>(bytes), buckets[i]->bytes);
+	}
+	m_Changed.notify_all();
+}
+
+void WinHttpWrapper::BandwidthThrottle::FillMetrics(Metrics& metrics)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	auto add = [&](Bucket& bucket, const std::wstring& host, int priority)
+	{
+		bucket.Refill(now);
+		BandwidthBucketMetrics entry;
+		entry.host = host;
+		entry.priority = priority;
+		entry.bytesPerSecond = bucket.rate;
+		entry.burst = bucket.burst;
+		entry.tokens = bucket.tokens;
+		entry.bytes = bucket.bytes;
+		entry.waits = bucket.waits;
+		metrics.bandwidthBuckets.push_back(entry);
+	};
+
+	if (m_Global.rate)
+		add(m_Global, std::wstring(), -1);
+	for (auto& host : m_Hosts)
+		add(host.second, host.first, -1);
+	for (int p = 0; p < PRIORITY_COUNT; ++p)
+	{
+		if (m_Priorities[p].rate)
+			add(m_Priorities[p], std::wstring(), p);
+	}
+	metrics.throttleWaits = m_Waits;
+	metrics.throttleWaitTimeUs = m_WaitTimeUs;
+}
@@ -0,0 +1,95 @@
+// The MIT License (MIT)
+// Bandwidth throttling for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <unordered_map>
+#include "WinHttpScheduler.h"
+
+namespace WinHttpWrapper
+{
+	// Token-bucket limits on the bytes of response bodies read and request
+	// bodies written, globally, per host and per priority. Each read or write
+	// takes tokens from every bucket that applies, and waits while one of
+	// them is empty, which leaves the data in the socket and lets TCP flow
+	// control slow the other end down. Buckets refill at their rate up to
+	// their burst size. Limits can change at any time, transfers waiting on a
+	// bucket pick them up right away.
+	class BandwidthThrottle
+	{
+	public:
+		// Pacing of one transfer. Thread-safe: the segments of a download
+		// share one.
+		class Meter
+		{
+		public:
+			Meter(const std::wstring& host, RequestPriority priority, const CancellationToken* cancel = NULL);
+
+			// Wait until some of wanted bytes may be transferred and return
+			// how many (wanted when unlimited), 0 when cancelled
+			size_t Take(size_t wanted) const;
+			// Give back bytes taken but not transferred
+			void Refund(size_t bytes) const;
+			// Whether a limit applies to this transfer right now
+			bool IsLimited() const;
+
+		private:
+			std::wstring m_Host;
+			RequestPriority m_Priority;
+			const CancellationToken* m_Cancel;
+		};
+
+		static BandwidthThrottle& Instance();
+
+		// bytesPerSecond 0 removes the limit. burst is the most bytes sent
+		// at once after an idle period, 0 for one second worth.
+		void SetGlobalLimit(ULONGLONG bytesPerSecond, ULONGLONG burst = 0);
+		// host is the server name, as in the URLs
+		void SetHostLimit(const std::wstring& host, ULONGLONG bytesPerSecond, ULONGLONG burst = 0);
+		void SetPriorityLimit(RequestPriority priority, ULONGLONG bytesPerSecond, ULONGLONG burst = 0);
+
+		void FillMetrics(Metrics& metrics);
+
+	private:
+		BandwidthThrottle();
+
+		struct Bucket
+		{
+			Bucket() : rate(0), burst(0), tokens(0), bytes(0), waits(0) {}
+
+			void Refill(std::chrono::steady_clock::time_point now);
+
+			ULONGLONG rate;             // Bytes per second, 0 when unlimited
+			ULONGLONG burst;
+			double tokens;
+			std::chrono::steady_clock::time_point refilled;
+			ULONGLONG bytes;            // Taken from it
+			ULONGLONG waits;            // Transfers it paused
+		};
+
+		size_t Take(const std::wstring& host, RequestPriority priority, size_t wanted, const CancellationToken* cancel);
+		void Refund(const std::wstring& host, RequestPriority priority, size_t bytes);
+		bool IsLimited(const std::wstring& host, RequestPriority priority);
+		// Buckets with a limit that apply to a transfer, at most 3
+		int Limits(const std::wstring& host, RequestPriority priority, Bucket* buckets[3]);
+		void SetLimit(Bucket& bucket, ULONGLONG bytesPerSecond, ULONGLONG burst);
+		void UpdateEnabled();
+
+		std::mutex m_Mutex;
+		std::condition_variable m_Changed;
+		std::atomic<bool> m_Enabled;    // Whether any limit is set, checked without the lock
+		Bucket m_Global;
+		Bucket m_Priorities[PRIORITY_COUNT];
+		std::unordered_map<std::wstring, Bucket> m_Hosts;
+		ULONGLONG m_Waits;
+		ULONGLONG m_WaitTimeUs;
+	};
+
+}
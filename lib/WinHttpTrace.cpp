@@ -0,0 +1,230 @@
+// The MIT License (MIT)
+// Request tracing for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#include "WinHttpTrace.h"
+#include "WinHttpWrapper.h"
+#include "WinHttpUtf.h"
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+#ifndef _WIN32
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+std::atomic<bool> WinHttpWrapper::Tracer::s_Enabled(false);
+
+namespace
+{
+	// Spans kept per thread until written, the rest are counted as dropped
+	const size_t kMaxEventsPerThread = 256 * 1024;
+
+	struct TraceEvent
+	{
+		const char* name;
+		const char* category;
+		const char* argName;
+		long long argValue;
+		ULONGLONG request;
+		long long start;
+		long long duration;
+	};
+
+	struct ThreadBuffer
+	{
+		ThreadBuffer() : tid(0), dropped(0) {}
+
+		std::mutex mutex;           // Only contended while writing the trace
+		std::vector<TraceEvent> events;
+		unsigned long tid;
+		ULONGLONG dropped;
+	};
+
+	std::mutex g_buffersMutex;
+	std::vector<std::shared_ptr<ThreadBuffer>> g_buffers;
+	std::atomic<ULONGLONG> g_nextRequestId(1);
+
+	thread_local std::shared_ptr<ThreadBuffer> t_buffer;
+	thread_local ULONGLONG t_request = 0;
+
+	const std::chrono::steady_clock::time_point g_epoch = std::chrono::steady_clock::now();
+
+	unsigned long CurrentThreadId()
+	{
+#ifdef _WIN32
+		return GetCurrentThreadId();
+#elif defined(__linux__)
+		return static_cast<unsigned long>(syscall(SYS_gettid));
+#else
+		static std::atomic<unsigned long> nextId(1);
+		return nextId++;
+#endif
+	}
+
+	unsigned long CurrentProcessId()
+	{
+#ifdef _WIN32
+		return GetCurrentProcessId();
+#else
+		return static_cast<unsigned long>(getpid());
+#endif
+	}
+
+	ThreadBuffer& LocalBuffer()
+	{
+		if (!t_buffer)
+		{
+			t_buffer = std::make_shared<ThreadBuffer>();
+			t_buffer->tid = CurrentThreadId();
+			std::lock_guard<std::mutex> lock(g_buffersMutex);
+			g_buffers.push_back(t_buffer);
+		}
+		return *t_buffer;
+	}
+}
+
+void WinHttpWrapper::Tracer::Start()
+{
+	{
+		std::lock_guard<std::mutex> lock(g_buffersMutex);
+		for (const std::shared_ptr<ThreadBuffer>& buffer : g_buffers)
+		{
+			std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+			buffer->events.clear();
+			buffer->dropped = 0;
+		}
+	}
+	s_Enabled = true;
+	if (IsDebugLoggingEnabled()) {
+		DebugLog(L"[TRACE] Tracing started");
+	}
+}
+
+void WinHttpWrapper::Tracer::Stop()
+{
+	s_Enabled = false;
+}
+
+long long WinHttpWrapper::Tracer::Now()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - g_epoch).count();
+}
+
+void WinHttpWrapper::Tracer::Record(const char* name, const char* category, long long start, long long end,
+	const char* argName, long long argValue)
+{
+	ThreadBuffer& buffer = LocalBuffer();
+	std::lock_guard<std::mutex> lock(buffer.mutex);
+	if (buffer.events.size() >= kMaxEventsPerThread)
+	{
+		++buffer.dropped;
+		return;
+	}
+	TraceEvent event = { name, category, argName, argValue, t_request, start, end - start };
+	buffer.events.push_back(event);
+}
+
+bool WinHttpWrapper::Tracer::Write(const std::wstring& path)
+{
+	// Take the events out, and forget the threads that are gone
+	std::vector<std::pair<unsigned long, std::vector<TraceEvent>>> threads;
+	ULONGLONG dropped = 0;
+	{
+		std::lock_guard<std::mutex> lock(g_buffersMutex);
+		for (size_t i = 0; i < g_buffers.size(); )
+		{
+			std::shared_ptr<ThreadBuffer>& buffer = g_buffers[i];
+			{
+				std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+				threads.push_back(std::make_pair(buffer->tid, std::vector<TraceEvent>()));
+				threads.back().second.swap(buffer->events);
+				dropped += buffer->dropped;
+				buffer->dropped = 0;
+			}
+			if (buffer.use_count() == 1)
+			{
+				buffer = g_buffers.back();
+				g_buffers.pop_back();
+			}
+			else
+				++i;
+		}
+	}
+
+	const unsigned long pid = CurrentProcessId();
+	std::string json;
+	json += "{\"traceEvents\":[\n";
+	json += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" + std::to_string(pid) +
+		",\"tid\":0,\"args\":{\"name\":\"WinHttpWrapper\"}}";
+	size_t count = 0;
+	char line[512];
+	for (const auto& thread : threads)
+	{
+		for (const TraceEvent& event : thread.second)
+		{
+			int written = snprintf(line, sizeof(line),
+				",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%lu,\"tid\":%lu,\"args\":{\"request\":%llu",
+				event.name, event.category, event.start, event.duration, pid, thread.first,
+				static_cast<unsigned long long>(event.request));
+			if (written > 0 && event.argName)
+				written += snprintf(line + written, sizeof(line) - written, ",\"%s\":%lld", event.argName, event.argValue);
+			if (written > 0 && static_cast<size_t>(written) < sizeof(line) - 2)
+			{
+				json.append(line, written);
+				json += "}}";
+			}
+			++count;
+		}
+	}
+	json += "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":" + std::to_string(dropped) + "}}\n";
+
+#ifdef _WIN32
+	HANDLE hFile = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ,
+		NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	DWORD written = 0;
+	const bool ok = WriteFile(hFile, json.data(), static_cast<DWORD>(json.size()), &written, NULL) && written == json.size();
+	CloseHandle(hFile);
+#else
+	FILE* file = fopen(WideToUtf8(path).c_str(), "wb");
+	if (!file)
+		return false;
+	const bool ok = fwrite(json.data(), 1, json.size(), file) == json.size();
+	fclose(file);
+#endif
+
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[TRACE] Wrote %zu spans (%llu dropped) to '%s'", count, dropped, path.c_str());
+	}
+	return ok;
+}
+
+WinHttpWrapper::TraceRequestScope::TraceRequestScope()
+	: m_Previous(t_request)
+{
+	if (t_request == 0 && Tracer::IsEnabled())
+		t_request = g_nextRequestId++;
+}
+
+WinHttpWrapper::TraceRequestScope::TraceRequestScope(ULONGLONG requestId)
+	: m_Previous(t_request)
+{
+	t_request = requestId;
+}
+
+WinHttpWrapper::TraceRequestScope::~TraceRequestScope()
+{
+	t_request = m_Previous;
+}
+
+ULONGLONG WinHttpWrapper::TraceRequestScope::Current()
+{
+	return t_request;
+}
@@ -0,0 +1,104 @@
+// The MIT License (MIT)
+// Request tracing for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <string>
+#include <atomic>
+#include "WinHttpPlatform.h"
+
+namespace WinHttpWrapper
+{
+	// Opt-in timeline of the requests: queueing, connecting, sending,
+	// waiting, every body chunk, ... as spans tagged with their thread and
+	// request, written as Chrome Trace Event JSON (opens in Perfetto or
+	// chrome://tracing). Each thread records into its own buffer, so a span
+	// costs an uncontended lock when tracing, and an atomic load otherwise.
+	class Tracer
+	{
+	public:
+		// Drop what was recorded so far and start recording
+		static void Start();
+		static void Stop();
+		static bool IsEnabled() { return s_Enabled.load(std::memory_order_relaxed); }
+
+		// Write what was recorded to path (overwritten), and forget it
+		static bool Write(const std::wstring& path);
+
+		// Microseconds on the trace clock
+		static long long Now();
+		// Span from start to end on the current thread. name, category and
+		// argName are kept as pointers: they must be string literals.
+		static void Record(const char* name, const char* category, long long start, long long end,
+			const char* argName = NULL, long long argValue = 0);
+
+	private:
+		static std::atomic<bool> s_Enabled;
+	};
+
+	// Tags the spans of the current thread with a request ID while in scope
+	class TraceRequestScope
+	{
+	public:
+		// A new ID when tracing, unless the thread is already in a request
+		TraceRequestScope();
+		// Continue a request on another thread
+		explicit TraceRequestScope(ULONGLONG requestId);
+		~TraceRequestScope();
+
+		// 0 outside requests
+		static ULONGLONG Current();
+
+	private:
+		TraceRequestScope(const TraceRequestScope&) = delete;
+		TraceRequestScope& operator=(const TraceRequestScope&) = delete;
+
+		ULONGLONG m_Previous;
+	};
+
+	// Span from construction to End() (or destruction), only recorded when
+	// tracing was enabled at construction. Literals only, as for Record().
+	class TraceSpan
+	{
+	public:
+		explicit TraceSpan(const char* name, const char* category = "http")
+			: m_Name(name)
+			, m_Category(category)
+			, m_ArgName(NULL)
+			, m_ArgValue(0)
+			, m_Start(Tracer::IsEnabled() ? Tracer::Now() : -1)
+		{}
+		~TraceSpan()
+		{
+			End();
+		}
+
+		void SetArg(const char* name, long long value)
+		{
+			m_ArgName = name;
+			m_ArgValue = value;
+		}
+
+		void End()
+		{
+			if (m_Start >= 0)
+			{
+				Tracer::Record(m_Name, m_Category, m_Start, Tracer::Now(), m_ArgName, m_ArgValue);
+				m_Start = -1;
+			}
+		}
+
+	private:
+		TraceSpan(const TraceSpan&) = delete;
+		TraceSpan& operator=(const TraceSpan&) = delete;
+
+		const char* m_Name;
+		const char* m_Category;
+		const char* m_ArgName;
+		long long m_ArgValue;
+		long long m_Start;
+	};
+
+}
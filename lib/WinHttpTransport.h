@@ -0,0 +1,67 @@
+// The MIT License (MIT)
+// Transport backends for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include "WinHttpWrapper.h"
+#include <memory>
+
+namespace WinHttpWrapper
+{
+	// One request as handed over by HttpRequest once it is scheduled, with
+	// everything the backend needs to send it. Only valid during Send().
+	struct TransportRequest
+	{
+		const std::wstring& verb;
+		const std::wstring& userAgent;
+		const std::wstring& domain;
+		const std::wstring& path;
+		int port;
+		bool secure;
+		const std::wstring& headers;   // CRLF separated, as given by the caller
+		const std::string& body;
+		BodySource* source;            // Streamed body instead of body, or NULL
+		const std::wstring& proxyUrl;  // host:port, empty for the default
+		const std::wstring& proxyUsername;
+		const std::wstring& proxyPassword;
+		const std::wstring& serverUsername;
+		const std::wstring& serverPassword;
+		const MimeClassifier& mime;
+		ULONGLONG maxResponseSize;     // 0 for none
+		RecordedExchange* record;      // Body chunks are added to it when set
+		const CancellationToken* cancel;  // Aborts the request when cancelled, or NULL
+		const BandwidthThrottle::Meter& meter;  // Paces the body bytes read and written
+		BodyHasher* hasher;            // Fed the response body as it is read, or NULL
+		DWORD timeoutMs;               // Longest wait for the server, 0 for the backend's own
+	};
+
+	// Backend under HttpRequest, doing the network I/O of Get/Post/Put/
+	// Delete/Upload. Scheduling, record/replay and response pooling stay in
+	// HttpRequest, so every backend gets them. Send() is called from any
+	// number of threads at once.
+	class Transport
+	{
+	public:
+		virtual ~Transport() {}
+
+		// Fill the (reset) response, false with response.error set on failure
+		virtual bool Send(const TransportRequest& request, HttpResponse& response) = 0;
+
+		// Backend of requests without their own: WinHttpTransport on
+		// Windows, PosixTransport elsewhere
+		static std::shared_ptr<Transport> Default();
+		static void SetDefault(std::shared_ptr<Transport> transport);
+	};
+
+#ifdef _WIN32
+	// WinHTTP, with proxy and authentication negotiation
+	class WinHttpTransport : public Transport
+	{
+	public:
+		bool Send(const TransportRequest& request, HttpResponse& response) override;
+	};
+#endif
+
+}
@@ -0,0 +1,271 @@
+// The MIT License (MIT)
+// UTF-8 / UTF-16 transcoding for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#include "WinHttpUtf.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WINHTTP_UTF_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	const char32_t kReplacement = 0xFFFD;
+	const bool kWide16 = sizeof(wchar_t) == 2;
+
+	// The output never needs more units than this, so it is sized once up front
+	// and trimmed at the end instead of measuring the input in a first pass
+	const size_t kMaxUtf8PerWide = kWide16 ? 3 : 4;
+
+#if WINHTTP_UTF_SSE2
+	// Widen 16 ASCII bytes to 16 wchar_t
+	inline void StoreAsciiWide(__m128i bytes, wchar_t* dst)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		__m128i lo = _mm_unpacklo_epi8(bytes, zero);
+		__m128i hi = _mm_unpackhi_epi8(bytes, zero);
+		if (kWide16)
+		{
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst), lo);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 8), hi);
+		}
+		else
+		{
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi16(lo, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4), _mm_unpackhi_epi16(lo, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 8), _mm_unpacklo_epi16(hi, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 12), _mm_unpackhi_epi16(hi, zero));
+		}
+	}
+
+	// Narrow 16 wchar_t to 16 bytes if they are all ASCII
+	inline bool StoreAsciiNarrow(const wchar_t* src, char* dst)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i* in = reinterpret_cast<const __m128i*>(src);
+		__m128i packed;
+		if (kWide16)
+		{
+			__m128i a = _mm_loadu_si128(in);
+			__m128i b = _mm_loadu_si128(in + 1);
+			__m128i high = _mm_and_si128(_mm_or_si128(a, b), _mm_set1_epi16(static_cast<short>(0xFF80)));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, zero)) != 0xFFFF)
+				return false;
+			packed = _mm_packus_epi16(a, b);
+		}
+		else
+		{
+			__m128i a = _mm_loadu_si128(in);
+			__m128i b = _mm_loadu_si128(in + 1);
+			__m128i c = _mm_loadu_si128(in + 2);
+			__m128i d = _mm_loadu_si128(in + 3);
+			__m128i all = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+			__m128i high = _mm_and_si128(all, _mm_set1_epi32(static_cast<int>(0xFFFFFF80)));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi32(high, zero)) != 0xFFFF)
+				return false;
+			packed = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst), packed);
+		return true;
+	}
+#endif
+
+	inline bool IsContinuation(unsigned char c)
+	{
+		return (c & 0xC0) == 0x80;
+	}
+
+	// Decode one non-ASCII sequence starting at src[i], advancing i past it.
+	// An invalid or truncated sequence yields U+FFFD and skips only the bytes
+	// that were a valid prefix, so the next lead byte is not swallowed.
+	char32_t DecodeSequence(const unsigned char* src, size_t size, size_t& i)
+	{
+		unsigned char lead = src[i++];
+		size_t needed;
+		char32_t cp;
+		unsigned char lo = 0x80, hi = 0xBF;
+
+		if (lead >= 0xC2 && lead <= 0xDF)
+		{
+			needed = 1;
+			cp = lead & 0x1F;
+		}
+		else if (lead >= 0xE0 && lead <= 0xEF)
+		{
+			needed = 2;
+			cp = lead & 0x0F;
+			if (lead == 0xE0)
+				lo = 0xA0;          // Overlong
+			else if (lead == 0xED)
+				hi = 0x9F;          // Surrogates
+		}
+		else if (lead >= 0xF0 && lead <= 0xF4)
+		{
+			needed = 3;
+			cp = lead & 0x07;
+			if (lead == 0xF0)
+				lo = 0x90;          // Overlong
+			else if (lead == 0xF4)
+				hi = 0x8F;          // Above U+10FFFF
+		}
+		else
+		{
+			return kReplacement;
+		}
+
+		for (size_t k = 0; k < needed; ++k)
+		{
+			if (i >= size)
+				return kReplacement;
+			unsigned char c = src[i];
+			if (k == 0 ? (c < lo || c > hi) : !IsContinuation(c))
+				return kReplacement;
+			cp = (cp << 6) | (c & 0x3F);
+			++i;
+		}
+		return cp;
+	}
+
+	inline char* EncodeUtf8(char32_t cp, char* dst)
+	{
+		if (cp < 0x80)
+		{
+			*dst++ = static_cast<char>(cp);
+		}
+		else if (cp < 0x800)
+		{
+			*dst++ = static_cast<char>(0xC0 | (cp >> 6));
+			*dst++ = static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		else if (cp < 0x10000)
+		{
+			*dst++ = static_cast<char>(0xE0 | (cp >> 12));
+			*dst++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			*dst++ = static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		else
+		{
+			*dst++ = static_cast<char>(0xF0 | (cp >> 18));
+			*dst++ = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+			*dst++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			*dst++ = static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		return dst;
+	}
+}
+
+void WinHttpWrapper::Utf8ToWide(const char* data, size_t size, std::wstring& out)
+{
+	out.resize(size);
+	if (size == 0)
+		return;
+
+	const unsigned char* src = reinterpret_cast<const unsigned char*>(data);
+	wchar_t* begin = &out[0];
+	wchar_t* dst = begin;
+	size_t i = 0;
+
+	while (i < size)
+	{
+#if WINHTTP_UTF_SSE2
+		while (i + 16 <= size)
+		{
+			__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			if (_mm_movemask_epi8(bytes) != 0)
+				break;
+			StoreAsciiWide(bytes, dst);
+			i += 16;
+			dst += 16;
+		}
+		if (i >= size)
+			break;
+#endif
+		if (src[i] < 0x80)
+		{
+			*dst++ = static_cast<wchar_t>(src[i++]);
+			continue;
+		}
+
+		char32_t cp = DecodeSequence(src, size, i);
+		if (kWide16 && cp >= 0x10000)
+		{
+			cp -= 0x10000;
+			*dst++ = static_cast<wchar_t>(0xD800 + (cp >> 10));
+			*dst++ = static_cast<wchar_t>(0xDC00 + (cp & 0x3FF));
+		}
+		else
+		{
+			*dst++ = static_cast<wchar_t>(cp);
+		}
+	}
+
+	out.resize(static_cast<size_t>(dst - begin));
+}
+
+void WinHttpWrapper::WideToUtf8(const wchar_t* data, size_t size, std::string& out)
+{
+	out.resize(size * kMaxUtf8PerWide);
+	if (size == 0)
+		return;
+
+	char* begin = &out[0];
+	char* dst = begin;
+	size_t i = 0;
+
+	while (i < size)
+	{
+#if WINHTTP_UTF_SSE2
+		while (i + 16 <= size && StoreAsciiNarrow(data + i, dst))
+		{
+			i += 16;
+			dst += 16;
+		}
+		if (i >= size)
+			break;
+#endif
+		char32_t cp = static_cast<char32_t>(data[i++]);
+		if (cp < 0x80)
+		{
+			*dst++ = static_cast<char>(cp);
+			continue;
+		}
+
+		if (cp >= 0xD800 && cp <= 0xDFFF)
+		{
+			// Only a high surrogate followed by a low one is a valid pair
+			char32_t next = i < size ? static_cast<char32_t>(data[i]) : 0;
+			if (kWide16 && cp <= 0xDBFF && next >= 0xDC00 && next <= 0xDFFF)
+			{
+				cp = 0x10000 + ((cp - 0xD800) << 10) + (next - 0xDC00);
+				++i;
+			}
+			else
+			{
+				cp = kReplacement;
+			}
+		}
+		else if (cp > 0x10FFFF)
+		{
+			cp = kReplacement;
+		}
+		dst = EncodeUtf8(cp, dst);
+	}
+
+	out.resize(static_cast<size_t>(dst - begin));
+}
+
+std::wstring WinHttpWrapper::Utf8ToWide(const std::string& str)
+{
+	std::wstring result;
+	Utf8ToWide(str.data(), str.size(), result);
+	return result;
+}
+
+std::string WinHttpWrapper::WideToUtf8(const std::wstring& str)
+{
+	std::string result;
+	WideToUtf8(str.data(), str.size(), result);
+	return result;
+}
@@ -0,0 +1,26 @@
+// The MIT License (MIT)
+// UTF-8 / UTF-16 transcoding for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+namespace WinHttpWrapper
+{
+	// Single pass transcoders between UTF-8 and the platform wide encoding
+	// (UTF-16 on Windows, UTF-32 where wchar_t is 4 bytes). Runs of ASCII are
+	// converted 16 bytes at a time when SSE2 is available. Invalid sequences
+	// are replaced by U+FFFD, like MultiByteToWideChar / WideCharToMultiByte.
+	//
+	// The overloads taking an output string overwrite it and reuse its
+	// capacity, so a caller converting in a loop allocates only once.
+	void Utf8ToWide(const char* data, size_t size, std::wstring& out);
+	void WideToUtf8(const wchar_t* data, size_t size, std::string& out);
+
+	std::wstring Utf8ToWide(const std::string& str);
+	std::string WideToUtf8(const std::wstring& str);
+
+}
@@ -0,0 +1,418 @@
+// The MIT License (MIT)
+// WebSockets for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#include "WinHttpWebSocket.h"
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+	const size_t kDefaultMaxMessageSize = 64 * 1024 * 1024;
+	const size_t kDefaultMaxQueuedBytes = 16 * 1024 * 1024;
+
+#ifdef _WIN32
+	const DWORD kFrameChunkSize = 64 * 1024;
+
+	std::wstring QueryRawHeaders(HINTERNET hRequest)
+	{
+		DWORD dwSize = 0;
+		WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_RAW_HEADERS_CRLF,
+			WINHTTP_HEADER_NAME_BY_INDEX, WINHTTP_NO_OUTPUT_BUFFER,
+			&dwSize, WINHTTP_NO_HEADER_INDEX);
+		if (GetLastError() != ERROR_INSUFFICIENT_BUFFER || dwSize == 0)
+			return L"";
+
+		std::wstring headers(dwSize / sizeof(wchar_t), L'\0');
+		if (!WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_RAW_HEADERS_CRLF,
+			WINHTTP_HEADER_NAME_BY_INDEX, &headers[0], &dwSize, WINHTTP_NO_HEADER_INDEX))
+			return L"";
+		headers.resize(dwSize / sizeof(wchar_t));
+		return headers;
+	}
+#endif
+}
+
+WinHttpWrapper::WebSocket::WebSocket()
+	: m_KeepAlive(0)
+	, m_MaxMessageSize(kDefaultMaxMessageSize)
+	, m_MaxQueuedBytes(kDefaultMaxQueuedBytes)
+#ifdef _WIN32
+	, m_Session(NULL)
+	, m_Connect(NULL)
+	, m_Socket(NULL)
+#endif
+	, m_QueuedBytes(0)
+	, m_Open(false)
+	, m_Closing(false)
+	, m_Stopping(false)
+	, m_CloseStatus(0)
+{
+}
+
+WinHttpWrapper::WebSocket::~WebSocket()
+{
+	Abort();
+}
+
+bool WinHttpWrapper::WebSocket::IsOpen() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Open;
+}
+
+USHORT WinHttpWrapper::WebSocket::CloseStatus() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_CloseStatus;
+}
+
+std::string WinHttpWrapper::WebSocket::CloseReason() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_CloseReason;
+}
+
+std::wstring WinHttpWrapper::WebSocket::Error() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Error;
+}
+
+bool WinHttpWrapper::WebSocket::Poll(WebSocketMessage& message)
+{
+	return Wait(message, 0);
+}
+
+bool WinHttpWrapper::WebSocket::Wait(WebSocketMessage& message, DWORD timeoutMs)
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	auto ready = [this] { return !m_Queue.empty() || !m_Open; };
+	if (timeoutMs == INFINITE)
+		m_Changed.wait(lock, ready);
+	else if (timeoutMs > 0)
+		m_Changed.wait_for(lock, std::chrono::milliseconds(timeoutMs), ready);
+
+	if (m_Queue.empty())
+		return false;
+
+	message = std::move(m_Queue.front());
+	m_Queue.pop_front();
+	m_QueuedBytes -= message.data.size();
+	// The receiver may be waiting for room in the queue
+	m_Changed.notify_all();
+	return true;
+}
+
+void WinHttpWrapper::WebSocket::Finish(USHORT status, const std::string& reason, const std::wstring& error)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (!m_Open)
+		return;
+	m_Open = false;
+	m_CloseStatus = status;
+	m_CloseReason = reason;
+	m_Error = error;
+	m_Changed.notify_all();
+
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[WEBSOCKET] Closed with status %u%s%s", status,
+			error.empty() ? L"" : L": ", error.c_str());
+	}
+}
+
+#ifdef _WIN32
+void WinHttpWrapper::WebSocket::Start(HINTERNET hSession, HINTERNET hConnect, HINTERNET hWebSocket)
+{
+	m_Session = hSession;
+	m_Connect = hConnect;
+	m_Socket = hWebSocket;
+	m_Open = true;
+	m_Receiver = std::thread(&WebSocket::ReceiveLoop, this, hWebSocket);
+}
+
+bool WinHttpWrapper::WebSocket::Send(const void* data, size_t size, bool binary)
+{
+	std::lock_guard<std::mutex> sendLock(m_SendMutex);
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (!m_Open || m_Closing)
+			return false;
+	}
+
+	// Sent straight from the caller's buffer, in fragments when it does not
+	// fit in one chunk
+	const BYTE* bytes = static_cast<const BYTE*>(data);
+	const WINHTTP_WEB_SOCKET_BUFFER_TYPE fragmentType = binary
+		? WINHTTP_WEB_SOCKET_BINARY_FRAGMENT_BUFFER_TYPE
+		: WINHTTP_WEB_SOCKET_UTF8_FRAGMENT_BUFFER_TYPE;
+	const WINHTTP_WEB_SOCKET_BUFFER_TYPE messageType = binary
+		? WINHTTP_WEB_SOCKET_BINARY_MESSAGE_BUFFER_TYPE
+		: WINHTTP_WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE;
+
+	size_t offset = 0;
+	do
+	{
+		const DWORD count = static_cast<DWORD>((std::min)(size - offset, static_cast<size_t>(kFrameChunkSize)));
+		const bool last = offset + count == size;
+		DWORD dwError = WinHttpWebSocketSend(m_Socket, last ? messageType : fragmentType,
+			const_cast<BYTE*>(bytes + offset), count);
+		if (dwError != ERROR_SUCCESS)
+		{
+			if (IsDebugLoggingEnabled()) {
+				DebugLogFormat(L"[WEBSOCKET] Send failed, error code: %lu", dwError);
+			}
+			return false;
+		}
+		offset += count;
+	} while (offset < size);
+
+	return true;
+}
+
+void WinHttpWrapper::WebSocket::Close(USHORT status, const std::string& reason, DWORD timeoutMs)
+{
+	{
+		std::lock_guard<std::mutex> sendLock(m_SendMutex);
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		if (m_Open && !m_Closing)
+		{
+			m_Closing = true;
+			lock.unlock();
+
+			// Close reasons are limited to 123 bytes by the protocol
+			std::string text = reason.substr(0, 123);
+			WinHttpWebSocketShutdown(m_Socket, status,
+				text.empty() ? NULL : &text[0], static_cast<DWORD>(text.size()));
+		}
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_Changed.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] { return !m_Open; });
+	}
+
+	Abort();
+}
+
+void WinHttpWrapper::WebSocket::Abort()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stopping = true;
+		m_Changed.notify_all();
+	}
+
+	// Closing the handle makes a pending receive return
+	{
+		std::lock_guard<std::mutex> sendLock(m_SendMutex);
+		if (m_Socket)
+		{
+			WinHttpCloseHandle(m_Socket);
+			m_Socket = NULL;
+		}
+	}
+	if (m_Receiver.joinable())
+		m_Receiver.join();
+
+	if (m_Connect)
+	{
+		WinHttpCloseHandle(m_Connect);
+		m_Connect = NULL;
+	}
+	if (m_Session)
+	{
+		WinHttpCloseHandle(m_Session);
+		m_Session = NULL;
+	}
+
+	Finish(WINHTTP_WEB_SOCKET_ABORTED_CLOSE_STATUS, "", L"");
+}
+
+void WinHttpWrapper::WebSocket::ReceiveLoop(HINTERNET hWebSocket)
+{
+	// Frames are received straight into the message they belong to
+	WebSocketMessage message;
+	size_t used = 0;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Changed.wait(lock, [this] { return m_QueuedBytes < m_MaxQueuedBytes || m_Stopping; });
+			if (m_Stopping)
+				return;
+		}
+
+		if (message.data.size() - used < kFrameChunkSize)
+			message.data.resize(used + kFrameChunkSize);
+
+		DWORD dwRead = 0;
+		WINHTTP_WEB_SOCKET_BUFFER_TYPE type;
+		DWORD dwError = WinHttpWebSocketReceive(hWebSocket, &message.data[used], kFrameChunkSize, &dwRead, &type);
+		if (dwError != ERROR_SUCCESS)
+		{
+			bool stopping;
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				stopping = m_Stopping;
+			}
+			if (!stopping)
+				Finish(WINHTTP_WEB_SOCKET_ABORTED_CLOSE_STATUS, "", L"WebSocket connection lost!");
+			return;
+		}
+
+		if (type == WINHTTP_WEB_SOCKET_CLOSE_BUFFER_TYPE)
+		{
+			USHORT status = 0;
+			char reason[123];
+			DWORD dwReasonLength = 0;
+			if (WinHttpWebSocketQueryCloseStatus(hWebSocket, &status, reason, sizeof(reason), &dwReasonLength) != ERROR_SUCCESS)
+				status = WINHTTP_WEB_SOCKET_ABORTED_CLOSE_STATUS;
+
+			// Complete the handshake when the server started it
+			bool closing;
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				closing = m_Closing;
+				m_Closing = true;
+			}
+			if (!closing)
+			{
+				std::lock_guard<std::mutex> sendLock(m_SendMutex);
+				if (m_Socket)
+					WinHttpWebSocketShutdown(m_Socket, status, NULL, 0);
+			}
+
+			Finish(status, std::string(reason, dwReasonLength), L"");
+			return;
+		}
+
+		used += dwRead;
+		if (m_MaxMessageSize && used > m_MaxMessageSize)
+		{
+			{
+				std::lock_guard<std::mutex> sendLock(m_SendMutex);
+				if (m_Socket)
+					WinHttpWebSocketShutdown(m_Socket, WINHTTP_WEB_SOCKET_MESSAGE_TOO_BIG_CLOSE_STATUS, NULL, 0);
+			}
+			Finish(WINHTTP_WEB_SOCKET_MESSAGE_TOO_BIG_CLOSE_STATUS, "", L"WebSocket message exceeds the size limit!");
+			return;
+		}
+
+		if (type == WINHTTP_WEB_SOCKET_BINARY_MESSAGE_BUFFER_TYPE ||
+			type == WINHTTP_WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE)
+		{
+			message.data.resize(used);
+			// Small messages should not keep a whole chunk allocated while queued
+			if (message.data.capacity() - used > kFrameChunkSize / 2)
+				message.data.shrink_to_fit();
+			message.binary = type == WINHTTP_WEB_SOCKET_BINARY_MESSAGE_BUFFER_TYPE;
+
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_QueuedBytes += used;
+			m_Queue.push_back(std::move(message));
+			m_Changed.notify_all();
+
+			message = WebSocketMessage();
+			used = 0;
+		}
+	}
+}
+
+bool WinHttpWrapper::HttpRequest::OpenWebSocket(const std::wstring& rest_of_path,
+	const std::wstring& requestHeader,
+	WebSocket& socket,
+	HttpResponse& response)
+{
+	response.Reset();
+
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[WEBSOCKET] Opening '%s:%d%s'", m_Domain.c_str(), m_Port, rest_of_path.c_str());
+	}
+
+	// The connection is long-lived, so it does not take a scheduler slot
+	HINTERNET hSession = OpenSession(m_UserAgent, m_ProxyUrl, m_ProxyUsername);
+	if (!hSession)
+	{
+		response.error = L"Failed to open HTTP session!";
+		return false;
+	}
+
+	if (socket.m_KeepAlive)
+	{
+		DWORD dwKeepAlive = socket.m_KeepAlive;
+		WinHttpSetOption(hSession, WINHTTP_OPTION_WEB_SOCKET_KEEPALIVE_INTERVAL, &dwKeepAlive, sizeof(dwKeepAlive));
+	}
+
+	HINTERNET hConnect = WinHttpConnect(hSession, m_Domain.c_str(), m_Port, 0);
+	if (!hConnect)
+	{
+		WinHttpCloseHandle(hSession);
+		response.error = L"Failed to connect to server!";
+		return false;
+	}
+
+	HINTERNET hRequest = WinHttpOpenRequest(hConnect, L"GET", rest_of_path.c_str(),
+		NULL, WINHTTP_NO_REFERER,
+		WINHTTP_DEFAULT_ACCEPT_TYPES,
+		WINHTTP_FLAG_REFRESH | (m_Secure ? WINHTTP_FLAG_SECURE : 0));
+	if (!hRequest)
+	{
+		WinHttpCloseHandle(hConnect);
+		WinHttpCloseHandle(hSession);
+		response.error = L"Failed to open request!";
+		return false;
+	}
+
+	// Hosts that need an authentication round trip must have been
+	// authenticated by a regular request first
+	ApplyCachedCredentials(hRequest, m_Domain, m_Port,
+		m_ProxyUsername, m_ProxyPassword, m_ServerUsername, m_ServerPassword, m_ProxyUrl);
+
+	DWORD dwSize = sizeof(DWORD);
+	BOOL bResults = WinHttpSetOption(hRequest, WINHTTP_OPTION_UPGRADE_TO_WEB_SOCKET, NULL, 0) &&
+		WinHttpSendRequest(hRequest,
+			requestHeader.empty() ? WINHTTP_NO_ADDITIONAL_HEADERS : requestHeader.c_str(),
+			requestHeader.empty() ? 0 : static_cast<DWORD>(-1),
+			WINHTTP_NO_REQUEST_DATA, 0, 0, 0) &&
+		WinHttpReceiveResponse(hRequest, NULL) &&
+		WinHttpQueryHeaders(hRequest,
+			WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+			WINHTTP_HEADER_NAME_BY_INDEX, &response.statusCode, &dwSize,
+			WINHTTP_NO_HEADER_INDEX);
+
+	HINTERNET hWebSocket = NULL;
+	if (!bResults)
+	{
+		DWORD lastError = GetLastError();
+		if (IsDebugLoggingEnabled()) {
+			DebugLogFormat(L"[WEBSOCKET] Upgrade request failed, error code: %lu", lastError);
+		}
+		response.error = L"Failed to send WebSocket upgrade request!";
+	}
+	else
+	{
+		response.header = QueryRawHeaders(hRequest);
+		if (response.statusCode != 101)
+			response.error = L"WebSocket upgrade refused!";
+		else if (!(hWebSocket = WinHttpWebSocketCompleteUpgrade(hRequest, 0)))
+			response.error = L"Failed to complete WebSocket upgrade!";
+	}
+
+	// The request handle is not needed once upgraded
+	WinHttpCloseHandle(hRequest);
+
+	if (!hWebSocket)
+	{
+		WinHttpCloseHandle(hConnect);
+		WinHttpCloseHandle(hSession);
+		return false;
+	}
+
+	socket.Start(hSession, hConnect, hWebSocket);
+	return true;
+}
+
+#endif
@@ -0,0 +1,120 @@
+// The MIT License (MIT)
+// WebSockets for WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include "WinHttpWrapper.h"
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#ifndef _WIN32
+#include "WinHttpPosixTransport.h"
+#endif
+
+namespace WinHttpWrapper
+{
+	struct WebSocketMessage
+	{
+		WebSocketMessage() : binary(false) {}
+		std::string data;           // UTF-8 text, or bytes when binary
+		bool binary;
+	};
+
+	// WebSocket connection opened with HttpRequest::OpenWebSocket().
+	// A receiver thread reassembles fragmented messages and queues them
+	// until Poll() or Wait() takes them; it stops reading from the socket
+	// while the queue is full, so a slow consumer slows the server down
+	// instead of growing memory. WinHTTP answers pings and sends keep-alive
+	// frames by itself; outside Windows the frames are handled here, on a
+	// connection upgraded by PosixTransport, and the receiver answers pings
+	// and sends a ping after each keep-alive interval without traffic.
+	// Send() and the receiving side may be used from different threads.
+	class WebSocket
+	{
+	public:
+		WebSocket();
+		~WebSocket();
+
+		// Settings read when the connection is opened
+		// Interval between keep-alive frames, in ms (WinHTTP enforces a
+		// 15000 minimum, 0 keeps its default of 30000)
+		void SetKeepAliveInterval(DWORD milliseconds) { m_KeepAlive = milliseconds; }
+		// Larger incoming messages close the connection with 1009 (0 for no limit)
+		void SetMaxMessageSize(size_t bytes) { m_MaxMessageSize = bytes; }
+		// Received bytes waiting for the consumer before reading pauses
+		void SetMaxQueuedBytes(size_t bytes) { m_MaxQueuedBytes = bytes; }
+
+		bool IsOpen() const;
+
+		// Messages larger than one frame chunk are sent as fragments
+		bool Send(const void* data, size_t size, bool binary);
+
+		// Take the next message without waiting, false when none is queued
+		bool Poll(WebSocketMessage& message);
+
+		// Wait up to timeoutMs for a message (INFINITE to wait for one or
+		// for the connection to close)
+		bool Wait(WebSocketMessage& message, DWORD timeoutMs);
+
+		// Closing handshake: send a close frame and wait up to timeoutMs for
+		// the server's one before dropping the connection. Queued messages
+		// can still be taken afterwards.
+		void Close(USHORT status = WINHTTP_WEB_SOCKET_SUCCESS_CLOSE_STATUS,
+			const std::string& reason = "", DWORD timeoutMs = 2000);
+
+		// Valid once IsOpen() is false: the close status sent by the server
+		// (1006 when the connection dropped without one), and why it dropped
+		USHORT CloseStatus() const;
+		std::string CloseReason() const;
+		std::wstring Error() const;
+
+	private:
+		friend class HttpRequest;
+
+		WebSocket(const WebSocket&) = delete;
+		WebSocket& operator=(const WebSocket&) = delete;
+
+#ifdef _WIN32
+		void Start(HINTERNET hSession, HINTERNET hConnect, HINTERNET hWebSocket);
+		void ReceiveLoop(HINTERNET hWebSocket);
+#else
+		void Start(std::unique_ptr<PosixTransport::Stream> stream);
+		void ReceiveLoop();
+		// One masked frame, with m_SendMutex held
+		bool SendFrame(BYTE opcode, const void* data, size_t size, bool final);
+		// Close frame, with m_SendMutex held
+		bool SendClose(USHORT status, const std::string& reason);
+#endif
+		void Finish(USHORT status, const std::string& reason, const std::wstring& error);
+		void Abort();
+
+		DWORD m_KeepAlive;
+		size_t m_MaxMessageSize;
+		size_t m_MaxQueuedBytes;
+
+#ifdef _WIN32
+		HINTERNET m_Session;
+		HINTERNET m_Connect;
+		HINTERNET m_Socket;
+#else
+		std::unique_ptr<PosixTransport::Stream> m_Stream;
+		std::vector<char> m_Frame;  // Masked frame being sent
+#endif
+		std::mutex m_SendMutex;     // One send at a time, handle closed under it
+		std::thread m_Receiver;
+
+		mutable std::mutex m_Mutex;
+		std::condition_variable m_Changed;
+		std::deque<WebSocketMessage> m_Queue;
+		size_t m_QueuedBytes;
+		bool m_Open;
+		bool m_Closing;             // Close frame sent by us
+		bool m_Stopping;            // Receiver asked to exit
+		USHORT m_CloseStatus;
+		std::string m_CloseReason;
+		std::wstring m_Error;
+	};
+
+}
@@ -4,6 +4,8 @@
 //
 // http://opensource.org/licenses/MIT
 
+#ifdef _WIN32
+
 #include "WinHttpWinVersion.h"
 #include <Windows.h>
 
@@ -35,4 +37,6 @@ bool WinHttpWinVersion::IsBuildNumGreaterOrEqual(unsigned int buildNumber)
 		return (buildNumber >= info.BuildNum);
 	}
 	return false;
-}
\ No newline at end of file
+}
+
+#endif
@@ -1,5 +1,5 @@
 // The MIT License (MIT)
-// WinHTTP Wrapper 1.0.6
+// WinHTTP Wrapper 1.0.29
 // Copyright (C) 2020 - 2022, by Wong Shao Voon (shaovoon@yahoo.com)
 //
 // http://opensource.org/licenses/MIT
@@ -8,14 +8,46 @@
 // version 1.0.4: Add hGetHeaderDictionary() and contentLength to HttpResponse class
 // version 1.0.5: Add binary response support with automatic content-type detection
 // version 1.0.6: Use DEFAULT_PROXY consistently, add explicit proxy URL support with credential parsing
+// version 1.0.7: Cache negotiated auth schemes per host, discard 401/407 challenge bodies unread
+// version 1.0.8: Add segmented (parallel multi-range) downloads to a file or buffer
+// version 1.0.9: Add resumable downloads with on-disk checkpoints
+// version 1.0.10: Schedule requests under global/per-host concurrency limits and priorities
+// version 1.0.11: Table-driven MIME classification with suffix rules and content sniffing
+// version 1.0.12: Add per-response body size limits and a process-wide memory budget
+// version 1.0.13: Add HttpClient with prepared requests
+// version 1.0.14: Stream request bodies from a BodySource (multipart uploads)
+// version 1.0.15: Add WebSocket connections
+// version 1.0.16: Add Server-Sent Events subscriptions
+// version 1.0.17: Read bodies in place and recycle responses through a ResponsePool
+// version 1.0.18: Record and replay traffic through a TrafficLog
+// version 1.0.19: Pluggable transports, with a POSIX socket backend outside Windows
+// version 1.0.20: Cancel queued and in-flight requests through CancellationTokens
+// version 1.0.21: Token-bucket bandwidth limits, globally, per host and per priority
+// version 1.0.22: Chrome Trace Event export of request timelines
+// version 1.0.23: Native buffers to keep large bodies out of garbage-collected heaps
+// version 1.0.24: Follow append-only resources with incremental Range requests
+// version 1.0.25: Hash response bodies while they are read, with expected digests
+// version 1.0.26: Endpoint groups routing requests to the fastest healthy mirror
+// version 1.0.27: Retry idempotent requests with jittered backoff, Retry-After and per-host budgets
+// version 1.0.28: Per-server circuit breakers failing requests fast while a server is down
+// version 1.0.29: Send request bodies from caller-owned memory (MemorySource) without copying
 
 #include "WinHttpWrapper.h"
-#include <winhttp.h>
+#include "WinHttpReplay.h"
+#include "WinHttpTransport.h"
 #include <algorithm>
+#include <climits>
+#include <cstdarg>
+#include <cstring>
+#include <cwchar>
 #include <iostream>
 #include <sstream>
 
+#ifdef _WIN32
 #pragma comment(lib, "Winhttp.lib")
+#else
+#include "WinHttpPosixTransport.h"
+#endif
 
 // Debug logging implementation
 namespace
@@ -28,8 +60,35 @@ namespace
 	{
 		// Output to both console and debug output
 		std::wcout << message << std::endl;
+#ifdef _WIN32
 		OutputDebugStringW((message + L"\n").c_str());
+#endif
 	}
+
+#ifndef _WIN32
+	// The log formats follow MSVC, where %s and %c take wide arguments in
+	// wide format strings; elsewhere those need the l modifier
+	std::wstring PortableFormat(const wchar_t* format)
+	{
+		std::wstring result;
+		for (const wchar_t* p = format; *p; ++p)
+		{
+			result += *p;
+			if (*p != L'%')
+				continue;
+			if (p[1] == L'%')
+			{
+				result += *++p;
+				continue;
+			}
+			while (p[1] && wcschr(L"-+ #0123456789.*", p[1]))
+				result += *++p;
+			if (p[1] == L's' || p[1] == L'c')
+				result += L'l';
+		}
+		return result;
+	}
+#endif
 }
 
 void WinHttpWrapper::EnableDebugLogging(bool enable)
@@ -80,17 +139,326 @@ void WinHttpWrapper::DebugLogFormat(const wchar_t* format, ...)
 	va_list args;
 	va_start(args, format);
 
+#ifdef _WIN32
 	// Calculate required buffer size
 	int size = _vscwprintf(format, args) + 1;
 	std::vector<wchar_t> buffer(size);
 
 	// Format the string
 	vswprintf_s(buffer.data(), size, format, args);
+#else
+	// vswprintf cannot measure the output: grow the buffer until it fits
+	const std::wstring portableFormat = PortableFormat(format);
+	std::vector<wchar_t> buffer(256);
+	for (;;)
+	{
+		va_list attempt;
+		va_copy(attempt, args);
+		int written = vswprintf(buffer.data(), buffer.size(), portableFormat.c_str(), attempt);
+		va_end(attempt);
+		if (written >= 0 || buffer.size() >= 1024 * 1024)
+			break;
+		buffer.resize(buffer.size() * 4);
+	}
+	buffer.back() = L'\0';
+#endif
 	va_end(args);
 
 	DebugLog(std::wstring(buffer.data()));
 }
 
+#ifdef _WIN32
+// Authentication scheme cache
+namespace
+{
+	// Scheme negotiated per (target, host, port), so that later requests can
+	// call WinHttpSetCredentials up front instead of paying for the 401/407
+	// challenge round-trip (and the body re-upload) on every call.
+	// The realm is not part of the key: it is only known once the challenge
+	// has been received, which is exactly what the cache avoids.
+	std::mutex g_authCacheMutex;
+	std::unordered_map<std::wstring, DWORD> g_authSchemeCache;
+
+	std::wstring AuthCacheKey(DWORD dwTarget, const std::wstring& host, int port)
+	{
+		std::wstring key = (dwTarget == WINHTTP_AUTH_TARGET_PROXY) ? L"proxy|" : L"server|";
+		key += host;
+		if (port > 0)
+		{
+			key += L':';
+			key += std::to_wstring(port);
+		}
+		return key;
+	}
+
+	DWORD LookupAuthScheme(DWORD dwTarget, const std::wstring& host, int port)
+	{
+		std::lock_guard<std::mutex> lock(g_authCacheMutex);
+		auto it = g_authSchemeCache.find(AuthCacheKey(dwTarget, host, port));
+		return it != g_authSchemeCache.end() ? it->second : 0;
+	}
+
+	void StoreAuthScheme(DWORD dwTarget, const std::wstring& host, int port, DWORD dwScheme)
+	{
+		std::lock_guard<std::mutex> lock(g_authCacheMutex);
+		if (dwScheme != 0)
+			g_authSchemeCache[AuthCacheKey(dwTarget, host, port)] = dwScheme;
+		else
+			g_authSchemeCache.erase(AuthCacheKey(dwTarget, host, port));
+	}
+}
+
+// Streamed request bodies
+namespace
+{
+	const DWORD kWriteChunkSize = 64 * 1024;
+
+	// In-memory body written like a streamed one, so that it can be paced
+	class BufferSource : public WinHttpWrapper::BodySource
+	{
+	public:
+		explicit BufferSource(const std::string& body) : m_Body(body), m_Pos(0) {}
+
+		ULONGLONG Length() const override { return m_Body.size(); }
+		bool Rewind() override
+		{
+			m_Pos = 0;
+			return true;
+		}
+		bool Read(uint8_t* buffer, DWORD size, DWORD& read) override
+		{
+			read = static_cast<DWORD>((std::min)(static_cast<size_t>(size), m_Body.size() - m_Pos));
+			memcpy(buffer, m_Body.data() + m_Pos, read);
+			m_Pos += read;
+			return true;
+		}
+
+	private:
+		const std::string& m_Body;
+		size_t m_Pos;
+	};
+
+	// Write the whole body after WinHttpSendRequest, one chunk at a time
+	bool WriteRequestBody(HINTERNET hRequest, WinHttpWrapper::BodySource& source,
+		const WinHttpWrapper::BandwidthThrottle::Meter& meter, std::wstring& error)
+	{
+		if (!source.Rewind())
+		{
+			error = L"Failed to read request body!";
+			return false;
+		}
+
+		std::vector<uint8_t> chunk(kWriteChunkSize);
+		ULONGLONG written = 0;
+		for (;;)
+		{
+			// Paced by the bandwidth limits, 0 once cancelled
+			const DWORD dwAllowed = static_cast<DWORD>(meter.Take(kWriteChunkSize));
+			if (dwAllowed == 0)
+			{
+				error = L"Failed to send request body!";
+				return false;
+			}
+
+			DWORD dwRead = 0;
+			if (!source.Read(chunk.data(), dwAllowed, dwRead))
+			{
+				error = L"Failed to read request body!";
+				return false;
+			}
+			meter.Refund(dwAllowed - dwRead);
+			if (dwRead == 0)
+				break;
+
+			DWORD dwWritten = 0;
+			if (!WinHttpWriteData(hRequest, chunk.data(), dwRead, &dwWritten) || dwWritten != dwRead)
+			{
+				error = L"Failed to send request body!";
+				return false;
+			}
+			written += dwRead;
+		}
+
+		// The announced Content-Length must match, or the server waits for more
+		if (written != source.Length())
+		{
+			error = L"Request body size changed while sending!";
+			return false;
+		}
+		return true;
+	}
+}
+
+// Connect and TLS handshake spans, from the WinHTTP status notifications
+// (delivered on the thread sending the request)
+namespace
+{
+	struct ConnectTrace
+	{
+		ConnectTrace(bool secure) : secure(secure), connecting(-1), connected(-1) {}
+
+		bool secure;
+		long long connecting;
+		long long connected;
+	};
+
+	void CALLBACK TraceStatusCallback(HINTERNET hInternet, DWORD_PTR context, DWORD status, LPVOID info, DWORD infoLength)
+	{
+		(void)hInternet;
+		(void)info;
+		(void)infoLength;
+		ConnectTrace* trace = reinterpret_cast<ConnectTrace*>(context);
+		if (!trace)
+			return;
+
+		const long long now = WinHttpWrapper::Tracer::Now();
+		switch (status)
+		{
+		case WINHTTP_CALLBACK_STATUS_CONNECTING_TO_SERVER:
+			trace->connecting = now;
+			break;
+		case WINHTTP_CALLBACK_STATUS_CONNECTED_TO_SERVER:
+			if (trace->connecting >= 0)
+				WinHttpWrapper::Tracer::Record("connect", "http", trace->connecting, now);
+			trace->connecting = -1;
+			trace->connected = now;
+			break;
+		case WINHTTP_CALLBACK_STATUS_SENDING_REQUEST:
+			// The handshake runs between connecting and sending
+			if (trace->secure && trace->connected >= 0)
+				WinHttpWrapper::Tracer::Record("tls", "http", trace->connected, now);
+			trace->connected = -1;
+			break;
+		}
+	}
+}
+
+// Response bodies
+namespace
+{
+	// Most memory reserved up front from a Content-Length
+	const ULONGLONG kMaxBodyReserve = 16 * 1024 * 1024;
+
+	std::wstring QueryContentType(HINTERNET hRequest)
+	{
+		wchar_t szContentType[256];
+		DWORD dwSize = sizeof(szContentType);
+		if (WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_CONTENT_TYPE,
+			WINHTTP_HEADER_NAME_BY_INDEX, szContentType, &dwSize, WINHTTP_NO_HEADER_INDEX))
+			return std::wstring(szContentType, dwSize / sizeof(wchar_t));
+		if (GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+			return L"";
+
+		std::wstring contentType(dwSize / sizeof(wchar_t), L'\0');
+		if (!WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_CONTENT_TYPE,
+			WINHTTP_HEADER_NAME_BY_INDEX, &contentType[0], &dwSize, WINHTTP_NO_HEADER_INDEX))
+			return L"";
+		contentType.resize(dwSize / sizeof(wchar_t));
+		return contentType;
+	}
+}
+
+void WinHttpWrapper::ClearAuthSchemeCache()
+{
+	std::lock_guard<std::mutex> lock(g_authCacheMutex);
+	g_authSchemeCache.clear();
+}
+#else
+void WinHttpWrapper::ClearAuthSchemeCache()
+{
+	// PosixTransport sends Basic credentials up front, nothing is negotiated
+}
+#endif
+
+const wchar_t* const WinHttpWrapper::kCancelledError = L"Request cancelled!";
+const wchar_t* const WinHttpWrapper::kDigestMismatchError = L"Response body does not match the expected digest!";
+const wchar_t* const WinHttpWrapper::kCircuitOpenError = L"Circuit breaker open!";
+
+namespace
+{
+	// Store the digest of the body read, failing the response when it is
+	// not the expected one
+	bool CheckDigest(WinHttpWrapper::BodyHasher& hasher, const std::string& expected, WinHttpWrapper::HttpResponse& response)
+	{
+		response.digest = hasher.Finish();
+		if (expected.empty() || WinHttpWrapper::BodyHasher::Matches(response.digest, expected))
+			return true;
+
+		if (WinHttpWrapper::IsDebugLoggingEnabled()) {
+			const std::wstring digest(response.digest.begin(), response.digest.end());
+			const std::wstring wanted(expected.begin(), expected.end());
+			WinHttpWrapper::DebugLogFormat(L"[HASH] Body digest %s does not match the expected %s",
+				digest.c_str(), wanted.c_str());
+		}
+		response.error = WinHttpWrapper::kDigestMismatchError;
+		response.text.clear();
+		response.binaryData.clear();
+		return false;
+	}
+}
+
+// Transports
+namespace
+{
+	std::mutex g_transportMutex;
+	std::shared_ptr<WinHttpWrapper::Transport> g_defaultTransport;
+}
+
+std::shared_ptr<WinHttpWrapper::Transport> WinHttpWrapper::Transport::Default()
+{
+	std::lock_guard<std::mutex> lock(g_transportMutex);
+	if (!g_defaultTransport)
+	{
+#ifdef _WIN32
+		g_defaultTransport = std::make_shared<WinHttpTransport>();
+#else
+		g_defaultTransport = std::make_shared<PosixTransport>();
+#endif
+	}
+	return g_defaultTransport;
+}
+
+void WinHttpWrapper::Transport::SetDefault(std::shared_ptr<Transport> transport)
+{
+	std::lock_guard<std::mutex> lock(g_transportMutex);
+	g_defaultTransport = transport;
+}
+
+#ifdef _WIN32
+bool WinHttpWrapper::WinHttpTransport::Send(const TransportRequest& request, HttpResponse& response)
+{
+	return HttpRequest::http(request.verb, request.userAgent, request.domain,
+		request.path, request.port, request.secure,
+		request.headers, request.body,
+		response.text, response.binaryData, response.isBinary,
+		response.header,
+		response.statusCode,
+		response.contentLength,
+		response.error,
+		request.proxyUsername, request.proxyPassword,
+		request.serverUsername, request.serverPassword,
+		request.proxyUrl, request.mime,
+		request.maxResponseSize, request.source, request.record,
+		request.cancel, request.meter, request.hasher,
+		&response.timing, request.timeoutMs);
+}
+#endif
+
+bool WinHttpWrapper::MemorySource::Rewind()
+{
+	m_Pos = 0;
+	return true;
+}
+
+bool WinHttpWrapper::MemorySource::Read(uint8_t* buffer, DWORD size, DWORD& read)
+{
+	read = static_cast<DWORD>((std::min)(static_cast<size_t>(size), m_Size - m_Pos));
+	if (read > 0)
+		memcpy(buffer, m_Data + m_Pos, read);
+	m_Pos += read;
+	return true;
+}
+
 // HTTP Request Methods
 bool WinHttpWrapper::HttpRequest::Get(
 	const std::wstring& rest_of_path,
@@ -167,29 +535,232 @@ bool WinHttpWrapper::HttpRequest::Delete(
 		response);
 }
 
+bool WinHttpWrapper::HttpRequest::Upload(
+	const std::wstring& verb,
+	const std::wstring& rest_of_path,
+	const std::wstring& requestHeader,
+	BodySource& source,
+	HttpResponse& response)
+{
+	if (IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[REQUEST] %s upload to '%s%s' with %llu bytes body",
+			verb.c_str(), m_Domain.c_str(), rest_of_path.c_str(), source.Length());
+	}
+	std::wstring header = requestHeader;
+	std::wstring contentType = source.ContentType();
+	if (!contentType.empty())
+		header += L"Content-Type: " + contentType + L"\r\n";
+	return Request(
+		verb,
+		rest_of_path,
+		header,
+		std::string(),
+		response,
+		&source);
+}
+
 bool WinHttpWrapper::HttpRequest::Request(
 	const std::wstring& verb,
 	const std::wstring& rest_of_path,
 	const std::wstring& requestHeader,
 	const std::string& body,
-	HttpResponse& response)
+	HttpResponse& response,
+	BodySource* source,
+	const CancellationToken* cancel)
 {
 	if (IsDebugLoggingEnabled()) {
 		DebugLogFormat(L"[REQUEST] Starting %s request - Domain: '%s', Port: %d, Secure: %s",
 			verb.c_str(), m_Domain.c_str(), m_Port, m_Secure ? L"Yes" : L"No");
 	}
 
-	bool result = http(verb, m_UserAgent, m_Domain,
-		rest_of_path, m_Port, m_Secure,
-		requestHeader, body,
-		response.text, response.binaryData, response.isBinary,
-		response.header,
-		response.statusCode,
-		response.contentLength,
-		response.error,
-		m_ProxyUsername, m_ProxyPassword,
+	// The token given for this request wins over the one set on the object
+	const CancellationToken* token = cancel ? cancel : m_Cancel.get();
+
+	// Spans of this request carry its ID, on every thread
+	TraceRequestScope traceScope;
+	TraceSpan requestSpan("request");
+
+	const std::chrono::steady_clock::time_point deadline =
+		std::chrono::steady_clock::now() + std::chrono::milliseconds(m_TimeoutMs);
+	const bool retryable = m_Retry.maxAttempts > 1 && RetryPolicy::IsIdempotent(verb);
+	if (retryable)
+		RetryBudget::Instance().Deposit(m_Domain);
+
+	for (int attempt = 1; ; ++attempt)
+	{
+		DWORD timeoutMs = 0;
+		if (m_TimeoutMs)
+		{
+			const long long left = std::chrono::duration_cast<std::chrono::milliseconds>(
+				deadline - std::chrono::steady_clock::now()).count();
+			timeoutMs = static_cast<DWORD>((std::max)(1LL, left));
+		}
+		const bool result = Attempt(verb, rest_of_path, requestHeader, body, response, source, token, timeoutMs);
+		requestSpan.SetArg("status", response.statusCode);
+		if (!retryable || attempt >= m_Retry.maxAttempts || !RetryPolicy::IsTransient(result, response))
+			return result;
+
+		DWORD delayMs = m_Retry.Backoff(attempt);
+		DWORD retryAfterMs = 0;
+		if (RetryPolicy::RetryAfter(response.header, retryAfterMs))
+		{
+			if (retryAfterMs > m_Retry.maxDelayMs)
+				return result;
+			delayMs = retryAfterMs;
+		}
+		if (m_TimeoutMs && std::chrono::steady_clock::now() + std::chrono::milliseconds(delayMs) >= deadline)
+			return result;
+		if (!RetryBudget::Instance().Withdraw(m_Domain))
+			return result;
+
+		if (IsDebugLoggingEnabled()) {
+			DebugLogFormat(L"[REQUEST] Attempt %d failed (status %lu), retrying in %lu ms",
+				attempt, response.statusCode, delayMs);
+		}
+		TraceSpan backoffSpan("retry backoff");
+		backoffSpan.SetArg("attempt", attempt);
+		if (!RetryBudget::Instance().Wait(delayMs, token))
+		{
+			response.Reset();
+			response.error = kCancelledError;
+			response.cancelled = true;
+			return false;
+		}
+	}
+}
+
+bool WinHttpWrapper::HttpRequest::Attempt(
+	const std::wstring& verb,
+	const std::wstring& rest_of_path,
+	const std::wstring& requestHeader,
+	const std::string& body,
+	HttpResponse& response,
+	BodySource* source,
+	const CancellationToken* token,
+	DWORD timeoutMs)
+{
+	// The response may be a recycled one, or the one of the last attempt:
+	// clear it, keeping its buffers
+	response.Reset();
+
+	// A request to an endpoint group goes to one of its endpoints, which
+	// the limits and the connection apply to
+	Endpoint target(m_Domain, m_Port, m_Secure);
+	const bool routed = EndpointGroups::Instance().Choose(m_Domain, target);
+	if (routed && IsDebugLoggingEnabled()) {
+		DebugLogFormat(L"[REQUEST] '%s' routed to %s:%d", m_Domain.c_str(), target.domain.c_str(), target.port);
+	}
+	const BandwidthThrottle::Meter meter(target.domain, m_Priority, token);
+
+	// A server that keeps failing is not waited for
+	CircuitBreakers::Ticket breaker = CircuitBreakers::Instance().Acquire(HostKey(target.domain, target.port));
+	if (!breaker.Allowed())
+	{
+		if (IsDebugLoggingEnabled()) {
+			DebugLogFormat(L"[REQUEST] Circuit breaker of %s:%d open, failing right away", target.domain.c_str(), target.port);
+		}
+		response.error = kCircuitOpenError;
+		response.circuitOpen = true;
+		return false;
+	}
+
+	// Wait for our turn under the concurrency limits, or the cancellation
+	TraceSpan queueSpan("queue");
+	const std::chrono::steady_clock::time_point queued = std::chrono::steady_clock::now();
+	RequestScheduler::Slot slot = RequestScheduler::Instance().Acquire(HostKey(target.domain, target.port), m_Priority, token);
+	const std::chrono::steady_clock::time_point sent = std::chrono::steady_clock::now();
+	response.timing.queueUs = std::chrono::duration_cast<std::chrono::microseconds>(sent - queued).count();
+	queueSpan.End();
+	if (!slot.Granted())
+	{
+		response.error = kCancelledError;
+		response.cancelled = true;
+		return false;
+	}
+
+	TrafficLog& trafficLog = TrafficLog::Instance();
+	const TrafficLog::Mode trafficMode = trafficLog.GetMode();
+	BodyHasher hasher(m_Hash);
+	if (trafficMode == TrafficLog::MODE_REPLAY)
+	{
+		if (!trafficLog.Replay(verb, m_Domain, m_Port, rest_of_path, response))
+			return false;
+		if (m_Hash == HASH_NONE)
+			return true;
+		if (response.isBinary)
+			hasher.Update(response.binaryData.data(), response.binaryData.size());
+		else
+			hasher.Update(response.text.data(), response.text.size());
+		return CheckDigest(hasher, m_ExpectedDigest, response);
+	}
+
+	RecordedExchange exchange;
+	RecordedExchange* record = NULL;
+	if (trafficMode == TrafficLog::MODE_RECORD)
+	{
+		record = &exchange;
+		exchange.verb = verb;
+		exchange.host = m_Domain;
+		exchange.port = m_Port;
+		exchange.secure = m_Secure;
+		exchange.path = rest_of_path;
+		exchange.requestHeaders = requestHeader;
+		if (source && source->Data())
+			exchange.requestBody.assign(reinterpret_cast<const char*>(source->Data()), static_cast<size_t>(source->Length()));
+		else
+			exchange.requestBody = body;
+		exchange.Start();
+	}
+
+	const TransportRequest request = {
+		verb, m_UserAgent, target.domain,
+		rest_of_path, target.port, target.secure,
+		requestHeader, body, source,
+		m_ProxyUrl, m_ProxyUsername, m_ProxyPassword,
 		m_ServerUsername, m_ServerPassword,
-		m_ProxyUrl);
+		m_Mime ? *m_Mime : MimeClassifier::Default(),
+		MaxResponseSize(), record, token, meter,
+		m_Hash != HASH_NONE ? &hasher : NULL,
+		timeoutMs
+	};
+	std::shared_ptr<Transport> transport = m_Transport ? m_Transport : Transport::Default();
+	bool result = transport->Send(request, response);
+	response.timing.Finish(sent);
+	if (result && m_Hash != HASH_NONE)
+		result = CheckDigest(hasher, m_ExpectedDigest, response);
+
+	// Whatever failed after a cancellation failed because of it
+	if (!result && token && token->IsCancelled())
+	{
+		response.error = kCancelledError;
+		response.cancelled = true;
+	}
+
+	if (record)
+	{
+		exchange.succeeded = result;
+		exchange.statusCode = response.statusCode;
+		exchange.responseHeaders = response.header;
+		exchange.isBinary = response.isBinary;
+		if (response.isBinary)
+			exchange.responseBody.assign(response.binaryData.begin(), response.binaryData.end());
+		else
+			exchange.responseBody = response.text;
+		exchange.error = response.error;
+		trafficLog.Record(exchange);
+	}
+
+	if (!response.cancelled)
+	{
+		breaker.Report(!result || response.statusCode >= 500 || response.statusCode == 429,
+			response.timing.waitUs / 1000);
+	}
+
+	if (routed && !response.cancelled)
+	{
+		EndpointGroups::Instance().Report(m_Domain, target, result, response.statusCode, response.timing,
+			response.isBinary ? response.binaryData.size() : response.text.size());
+	}
 
 	if (IsDebugLoggingEnabled()) {
 		DebugLogFormat(L"[REQUEST] Request completed - Success: %s, Status: %lu",
@@ -304,92 +875,25 @@ std::wstring WinHttpWrapper::HttpResponse::GetContentType()
 	return L"";
 }
 
-bool WinHttpWrapper::HttpResponse::IsBinaryMimeType(const std::wstring& contentType)
+void WinHttpWrapper::HttpResponse::Recycle(size_t maxRetainedBytes)
 {
-	if (IsDebugLoggingEnabled()) {
-		DebugLogFormat(L"[RESPONSE] Checking if content type '%s' is binary", contentType.c_str());
-	}
-
-	if (contentType.empty())
-	{
-		if (IsDebugLoggingEnabled()) {
-			DebugLog(L"[RESPONSE] Empty content type, assuming text");
-		}
-		return false;
-	}
-
-	// Remove parameters after semicolon (like charset)
-	std::wstring type = contentType;
-	size_t semicolonIndex = type.find(L';');
-	if (semicolonIndex != std::wstring::npos)
-	{
-		type = type.substr(0, semicolonIndex);
-		if (IsDebugLoggingEnabled()) {
-			DebugLogFormat(L"[RESPONSE] Content type after parameter removal: '%s'", type.c_str());
-		}
-	}
-
-	// Trim whitespace and convert to lowercase
-	// Remove leading/trailing spaces
-	size_t start = type.find_first_not_of(L" \t\r\n");
-	if (start == std::wstring::npos)
-	{
-		if (IsDebugLoggingEnabled()) {
-			DebugLog(L"[RESPONSE] Content type is all whitespace, assuming text");
-		}
-		return false;
-	}
-
-	size_t end = type.find_last_not_of(L" \t\r\n");
-	type = type.substr(start, end - start + 1);
-
-	// Convert to lowercase
-	std::transform(type.begin(), type.end(), type.begin(), ::towlower);
-	if (IsDebugLoggingEnabled()) {
-		DebugLogFormat(L"[RESPONSE] Normalized content type: '%s'", type.c_str());
-	}
-
-	// If it starts with "text/", it's not binary
-	if (type.find(L"text/") == 0)
-	{
-		if (IsDebugLoggingEnabled()) {
-			DebugLog(L"[RESPONSE] Content type starts with 'text/', treating as text");
-		}
-		return false;
-	}
-
-	// Check against known text-based MIME types
-	if (type == L"text/html" ||
-		type == L"text/css" ||
-		type == L"text/xml" ||
-		type == L"application/javascript" ||
-		type == L"application/atom+xml" ||
-		type == L"application/rss+xml" ||
-		type == L"text/mathml" ||
-		type == L"text/plain" ||
-		type == L"text/vnd.sun.j2me.app-descriptor" ||
-		type == L"text/vnd.wap.wml" ||
-		type == L"text/x-component" ||
-		type == L"image/svg+xml" ||
-		type == L"application/json" ||
-		type == L"application/rtf" ||
-		type == L"application/x-perl" ||
-		type == L"application/xhtml+xml" ||
-		type == L"application/xspf+xml")
-	{
-		if (IsDebugLoggingEnabled()) {
-			DebugLog(L"[RESPONSE] Content type matched known text type, treating as text");
-		}
-		return false;
-	}
+	Reset();
+	if (text.capacity() > maxRetainedBytes)
+		std::string().swap(text);
+	if (binaryData.capacity() > maxRetainedBytes)
+		std::vector<uint8_t>().swap(binaryData);
+	if (header.capacity() * sizeof(wchar_t) > maxRetainedBytes)
+		std::wstring().swap(header);
+	if (error.capacity() * sizeof(wchar_t) > maxRetainedBytes)
+		std::wstring().swap(error);
+}
 
-	// Everything else is considered binary
-	if (IsDebugLoggingEnabled()) {
-		DebugLog(L"[RESPONSE] Content type not recognized as text, treating as binary");
-	}
-	return true;
+bool WinHttpWrapper::HttpResponse::IsBinaryMimeType(const std::wstring& contentType)
+{
+	return MimeClassifier::Default().IsBinary(contentType);
 }
 
+#ifdef _WIN32
 bool WinHttpWrapper::HttpRequest::http(const std::wstring& verb, const std::wstring& user_agent, const std::wstring& domain,
 	const std::wstring& rest_of_path, int port, bool secure,
 	const std::wstring& requestHeader, const std::string& body,
@@ -397,7 +901,11 @@ bool WinHttpWrapper::HttpRequest::http(const std::wstring& verb, const std::wstr
 	std::wstring& responseHeader, DWORD& dwStatusCode, DWORD& dwContent, std::wstring& error,
 	const std::wstring& szProxyUsername, const std::wstring& szProxyPassword,
 	const std::wstring& szServerUsername, const std::wstring& szServerPassword,
-	const std::wstring& szProxyUrl)
+	const std::wstring& szProxyUrl, const MimeClassifier& mime,
+	ULONGLONG maxResponseSize, BodySource* source,
+	RecordedExchange* record, const CancellationToken* cancel,
+	const BandwidthThrottle::Meter& meter, BodyHasher* hasher,
+	RequestTiming* timing, DWORD timeoutMs)
 {
 	if (IsDebugLoggingEnabled()) {
 		DebugLog(L"[HTTP] Starting HTTP request processing");
@@ -409,6 +917,14 @@ bool WinHttpWrapper::HttpRequest::http(const std::wstring& verb, const std::wstr
 		DebugLogFormat(L"[HTTP] Has Request Headers: %s", requestHeader.empty() ? L"No" : L"Yes");
 	}
 
+	// A body paced by the bandwidth limits is written in chunks, like a
+	// streamed one
+	BufferSource bufferSource(body);
+	if (!source && !body.empty() && meter.IsLimited())
+		source = &bufferSource;
+	// A body already in memory goes out with the request itself
+	const bool inMemory = source && source->Data() && source->Length() <= MAXDWORD && !meter.IsLimited();
+
 	DWORD dwSupportedSchemes;
 	DWORD dwFirstScheme;
 	DWORD dwSelectedScheme;
@@ -421,52 +937,26 @@ bool WinHttpWrapper::HttpRequest::http(const std::wstring& verb, const std::wstr
 	HINTERNET hConnect = NULL;
 	HINTERNET hRequest = NULL;
 	BOOL bDone = FALSE;
+	// Cancelling closes hRequest, which fails whatever call is blocked on it
+	CancellableHandles cancellable(cancel);
 	DWORD dwProxyAuthScheme = 0;
+	DWORD dwServerAuthScheme = 0;
 
-	// Determine proxy configuration
-	DWORD dwAccessType;
-	LPCWSTR lpszProxy;
-	LPCWSTR lpszProxyBypass;
+	dwStatusCode = 0;
+	isBinary = false;
 
-	if (!szProxyUrl.empty())
+	// Use WinHttpOpen to obtain a session handle.
+	if (IsDebugLoggingEnabled()) {
+		DebugLog(L"[HTTP] Opening HTTP session...");
+	}
+	TraceSpan sessionSpan("session");
+	hSession = OpenSession(user_agent, szProxyUrl, szProxyUsername);
+	sessionSpan.End();
+
+	if (hSession)
 	{
-		// Use explicit proxy URL
-		dwAccessType = WINHTTP_ACCESS_TYPE_NAMED_PROXY;
-		lpszProxy = szProxyUrl.c_str();
-		lpszProxyBypass = WINHTTP_NO_PROXY_BYPASS;
 		if (IsDebugLoggingEnabled()) {
-			DebugLogFormat(L"[HTTP] Using explicit proxy: '%s'", szProxyUrl.c_str());
-			DebugLogFormat(L"[HTTP] Proxy credentials provided: %s",
-				szProxyUsername.empty() ? L"No" : L"Yes");
-		}
-	}
-	else
-	{
-		// Use default system proxy settings consistently across all Windows versions
-		dwAccessType = WINHTTP_ACCESS_TYPE_DEFAULT_PROXY;
-		lpszProxy = WINHTTP_NO_PROXY_NAME;
-		lpszProxyBypass = WINHTTP_NO_PROXY_BYPASS;
-		if (IsDebugLoggingEnabled()) {
-			DebugLog(L"[HTTP] Using default system proxy settings");
-		}
-	}
-
-	dwStatusCode = 0;
-	isBinary = false;
-
-	// Use WinHttpOpen to obtain a session handle.
-	if (IsDebugLoggingEnabled()) {
-		DebugLog(L"[HTTP] Opening HTTP session...");
-	}
-	hSession = WinHttpOpen(user_agent.c_str(),
-		dwAccessType,
-		lpszProxy,
-		lpszProxyBypass, 0);
-
-	if (hSession)
-	{
-		if (IsDebugLoggingEnabled()) {
-			DebugLogFormat(L"[HTTP] HTTP session opened successfully, handle: 0x%p", hSession);
+			DebugLogFormat(L"[HTTP] HTTP session opened successfully, handle: 0x%p", hSession);
 		}
 	}
 	else
@@ -514,11 +1004,25 @@ bool WinHttpWrapper::HttpRequest::http(const std::wstring& verb, const std::wstr
 		WINHTTP_DEFAULT_ACCEPT_TYPES,
 		WINHTTP_FLAG_REFRESH | flag);
 
-	if (hRequest)
+	if (hRequest && !cancellable.Add(hRequest))
+	{
+		if (IsDebugLoggingEnabled()) {
+			DebugLog(L"[HTTP] Request cancelled before sending");
+		}
+		hRequest = NULL;
+		bDone = TRUE;
+	}
+	else if (hRequest)
 	{
 		if (IsDebugLoggingEnabled()) {
 			DebugLogFormat(L"[HTTP] Request opened successfully, handle: 0x%p", hRequest);
 		}
+		// Bound the resolve, connect, send and receive by the time left
+		if (timeoutMs)
+		{
+			const int timeout = static_cast<int>((std::min)(timeoutMs, static_cast<DWORD>(INT_MAX)));
+			WinHttpSetTimeouts(hRequest, timeout, timeout, timeout, timeout);
+		}
 	}
 	else
 	{
@@ -531,6 +1035,46 @@ bool WinHttpWrapper::HttpRequest::http(const std::wstring& verb, const std::wstr
 		bDone = TRUE;
 	}
 
+	// Notifications only needed for the trace
+	ConnectTrace connectTrace(secure);
+	if (hRequest && Tracer::IsEnabled())
+	{
+		DWORD_PTR context = reinterpret_cast<DWORD_PTR>(&connectTrace);
+		WinHttpSetOption(hRequest, WINHTTP_OPTION_CONTEXT_VALUE, &context, sizeof(context));
+		WinHttpSetStatusCallback(hRequest, TraceStatusCallback,
+			WINHTTP_CALLBACK_FLAG_CONNECT_TO_SERVER | WINHTTP_CALLBACK_FLAG_SEND_REQUEST, 0);
+	}
+
+	// Reuse the schemes negotiated by earlier requests to this host or proxy:
+	// setting the credentials before the first send skips the challenge.
+	if (hRequest)
+	{
+		dwServerAuthScheme = LookupAuthScheme(WINHTTP_AUTH_TARGET_SERVER, domain, port);
+		if (dwServerAuthScheme != 0)
+		{
+			if (IsDebugLoggingEnabled()) {
+				DebugLogFormat(L"[HTTP] Using cached server auth scheme: 0x%lx", dwServerAuthScheme);
+			}
+			if (!WinHttpSetCredentials(hRequest,
+				WINHTTP_AUTH_TARGET_SERVER,
+				dwServerAuthScheme,
+				szServerUsername.c_str(),
+				szServerPassword.c_str(),
+				NULL))
+			{
+				dwServerAuthScheme = 0;
+			}
+		}
+
+		if (!szProxyUrl.empty() && szProxyUsername != L"")
+		{
+			dwProxyAuthScheme = LookupAuthScheme(WINHTTP_AUTH_TARGET_PROXY, szProxyUrl, 0);
+			if (dwProxyAuthScheme != 0 && IsDebugLoggingEnabled()) {
+				DebugLogFormat(L"[HTTP] Using cached proxy auth scheme: 0x%lx", dwProxyAuthScheme);
+			}
+		}
+	}
+
 	int requestAttempt = 0;
 	while (!bDone)
 	{
@@ -538,6 +1082,9 @@ bool WinHttpWrapper::HttpRequest::http(const std::wstring& verb, const std::wstr
 		if (IsDebugLoggingEnabled()) {
 			DebugLogFormat(L"[HTTP] Request attempt #%d", requestAttempt);
 		}
+		// Later attempts answer a 401/407 challenge (or a resend request)
+		TraceSpan attemptSpan(requestAttempt == 1 ? "attempt" : "auth retry");
+		attemptSpan.SetArg("attempt", requestAttempt);
 
 		//  If a proxy authentication challenge was responded to, reset
 		//  those credentials before each SendRequest, because the proxy
@@ -572,30 +1119,60 @@ bool WinHttpWrapper::HttpRequest::http(const std::wstring& verb, const std::wstr
 		}
 
 		// Send a request.
+		TraceSpan sendSpan("send");
 		if (hRequest)
 		{
 			if (IsDebugLoggingEnabled()) {
 				DebugLog(L"[HTTP] Sending HTTP request...");
 			}
-			if (requestHeader.empty())
+
+			// A streamed body is only announced here, and written once the
+			// headers are out
+			LPVOID pBody = (LPVOID)body.data();
+			DWORD dwBodySize = static_cast<DWORD>(body.size());
+			DWORD dwTotalLength = dwBodySize;
+			const std::wstring* pHeader = &requestHeader;
+			std::wstring streamHeader;
+			if (inMemory)
+			{
+				pBody = (LPVOID)source->Data();
+				dwBodySize = static_cast<DWORD>(source->Length());
+				dwTotalLength = dwBodySize;
+			}
+			else if (source)
+			{
+				ULONGLONG length = source->Length();
+				pBody = WINHTTP_NO_REQUEST_DATA;
+				dwBodySize = 0;
+				dwTotalLength = static_cast<DWORD>(length);
+				if (length > MAXDWORD)
+				{
+					// Too large for the DWORD total: announce it ourselves
+					streamHeader = requestHeader + L"Content-Length: " + std::to_wstring(length) + L"\r\n";
+					pHeader = &streamHeader;
+					dwTotalLength = WINHTTP_IGNORE_REQUEST_TOTAL_LENGTH;
+				}
+			}
+
+			if (pHeader->empty())
 			{
 				if (IsDebugLoggingEnabled()) {
 					DebugLog(L"[HTTP] Sending request without additional headers");
 				}
 				bResults = WinHttpSendRequest(hRequest,
 					WINHTTP_NO_ADDITIONAL_HEADERS, 0,
-					(LPVOID)body.data(), body.size(),
-					body.size(), 0);
+					pBody, dwBodySize,
+					dwTotalLength, 0);
 			}
 			else
 			{
 				if (IsDebugLoggingEnabled()) {
-					DebugLogFormat(L"[HTTP] Sending request with headers (length: %zu)", requestHeader.size());
+					DebugLogFormat(L"[HTTP] Sending request with headers (length: %zu)", pHeader->size());
 				}
 				bResults = WinHttpSendRequest(hRequest,
-					requestHeader.c_str(), requestHeader.size(),
-					(LPVOID)body.data(), body.size(),
-					body.size(), 0);
+					pHeader->c_str(), static_cast<DWORD>(pHeader->size()),
+					pBody, dwBodySize,
+					dwTotalLength, 0);
 			}
 
 			if (!bResults)
@@ -614,13 +1191,26 @@ bool WinHttpWrapper::HttpRequest::http(const std::wstring& verb, const std::wstr
 			}
 		}
 
+		if (bResults && source && !inMemory)
+		{
+			if (IsDebugLoggingEnabled()) {
+				DebugLogFormat(L"[HTTP] Streaming request body (%llu bytes)", source->Length());
+			}
+			bResults = WriteRequestBody(hRequest, *source, meter, error);
+		}
+		sendSpan.End();
+
 		// End the request.
 		if (bResults)
 		{
 			if (IsDebugLoggingEnabled()) {
 				DebugLog(L"[HTTP] Waiting for response...");
 			}
+			TraceSpan waitSpan("wait");
 			bResults = WinHttpReceiveResponse(hRequest, NULL);
+			waitSpan.End();
+			if (bResults && timing)
+				timing->MarkHeaders();
 			if (!bResults)
 			{
 				DWORD lastError = GetLastError();
@@ -715,151 +1305,12 @@ bool WinHttpWrapper::HttpRequest::http(const std::wstring& verb, const std::wstr
 			}
 		}
 
-		// Keep checking for data until there is nothing left.
+		// Handle the status code before reading the body: a 401/407 challenge
+		// that is answered below gets resent on the same handle, and WinHTTP
+		// discards its body instead of us buffering it for nothing.
+		BOOL bResponseReceived = bResults;
 		if (bResults)
 		{
-			if (IsDebugLoggingEnabled()) {
-				DebugLog(L"[HTTP] Processing response data...");
-			}
-
-			// Determine content type and whether response is binary
-			// We need to create a temporary HttpResponse to use the parsing methods
-			HttpResponse tempResponse;
-			tempResponse.header = responseHeader;
-			std::wstring contentType = tempResponse.GetContentType();
-			isBinary = HttpResponse::IsBinaryMimeType(contentType);
-
-			if (IsDebugLoggingEnabled()) {
-				DebugLogFormat(L"[HTTP] Content-Type: '%s', Binary: %s",
-					contentType.c_str(), isBinary ? L"Yes" : L"No");
-			}
-
-			if (isBinary)
-			{
-				if (IsDebugLoggingEnabled()) {
-					DebugLog(L"[HTTP] Reading response as binary data...");
-				}
-				// Read as binary data
-				binaryData.clear();
-				do
-				{
-					// Check for available data.
-					dwSize = 0;
-					if (!WinHttpQueryDataAvailable(hRequest, &dwSize))
-					{
-						DWORD lastError = GetLastError();
-						if (IsDebugLoggingEnabled()) {
-							DebugLogFormat(L"[HTTP] Error querying available data: %lu", lastError);
-						}
-						error = L"Error querying available data: ";
-						error += std::to_wstring(lastError);
-					}
-
-					dwContent += dwSize;
-					if (dwSize == 0)
-					{
-						if (IsDebugLoggingEnabled()) {
-							DebugLog(L"[HTTP] No more data available");
-						}
-						break;
-					}
-
-					if (IsDebugLoggingEnabled()) {
-						DebugLogFormat(L"[HTTP] %lu bytes available for reading", dwSize);
-					}
-
-					// Allocate space for the buffer.
-					std::vector<uint8_t> temp(dwSize);
-					// Read the data.
-					if (!WinHttpReadData(hRequest, (LPVOID)temp.data(),
-						dwSize, &dwDownloaded))
-					{
-						DWORD lastError = GetLastError();
-						if (IsDebugLoggingEnabled()) {
-							DebugLogFormat(L"[HTTP] Error reading data: %lu", lastError);
-						}
-						error = L"Error reading response data: ";
-						error += std::to_wstring(lastError);
-					}
-					else
-					{
-						if (IsDebugLoggingEnabled()) {
-							DebugLogFormat(L"[HTTP] Successfully read %lu bytes", dwDownloaded);
-						}
-						binaryData.insert(binaryData.end(), temp.begin(), temp.begin() + dwDownloaded);
-					}
-				}
-				while (dwSize > 0);
-
-				if (IsDebugLoggingEnabled()) {
-					DebugLogFormat(L"[HTTP] Total binary data read: %zu bytes", binaryData.size());
-				}
-			}
-			else
-			{
-				if (IsDebugLoggingEnabled()) {
-					DebugLog(L"[HTTP] Reading response as text data...");
-				}
-				// Read as text data (original logic)
-				std::string temp;
-				text = "";
-				do
-				{
-					// Check for available data.
-					dwSize = 0;
-					if (!WinHttpQueryDataAvailable(hRequest, &dwSize))
-					{
-						DWORD lastError = GetLastError();
-						if (IsDebugLoggingEnabled()) {
-							DebugLogFormat(L"[HTTP] Error querying available data: %lu", lastError);
-						}
-						error = L"Error querying available data: ";
-						error += std::to_wstring(lastError);
-					}
-
-					dwContent += dwSize;
-					if (dwSize == 0)
-					{
-						if (IsDebugLoggingEnabled()) {
-							DebugLog(L"[HTTP] No more data available");
-						}
-						break;
-					}
-
-					if (IsDebugLoggingEnabled()) {
-						DebugLogFormat(L"[HTTP] %lu bytes available for reading", dwSize);
-					}
-
-					// Allocate space for the buffer.
-					temp = "";
-					temp.resize(dwSize);
-					// Read the data.
-					ZeroMemory((void*)(&temp[0]), dwSize);
-					if (!WinHttpReadData(hRequest, (LPVOID)(&temp[0]),
-						dwSize, &dwDownloaded))
-					{
-						DWORD lastError = GetLastError();
-						if (IsDebugLoggingEnabled()) {
-							DebugLogFormat(L"[HTTP] Error reading data: %lu", lastError);
-						}
-						error = L"Error reading response data: ";
-						error += std::to_wstring(lastError);
-					}
-					else
-					{
-						if (IsDebugLoggingEnabled()) {
-							DebugLogFormat(L"[HTTP] Successfully read %lu bytes", dwDownloaded);
-						}
-						text += temp;
-					}
-				}
-				while (dwSize > 0);
-
-				if (IsDebugLoggingEnabled()) {
-					DebugLogFormat(L"[HTTP] Total text data read: %zu bytes", text.size());
-				}
-			}
-
 			switch (dwStatusCode)
 			{
 			default:
@@ -934,6 +1385,7 @@ bool WinHttpWrapper::HttpRequest::http(const std::wstring& verb, const std::wstr
 							if (IsDebugLoggingEnabled()) {
 								DebugLog(L"[HTTP] Server credentials set successfully");
 							}
+							dwServerAuthScheme = dwSelectedScheme;
 						}
 					}
 				}
@@ -997,6 +1449,246 @@ bool WinHttpWrapper::HttpRequest::http(const std::wstring& verb, const std::wstr
 			}
 		}
 
+		// Keep checking for data until there is nothing left.
+		if (bResponseReceived && (bDone || !bResults))
+		{
+			if (IsDebugLoggingEnabled()) {
+				DebugLog(L"[HTTP] Processing response data...");
+			}
+
+			// Determine content type and whether response is binary, asking
+			// WinHTTP for the one header instead of parsing all of them
+			std::wstring contentType = QueryContentType(hRequest);
+			// Without a Content-Type, read the body as binary and decide from its first bytes
+			bool sniff = contentType.empty() && mime.IsSniffing();
+			isBinary = sniff || mime.IsBinary(contentType);
+
+			if (IsDebugLoggingEnabled()) {
+				DebugLogFormat(L"[HTTP] Content-Type: '%s', Binary: %s",
+					contentType.c_str(), sniff ? L"Sniffed" : isBinary ? L"Yes" : L"No");
+			}
+
+			// Bytes buffered below count against the process-wide memory budget
+			// until the whole body has been read
+			MemoryBudget::Lease lease;
+
+			// Refuse a body announced as larger than the limit without reading it
+			ULONGLONG announcedLength = 0;
+			{
+				wchar_t szLength[32] = { 0 };
+				DWORD dwLengthSize = sizeof(szLength);
+				if (WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_CONTENT_LENGTH,
+						WINHTTP_HEADER_NAME_BY_INDEX, szLength, &dwLengthSize, WINHTTP_NO_HEADER_INDEX))
+				{
+					announcedLength = wcstoull(szLength, NULL, 10);
+				}
+			}
+			bool bTooLarge = maxResponseSize && announcedLength > maxResponseSize;
+
+			// Size the body buffer once when its length is known. The length
+			// comes from the server, so only trust it up to a point.
+			const size_t reserveSize = static_cast<size_t>((std::min)(announcedLength, kMaxBodyReserve));
+
+			if (bTooLarge)
+			{
+				if (IsDebugLoggingEnabled()) {
+					DebugLogFormat(L"[HTTP] Content-Length is over the %llu bytes limit, not reading the body", maxResponseSize);
+				}
+				error = L"Response body exceeds the size limit!";
+				bResults = FALSE;
+			}
+			else if (isBinary)
+			{
+				if (IsDebugLoggingEnabled()) {
+					DebugLog(L"[HTTP] Reading response as binary data...");
+				}
+				// Read as binary data
+				binaryData.clear();
+				binaryData.reserve(reserveSize);
+				if (hasher)
+					hasher->Reset();
+				do
+				{
+					TraceSpan readSpan("read");
+
+					// Check for available data.
+					dwSize = 0;
+					if (!WinHttpQueryDataAvailable(hRequest, &dwSize))
+					{
+						DWORD lastError = GetLastError();
+						if (IsDebugLoggingEnabled()) {
+							DebugLogFormat(L"[HTTP] Error querying available data: %lu", lastError);
+						}
+						error = L"Error querying available data: ";
+						error += std::to_wstring(lastError);
+					}
+
+					// Paced by the bandwidth limits: read no more than allowed
+					// (nothing once cancelled)
+					if (dwSize > 0)
+						dwSize = static_cast<DWORD>(meter.Take(dwSize));
+
+					dwContent += dwSize;
+					if (dwSize == 0)
+					{
+						if (IsDebugLoggingEnabled()) {
+							DebugLog(L"[HTTP] No more data available");
+						}
+						break;
+					}
+
+					if (maxResponseSize && dwContent > maxResponseSize)
+					{
+						if (IsDebugLoggingEnabled()) {
+							DebugLogFormat(L"[HTTP] Body is over the %llu bytes limit, aborting", maxResponseSize);
+						}
+						error = L"Response body exceeds the size limit!";
+						bResults = FALSE;
+						break;
+					}
+
+					// Pauses while the memory budget is exhausted
+					lease.Reserve(dwSize);
+
+					if (IsDebugLoggingEnabled()) {
+						DebugLogFormat(L"[HTTP] %lu bytes available for reading", dwSize);
+					}
+
+					// Read the data straight into the body
+					size_t used = binaryData.size();
+					binaryData.resize(used + dwSize);
+					if (!WinHttpReadData(hRequest, (LPVOID)(binaryData.data() + used),
+						dwSize, &dwDownloaded))
+					{
+						DWORD lastError = GetLastError();
+						if (IsDebugLoggingEnabled()) {
+							DebugLogFormat(L"[HTTP] Error reading data: %lu", lastError);
+						}
+						error = L"Error reading response data: ";
+						error += std::to_wstring(lastError);
+						binaryData.resize(used);
+					}
+					else
+					{
+						if (IsDebugLoggingEnabled()) {
+							DebugLogFormat(L"[HTTP] Successfully read %lu bytes", dwDownloaded);
+						}
+						binaryData.resize(used + dwDownloaded);
+						readSpan.SetArg("bytes", dwDownloaded);
+						if (hasher)
+							hasher->Update(binaryData.data() + used, dwDownloaded);
+						if (record)
+							record->AddChunk(dwDownloaded);
+					}
+				}
+				while (dwSize > 0);
+
+				if (IsDebugLoggingEnabled()) {
+					DebugLogFormat(L"[HTTP] Total binary data read: %zu bytes", binaryData.size());
+				}
+
+				if (sniff && !MimeClassifier::SniffBinary(binaryData.data(), binaryData.size()))
+				{
+					if (IsDebugLoggingEnabled()) {
+						DebugLog(L"[HTTP] Sniffed content looks like text");
+					}
+					text.assign(binaryData.begin(), binaryData.end());
+					binaryData.clear();
+					isBinary = false;
+				}
+			}
+			else
+			{
+				if (IsDebugLoggingEnabled()) {
+					DebugLog(L"[HTTP] Reading response as text data...");
+				}
+				// Read as text data (original logic)
+				text = "";
+				text.reserve(reserveSize);
+				if (hasher)
+					hasher->Reset();
+				do
+				{
+					TraceSpan readSpan("read");
+
+					// Check for available data.
+					dwSize = 0;
+					if (!WinHttpQueryDataAvailable(hRequest, &dwSize))
+					{
+						DWORD lastError = GetLastError();
+						if (IsDebugLoggingEnabled()) {
+							DebugLogFormat(L"[HTTP] Error querying available data: %lu", lastError);
+						}
+						error = L"Error querying available data: ";
+						error += std::to_wstring(lastError);
+					}
+
+					// Paced by the bandwidth limits: read no more than allowed
+					// (nothing once cancelled)
+					if (dwSize > 0)
+						dwSize = static_cast<DWORD>(meter.Take(dwSize));
+
+					dwContent += dwSize;
+					if (dwSize == 0)
+					{
+						if (IsDebugLoggingEnabled()) {
+							DebugLog(L"[HTTP] No more data available");
+						}
+						break;
+					}
+
+					if (maxResponseSize && dwContent > maxResponseSize)
+					{
+						if (IsDebugLoggingEnabled()) {
+							DebugLogFormat(L"[HTTP] Body is over the %llu bytes limit, aborting", maxResponseSize);
+						}
+						error = L"Response body exceeds the size limit!";
+						bResults = FALSE;
+						break;
+					}
+
+					// Pauses while the memory budget is exhausted
+					lease.Reserve(dwSize);
+
+					if (IsDebugLoggingEnabled()) {
+						DebugLogFormat(L"[HTTP] %lu bytes available for reading", dwSize);
+					}
+
+					// Read the data straight into the body
+					size_t used = text.size();
+					text.resize(used + dwSize);
+					if (!WinHttpReadData(hRequest, (LPVOID)(&text[used]),
+						dwSize, &dwDownloaded))
+					{
+						DWORD lastError = GetLastError();
+						if (IsDebugLoggingEnabled()) {
+							DebugLogFormat(L"[HTTP] Error reading data: %lu", lastError);
+						}
+						error = L"Error reading response data: ";
+						error += std::to_wstring(lastError);
+						text.resize(used);
+					}
+					else
+					{
+						if (IsDebugLoggingEnabled()) {
+							DebugLogFormat(L"[HTTP] Successfully read %lu bytes", dwDownloaded);
+						}
+						text.resize(used + dwDownloaded);
+						readSpan.SetArg("bytes", dwDownloaded);
+						if (hasher)
+							hasher->Update(&text[used], dwDownloaded);
+						if (record)
+							record->AddChunk(dwDownloaded);
+					}
+				}
+				while (dwSize > 0);
+
+				if (IsDebugLoggingEnabled()) {
+					DebugLogFormat(L"[HTTP] Total text data read: %zu bytes", text.size());
+				}
+			}
+		}
+
 		// Keep track of the last status code.
 		dwLastStatus = dwStatusCode;
 
@@ -1014,12 +1706,34 @@ bool WinHttpWrapper::HttpRequest::http(const std::wstring& verb, const std::wstr
 		DebugLogFormat(L"[HTTP] Request processing complete after %d attempts", requestAttempt);
 	}
 
+	// Remember which schemes got through, and forget the ones that did not
+	// (credentials or server configuration may have changed since).
+	if (bResults)
+	{
+		if (dwStatusCode == 401)
+			StoreAuthScheme(WINHTTP_AUTH_TARGET_SERVER, domain, port, 0);
+		else if (dwServerAuthScheme != 0)
+			StoreAuthScheme(WINHTTP_AUTH_TARGET_SERVER, domain, port, dwServerAuthScheme);
+
+		if (!szProxyUrl.empty() && szProxyUsername != L"")
+		{
+			if (dwStatusCode == 407)
+				StoreAuthScheme(WINHTTP_AUTH_TARGET_PROXY, szProxyUrl, 0, 0);
+			else if (dwProxyAuthScheme != 0)
+				StoreAuthScheme(WINHTTP_AUTH_TARGET_PROXY, szProxyUrl, 0, dwProxyAuthScheme);
+		}
+	}
+
+	// A read cut short by a cancellation may still look complete
+	if (cancel && cancel->IsCancelled())
+		bResults = FALSE;
+
 	// Close any open handles.
 	if (IsDebugLoggingEnabled()) {
 		DebugLog(L"[HTTP] Closing HTTP handles...");
 	}
 	if (hRequest) {
-		WinHttpCloseHandle(hRequest);
+		cancellable.Close(hRequest);
 		if (IsDebugLoggingEnabled()) {
 			DebugLog(L"[HTTP] Request handle closed");
 		}
@@ -1053,6 +1767,67 @@ bool WinHttpWrapper::HttpRequest::http(const std::wstring& verb, const std::wstr
 	return true;
 }
 
+HINTERNET WinHttpWrapper::HttpRequest::OpenSession(const std::wstring& user_agent,
+	const std::wstring& szProxyUrl, const std::wstring& szProxyUsername)
+{
+	// Determine proxy configuration
+	DWORD dwAccessType;
+	LPCWSTR lpszProxy;
+	LPCWSTR lpszProxyBypass;
+
+	if (!szProxyUrl.empty())
+	{
+		// Use explicit proxy URL
+		dwAccessType = WINHTTP_ACCESS_TYPE_NAMED_PROXY;
+		lpszProxy = szProxyUrl.c_str();
+		lpszProxyBypass = WINHTTP_NO_PROXY_BYPASS;
+		if (IsDebugLoggingEnabled()) {
+			DebugLogFormat(L"[HTTP] Using explicit proxy: '%s'", szProxyUrl.c_str());
+			DebugLogFormat(L"[HTTP] Proxy credentials provided: %s",
+				szProxyUsername.empty() ? L"No" : L"Yes");
+		}
+	}
+	else
+	{
+		// Use default system proxy settings consistently across all Windows versions
+		dwAccessType = WINHTTP_ACCESS_TYPE_DEFAULT_PROXY;
+		lpszProxy = WINHTTP_NO_PROXY_NAME;
+		lpszProxyBypass = WINHTTP_NO_PROXY_BYPASS;
+		if (IsDebugLoggingEnabled()) {
+			DebugLog(L"[HTTP] Using default system proxy settings");
+		}
+	}
+
+	return WinHttpOpen(user_agent.c_str(),
+		dwAccessType,
+		lpszProxy,
+		lpszProxyBypass, 0);
+}
+
+void WinHttpWrapper::HttpRequest::ApplyCachedCredentials(HINTERNET hRequest,
+	const std::wstring& domain, int port,
+	const std::wstring& szProxyUsername, const std::wstring& szProxyPassword,
+	const std::wstring& szServerUsername, const std::wstring& szServerPassword,
+	const std::wstring& szProxyUrl)
+{
+	DWORD dwServerAuthScheme = LookupAuthScheme(WINHTTP_AUTH_TARGET_SERVER, domain, port);
+	if (dwServerAuthScheme != 0)
+	{
+		WinHttpSetCredentials(hRequest, WINHTTP_AUTH_TARGET_SERVER, dwServerAuthScheme,
+			szServerUsername.c_str(), szServerPassword.c_str(), NULL);
+	}
+
+	if (!szProxyUrl.empty() && szProxyUsername != L"")
+	{
+		DWORD dwProxyAuthScheme = LookupAuthScheme(WINHTTP_AUTH_TARGET_PROXY, szProxyUrl, 0);
+		if (dwProxyAuthScheme != 0)
+		{
+			WinHttpSetCredentials(hRequest, WINHTTP_AUTH_TARGET_PROXY, dwProxyAuthScheme,
+				szProxyUsername.c_str(), szProxyPassword.c_str(), NULL);
+		}
+	}
+}
+
 DWORD WinHttpWrapper::HttpRequest::ChooseAuthScheme(DWORD dwSupportedSchemes)
 {
 	if (IsDebugLoggingEnabled()) {
@@ -1114,6 +1889,8 @@ DWORD WinHttpWrapper::HttpRequest::ChooseAuthScheme(DWORD dwSupportedSchemes)
 	}
 }
 
+#endif
+
 std::unordered_map<std::wstring, std::wstring>& WinHttpWrapper::HttpResponse::GetHeaderDictionary()
 {
 	if (!dict.empty())
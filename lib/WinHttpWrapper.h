@@ -1,5 +1,5 @@
 // The MIT License (MIT)
-// WinHTTP Wrapper 1.0.6
+// WinHTTP Wrapper 1.0.29
 // Copyright (C) 2020 - 2022, by Wong Shao Voon (shaovoon@yahoo.com)
 //
 // http://opensource.org/licenses/MIT
@@ -8,6 +8,29 @@
 // version 1.0.4: Add hGetHeaderDictionary() and contentLength to HttpResponse class
 // version 1.0.5: Add binary response support with automatic content-type detection
 // version 1.0.6: Use DEFAULT_PROXY consistently, add explicit proxy URL support with credential parsing
+// version 1.0.7: Cache negotiated auth schemes per host, discard 401/407 challenge bodies unread
+// version 1.0.8: Add segmented (parallel multi-range) downloads to a file or buffer
+// version 1.0.9: Add resumable downloads with on-disk checkpoints
+// version 1.0.10: Schedule requests under global/per-host concurrency limits and priorities
+// version 1.0.11: Table-driven MIME classification with suffix rules and content sniffing
+// version 1.0.12: Add per-response body size limits and a process-wide memory budget
+// version 1.0.13: Add HttpClient with prepared requests
+// version 1.0.14: Stream request bodies from a BodySource (multipart uploads)
+// version 1.0.15: Add WebSocket connections
+// version 1.0.16: Add Server-Sent Events subscriptions
+// version 1.0.17: Read bodies in place and recycle responses through a ResponsePool
+// version 1.0.18: Record and replay traffic through a TrafficLog
+// version 1.0.19: Pluggable transports, with a POSIX socket backend outside Windows
+// version 1.0.20: Cancel queued and in-flight requests through CancellationTokens
+// version 1.0.21: Token-bucket bandwidth limits, globally, per host and per priority
+// version 1.0.22: Chrome Trace Event export of request timelines
+// version 1.0.23: Native buffers to keep large bodies out of garbage-collected heaps
+// version 1.0.24: Follow append-only resources with incremental Range requests
+// version 1.0.25: Hash response bodies while they are read, with expected digests
+// version 1.0.26: Endpoint groups routing requests to the fastest healthy mirror
+// version 1.0.27: Retry idempotent requests with jittered backoff, Retry-After and per-host budgets
+// version 1.0.28: Per-server circuit breakers failing requests fast while a server is down
+// version 1.0.29: Send request bodies from caller-owned memory (MemorySource) without copying
 
 #pragma once
 
@@ -15,9 +38,20 @@
 #include <vector>
 #include <functional>
 #include <mutex>
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
+#include <memory>
+#include "WinHttpPlatform.h"
 #include <unordered_map>
+#include "WinHttpScheduler.h"
+#include "WinHttpMime.h"
+#include "WinHttpMemory.h"
+#include "WinHttpCancel.h"
+#include "WinHttpThrottle.h"
+#include "WinHttpTrace.h"
+#include "WinHttpHash.h"
+#include "WinHttpEndpoints.h"
+#include "WinHttpRetry.h"
+#include "WinHttpBreaker.h"
+#include <chrono>
 
 namespace WinHttpWrapper
 {
@@ -32,9 +66,57 @@ namespace WinHttpWrapper
 	void DebugLog(const std::wstring& message);
 	void DebugLogFormat(const wchar_t* format, ...);
 
+	// Forget every authentication scheme negotiated so far, so the next
+	// request to each host goes through the 401/407 challenge again
+	// (call it after changing credentials)
+	void ClearAuthSchemeCache();
+
+	// Error of the responses failed by a cancellation, see HttpResponse::cancelled
+	extern const wchar_t* const kCancelledError;
+
+	// Error of the responses whose body does not hash to the expected digest
+	extern const wchar_t* const kDigestMismatchError;
+
+	// Error of the requests not sent because the circuit breaker of their
+	// server is open, see HttpResponse::circuitOpen
+	extern const wchar_t* const kCircuitOpenError;
+
+	// Where the time of a request went, measured by HttpRequest for every
+	// request (traced or not)
+	struct RequestTiming
+	{
+		RequestTiming() { Reset(); }
+		void Reset()
+		{
+			queueUs = 0;
+			waitUs = 0;
+			totalUs = 0;
+			headersAt = std::chrono::steady_clock::time_point();
+		}
+		// Called by the transports once the response headers are in
+		void MarkHeaders()
+		{
+			headersAt = std::chrono::steady_clock::now();
+		}
+		// Set waitUs and totalUs of a request sent at sent and done now
+		void Finish(std::chrono::steady_clock::time_point sent)
+		{
+			const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			const std::chrono::steady_clock::time_point headers =
+				headersAt > sent ? headersAt : now;
+			waitUs = std::chrono::duration_cast<std::chrono::microseconds>(headers - sent).count();
+			totalUs = std::chrono::duration_cast<std::chrono::microseconds>(now - sent).count();
+		}
+
+		ULONGLONG queueUs;      // Waiting for a scheduler slot
+		ULONGLONG waitUs;       // From sending (connecting included) to the response headers
+		ULONGLONG totalUs;      // From sending to the end of the body
+		std::chrono::steady_clock::time_point headersAt;
+	};
+
 	struct HttpResponse
 	{
-		HttpResponse() : statusCode(0), contentLength(0), isBinary(false) {}
+		HttpResponse() : statusCode(0), contentLength(0), isBinary(false), cancelled(false), circuitOpen(false) {}
 		void Reset()
 		{
 			text = "";
@@ -45,13 +127,21 @@ namespace WinHttpWrapper
 			dict.clear();
 			contentLength = 0;
 			isBinary = false;
+			cancelled = false;
+			circuitOpen = false;
+			digest.clear();
+			timing.Reset();
 		}
+		// Reset() keeps the buffers' capacity for the next request; this
+		// also frees the buffers larger than maxRetainedBytes
+		void Recycle(size_t maxRetainedBytes);
+
 		std::unordered_map<std::wstring, std::wstring>& GetHeaderDictionary();
 
 		// Get content type from response headers
 		std::wstring GetContentType();
 
-		// Check if content type indicates binary data
+		// Check if content type indicates binary data, with the default MimeClassifier
 		static bool IsBinaryMimeType(const std::wstring& contentType);
 
 		std::string text;           // For text responses
@@ -61,10 +151,85 @@ namespace WinHttpWrapper
 		DWORD contentLength;
 		std::wstring error;
 		bool isBinary;              // True if response is binary
+		bool cancelled;             // Failed because its CancellationToken was cancelled
+		bool circuitOpen;           // Failed without being sent, see CircuitBreakers
+		std::string digest;         // Hex digest of the body, see HttpRequest::SetBodyHash
+		RequestTiming timing;
 	private:
 		std::unordered_map<std::wstring, std::wstring> dict;
 	};
 
+	// Request body produced while it is being sent, so that its size does
+	// not matter (see MultipartForm)
+	class BodySource
+	{
+	public:
+		virtual ~BodySource() {}
+
+		// Total size, announced as Content-Length
+		virtual ULONGLONG Length() const = 0;
+
+		// Sent as Content-Type when not empty
+		virtual std::wstring ContentType() const { return std::wstring(); }
+
+		// Start over: the body is sent again after an authentication challenge
+		virtual bool Rewind() = 0;
+
+		// Fill buffer with up to size bytes, read = 0 at the end
+		virtual bool Read(uint8_t* buffer, DWORD size, DWORD& read) = 0;
+
+		// The whole body when it is in memory already: the transports then
+		// send it from there rather than through Read()
+		virtual const uint8_t* Data() const { return NULL; }
+	};
+
+	// Body in memory owned by the caller, sent without being copied. It must
+	// stay unchanged until the request returns.
+	class MemorySource : public BodySource
+	{
+	public:
+		MemorySource(const void* data, size_t size, const std::wstring& contentType = std::wstring())
+			: m_Data(static_cast<const uint8_t*>(data)), m_Size(size), m_Pos(0), m_ContentType(contentType) {}
+
+		ULONGLONG Length() const override { return m_Size; }
+		std::wstring ContentType() const override { return m_ContentType; }
+		bool Rewind() override;
+		bool Read(uint8_t* buffer, DWORD size, DWORD& read) override;
+		const uint8_t* Data() const override { return m_Data; }
+
+	private:
+		const uint8_t* m_Data;
+		size_t m_Size;
+		size_t m_Pos;
+		std::wstring m_ContentType;
+	};
+
+	class WebSocket;
+	struct RecordedExchange;
+	class Transport;
+
+	struct DownloadOptions
+	{
+		DownloadOptions() : minSegments(2), maxSegments(8), segmentSize(4 * 1024 * 1024), resume(false) {}
+		std::wstring filePath;      // Destination file, or response.binaryData when empty
+		int minSegments;            // Parallel connections to start with
+		int maxSegments;            // Upper bound while adapting to measured throughput
+		DWORD segmentSize;          // Bytes fetched per Range request
+		bool resume;                // Checkpoint progress to "<filePath>.download" and continue from it
+	};
+
+	// How far HttpRequest::Follow() read an append-only resource (a log, a
+	// data feed), kept by the caller between calls. Start from a default
+	// constructed one.
+	struct FollowCursor
+	{
+		FollowCursor() : offset(0), restarted(false) {}
+		ULONGLONG offset;           // Bytes of the resource read so far
+		std::string tail;           // Last bytes read, to recognize the same resource on the next call
+		std::wstring validator;     // ETag (or Last-Modified) of the last read
+		bool restarted;             // The last call found the resource replaced or truncated and read it from 0
+	};
+
 	class HttpRequest
 	{
 	public:
@@ -87,6 +252,11 @@ namespace WinHttpWrapper
 			, m_ServerUsername(server_username)
 			, m_ServerPassword(server_password)
 			, m_ProxyUrl(proxy_url)
+			, m_Priority(PRIORITY_NORMAL)
+			, m_Mime(NULL)
+			, m_MaxResponseSize(0)
+			, m_Hash(HASH_NONE)
+			, m_TimeoutMs(0)
 		{}
 
 		// Static debug logging control methods (convenience wrappers)
@@ -149,6 +319,64 @@ namespace WinHttpWrapper
 			return !m_ProxyUsername.empty();
 		}
 
+		// Scheduling class used to wait for a slot in the RequestScheduler
+		void SetPriority(RequestPriority priority) {
+			m_Priority = priority;
+		}
+
+		RequestPriority GetPriority() const {
+			return m_Priority;
+		}
+
+		// Classifier deciding between text and binary responses, which must
+		// outlive the request (NULL for MimeClassifier::Default())
+		void SetMimeClassifier(const MimeClassifier* classifier) {
+			m_Mime = classifier;
+		}
+
+		// Fail responses whose body is larger than this, before reading it
+		// when the server sends Content-Length (0 for the process default,
+		// see MemoryBudget::SetDefaultMaxResponseSize)
+		void SetMaxResponseSize(ULONGLONG bytes) {
+			m_MaxResponseSize = bytes;
+		}
+
+		// Hash response bodies while they are read, into HttpResponse::digest.
+		// With expectedDigest (hex), a body hashing to anything else fails
+		// the request, and Download() deletes what it wrote.
+		void SetBodyHash(HashAlgorithm algorithm, const std::string& expectedDigest = std::string()) {
+			m_Hash = algorithm;
+			m_ExpectedDigest = algorithm != HASH_NONE ? expectedDigest : std::string();
+		}
+
+		// Send idempotent requests failing with a transient error again,
+		// within the budget of retries of their host (see RetryBudget)
+		void SetRetryPolicy(const RetryPolicy& policy) {
+			m_Retry = policy;
+		}
+
+		// Time Get/Post/Put/Delete/Upload may take, retries included, 0 for
+		// no limit (the default). Each
+		// wait of the transport for the server is bounded by the time left
+		// (the time waiting for a scheduler slot is not).
+		void SetTimeout(DWORD timeoutMs) {
+			m_TimeoutMs = timeoutMs;
+		}
+
+		// Token aborting this request (and its downloads) when cancelled
+		void SetCancellationToken(const CancellationToken& token) {
+			m_Cancel = std::make_shared<const CancellationToken>(token);
+		}
+
+		void ClearCancellationToken() {
+			m_Cancel.reset();
+		}
+
+		// Backend sending this request (NULL for Transport::Default())
+		void SetTransport(std::shared_ptr<Transport> transport) {
+			m_Transport = transport;
+		}
+
 		bool Get(const std::wstring& rest_of_path,
 			const std::wstring& requestHeader,
 			HttpResponse& response);
@@ -165,14 +393,69 @@ namespace WinHttpWrapper
 			const std::string& body,
 			HttpResponse& response);
 
+		// Send a request whose body is streamed from source
+		bool Upload(const std::wstring& verb,
+			const std::wstring& rest_of_path,
+			const std::wstring& requestHeader,
+			BodySource& source,
+			HttpResponse& response);
+
+		// GET what was appended to the resource since cursor, with a Range
+		// request starting a few bytes before it to check that the resource
+		// is still the same, and move cursor past it. The body holds only
+		// the new bytes (status 304 when nothing changed). A resource that
+		// was truncated or replaced is read again from 0, with
+		// cursor.restarted set. Implemented in WinHttpFollow.cpp
+		bool Follow(const std::wstring& rest_of_path,
+			const std::wstring& requestHeader,
+			FollowCursor& cursor,
+			HttpResponse& response);
+
+#ifdef _WIN32
+		// Download a resource with parallel Range requests written straight
+		// to their offset in the destination. Falls back to a single stream
+		// when the server does not support ranges. Implemented in WinHttpDownload.cpp
+		bool Download(const std::wstring& rest_of_path,
+			const std::wstring& requestHeader,
+			const DownloadOptions& options,
+			HttpResponse& response);
+#endif
+
+		// Upgrade to a WebSocket connection, started on socket when the
+		// server answers 101. Implemented in WinHttpWebSocket.cpp, and in
+		// WinHttpPosixWebSocket.cpp outside Windows
+		bool OpenWebSocket(const std::wstring& rest_of_path,
+			const std::wstring& requestHeader,
+			WebSocket& socket,
+			HttpResponse& response);
+
 	private:
-		// Request is wrapper around http()
+		friend class HttpClient;
+		friend class EventSource;
+		friend class WinHttpTransport;
+
+		// Sends the request, and again as the retry policy allows
 		bool Request(
 			const std::wstring& verb,
 			const std::wstring& rest_of_path,
 			const std::wstring& requestHeader,
 			const std::string& body,
-			HttpResponse& response);
+			HttpResponse& response,
+			BodySource* source = NULL,
+			const CancellationToken* cancel = NULL);
+
+		// Schedules one attempt, then sends it through the transport
+		bool Attempt(
+			const std::wstring& verb,
+			const std::wstring& rest_of_path,
+			const std::wstring& requestHeader,
+			const std::string& body,
+			HttpResponse& response,
+			BodySource* source,
+			const CancellationToken* token,
+			DWORD timeoutMs);
+
+#ifdef _WIN32
 		static bool http(
 			const std::wstring& verb, const std::wstring& user_agent, const std::wstring& domain,
 			const std::wstring& rest_of_path, int port, bool secure,
@@ -182,9 +465,35 @@ namespace WinHttpWrapper
 			DWORD& statusCode, DWORD& dwContent, std::wstring& error,
 			const std::wstring& szProxyUsername, const std::wstring& szProxyPassword,
 			const std::wstring& szServerUsername, const std::wstring& szServerPassword,
+			const std::wstring& szProxyUrl, const MimeClassifier& mime,
+			ULONGLONG maxResponseSize, BodySource* source,
+			RecordedExchange* record, const CancellationToken* cancel,
+			const BandwidthThrottle::Meter& meter, BodyHasher* hasher,
+			RequestTiming* timing, DWORD timeoutMs);
+
+		static HINTERNET OpenSession(const std::wstring& user_agent,
+			const std::wstring& szProxyUrl, const std::wstring& szProxyUsername);
+		static void ApplyCachedCredentials(HINTERNET hRequest,
+			const std::wstring& domain, int port,
+			const std::wstring& szProxyUsername, const std::wstring& szProxyPassword,
+			const std::wstring& szServerUsername, const std::wstring& szServerPassword,
 			const std::wstring& szProxyUrl);
 
 		static DWORD ChooseAuthScheme(DWORD dwSupportedSchemes);
+#endif
+
+		ULONGLONG MaxResponseSize() const {
+			return m_MaxResponseSize ? m_MaxResponseSize : MemoryBudget::Instance().GetDefaultMaxResponseSize();
+		}
+
+		// Scheduler key of this request's server
+		std::wstring HostKey() const {
+			return HostKey(m_Domain, m_Port);
+		}
+
+		static std::wstring HostKey(const std::wstring& domain, int port) {
+			return domain + L":" + std::to_wstring(port);
+		}
 
 		std::wstring m_Domain;
 		int m_Port;
@@ -195,6 +504,15 @@ namespace WinHttpWrapper
 		std::wstring m_ServerUsername;
 		std::wstring m_ServerPassword;
 		std::wstring m_ProxyUrl;  // Explicit proxy URL
+		RequestPriority m_Priority;
+		const MimeClassifier* m_Mime;
+		ULONGLONG m_MaxResponseSize;
+		std::shared_ptr<Transport> m_Transport;
+		std::shared_ptr<const CancellationToken> m_Cancel;
+		HashAlgorithm m_Hash;
+		std::string m_ExpectedDigest;
+		RetryPolicy m_Retry;
+		DWORD m_TimeoutMs;
 	};
 
 }
\ No newline at end of file
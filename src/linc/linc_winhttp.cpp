@@ -2,6 +2,18 @@
 
 #include "linc_winhttp.h"
 #include "WinHttpWrapper.h"
+#include "WinHttpMetrics.h"
+#include "WinHttpUtf.h"
+#include "WinHttpJson.h"
+#include "WinHttpClient.h"
+#include "WinHttpMultipart.h"
+#include "WinHttpWebSocket.h"
+#include "WinHttpEventSource.h"
+#include "WinHttpResponsePool.h"
+#include "WinHttpReplay.h"
+#include "WinHttpThrottle.h"
+#include "WinHttpTrace.h"
+#include "WinHttpBuffer.h"
 
 #include <string>
 #include <stdexcept>
@@ -9,6 +21,9 @@
 #include <memory>
 #include <vector>
 #include <map>
+#include <algorithm>
+#include <cstring>
+#include <mutex>
 
 namespace linc {
     namespace winhttp {
@@ -23,50 +38,24 @@ namespace linc {
          * Convert UTF-8 encoded C string to wstring
          * @param utf8_cstr UTF-8 encoded null-terminated C string
          * @return wstring representation (UTF-16 on Windows)
-         * @throws std::runtime_error if conversion fails
          */
         std::wstring utf8ToWstring(const char* utf8_cstr) {
-            if (!utf8_cstr || *utf8_cstr == '\0') {
-                return std::wstring();
+            std::wstring result;
+            if (utf8_cstr) {
+                ::WinHttpWrapper::Utf8ToWide(utf8_cstr, strlen(utf8_cstr), result);
             }
-
-            // Get required buffer size
-            int len = MultiByteToWideChar(CP_UTF8, 0, utf8_cstr, -1, nullptr, 0);
-            if (len == 0) {
-                //throw std::runtime_error("Failed to convert UTF-8 string to wstring");
-                return L"";
-            }
-
-            // Allocate buffer and convert (-1 to exclude null terminator from string size)
-            std::wstring result(len - 1, 0);
-            MultiByteToWideChar(CP_UTF8, 0, utf8_cstr, -1, &result[0], len);
-
             return result;
         }
 
         /**
-         * Convert wstring to UTF-8 encoded std::string
+         * Convert wstring to a hxcpp String. The UTF-8 bytes go through a
+         * per-thread scratch buffer, since ::String copies them anyway.
          * @param wstr Wide string to convert (UTF-16 on Windows)
-         * @return UTF-8 encoded std::string
-         * @throws std::runtime_error if conversion fails
          */
-        std::string wstringToUtf8(const std::wstring& wstr) {
-            if (wstr.empty()) {
-                return std::string();
-            }
-
-            // Get required buffer size
-            int len = WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), -1, nullptr, 0, nullptr, nullptr);
-            if (len == 0) {
-                //throw std::runtime_error("Failed to convert wstring to UTF-8 string");
-                return "";
-            }
-
-            // Allocate buffer and convert (-1 to exclude null terminator from string size)
-            std::string result(len - 1, 0);
-            WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), -1, &result[0], len, nullptr, nullptr);
-
-            return result;
+        ::String wstringToHxString(const std::wstring& wstr) {
+            static thread_local std::string scratch;
+            ::WinHttpWrapper::WideToUtf8(wstr.data(), wstr.size(), scratch);
+            return ::String::create(scratch.c_str(), static_cast<int>(scratch.size()));
         }
 
         Array<unsigned char> vectorToHaxeBytes(const std::vector<uint8_t>& binary_data) {
@@ -88,17 +77,175 @@ namespace linc {
             return haxe_bytes;
         }
 
-        ::Dynamic responseToHxObject(::WinHttpWrapper::HttpResponse& response) {
+        /**
+         * Build the Haxe value of the node at index, advancing index past it
+         * and its children. Objects are filled like haxe.Json.parse does.
+         */
+        ::Dynamic jsonToHx(const ::WinHttpWrapper::JsonDocument& doc, size_t& index) {
+
+            typedef ::WinHttpWrapper::JsonDocument JsonDocument;
+            const JsonDocument::Node& node = doc.Nodes()[index++];
+
+            switch (node.type) {
+                case JsonDocument::JSON_FALSE:
+                    return false;
+                case JsonDocument::JSON_TRUE:
+                    return true;
+                case JsonDocument::JSON_INT:
+                    return (int)node.integer;
+                case JsonDocument::JSON_NUMBER:
+                    return node.number;
+                case JsonDocument::JSON_STRING:
+                    return ::String::create(doc.Strings() + node.str.offset, (int)node.str.length);
+                case JsonDocument::JSON_ARRAY: {
+                    Array<Dynamic> array = new Array_obj<Dynamic>(0, node.count);
+                    for (uint32_t i = 0; i < node.count; ++i) {
+                        array->push(jsonToHx(doc, index));
+                    }
+                    return array;
+                }
+                case JsonDocument::JSON_OBJECT: {
+                    hx::Anon object = hx::Anon_obj::Create();
+                    for (uint32_t i = 0; i < node.count; ++i) {
+                        const JsonDocument::Node& key = doc.Nodes()[index++];
+                        ::String name = ::String::create(doc.Strings() + key.str.offset, (int)key.str.length);
+                        object->__SetField(name, jsonToHx(doc, index), hx::paccDynamic);
+                    }
+                    return object;
+                }
+                default:
+                    return null();
+            }
+
+        }
+
+        // Native objects Haxe only knows by an int handle. find() hands out
+        // a reference, so an object removed while another thread uses it
+        // lives until that use ends.
+        template <typename T>
+        class HandleRegistry {
+
+        public:
+            int add(std::shared_ptr<T> object) {
+
+                std::lock_guard<std::mutex> lock(mutex);
+                const int handle = next++;
+                objects[handle] = std::move(object);
+                return handle;
+
+            }
+
+            std::shared_ptr<T> find(int handle) {
+
+                std::lock_guard<std::mutex> lock(mutex);
+                auto it = objects.find(handle);
+                return it == objects.end() ? nullptr : it->second;
+
+            }
+
+            // The removed object, if any, for the caller to close or free
+            // outside the lock
+            std::shared_ptr<T> remove(int handle) {
+
+                std::shared_ptr<T> object;
+                std::lock_guard<std::mutex> lock(mutex);
+                auto it = objects.find(handle);
+                if (it != objects.end()) {
+                    object = std::move(it->second);
+                    objects.erase(it);
+                }
+                return object;
+
+            }
+
+        private:
+            std::mutex mutex;
+            std::map<int, std::shared_ptr<T>> objects;
+            int next = 1;
+
+        };
+
+        // Native buffers: the bytes stay out of the GC heap until released
+        static HandleRegistry<::WinHttpWrapper::NativeBuffer> nativeBuffers;
+
+        int mapNativeFile(::String path) {
+
+            if (::hx::IsNull(path)) return 0;
+            const std::wstring _path = utf8ToWstring(path.c_str());
+            std::shared_ptr<::WinHttpWrapper::NativeBuffer> buffer;
+            {
+                hx::AutoGCFreeZone gcFreeZone;
+                buffer = ::WinHttpWrapper::NativeBuffer::MapFile(_path);
+            }
+            return buffer ? nativeBuffers.add(buffer) : 0;
+
+        }
+
+        Float nativeBufferLength(int handle) {
+
+            std::shared_ptr<::WinHttpWrapper::NativeBuffer> buffer = nativeBuffers.find(handle);
+            return buffer ? static_cast<Float>(buffer->Size()) : 0;
+
+        }
+
+        unsigned char* nativeBufferData(int handle) {
+
+            // Stays valid after the lookup: only releaseNativeBuffer() frees it
+            std::shared_ptr<::WinHttpWrapper::NativeBuffer> buffer = nativeBuffers.find(handle);
+            return buffer ? reinterpret_cast<unsigned char*>(buffer->Data()) : nullptr;
+
+        }
+
+        Array<unsigned char> nativeBufferRead(int handle, Float offset, int length) {
+
+            std::shared_ptr<::WinHttpWrapper::NativeBuffer> buffer = nativeBuffers.find(handle);
+            if (!buffer || offset < 0 || length < 0 || offset + length > static_cast<Float>(buffer->Size())) {
+                return null();
+            }
+
+            Array<unsigned char> haxe_bytes = new Array_obj<unsigned char>(length, length);
+            if (length > 0) {
+                memcpy(haxe_bytes->GetBase(), buffer->Data() + static_cast<size_t>(offset), length);
+            }
+            return haxe_bytes;
+
+        }
+
+        void releaseNativeBuffer(int handle) {
+
+            // Freed (or unmapped) outside the lock
+            nativeBuffers.remove(handle);
+
+        }
+
+        hx::Anon responseToHxObject(::WinHttpWrapper::HttpResponse& response, const ::WinHttpWrapper::JsonDocument* json = nullptr, bool nativeBody = false) {
 
+            ::WinHttpWrapper::TraceSpan span("marshal", "haxe");
             hx::Anon result = hx::Anon_obj::Create();
 
-            result->Add(HX_CSTRING("headers"), response.header.empty() ? null() : ::String(wstringToUtf8(response.header).c_str()));
-            result->Add(HX_CSTRING("content"), response.isBinary ? null() : ::String(response.text.c_str()));
+            result->Add(HX_CSTRING("headers"), response.header.empty() ? null() : wstringToHxString(response.header));
+            if (json) {
+                // The parsed body replaces the text one
+                size_t index = 0;
+                result->Add(HX_CSTRING("json"), jsonToHx(*json, index));
+                result->Add(HX_CSTRING("content"), null());
+            }
+            else {
+                result->Add(HX_CSTRING("content"), response.isBinary ? null() : ::String(response.text.c_str()));
+            }
             result->Add(HX_CSTRING("contentLength"), response.contentLength);
             result->Add(HX_CSTRING("status"), response.statusCode);
-            result->Add(HX_CSTRING("error"), response.error.empty() ? null() : ::String(wstringToUtf8(response.error).c_str()));
+            result->Add(HX_CSTRING("error"), response.error.empty() ? null() : wstringToHxString(response.error));
+            result->Add(HX_CSTRING("cancelled"), response.cancelled);
+            result->Add(HX_CSTRING("circuitOpen"), response.circuitOpen);
+            result->Add(HX_CSTRING("digest"), response.digest.empty() ? null() : ::String(response.digest.c_str()));
 
-            if (response.isBinary) {
+            if (response.isBinary && nativeBody) {
+                // The body moves out of the pooled response without a copy
+                std::shared_ptr<::WinHttpWrapper::NativeBuffer> buffer = std::make_shared<::WinHttpWrapper::NativeBuffer>(std::move(response.binaryData));
+                result->Add(HX_CSTRING("nativeContent"), nativeBuffers.add(buffer));
+            }
+            else if (response.isBinary) {
                 result->Add(HX_CSTRING("binaryContent"), vectorToHaxeBytes(response.binaryData));
             }
 
@@ -106,7 +253,96 @@ namespace linc {
 
         }
 
-        ::Dynamic sendHttpRequest(::String domain, int port, bool https, ::String path, int method, ::String body, ::String headers, ::String proxy, int timeout) {
+        // Cancellation tokens. A request holds its own copy of the token,
+        // so releasing a handle while the request runs is safe.
+        static HandleRegistry<::WinHttpWrapper::CancellationToken> cancelTokens;
+
+        int createCancelToken(int parent) {
+
+            std::shared_ptr<::WinHttpWrapper::CancellationToken> parentToken = cancelTokens.find(parent);
+            std::shared_ptr<::WinHttpWrapper::CancellationToken> token = parentToken
+                ? std::make_shared<::WinHttpWrapper::CancellationToken>(parentToken->Child())
+                : std::make_shared<::WinHttpWrapper::CancellationToken>();
+
+            return cancelTokens.add(token);
+
+        }
+
+        void cancelToken(int handle) {
+
+            std::shared_ptr<::WinHttpWrapper::CancellationToken> token = cancelTokens.find(handle);
+            if (token) {
+                // Closing the request handles may block briefly
+                hx::AutoGCFreeZone gcFreeZone;
+                token->Cancel();
+            }
+
+        }
+
+        bool isTokenCancelled(int handle) {
+
+            std::shared_ptr<::WinHttpWrapper::CancellationToken> token = cancelTokens.find(handle);
+            return token && token->IsCancelled();
+
+        }
+
+        void releaseCancelToken(int handle) {
+
+            cancelTokens.remove(handle);
+
+        }
+
+        static void applyCancelToken(::WinHttpWrapper::HttpRequest& req, int handle) {
+
+            std::shared_ptr<::WinHttpWrapper::CancellationToken> token = cancelTokens.find(handle);
+            if (token) {
+                req.SetCancellationToken(*token);
+            }
+
+        }
+
+        // Retry policy from the Haxe fields, 0 keeping a default
+        static ::WinHttpWrapper::RetryPolicy toRetryPolicy(int attempts, int baseDelayMs, int maxDelayMs) {
+
+            ::WinHttpWrapper::RetryPolicy policy;
+            policy.maxAttempts = attempts > 1 ? attempts : 1;
+            if (baseDelayMs > 0) policy.baseDelayMs = (DWORD)baseDelayMs;
+            if (maxDelayMs > 0) policy.maxDelayMs = (DWORD)maxDelayMs;
+            return policy;
+
+        }
+
+        // The Haxe API has always taken the timeout in seconds
+        static DWORD toTimeoutMs(int seconds) {
+
+            return seconds > 0 ? (DWORD)(std::min)(seconds, (int)(MAXDWORD / 1000)) * 1000 : 0;
+
+        }
+
+        // Keeps a GC object alive while its memory is read from a GC free
+        // zone, where nothing else on this thread may reference it
+        struct GCRoot {
+
+            explicit GCRoot(hx::Object* object) : object(object) {
+                if (object) hx::GCAddRoot(&this->object);
+            }
+
+            ~GCRoot() {
+                if (object) hx::GCRemoveRoot(&object);
+            }
+
+            hx::Object* object;
+
+        };
+
+        // Send bodySize bytes at body, which owner (a GC object) holds, without
+        // copying them: owner is rooted for the duration of the request. A
+        // collector built with HXCPP_GC_MOVING may move it even so, and the
+        // body is then copied once.
+        static ::Dynamic sendRequest(::String domain, int port, bool https, ::String path, int method, hx::Object* owner, const uint8_t* body, size_t bodySize, ::String headers, ::String proxy, int timeout, int priority, int responseType, int cancelToken, int hashAlgorithm, ::String expectedDigest, int retryAttempts, int retryBaseDelayMs, int retryMaxDelayMs) {
+
+            // The request and its marshaling share a trace request ID
+            ::WinHttpWrapper::TraceRequestScope traceScope;
 
             if (method < 0 || method > 3) {
                 hx::Anon errResult = hx::Anon_obj::Create();
@@ -115,18 +351,32 @@ namespace linc {
                 return errResult;
             }
 
-            // Copy every input out of GC memory first: the blocking WinHTTP
-            // calls below run inside a hxcpp GC free zone, where touching
-            // GC-managed values (::String, ...) is forbidden.
+            // Copy every other input out of GC memory first: the blocking
+            // WinHTTP calls below run inside a hxcpp GC free zone, where
+            // touching GC-managed values (::String, ...) is forbidden.
             const std::wstring _domain = utf8ToWstring(domain.c_str());
             const std::wstring _path = ::hx::IsNull(path) ? L"" : utf8ToWstring(path.c_str());
-            const std::string _body = ::hx::IsNull(body) ? "" : std::string(body.c_str());
+#ifdef HXCPP_GC_MOVING
+            const std::string _bodyCopy(reinterpret_cast<const char*>(body), bodySize);
+            body = reinterpret_cast<const uint8_t*>(_bodyCopy.data());
+            owner = nullptr;
+#endif
+            GCRoot bodyRoot(owner);
             const std::wstring _headers = ::hx::IsNull(headers) ? L"" : utf8ToWstring(headers.c_str());
             const bool _hasProxy = !( ::hx::IsNull(proxy));
             const std::wstring _proxy = _hasProxy ? utf8ToWstring(proxy.c_str()) : L"";
+            const std::string _expectedDigest = ::hx::IsNull(expectedDigest) ? "" : std::string(expectedDigest.c_str());
 
             ::WinHttpWrapper::HttpRequest req(_domain, port, https);
-            ::WinHttpWrapper::HttpResponse response;
+            req.SetPriority(static_cast<::WinHttpWrapper::RequestPriority>(priority));
+            req.SetBodyHash(static_cast<::WinHttpWrapper::HashAlgorithm>(hashAlgorithm), _expectedDigest);
+            req.SetRetryPolicy(toRetryPolicy(retryAttempts, retryBaseDelayMs, retryMaxDelayMs));
+            req.SetTimeout(toTimeoutMs(timeout));
+            applyCancelToken(req, cancelToken);
+            ::WinHttpWrapper::ResponsePool::Lease pooled = ::WinHttpWrapper::ResponsePool::Acquire();
+            ::WinHttpWrapper::HttpResponse& response = *pooled;
+            ::WinHttpWrapper::JsonDocument json;
+            bool parsed = false;
 
             {
                 // Without this zone, a slow request would make the garbage
@@ -143,23 +393,925 @@ namespace linc {
                     // GET
                     req.Get(_path, _headers, response);
                 }
-                else if (method == 1) {
-                    // POST
-                    req.Post(_path, _headers, _body, response);
+                else {
+                    // POST, PUT or DELETE
+                    static const wchar_t* verbs[] = { L"GET", L"POST", L"PUT", L"DELETE" };
+                    ::WinHttpWrapper::MemorySource source(body, bodySize);
+                    req.Upload(verbs[method], _path, _headers, source, response);
+                }
+
+                // Parse while still outside the GC; invalid JSON falls back
+                // to the text body
+                if (responseType == 1 && !response.isBinary && !response.text.empty()) {
+                    ::WinHttpWrapper::TraceSpan parseSpan("parse json", "haxe");
+                    parsed = json.Parse(response.text.data(), response.text.size());
                 }
-                else if (method == 2) {
-                    // PUT
-                    req.Put(_path, _headers, _body, response);
+            }
+
+            return responseToHxObject(response, parsed ? &json : nullptr, responseType == 2);
+
+        }
+
+        // The UTF-8 bytes of a string body, NULs included; only strings
+        // stored as UTF-16 need converting. Boxed, the string holds its
+        // characters for the root.
+        struct StringBody {
+
+            explicit StringBody(::String body) : data(reinterpret_cast<const uint8_t*>("")), size(0) {
+                if (::hx::IsNull(body)) {
+                    return;
                 }
-                else if (method == 3) {
-                    // DELETE
-                    req.Delete(_path, _headers, _body, response);
+#ifdef HX_SMART_STRINGS
+                if (body.isUTF16Encoded()) {
+                    ::WinHttpWrapper::WideToUtf8(reinterpret_cast<const wchar_t*>(body.raw_wptr()), body.length, converted);
+                    data = reinterpret_cast<const uint8_t*>(converted.data());
+                    size = converted.size();
+                    return;
                 }
+#endif
+                data = reinterpret_cast<const uint8_t*>(body.raw_ptr());
+                size = body.length;
+                owner = body;
             }
 
-            ::Dynamic result = responseToHxObject(response);
-	        response.Reset();
-            return result;
+            const uint8_t* data;
+            size_t size;
+            ::Dynamic owner;
+#ifdef HX_SMART_STRINGS
+            std::string converted;
+#endif
+
+        private:
+            StringBody(const StringBody&) = delete;
+            StringBody& operator=(const StringBody&) = delete;
+
+        };
+
+        // Checks offset and length (-1 for the rest) against a Bytes body,
+        // pointing data at the range
+        static bool bytesRange(Array<unsigned char> body, int offset, int& length, const uint8_t*& data) {
+
+            const int available = ::hx::IsNull(body) ? 0 : body->length;
+            if (length < 0) {
+                length = available - offset;
+            }
+            if (offset < 0 || length < 0 || offset > available - length) {
+                return false;
+            }
+
+            data = available > 0 ? reinterpret_cast<const uint8_t*>(body->GetBase()) + offset : nullptr;
+            return true;
+
+        }
+
+        ::Dynamic sendHttpRequest(::String domain, int port, bool https, ::String path, int method, ::String body, ::String headers, ::String proxy, int timeout, int priority, int responseType, int cancelToken, int hashAlgorithm, ::String expectedDigest, int retryAttempts, int retryBaseDelayMs, int retryMaxDelayMs) {
+
+            StringBody _body(body);
+            return sendRequest(domain, port, https, path, method, _body.owner.mPtr, _body.data, _body.size, headers, proxy, timeout, priority, responseType, cancelToken, hashAlgorithm, expectedDigest, retryAttempts, retryBaseDelayMs, retryMaxDelayMs);
+
+        }
+
+        ::Dynamic sendHttpRequestBytes(::String domain, int port, bool https, ::String path, int method, Array<unsigned char> body, int offset, int length, ::String headers, ::String proxy, int timeout, int priority, int responseType, int cancelToken, int hashAlgorithm, ::String expectedDigest, int retryAttempts, int retryBaseDelayMs, int retryMaxDelayMs) {
+
+            const uint8_t* data = nullptr;
+            if (!bytesRange(body, offset, length, data)) {
+                hx::Anon errResult = hx::Anon_obj::Create();
+                errResult->Add(HX_CSTRING("status"), 0);
+                errResult->Add(HX_CSTRING("error"), HX_CSTRING("Invalid body range"));
+                return errResult;
+            }
+
+            return sendRequest(domain, port, https, path, method, body.mPtr, data, (size_t)length, headers, proxy, timeout, priority, responseType, cancelToken, hashAlgorithm, expectedDigest, retryAttempts, retryBaseDelayMs, retryMaxDelayMs);
+
+        }
+
+        ::Dynamic download(::String domain, int port, bool https, ::String path, ::String headers, ::String proxy, ::String filePath, int maxSegments, bool resume, int priority, int cancelToken, int hashAlgorithm, ::String expectedDigest) {
+
+            ::WinHttpWrapper::TraceRequestScope traceScope;
+
+            // Same as sendHttpRequest(): copy every input out of GC memory
+            // before entering the GC free zone
+            const std::wstring _domain = utf8ToWstring(domain.c_str());
+            const std::wstring _path = ::hx::IsNull(path) ? L"" : utf8ToWstring(path.c_str());
+            const std::wstring _headers = ::hx::IsNull(headers) ? L"" : utf8ToWstring(headers.c_str());
+            const bool _hasProxy = !( ::hx::IsNull(proxy));
+            const std::wstring _proxy = _hasProxy ? utf8ToWstring(proxy.c_str()) : L"";
+
+            ::WinHttpWrapper::DownloadOptions options;
+            options.filePath = ::hx::IsNull(filePath) ? L"" : utf8ToWstring(filePath.c_str());
+            options.resume = resume;
+            if (maxSegments > 0) {
+                options.maxSegments = maxSegments;
+                options.minSegments = (std::min)(options.minSegments, maxSegments);
+            }
+            const std::string _expectedDigest = ::hx::IsNull(expectedDigest) ? "" : std::string(expectedDigest.c_str());
+
+            ::WinHttpWrapper::HttpRequest req(_domain, port, https);
+            req.SetPriority(static_cast<::WinHttpWrapper::RequestPriority>(priority));
+            req.SetBodyHash(static_cast<::WinHttpWrapper::HashAlgorithm>(hashAlgorithm), _expectedDigest);
+            applyCancelToken(req, cancelToken);
+            ::WinHttpWrapper::ResponsePool::Lease pooled = ::WinHttpWrapper::ResponsePool::Acquire();
+            ::WinHttpWrapper::HttpResponse& response = *pooled;
+
+            {
+                hx::AutoGCFreeZone gcFreeZone;
+
+                if (_hasProxy) {
+                    req.SetProxy(_proxy);
+                }
+
+                req.Download(_path, _headers, options, response);
+            }
+
+            return responseToHxObject(response);
+
+        }
+
+        ::Dynamic sendMultipart(::String domain, int port, bool https, ::String path, int method, ::String headers, ::String proxy, int priority, int responseType,
+            Array<int> kinds, Array<::String> names, Array<::String> values, Array<::String> fileNames, Array<::String> contentTypes, Array<::Dynamic> datas, int cancelToken) {
+
+            ::WinHttpWrapper::TraceRequestScope traceScope;
+
+            static const wchar_t* verbs[] = { L"GET", L"POST", L"PUT", L"DELETE" };
+            if (method < 0 || method > 3) {
+                hx::Anon errResult = hx::Anon_obj::Create();
+                errResult->Add(HX_CSTRING("status"), 0);
+                errResult->Add(HX_CSTRING("error"), HX_CSTRING("Invalid method"));
+                return errResult;
+            }
+
+            const std::wstring _domain = utf8ToWstring(domain.c_str());
+            const std::wstring _path = ::hx::IsNull(path) ? L"" : utf8ToWstring(path.c_str());
+            const std::wstring _headers = ::hx::IsNull(headers) ? L"" : utf8ToWstring(headers.c_str());
+            const bool _hasProxy = !( ::hx::IsNull(proxy));
+            const std::wstring _proxy = _hasProxy ? utf8ToWstring(proxy.c_str()) : L"";
+
+            // Fields and in-memory data are copied out of GC memory here,
+            // files are only sized and are read while sending
+            ::WinHttpWrapper::MultipartForm form;
+            for (int i = 0; i < kinds->length; ++i) {
+                ::String name = names[i];
+                ::String fileName = fileNames[i];
+                ::String contentType = contentTypes[i];
+                const std::string _name = ::hx::IsNull(name) ? "" : std::string(name.c_str());
+                const std::string _fileName = ::hx::IsNull(fileName) ? "" : std::string(fileName.c_str());
+                const std::string _contentType = ::hx::IsNull(contentType) ? "" : std::string(contentType.c_str());
+
+                if (kinds[i] == 0) {
+                    ::String value = values[i];
+                    form.AddField(_name, ::hx::IsNull(value) ? "" : std::string(value.c_str()));
+                }
+                else if (kinds[i] == 1) {
+                    Array<unsigned char> data = datas[i];
+                    if (::hx::IsNull(data)) {
+                        form.AddData(_name, _fileName, _contentType, nullptr, 0);
+                    }
+                    else {
+                        form.AddData(_name, _fileName, _contentType, reinterpret_cast<const uint8_t*>(data->GetBase()), data->length);
+                    }
+                }
+                else {
+                    ::String filePath = values[i];
+                    if (::hx::IsNull(filePath) || !form.AddFile(_name, utf8ToWstring(filePath.c_str()), _fileName, _contentType)) {
+                        hx::Anon errResult = hx::Anon_obj::Create();
+                        errResult->Add(HX_CSTRING("status"), 0);
+                        errResult->Add(HX_CSTRING("error"), HX_CSTRING("Cannot read upload file: ") + (::hx::IsNull(filePath) ? HX_CSTRING("null") : filePath));
+                        return errResult;
+                    }
+                }
+            }
+
+            ::WinHttpWrapper::HttpRequest req(_domain, port, https);
+            req.SetPriority(static_cast<::WinHttpWrapper::RequestPriority>(priority));
+            applyCancelToken(req, cancelToken);
+            ::WinHttpWrapper::ResponsePool::Lease pooled = ::WinHttpWrapper::ResponsePool::Acquire();
+            ::WinHttpWrapper::HttpResponse& response = *pooled;
+            ::WinHttpWrapper::JsonDocument json;
+            bool parsed = false;
+
+            {
+                hx::AutoGCFreeZone gcFreeZone;
+
+                if (_hasProxy) {
+                    req.SetProxy(_proxy);
+                }
+
+                req.Upload(verbs[method], _path, _headers, form, response);
+                if (responseType == 1 && !response.isBinary && !response.text.empty()) {
+                    ::WinHttpWrapper::TraceSpan parseSpan("parse json", "haxe");
+                    parsed = json.Parse(response.text.data(), response.text.size());
+                }
+            }
+
+            return responseToHxObject(response, parsed ? &json : nullptr, responseType == 2);
+
+        }
+
+        void registerMimeType(::String type, bool binary) {
+
+            if (::hx::IsNull(type)) return;
+            ::WinHttpWrapper::MimeClassifier::Default().Add(utf8ToWstring(type.c_str()), binary);
+
+        }
+
+        void setContentSniffing(bool enabled) {
+
+            ::WinHttpWrapper::MimeClassifier::Default().SetSniffing(enabled);
+
+        }
+
+        void setMemoryLimits(Float maxBufferedBytes, Float maxResponseBytes) {
+
+            ::WinHttpWrapper::MemoryBudget::Instance().SetLimit(maxBufferedBytes > 0 ? (ULONGLONG)maxBufferedBytes : 0);
+            ::WinHttpWrapper::MemoryBudget::Instance().SetDefaultMaxResponseSize(maxResponseBytes > 0 ? (ULONGLONG)maxResponseBytes : 0);
+
+        }
+
+        bool recordTraffic(::String path) {
+
+            return ::WinHttpWrapper::TrafficLog::Instance().StartRecording(utf8ToWstring(path.c_str()));
+
+        }
+
+        bool replayTraffic(::String path, bool paced) {
+
+            return ::WinHttpWrapper::TrafficLog::Instance().StartReplay(utf8ToWstring(path.c_str()), paced);
+
+        }
+
+        void stopTraffic() {
+
+            ::WinHttpWrapper::TrafficLog::Instance().Stop();
+
+        }
+
+        void startTrace() {
+
+            ::WinHttpWrapper::Tracer::Start();
+
+        }
+
+        void stopTrace() {
+
+            ::WinHttpWrapper::Tracer::Stop();
+
+        }
+
+        bool writeTrace(::String path) {
+
+            if (::hx::IsNull(path)) return false;
+            const std::wstring _path = utf8ToWstring(path.c_str());
+            hx::AutoGCFreeZone gcFreeZone;
+            return ::WinHttpWrapper::Tracer::Write(_path);
+
+        }
+
+        void setResponsePoolLimits(int maxPooled, Float maxRetainedBytes) {
+
+            ::WinHttpWrapper::ResponsePool::SetLimits(maxPooled > 0 ? maxPooled : 0, maxRetainedBytes > 0 ? static_cast<size_t>(maxRetainedBytes) : 0);
+
+        }
+
+        void setConcurrencyLimits(int maxGlobal, int maxPerHost) {
+
+            ::WinHttpWrapper::RequestScheduler::Instance().SetLimits(maxGlobal, maxPerHost);
+
+        }
+
+        void setGlobalBandwidthLimit(Float bytesPerSecond, Float burst) {
+
+            ::WinHttpWrapper::BandwidthThrottle::Instance().SetGlobalLimit(bytesPerSecond > 0 ? (ULONGLONG)bytesPerSecond : 0, burst > 0 ? (ULONGLONG)burst : 0);
+
+        }
+
+        void setHostBandwidthLimit(::String host, Float bytesPerSecond, Float burst) {
+
+            if (::hx::IsNull(host)) return;
+            ::WinHttpWrapper::BandwidthThrottle::Instance().SetHostLimit(utf8ToWstring(host.c_str()), bytesPerSecond > 0 ? (ULONGLONG)bytesPerSecond : 0, burst > 0 ? (ULONGLONG)burst : 0);
+
+        }
+
+        void setPriorityBandwidthLimit(int priority, Float bytesPerSecond, Float burst) {
+
+            ::WinHttpWrapper::BandwidthThrottle::Instance().SetPriorityLimit(static_cast<::WinHttpWrapper::RequestPriority>(priority), bytesPerSecond > 0 ? (ULONGLONG)bytesPerSecond : 0, burst > 0 ? (ULONGLONG)burst : 0);
+
+        }
+
+        bool setEndpointGroup(::String name, Array<::String> domains, Array<int> ports, Array<bool> secures) {
+
+            if (::hx::IsNull(name)) return false;
+            std::vector<::WinHttpWrapper::Endpoint> endpoints;
+            const int count = ::hx::IsNull(domains) ? 0 : domains->length;
+            for (int i = 0; i < count; ++i) {
+                endpoints.push_back(::WinHttpWrapper::Endpoint(utf8ToWstring(domains[i].c_str()), ports[i], secures[i]));
+            }
+            return ::WinHttpWrapper::EndpointGroups::Instance().SetGroup(utf8ToWstring(name.c_str()), endpoints);
+
+        }
+
+        void setEndpointSelection(Float exploration, int ejectAfterFailures, int ejectionMs) {
+
+            ::WinHttpWrapper::EndpointGroups::Instance().SetExploration(exploration);
+            ::WinHttpWrapper::EndpointGroups::Instance().SetEjection(ejectAfterFailures, ejectionMs > 0 ? (unsigned int)ejectionMs : 0);
+
+        }
+
+        void setRetryBudget(Float ratio, Float minPerSecond) {
+
+            ::WinHttpWrapper::RetryBudget::Instance().SetLimits(ratio, minPerSecond);
+
+        }
+
+        void setCircuitBreaker(bool enabled, Float failureRate, int slowCallMs, Float slowCallRate, int minCalls, int windowMs, int openMs, int halfOpenProbes) {
+
+            ::WinHttpWrapper::BreakerOptions options;
+            options.failureRate = failureRate;
+            options.slowCallMs = slowCallMs > 0 ? (DWORD)slowCallMs : 0;
+            options.slowCallRate = slowCallRate;
+            options.minCalls = minCalls;
+            options.windowMs = windowMs > 0 ? (DWORD)windowMs : 0;
+            options.openMs = openMs > 0 ? (DWORD)openMs : 0;
+            options.halfOpenProbes = halfOpenProbes;
+            ::WinHttpWrapper::CircuitBreakers::Instance().SetOptions(options);
+            ::WinHttpWrapper::CircuitBreakers::Instance().SetEnabled(enabled);
+
+        }
+
+        ::Dynamic getMetrics() {
+
+            const ::WinHttpWrapper::Metrics metrics = ::WinHttpWrapper::GetMetrics();
+
+            hx::Anon result = hx::Anon_obj::Create();
+
+            result->Add(HX_CSTRING("activeRequests"), (int)metrics.activeRequests);
+            result->Add(HX_CSTRING("queuedRequests"), (int)metrics.queuedRequests);
+
+            // Queue-time metrics, one entry per priority class
+            Array<Dynamic> queues = new Array_obj<Dynamic>(0, ::WinHttpWrapper::PRIORITY_COUNT);
+            for (int p = 0; p < ::WinHttpWrapper::PRIORITY_COUNT; ++p) {
+                hx::Anon queue = hx::Anon_obj::Create();
+                queue->Add(HX_CSTRING("dispatched"), (Float)metrics.dispatched[p]);
+                queue->Add(HX_CSTRING("queueTimeTotalMs"), metrics.queueTimeTotalUs[p] / 1000.0);
+                queue->Add(HX_CSTRING("queueTimeMaxMs"), metrics.queueTimeMaxUs[p] / 1000.0);
+                queues->push(queue);
+            }
+            result->Add(HX_CSTRING("priorities"), queues);
+
+            result->Add(HX_CSTRING("bufferedBytes"), (Float)metrics.bufferedBytes);
+            result->Add(HX_CSTRING("peakBufferedBytes"), (Float)metrics.peakBufferedBytes);
+            result->Add(HX_CSTRING("budgetWaits"), (Float)metrics.budgetWaits);
+
+            // One entry per bandwidth limit set
+            Array<Dynamic> buckets = new Array_obj<Dynamic>(0, (int)metrics.bandwidthBuckets.size());
+            for (const ::WinHttpWrapper::BandwidthBucketMetrics& bucket : metrics.bandwidthBuckets) {
+                hx::Anon entry = hx::Anon_obj::Create();
+                entry->Add(HX_CSTRING("host"), bucket.host.empty() ? null() : wstringToHxString(bucket.host));
+                entry->Add(HX_CSTRING("priority"), bucket.priority);
+                entry->Add(HX_CSTRING("bytesPerSecond"), (Float)bucket.bytesPerSecond);
+                entry->Add(HX_CSTRING("burst"), (Float)bucket.burst);
+                entry->Add(HX_CSTRING("tokens"), (Float)bucket.tokens);
+                entry->Add(HX_CSTRING("bytes"), (Float)bucket.bytes);
+                entry->Add(HX_CSTRING("waits"), (Float)bucket.waits);
+                buckets->push(entry);
+            }
+            result->Add(HX_CSTRING("bandwidth"), buckets);
+            result->Add(HX_CSTRING("throttleWaits"), (Float)metrics.throttleWaits);
+            result->Add(HX_CSTRING("throttleWaitTimeMs"), metrics.throttleWaitTimeUs / 1000.0);
+
+            // One entry per endpoint of each group
+            Array<Dynamic> endpoints = new Array_obj<Dynamic>(0, (int)metrics.endpoints.size());
+            for (const ::WinHttpWrapper::EndpointMetrics& endpoint : metrics.endpoints) {
+                hx::Anon entry = hx::Anon_obj::Create();
+                entry->Add(HX_CSTRING("group"), wstringToHxString(endpoint.group));
+                entry->Add(HX_CSTRING("url"), wstringToHxString((endpoint.endpoint.secure ? L"https://" : L"http://") + endpoint.endpoint.domain + L":" + std::to_wstring(endpoint.endpoint.port)));
+                entry->Add(HX_CSTRING("latencyMs"), endpoint.latencyMs);
+                entry->Add(HX_CSTRING("bytesPerSecond"), endpoint.bytesPerSecond);
+                entry->Add(HX_CSTRING("errorRate"), endpoint.errorRate);
+                entry->Add(HX_CSTRING("requests"), (Float)endpoint.requests);
+                entry->Add(HX_CSTRING("failures"), (Float)endpoint.failures);
+                entry->Add(HX_CSTRING("ejections"), (Float)endpoint.ejections);
+                entry->Add(HX_CSTRING("ejected"), endpoint.ejected);
+                endpoints->push(entry);
+            }
+            result->Add(HX_CSTRING("endpoints"), endpoints);
+
+            result->Add(HX_CSTRING("retries"), (Float)metrics.retries);
+            result->Add(HX_CSTRING("retriesOverBudget"), (Float)metrics.retriesOverBudget);
+
+            Array<Dynamic> breakers = new Array_obj<Dynamic>(0, (int)metrics.breakers.size());
+            for (const ::WinHttpWrapper::BreakerMetrics& breaker : metrics.breakers) {
+                hx::Anon entry = hx::Anon_obj::Create();
+                entry->Add(HX_CSTRING("host"), wstringToHxString(breaker.host));
+                entry->Add(HX_CSTRING("state"), (int)breaker.state);
+                entry->Add(HX_CSTRING("stateMs"), (Float)breaker.stateMs);
+                entry->Add(HX_CSTRING("failureRate"), breaker.failureRate);
+                entry->Add(HX_CSTRING("slowCallRate"), breaker.slowCallRate);
+                entry->Add(HX_CSTRING("calls"), (Float)breaker.calls);
+                entry->Add(HX_CSTRING("opened"), (Float)breaker.opened);
+                entry->Add(HX_CSTRING("rejected"), (Float)breaker.rejected);
+                breakers->push(entry);
+            }
+            result->Add(HX_CSTRING("breakers"), breakers);
+
+            return result;
+
+        }
+
+        // Clients. Sends keep a reference, so destroying a client while one
+        // of its requests is running is safe.
+        static HandleRegistry<::WinHttpWrapper::HttpClient> clients;
+
+        static const wchar_t* methodVerb(int method) {
+
+            static const wchar_t* verbs[] = { L"GET", L"POST", L"PUT", L"DELETE" };
+            return (method >= 0 && method <= 3) ? verbs[method] : nullptr;
+
+        }
+
+        static ::Dynamic errorResult(const ::String& message) {
+
+            hx::Anon errResult = hx::Anon_obj::Create();
+            errResult->Add(HX_CSTRING("status"), 0);
+            errResult->Add(HX_CSTRING("error"), message);
+            return errResult;
+
+        }
+
+        int createClient(::String domain, int port, bool https, ::String basePath, ::String headers, ::String proxy, ::String username, ::String password, int priority, int timeout, int retryAttempts, int retryBaseDelayMs, int retryMaxDelayMs) {
+
+            const std::wstring _domain = utf8ToWstring(domain.c_str());
+            const std::wstring _basePath = ::hx::IsNull(basePath) ? L"" : utf8ToWstring(basePath.c_str());
+            const std::wstring _headers = ::hx::IsNull(headers) ? L"" : utf8ToWstring(headers.c_str());
+            const std::wstring _username = ::hx::IsNull(username) ? L"" : utf8ToWstring(username.c_str());
+            const std::wstring _password = ::hx::IsNull(password) ? L"" : utf8ToWstring(password.c_str());
+
+            ::WinHttpWrapper::HttpRequest prototype(_domain, port, https, L"WinHttpClient", L"", L"", _username, _password);
+            prototype.SetPriority(static_cast<::WinHttpWrapper::RequestPriority>(priority));
+            prototype.SetRetryPolicy(toRetryPolicy(retryAttempts, retryBaseDelayMs, retryMaxDelayMs));
+            prototype.SetTimeout(toTimeoutMs(timeout));
+            if (!::hx::IsNull(proxy)) {
+                prototype.SetProxy(utf8ToWstring(proxy.c_str()));
+            }
+
+            std::shared_ptr<::WinHttpWrapper::HttpClient> client = std::make_shared<::WinHttpWrapper::HttpClient>(prototype, _basePath, _headers);
+
+            return clients.add(client);
+
+        }
+
+        void destroyClient(int handle) {
+
+            clients.remove(handle);
+
+        }
+
+        void cancelClient(int handle) {
+
+            std::shared_ptr<::WinHttpWrapper::HttpClient> client = clients.find(handle);
+            if (client) {
+                hx::AutoGCFreeZone gcFreeZone;
+                client->CancelAll();
+            }
+
+        }
+
+        int prepareRequest(int handle, int method, ::String pathTemplate, ::String headers) {
+
+            std::shared_ptr<::WinHttpWrapper::HttpClient> client = clients.find(handle);
+            const wchar_t* verb = methodVerb(method);
+            if (!client || !verb) {
+                return -1;
+            }
+
+            return client->Prepare(verb,
+                ::hx::IsNull(pathTemplate) ? L"" : utf8ToWstring(pathTemplate.c_str()),
+                ::hx::IsNull(headers) ? L"" : utf8ToWstring(headers.c_str()));
+
+        }
+
+        // Body of a client request: size bytes at data, which owner (a GC
+        // object) holds, sent from where they are as sendRequest() does
+        struct ClientBody {
+
+            ClientBody(hx::Object* owner, const uint8_t* data, size_t size)
+#ifdef HXCPP_GC_MOVING
+                : copy(reinterpret_cast<const char*>(data), size), root(nullptr), source(copy.data(), copy.size()) {}
+#else
+                : root(owner), source(data, size) {}
+#endif
+
+            const std::string copy;
+            GCRoot root;
+            ::WinHttpWrapper::MemorySource source;
+
+        };
+
+        static ::Dynamic sendPreparedBody(int handle, int id, Array<::String> params, hx::Object* owner, const uint8_t* body, size_t bodySize, int responseType) {
+
+            ::WinHttpWrapper::TraceRequestScope traceScope;
+
+            std::shared_ptr<::WinHttpWrapper::HttpClient> client = clients.find(handle);
+            if (!client) {
+                return errorResult(HX_CSTRING("Invalid client"));
+            }
+
+            // Only the parameters still need converting
+            std::vector<std::wstring> _params;
+            if (!::hx::IsNull(params)) {
+                _params.reserve(params->length);
+                for (int i = 0; i < params->length; ++i) {
+                    ::String param = params[i];
+                    _params.push_back(::hx::IsNull(param) ? L"" : utf8ToWstring(param.c_str()));
+                }
+            }
+            ClientBody _body(owner, body, bodySize);
+
+            ::WinHttpWrapper::ResponsePool::Lease pooled = ::WinHttpWrapper::ResponsePool::Acquire();
+            ::WinHttpWrapper::HttpResponse& response = *pooled;
+            ::WinHttpWrapper::JsonDocument json;
+            bool parsed = false;
+
+            {
+                hx::AutoGCFreeZone gcFreeZone;
+
+                client->Send(id, _params, _body.source, response);
+                if (responseType == 1 && !response.isBinary && !response.text.empty()) {
+                    ::WinHttpWrapper::TraceSpan parseSpan("parse json", "haxe");
+                    parsed = json.Parse(response.text.data(), response.text.size());
+                }
+            }
+
+            return responseToHxObject(response, parsed ? &json : nullptr, responseType == 2);
+
+        }
+
+        ::Dynamic sendPrepared(int handle, int id, Array<::String> params, ::String body, int responseType) {
+
+            StringBody _body(body);
+            return sendPreparedBody(handle, id, params, _body.owner.mPtr, _body.data, _body.size, responseType);
+
+        }
+
+        ::Dynamic sendPreparedBytes(int handle, int id, Array<::String> params, Array<unsigned char> body, int offset, int length, int responseType) {
+
+            const uint8_t* data = nullptr;
+            if (!bytesRange(body, offset, length, data)) {
+                return errorResult(HX_CSTRING("Invalid body range"));
+            }
+
+            return sendPreparedBody(handle, id, params, body.mPtr, data, (size_t)length, responseType);
+
+        }
+
+        static ::Dynamic sendClientBody(int handle, int method, ::String path, hx::Object* owner, const uint8_t* body, size_t bodySize, ::String headers, int responseType) {
+
+            ::WinHttpWrapper::TraceRequestScope traceScope;
+
+            std::shared_ptr<::WinHttpWrapper::HttpClient> client = clients.find(handle);
+            const wchar_t* verb = methodVerb(method);
+            if (!client) {
+                return errorResult(HX_CSTRING("Invalid client"));
+            }
+            if (!verb) {
+                return errorResult(HX_CSTRING("Invalid method"));
+            }
+
+            const std::wstring _path = ::hx::IsNull(path) ? L"" : utf8ToWstring(path.c_str());
+            const std::wstring _headers = ::hx::IsNull(headers) ? L"" : utf8ToWstring(headers.c_str());
+            ClientBody _body(owner, body, bodySize);
+
+            ::WinHttpWrapper::ResponsePool::Lease pooled = ::WinHttpWrapper::ResponsePool::Acquire();
+            ::WinHttpWrapper::HttpResponse& response = *pooled;
+            ::WinHttpWrapper::JsonDocument json;
+            bool parsed = false;
+
+            {
+                hx::AutoGCFreeZone gcFreeZone;
+
+                client->Send(verb, _path, _headers, _body.source, response);
+                if (responseType == 1 && !response.isBinary && !response.text.empty()) {
+                    ::WinHttpWrapper::TraceSpan parseSpan("parse json", "haxe");
+                    parsed = json.Parse(response.text.data(), response.text.size());
+                }
+            }
+
+            return responseToHxObject(response, parsed ? &json : nullptr, responseType == 2);
+
+        }
+
+        ::Dynamic sendClientRequest(int handle, int method, ::String path, ::String body, ::String headers, int responseType) {
+
+            StringBody _body(body);
+            return sendClientBody(handle, method, path, _body.owner.mPtr, _body.data, _body.size, headers, responseType);
+
+        }
+
+        ::Dynamic sendClientRequestBytes(int handle, int method, ::String path, Array<unsigned char> body, int offset, int length, ::String headers, int responseType) {
+
+            const uint8_t* data = nullptr;
+            if (!bytesRange(body, offset, length, data)) {
+                return errorResult(HX_CSTRING("Invalid body range"));
+            }
+
+            return sendClientBody(handle, method, path, body.mPtr, data, (size_t)length, headers, responseType);
+
+        }
+
+        // Followers keep their cursor natively between polls. Polls of one
+        // follower run one at a time.
+        struct Follower {
+
+            Follower(const ::WinHttpWrapper::HttpRequest& request, const std::wstring& path, const std::wstring& headers)
+                : request(request), path(path), headers(headers) {}
+
+            std::mutex mutex;
+            ::WinHttpWrapper::HttpRequest request;
+            const std::wstring path;
+            const std::wstring headers;
+            ::WinHttpWrapper::FollowCursor cursor;
+
+        };
+
+        static HandleRegistry<Follower> followers;
+
+        int createFollower(::String domain, int port, bool https, ::String path, ::String headers, ::String proxy, int priority) {
+
+            const std::wstring _domain = utf8ToWstring(domain.c_str());
+            const std::wstring _path = ::hx::IsNull(path) ? L"" : utf8ToWstring(path.c_str());
+            const std::wstring _headers = ::hx::IsNull(headers) ? L"" : utf8ToWstring(headers.c_str());
+
+            ::WinHttpWrapper::HttpRequest req(_domain, port, https);
+            req.SetPriority(static_cast<::WinHttpWrapper::RequestPriority>(priority));
+            if (!::hx::IsNull(proxy)) {
+                req.SetProxy(utf8ToWstring(proxy.c_str()));
+            }
+
+            std::shared_ptr<Follower> follower = std::make_shared<Follower>(req, _path, _headers);
+
+            return followers.add(follower);
+
+        }
+
+        void destroyFollower(int handle) {
+
+            followers.remove(handle);
+
+        }
+
+        ::Dynamic followerPoll(int handle, int responseType, int cancelToken) {
+
+            ::WinHttpWrapper::TraceRequestScope traceScope;
+
+            std::shared_ptr<Follower> follower = followers.find(handle);
+            if (!follower) {
+                return errorResult(HX_CSTRING("Invalid follower"));
+            }
+            std::shared_ptr<::WinHttpWrapper::CancellationToken> token = cancelTokens.find(cancelToken);
+            ::WinHttpWrapper::ResponsePool::Lease pooled = ::WinHttpWrapper::ResponsePool::Acquire();
+            ::WinHttpWrapper::HttpResponse& response = *pooled;
+            ULONGLONG offset = 0;
+            bool restarted = false;
+
+            {
+                hx::AutoGCFreeZone gcFreeZone;
+                std::lock_guard<std::mutex> lock(follower->mutex);
+
+                if (token) {
+                    follower->request.SetCancellationToken(*token);
+                }
+                else {
+                    follower->request.ClearCancellationToken();
+                }
+                follower->request.Follow(follower->path, follower->headers, follower->cursor, response);
+                offset = follower->cursor.offset;
+                restarted = follower->cursor.restarted;
+            }
+
+            hx::Anon result = responseToHxObject(response, nullptr, responseType == 2);
+            result->Add(HX_CSTRING("offset"), static_cast<Float>(offset));
+            result->Add(HX_CSTRING("restarted"), restarted);
+            return result;
+
+        }
+
+
+        // WebSockets. Closing one drops its queued messages, so Haxe drains
+        // them first.
+        static HandleRegistry<::WinHttpWrapper::WebSocket> webSockets;
+
+        ::Dynamic openWebSocket(::String domain, int port, bool https, ::String path, ::String headers, ::String proxy, int keepAliveInterval) {
+
+            const std::wstring _domain = utf8ToWstring(domain.c_str());
+            const std::wstring _path = ::hx::IsNull(path) ? L"" : utf8ToWstring(path.c_str());
+            const std::wstring _headers = ::hx::IsNull(headers) ? L"" : utf8ToWstring(headers.c_str());
+            const bool _hasProxy = !( ::hx::IsNull(proxy));
+            const std::wstring _proxy = _hasProxy ? utf8ToWstring(proxy.c_str()) : L"";
+
+            ::WinHttpWrapper::HttpRequest req(_domain, port, https);
+            std::shared_ptr<::WinHttpWrapper::WebSocket> socket = std::make_shared<::WinHttpWrapper::WebSocket>();
+            socket->SetKeepAliveInterval(keepAliveInterval > 0 ? keepAliveInterval : 0);
+            ::WinHttpWrapper::HttpResponse response;
+            bool opened;
+
+            {
+                hx::AutoGCFreeZone gcFreeZone;
+
+                if (_hasProxy) {
+                    req.SetProxy(_proxy);
+                }
+
+                opened = req.OpenWebSocket(_path, _headers, *socket, response);
+            }
+
+            const int handle = opened ? webSockets.add(socket) : 0;
+
+            hx::Anon result = hx::Anon_obj::Create();
+            result->Add(HX_CSTRING("handle"), handle);
+            result->Add(HX_CSTRING("status"), response.statusCode);
+            result->Add(HX_CSTRING("headers"), response.header.empty() ? null() : wstringToHxString(response.header));
+            result->Add(HX_CSTRING("error"), response.error.empty() ? null() : wstringToHxString(response.error));
+            return result;
+
+        }
+
+        bool webSocketSendText(int handle, ::String text) {
+
+            std::shared_ptr<::WinHttpWrapper::WebSocket> socket = webSockets.find(handle);
+            if (!socket) {
+                return false;
+            }
+
+            const std::string _text = ::hx::IsNull(text) ? "" : std::string(text.c_str());
+
+            hx::AutoGCFreeZone gcFreeZone;
+            return socket->Send(_text.data(), _text.size(), false);
+
+        }
+
+        bool webSocketSendBytes(int handle, Array<unsigned char> data, int offset, int length) {
+
+            std::shared_ptr<::WinHttpWrapper::WebSocket> socket = webSockets.find(handle);
+            if (!socket || ::hx::IsNull(data) || offset < 0 || length < 0 || offset + length > data->length) {
+                return false;
+            }
+
+            // Copied once out of GC memory, which may be collected while
+            // this thread is outside of it
+            const std::vector<uint8_t> _data(data->GetBase() + offset, data->GetBase() + offset + length);
+
+            hx::AutoGCFreeZone gcFreeZone;
+            return socket->Send(_data.data(), _data.size(), true);
+
+        }
+
+        ::Dynamic webSocketReceive(int handle, int timeoutMs) {
+
+            std::shared_ptr<::WinHttpWrapper::WebSocket> socket = webSockets.find(handle);
+            if (!socket) {
+                return null();
+            }
+
+            ::WinHttpWrapper::WebSocketMessage message;
+            bool received;
+
+            if (timeoutMs == 0) {
+                received = socket->Poll(message);
+            }
+            else {
+                hx::AutoGCFreeZone gcFreeZone;
+                received = socket->Wait(message, timeoutMs < 0 ? INFINITE : static_cast<DWORD>(timeoutMs));
+            }
+
+            if (!received) {
+                return null();
+            }
+
+            hx::Anon result = hx::Anon_obj::Create();
+            result->Add(HX_CSTRING("binary"), message.binary);
+            if (message.binary) {
+                const int length = static_cast<int>(message.data.size());
+                Array<unsigned char> bytes = new Array_obj<unsigned char>(length, length);
+                if (length > 0) {
+                    memcpy(bytes->GetBase(), message.data.data(), length);
+                }
+                result->Add(HX_CSTRING("bytes"), bytes);
+            }
+            else {
+                result->Add(HX_CSTRING("text"), ::String::create(message.data.data(), static_cast<int>(message.data.size())));
+            }
+            return result;
+
+        }
+
+        ::Dynamic webSocketState(int handle) {
+
+            std::shared_ptr<::WinHttpWrapper::WebSocket> socket = webSockets.find(handle);
+
+            hx::Anon result = hx::Anon_obj::Create();
+            const bool open = socket && socket->IsOpen();
+            result->Add(HX_CSTRING("open"), open);
+            if (socket && !open) {
+                const std::string reason = socket->CloseReason();
+                const std::wstring error = socket->Error();
+                result->Add(HX_CSTRING("closeStatus"), (int)socket->CloseStatus());
+                result->Add(HX_CSTRING("closeReason"), ::String::create(reason.data(), static_cast<int>(reason.size())));
+                result->Add(HX_CSTRING("error"), error.empty() ? null() : wstringToHxString(error));
+            }
+            return result;
+
+        }
+
+        void closeWebSocket(int handle, int status, ::String reason) {
+
+            std::shared_ptr<::WinHttpWrapper::WebSocket> socket = webSockets.remove(handle);
+            if (!socket) {
+                return;
+            }
+
+            const std::string _reason = ::hx::IsNull(reason) ? "" : std::string(reason.c_str());
+
+            hx::AutoGCFreeZone gcFreeZone;
+            socket->Close(static_cast<USHORT>(status), _reason);
+
+        }
+
+        static HandleRegistry<::WinHttpWrapper::EventSource> eventSources;
+
+        int openEventSource(::String domain, int port, bool https, ::String path, ::String headers, ::String proxy, ::String lastEventId) {
+
+            const std::wstring _domain = utf8ToWstring(domain.c_str());
+            const std::wstring _path = ::hx::IsNull(path) ? L"" : utf8ToWstring(path.c_str());
+            const std::wstring _headers = ::hx::IsNull(headers) ? L"" : utf8ToWstring(headers.c_str());
+
+            ::WinHttpWrapper::HttpRequest req(_domain, port, https);
+            if (!::hx::IsNull(proxy)) {
+                req.SetProxy(utf8ToWstring(proxy.c_str()));
+            }
+
+            // Connecting happens on the event source's own thread
+            std::shared_ptr<::WinHttpWrapper::EventSource> source = std::make_shared<::WinHttpWrapper::EventSource>(req, _path, _headers);
+            if (!::hx::IsNull(lastEventId)) {
+                source->SetLastEventId(std::string(lastEventId.c_str()));
+            }
+            source->Start();
+
+            return eventSources.add(source);
+
+        }
+
+        ::Dynamic eventSourceReceive(int handle, int timeoutMs) {
+
+            std::shared_ptr<::WinHttpWrapper::EventSource> source = eventSources.find(handle);
+            if (!source) {
+                return null();
+            }
+
+            ::WinHttpWrapper::ServerSentEvent event;
+            bool received;
+
+            if (timeoutMs == 0) {
+                received = source->Poll(event);
+            }
+            else {
+                hx::AutoGCFreeZone gcFreeZone;
+                received = source->Wait(event, timeoutMs < 0 ? INFINITE : static_cast<DWORD>(timeoutMs));
+            }
+
+            if (!received) {
+                return null();
+            }
+
+            hx::Anon result = hx::Anon_obj::Create();
+            result->Add(HX_CSTRING("type"), ::String::create(event.type.data(), static_cast<int>(event.type.size())));
+            result->Add(HX_CSTRING("data"), ::String::create(event.data.data(), static_cast<int>(event.data.size())));
+            result->Add(HX_CSTRING("id"), ::String::create(event.id.data(), static_cast<int>(event.id.size())));
+            return result;
+
+        }
+
+        ::Dynamic eventSourceState(int handle) {
+
+            std::shared_ptr<::WinHttpWrapper::EventSource> source = eventSources.find(handle);
+
+            hx::Anon result = hx::Anon_obj::Create();
+            result->Add(HX_CSTRING("open"), source && source->IsOpen());
+            result->Add(HX_CSTRING("connected"), source && source->IsConnected());
+            result->Add(HX_CSTRING("status"), source ? (int)source->StatusCode() : 0);
+            const std::wstring error = source ? source->Error() : std::wstring();
+            result->Add(HX_CSTRING("error"), error.empty() ? null() : wstringToHxString(error));
+            return result;
+
+        }
+
+        void closeEventSource(int handle) {
+
+            std::shared_ptr<::WinHttpWrapper::EventSource> source = eventSources.remove(handle);
+            if (!source) {
+                return;
+            }
+
+            hx::AutoGCFreeZone gcFreeZone;
+            source->Close();
 
         }
 
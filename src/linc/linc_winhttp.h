@@ -11,7 +11,112 @@ namespace linc {
 
         void enableDebugLogging(bool enabled);
 
-        ::Dynamic sendHttpRequest(::String domain, int port, bool https, ::String path, int method, ::String body, ::String headers, ::String proxy, int timeout);
+        ::Dynamic sendHttpRequest(::String domain, int port, bool https, ::String path, int method, ::String body, ::String headers, ::String proxy, int timeout, int priority, int responseType, int cancelToken, int hashAlgorithm, ::String expectedDigest, int retryAttempts, int retryBaseDelayMs, int retryMaxDelayMs);
+
+        ::Dynamic sendHttpRequestBytes(::String domain, int port, bool https, ::String path, int method, Array<unsigned char> body, int offset, int length, ::String headers, ::String proxy, int timeout, int priority, int responseType, int cancelToken, int hashAlgorithm, ::String expectedDigest, int retryAttempts, int retryBaseDelayMs, int retryMaxDelayMs);
+
+        ::Dynamic download(::String domain, int port, bool https, ::String path, ::String headers, ::String proxy, ::String filePath, int maxSegments, bool resume, int priority, int cancelToken, int hashAlgorithm, ::String expectedDigest);
+
+        ::Dynamic sendMultipart(::String domain, int port, bool https, ::String path, int method, ::String headers, ::String proxy, int priority, int responseType,
+            Array<int> kinds, Array<::String> names, Array<::String> values, Array<::String> fileNames, Array<::String> contentTypes, Array<::Dynamic> datas, int cancelToken);
+
+        int createCancelToken(int parent);
+
+        void cancelToken(int handle);
+
+        bool isTokenCancelled(int handle);
+
+        void releaseCancelToken(int handle);
+
+        int mapNativeFile(::String path);
+
+        Float nativeBufferLength(int handle);
+
+        unsigned char* nativeBufferData(int handle);
+
+        Array<unsigned char> nativeBufferRead(int handle, Float offset, int length);
+
+        void releaseNativeBuffer(int handle);
+
+        void setConcurrencyLimits(int maxGlobal, int maxPerHost);
+
+        void setGlobalBandwidthLimit(Float bytesPerSecond, Float burst);
+
+        void setHostBandwidthLimit(::String host, Float bytesPerSecond, Float burst);
+
+        void setPriorityBandwidthLimit(int priority, Float bytesPerSecond, Float burst);
+
+        bool setEndpointGroup(::String name, Array<::String> domains, Array<int> ports, Array<bool> secures);
+
+        void setEndpointSelection(Float exploration, int ejectAfterFailures, int ejectionMs);
+
+        void setRetryBudget(Float ratio, Float minPerSecond);
+
+        void setCircuitBreaker(bool enabled, Float failureRate, int slowCallMs, Float slowCallRate, int minCalls, int windowMs, int openMs, int halfOpenProbes);
+
+        void setMemoryLimits(Float maxBufferedBytes, Float maxResponseBytes);
+
+        void setResponsePoolLimits(int maxPooled, Float maxRetainedBytes);
+
+        bool recordTraffic(::String path);
+
+        bool replayTraffic(::String path, bool paced);
+
+        void stopTraffic();
+
+        void startTrace();
+
+        void stopTrace();
+
+        bool writeTrace(::String path);
+
+        ::Dynamic getMetrics();
+
+        void registerMimeType(::String type, bool binary);
+
+        void setContentSniffing(bool enabled);
+
+        int createClient(::String domain, int port, bool https, ::String basePath, ::String headers, ::String proxy, ::String username, ::String password, int priority, int timeout, int retryAttempts, int retryBaseDelayMs, int retryMaxDelayMs);
+
+        void destroyClient(int handle);
+
+        void cancelClient(int handle);
+
+        int createFollower(::String domain, int port, bool https, ::String path, ::String headers, ::String proxy, int priority);
+
+        void destroyFollower(int handle);
+
+        ::Dynamic followerPoll(int handle, int responseType, int cancelToken);
+
+        int prepareRequest(int handle, int method, ::String pathTemplate, ::String headers);
+
+        ::Dynamic sendPrepared(int handle, int id, Array<::String> params, ::String body, int responseType);
+
+        ::Dynamic sendPreparedBytes(int handle, int id, Array<::String> params, Array<unsigned char> body, int offset, int length, int responseType);
+
+        ::Dynamic sendClientRequest(int handle, int method, ::String path, ::String body, ::String headers, int responseType);
+
+        ::Dynamic sendClientRequestBytes(int handle, int method, ::String path, Array<unsigned char> body, int offset, int length, ::String headers, int responseType);
+
+        ::Dynamic openWebSocket(::String domain, int port, bool https, ::String path, ::String headers, ::String proxy, int keepAliveInterval);
+
+        bool webSocketSendText(int handle, ::String text);
+
+        bool webSocketSendBytes(int handle, Array<unsigned char> data, int offset, int length);
+
+        ::Dynamic webSocketReceive(int handle, int timeoutMs);
+
+        ::Dynamic webSocketState(int handle);
+
+        void closeWebSocket(int handle, int status, ::String reason);
+
+        int openEventSource(::String domain, int port, bool https, ::String path, ::String headers, ::String proxy, ::String lastEventId);
+
+        ::Dynamic eventSourceReceive(int handle, int timeoutMs);
+
+        ::Dynamic eventSourceState(int handle);
+
+        void closeEventSource(int handle);
 
     }
 }
@@ -12,6 +12,183 @@ enum abstract WinHttpMethod(Int) from Int to Int {
     public var DELETE = 3;
 }
 
+enum abstract WinHttpPriority(Int) from Int to Int {
+    public var INTERACTIVE = 0;
+    public var NORMAL = 1;
+    public var BULK = 2;
+}
+
+enum abstract WinHttpResponseType(Int) from Int to Int {
+    /** Body in `content` (or `binaryContent`) */
+    public var TEXT = 0;
+    /** Body parsed natively into `json`, `content` only set if it was not valid JSON */
+    public var JSON = 1;
+    /** Binary body in `nativeContent`, kept out of the GC heap; text bodies as with `TEXT` */
+    public var NATIVE = 2;
+}
+
+/** Digest of the response body, computed while it is read, see `WinHttpResponse.digest` */
+enum abstract WinHttpHashAlgorithm(Int) from Int to Int {
+    public var NONE = 0;
+    public var SHA256 = 1;
+    /** xxHash 64-bit, fast but not cryptographic */
+    public var XXH64 = 2;
+    public var CRC32C = 3;
+}
+
+enum abstract WinHttpBreakerState(Int) from Int to Int {
+    /** Requests go through */
+    public var CLOSED = 0;
+    /** Requests fail right away */
+    public var OPEN = 1;
+    /** A few probe requests go through */
+    public var HALF_OPEN = 2;
+}
+
+typedef WinHttpQueueMetrics = {
+
+    public var dispatched:Float;
+
+    public var queueTimeTotalMs:Float;
+
+    public var queueTimeMaxMs:Float;
+
+}
+
+typedef WinHttpBandwidthMetrics = {
+
+    /** Set for a per-host limit */
+    public var host:String;
+
+    /** Set (>= 0) for a per-priority limit, -1 otherwise */
+    public var priority:Int;
+
+    public var bytesPerSecond:Float;
+
+    public var burst:Float;
+
+    /** Bytes that may go through right now */
+    public var tokens:Float;
+
+    /** Bytes that went through */
+    public var bytes:Float;
+
+    /** Transfers it paused */
+    public var waits:Float;
+
+}
+
+typedef WinHttpEndpointMetrics = {
+
+    public var group:String;
+
+    /** `scheme://domain:port` of the endpoint */
+    public var url:String;
+
+    /** Moving average of the time to the response headers */
+    public var latencyMs:Float;
+
+    /** Moving average of the body throughput, 0 until measured */
+    public var bytesPerSecond:Float;
+
+    /** Moving average of the failures, from 0 to 1 */
+    public var errorRate:Float;
+
+    public var requests:Float;
+
+    public var failures:Float;
+
+    public var ejections:Float;
+
+    public var ejected:Bool;
+
+}
+
+typedef WinHttpBreakerMetrics = {
+
+    /** `domain:port` of the server */
+    public var host:String;
+
+    public var state:WinHttpBreakerState;
+
+    /** Time since the last change of state */
+    public var stateMs:Float;
+
+    /** Share of the requests of the window that failed */
+    public var failureRate:Float;
+
+    /** Share of the requests of the window that were slow */
+    public var slowCallRate:Float;
+
+    /** Requests within the window */
+    public var calls:Float;
+
+    /** Times the breaker opened */
+    public var opened:Float;
+
+    /** Requests failed right away while it was open */
+    public var rejected:Float;
+
+}
+
+typedef WinHttpMetrics = {
+
+    public var activeRequests:Int;
+
+    public var queuedRequests:Int;
+
+    /** Indexed by `WinHttpPriority` */
+    public var priorities:Array<WinHttpQueueMetrics>;
+
+    /** Response bytes currently being read into memory */
+    public var bufferedBytes:Float;
+
+    public var peakBufferedBytes:Float;
+
+    /** Reads that were paused until the memory budget had room */
+    public var budgetWaits:Float;
+
+    /** One entry per bandwidth limit set */
+    public var bandwidth:Array<WinHttpBandwidthMetrics>;
+
+    /** Reads and writes paused by a bandwidth limit */
+    public var throttleWaits:Float;
+
+    public var throttleWaitTimeMs:Float;
+
+    /** One entry per endpoint of each group */
+    public var endpoints:Array<WinHttpEndpointMetrics>;
+
+    /** Requests sent again after a transient failure */
+    public var retries:Float;
+
+    /** Retries dropped because the retry budget of their host was spent */
+    public var retriesOverBudget:Float;
+
+    /** One entry per server, with `setCircuitBreaker()` */
+    public var breakers:Array<WinHttpBreakerMetrics>;
+
+}
+
+/**
+ * Retries of idempotent requests (GET, PUT, DELETE) failing to connect or
+ * answered 429, 502, 503 or 504. Retry `n` waits a random time up to
+ * `baseDelayMs * 2^(n-1)` (capped at `maxDelayMs`), or the `Retry-After` of
+ * the response; a longer `Retry-After`, or one past the timeout, ends them.
+ */
+typedef WinHttpRetryPolicy = {
+
+    /** Including the first attempt */
+    public var maxAttempts:Int;
+
+    /** 100 by default */
+    @:optional public var baseDelayMs:Int;
+
+    /** 10000 by default */
+    @:optional public var maxDelayMs:Int;
+
+}
+
 typedef WinHttpResponse = {
 
     public var status:Int;
@@ -22,12 +199,33 @@ typedef WinHttpResponse = {
 
     public var binaryContent:Bytes;
 
+    /** Parsed body, with `WinHttpResponseType.JSON` */
+    @:optional public var json:Dynamic;
+
+    /** Binary body, with `WinHttpResponseType.NATIVE` */
+    @:optional public var nativeContent:WinHttpNativeBuffer;
+
+    /** Lowercase hex digest of the body, when a `WinHttpHashAlgorithm` was given */
+    @:optional public var digest:String;
+
     public var error:String;
 
+    /** Failed because its `WinHttpCancelToken` (or client) was cancelled */
+    public var cancelled:Bool;
+
+    /** Failed without being sent, the circuit breaker of the server being open */
+    public var circuitOpen:Bool;
+
 }
 
 @:keep
 @:keepSub
+@:allow(winhttp.WinHttpClient)
+@:allow(winhttp.WinHttpWebSocket)
+@:allow(winhttp.WinHttpEventSource)
+@:allow(winhttp.WinHttpCancelToken)
+@:allow(winhttp.WinHttpNativeBuffer)
+@:allow(winhttp.WinHttpFollower)
 class WinHttp {
 
     public static function enableDebugLogging(enabled:Bool):Void {
@@ -36,7 +234,306 @@ class WinHttp {
 
     }
 
-    public static function sendHttpRequest(url:String, method:WinHttpMethod, body:String, headers:Map<String,String>, proxy:String, timeout:Int):WinHttpResponse {
+    /**
+     * Limit how many requests run at once, globally and per host. Requests
+     * over the limits wait in a queue, served by priority.
+     */
+    public static function setConcurrencyLimits(maxGlobal:Int, maxPerHost:Int):Void {
+
+        WinHttp_Extern.setConcurrencyLimits(maxGlobal, maxPerHost);
+
+    }
+
+    /**
+     * Limit the bandwidth used by response and request bodies, all requests
+     * together. Transfers over the limit are paused, which slows the other
+     * end down. `burst` is the most bytes sent at once after an idle period
+     * (one second worth by default). Use 0 for no limit; the limits can
+     * change at any time.
+     */
+    public static function setGlobalBandwidthLimit(bytesPerSecond:Float, burst:Float = 0):Void {
+
+        WinHttp_Extern.setGlobalBandwidthLimit(bytesPerSecond, burst);
+
+    }
+
+    /** Same as `setGlobalBandwidthLimit()`, for the requests to one host */
+    public static function setHostBandwidthLimit(host:String, bytesPerSecond:Float, burst:Float = 0):Void {
+
+        WinHttp_Extern.setHostBandwidthLimit(host, bytesPerSecond, burst);
+
+    }
+
+    /**
+     * Same as `setGlobalBandwidthLimit()`, for the requests of one priority,
+     * such as `BULK` downloads.
+     */
+    public static function setPriorityBandwidthLimit(priority:WinHttpPriority, bytesPerSecond:Float, burst:Float = 0):Void {
+
+        WinHttp_Extern.setPriorityBandwidthLimit(priority, bytesPerSecond, burst);
+
+    }
+
+    /**
+     * Serve the requests to host `name` from equivalent mirrors: a URL with
+     * `name` as its host (`https://assets/img/a.png`) is sent to the
+     * endpoint (`https://cdn1.example.com`, ...) with the lowest expected
+     * time, from the latency, throughput and failures measured on the
+     * requests already sent to each. Endpoints failing repeatedly are left
+     * out for a while. An empty list removes the group. Returns false when
+     * an endpoint is itself a group.
+     */
+    public static function setEndpointGroup(name:String, endpoints:Array<String>):Bool {
+
+        final domains:Array<String> = [];
+        final ports:Array<Int> = [];
+        final secures:Array<Bool> = [];
+        for (endpoint in endpoints) {
+            final target = parseUrl(endpoint);
+            domains.push(target.domain);
+            ports.push(target.port);
+            secures.push(target.https);
+        }
+        return WinHttp_Extern.setEndpointGroup(name, domains, ports, secures);
+
+    }
+
+    /**
+     * Tune the endpoint groups: the share of requests sent to another
+     * endpoint than the best one to keep measuring it (0.05 by default), and
+     * the failures in a row after which an endpoint is left out for
+     * `ejectionMs` (3 and 10000 by default; doubling on each ejection in a
+     * row).
+     */
+    public static function setEndpointSelection(exploration:Float = 0.05, ejectAfterFailures:Int = 3, ejectionMs:Int = 10000):Void {
+
+        WinHttp_Extern.setEndpointSelection(exploration, ejectAfterFailures, ejectionMs);
+
+    }
+
+    /**
+     * Bound the retries sent to each host: every request that may be
+     * retried adds `ratio` of a retry to the budget of its host, each retry
+     * takes one, and each host gets `minPerSecond` more a second (0.1 and 1
+     * by default).
+     */
+    public static function setRetryBudget(ratio:Float = 0.1, minPerSecond:Float = 1):Void {
+
+        WinHttp_Extern.setRetryBudget(ratio, minPerSecond);
+
+    }
+
+    /**
+     * Fail requests to a server right away, with `circuitOpen` set, while
+     * it keeps failing. A server's breaker opens when, among at least
+     * `minCalls` requests of the last `windowMs`, the share of failures
+     * (connection errors, 5xx, 429) reaches `failureRate`, or the share of
+     * requests taking over `slowCallMs` (0 to ignore) to the response
+     * headers reaches `slowCallRate`. After `openMs` it lets
+     * `halfOpenProbes` requests through at once, and closes when they all
+     * succeed. Off by default.
+     */
+    public static function setCircuitBreaker(enabled:Bool, failureRate:Float = 0.5, slowCallMs:Int = 0, slowCallRate:Float = 0.5, minCalls:Int = 10, windowMs:Int = 10000, openMs:Int = 5000, halfOpenProbes:Int = 1):Void {
+
+        WinHttp_Extern.setCircuitBreaker(enabled, failureRate, slowCallMs, slowCallRate, minCalls, windowMs, openMs, halfOpenProbes);
+
+    }
+
+    /**
+     * Decide whether responses of the given type (`application/x-foo`) or
+     * structured syntax suffix (`+cbor`) are returned as `content` or as
+     * `binaryContent`, overriding the built-in rules. May be called while
+     * requests are running; responses received afterwards follow it.
+     */
+    public static function registerMimeType(type:String, binary:Bool):Void {
+
+        WinHttp_Extern.registerMimeType(type, binary);
+
+    }
+
+    /**
+     * When enabled (the default), responses without a Content-Type header
+     * are classified as text or binary from their first bytes.
+     */
+    public static function setContentSniffing(enabled:Bool):Void {
+
+        WinHttp_Extern.setContentSniffing(enabled);
+
+    }
+
+    /**
+     * Cap the memory used by response bodies being read (reads pause while
+     * the budget is exhausted) and the size of a single response body
+     * (larger ones fail with an error). Use 0 for no limit.
+     */
+    public static function setMemoryLimits(maxBufferedBytes:Float, maxResponseBytes:Float):Void {
+
+        WinHttp_Extern.setMemoryLimits(maxBufferedBytes, maxResponseBytes);
+
+    }
+
+    /**
+     * Response objects are recycled per thread, keeping their buffers for
+     * the next request. Set how many are kept per thread and the largest
+     * buffer kept (in bytes); bigger ones are freed after use.
+     */
+    public static function setResponsePoolLimits(maxPooled:Int, maxRetainedBytes:Float):Void {
+
+        WinHttp_Extern.setResponsePoolLimits(maxPooled, maxRetainedBytes);
+
+    }
+
+    /**
+     * Record every request and response sent by `sendHttpRequest`,
+     * `sendMultipart` and clients to a binary log at `path` (overwritten),
+     * until `stopTraffic()`.
+     */
+    public static function recordTraffic(path:String):Bool {
+
+        return WinHttp_Extern.recordTraffic(path);
+
+    }
+
+    /**
+     * Answer requests from a log made by `recordTraffic()` instead of the
+     * network, in recorded order for each method and URL. With `paced`,
+     * responses take as long as they did when recorded; otherwise they are
+     * served as fast as possible. Requests missing from the log fail.
+     */
+    public static function replayTraffic(path:String, paced:Bool = false):Bool {
+
+        return WinHttp_Extern.replayTraffic(path, paced);
+
+    }
+
+    public static function stopTraffic():Void {
+
+        WinHttp_Extern.stopTraffic();
+
+    }
+
+    /**
+     * Start recording a timeline of every request (queueing, connecting,
+     * sending, waiting, body chunks, conversion to Haxe values), dropping
+     * anything recorded before. Costs next to nothing while not recording.
+     */
+    public static function startTrace():Void {
+
+        WinHttp_Extern.startTrace();
+
+    }
+
+    public static function stopTrace():Void {
+
+        WinHttp_Extern.stopTrace();
+
+    }
+
+    /**
+     * Write what was recorded so far to `path` (overwritten) as Chrome Trace
+     * Event JSON, to open in https://ui.perfetto.dev or chrome://tracing.
+     * Recording goes on until `stopTrace()`.
+     */
+    public static function writeTrace(path:String):Bool {
+
+        return WinHttp_Extern.writeTrace(path);
+
+    }
+
+    public static function getMetrics():WinHttpMetrics {
+
+        return WinHttp_Extern.getMetrics();
+
+    }
+
+    /**
+     * @param timeout Time the request may take in seconds, retries
+     * included, 0 for no limit
+     */
+    public static function sendHttpRequest(url:String, method:WinHttpMethod, body:String, headers:Map<String,String>, proxy:String, timeout:Int, priority:WinHttpPriority = NORMAL, responseType:WinHttpResponseType = TEXT, ?cancel:WinHttpCancelToken, hash:WinHttpHashAlgorithm = NONE, ?expectedDigest:String, ?retry:WinHttpRetryPolicy):WinHttpResponse {
+
+        final target = parseUrl(url);
+
+        final rawResponse:Dynamic = WinHttp_Extern.sendHttpRequest(target.domain, target.port, target.https, target.path, method, body, buildRawHeaders(headers), proxy, timeout, priority, responseType, cancelHandle(cancel), hash, expectedDigest,
+            retryAttempts(retry), retryDelay(retry, false), retryDelay(retry, true));
+
+        return toResponse(rawResponse);
+    }
+
+    /**
+     * Same as `sendHttpRequest()`, with a binary body: the `len` bytes of
+     * `body` from `pos` (the rest of it by default). The bytes are sent
+     * from where they are, without being copied, and must not change
+     * until the call returns.
+     */
+    public static function sendHttpRequestBytes(url:String, method:WinHttpMethod, body:Bytes, headers:Map<String,String>, proxy:String, timeout:Int, priority:WinHttpPriority = NORMAL, responseType:WinHttpResponseType = TEXT, ?cancel:WinHttpCancelToken, hash:WinHttpHashAlgorithm = NONE, ?expectedDigest:String, ?retry:WinHttpRetryPolicy, pos:Int = 0, ?len:Int):WinHttpResponse {
+
+        final target = parseUrl(url);
+
+        final rawResponse:Dynamic = WinHttp_Extern.sendHttpRequestBytes(target.domain, target.port, target.https, target.path, method,
+            body != null ? body.getData() : null, pos, len != null ? len : -1, buildRawHeaders(headers), proxy, timeout, priority, responseType, cancelHandle(cancel), hash, expectedDigest,
+            retryAttempts(retry), retryDelay(retry, false), retryDelay(retry, true));
+
+        return toResponse(rawResponse);
+    }
+
+    /**
+     * Send `form` as a multipart/form-data body. Its size is known up front,
+     * so it is sent with a Content-Length, and files are read from disk a
+     * chunk at a time while sending.
+     */
+    public static function sendMultipart(url:String, method:WinHttpMethod, form:WinHttpMultipart, headers:Map<String,String>, proxy:String, priority:WinHttpPriority = NORMAL, responseType:WinHttpResponseType = TEXT, ?cancel:WinHttpCancelToken):WinHttpResponse {
+
+        final target = parseUrl(url);
+
+        final rawResponse:Dynamic = WinHttp_Extern.sendMultipart(target.domain, target.port, target.https, target.path, method, buildRawHeaders(headers), proxy, priority, responseType,
+            form.kinds, form.names, form.values, form.fileNames, form.contentTypes, form.datas, cancelHandle(cancel));
+
+        return toResponse(rawResponse);
+    }
+
+    /**
+     * Download a resource with parallel Range requests (up to `maxSegments`
+     * connections), falling back to a single stream when the server does not
+     * support ranges. When `filePath` is set, the body is written to that file
+     * and `binaryContent` is null, otherwise it is returned in `binaryContent`.
+     * With `resume`, progress is checkpointed next to the file and a later
+     * call with the same URL and path continues where this one stopped,
+     * also after a cancellation. With `hash`, the body is hashed into
+     * `digest`; a body not matching `expectedDigest` fails the download and
+     * is deleted.
+     */
+    public static function download(url:String, headers:Map<String,String>, proxy:String, ?filePath:String, maxSegments:Int = 8, resume:Bool = false, priority:WinHttpPriority = BULK, ?cancel:WinHttpCancelToken, hash:WinHttpHashAlgorithm = NONE, ?expectedDigest:String):WinHttpResponse {
+
+        final target = parseUrl(url);
+
+        final rawResponse:Dynamic = WinHttp_Extern.download(target.domain, target.port, target.https, target.path, buildRawHeaders(headers), proxy, filePath, maxSegments, resume, priority, cancelHandle(cancel), hash, expectedDigest);
+
+        return toResponse(rawResponse);
+    }
+
+    static function retryAttempts(retry:WinHttpRetryPolicy):Int {
+
+        return retry == null ? 1 : retry.maxAttempts;
+
+    }
+
+    /** Base or maximum delay of `retry`, 0 for the default */
+    static function retryDelay(retry:WinHttpRetryPolicy, max:Bool):Int {
+
+        if (retry == null) return 0;
+        final delay:Null<Int> = max ? retry.maxDelayMs : retry.baseDelayMs;
+        return delay == null ? 0 : delay;
+
+    }
+
+    static function cancelHandle(cancel:WinHttpCancelToken):Int {
+
+        return cancel != null ? cancel.handle : 0;
+
+    }
+
+    static function parseUrl(url:String):{https:Bool, domain:String, port:Int, path:String} {
 
         var domain = "";
         var port = 80;
@@ -59,8 +556,17 @@ class WinHttp {
             throw "Invalid URL: " + url;
         }
 
+        return {
+            https: https,
+            domain: domain,
+            port: port,
+            path: path
+        };
+    }
+
+    static function buildRawHeaders(headers:Map<String,String>):String {
+
         var rawHeaders = new StringBuf();
-        var first = true;
         if (headers != null) {
             for (key => val in headers) {
                 rawHeaders.add(key);
@@ -69,11 +575,13 @@ class WinHttp {
                 rawHeaders.add(val);
                 rawHeaders.addChar('\r'.code);
                 rawHeaders.addChar('\n'.code);
-                first = false;
             }
         }
 
-        final rawResponse:Dynamic = WinHttp_Extern.sendHttpRequest(domain, port, https, path, method, body, rawHeaders.toString(), proxy, timeout);
+        return rawHeaders.toString();
+    }
+
+    static function toResponse(rawResponse:Dynamic):WinHttpResponse {
 
         final responseHeaders = new Map<String,String>();
         final rawResponseHeaders:String = rawResponse.headers;
@@ -103,8 +611,13 @@ class WinHttp {
             status: rawResponse.status,
             headers: responseHeaders,
             content: rawResponse.content,
+            json: rawResponse.json,
             error: rawResponse.error,
-            binaryContent: rawResponse.binaryContent != null ? Bytes.ofData(rawResponse.binaryContent) : null
+            cancelled: rawResponse.cancelled == true,
+            circuitOpen: rawResponse.circuitOpen == true,
+            digest: rawResponse.digest,
+            binaryContent: rawResponse.binaryContent != null ? Bytes.ofData(rawResponse.binaryContent) : null,
+            nativeContent: rawResponse.nativeContent != null ? new WinHttpNativeBuffer(rawResponse.nativeContent) : null
         };
 
         return response;
@@ -124,6 +637,163 @@ extern class WinHttp_Extern {
     static function enableDebugLogging(enabled:Bool):Void;
 
     @:native('::linc::winhttp::sendHttpRequest')
-    static function sendHttpRequest(domain:String, port:Int, https:Bool, path:String, method:Int, body:String, headers:String, proxy:String, timeout:Int):Dynamic;
+    static function sendHttpRequest(domain:String, port:Int, https:Bool, path:String, method:Int, body:String, headers:String, proxy:String, timeout:Int, priority:Int, responseType:Int, cancelToken:Int, hashAlgorithm:Int, expectedDigest:String, retryAttempts:Int, retryBaseDelayMs:Int, retryMaxDelayMs:Int):Dynamic;
+
+    @:native('::linc::winhttp::sendHttpRequestBytes')
+    static function sendHttpRequestBytes(domain:String, port:Int, https:Bool, path:String, method:Int, body:haxe.io.BytesData, offset:Int, length:Int, headers:String, proxy:String, timeout:Int, priority:Int, responseType:Int, cancelToken:Int, hashAlgorithm:Int, expectedDigest:String, retryAttempts:Int, retryBaseDelayMs:Int, retryMaxDelayMs:Int):Dynamic;
+
+    @:native('::linc::winhttp::sendMultipart')
+    static function sendMultipart(domain:String, port:Int, https:Bool, path:String, method:Int, headers:String, proxy:String, priority:Int, responseType:Int,
+        kinds:Array<Int>, names:Array<String>, values:Array<String>, fileNames:Array<String>, contentTypes:Array<String>, datas:Array<Dynamic>, cancelToken:Int):Dynamic;
+
+    @:native('::linc::winhttp::download')
+    static function download(domain:String, port:Int, https:Bool, path:String, headers:String, proxy:String, filePath:String, maxSegments:Int, resume:Bool, priority:Int, cancelToken:Int, hashAlgorithm:Int, expectedDigest:String):Dynamic;
+
+    @:native('::linc::winhttp::createCancelToken')
+    static function createCancelToken(parent:Int):Int;
+
+    @:native('::linc::winhttp::cancelToken')
+    static function cancelToken(handle:Int):Void;
+
+    @:native('::linc::winhttp::isTokenCancelled')
+    static function isTokenCancelled(handle:Int):Bool;
+
+    @:native('::linc::winhttp::releaseCancelToken')
+    static function releaseCancelToken(handle:Int):Void;
+
+    @:native('::linc::winhttp::mapNativeFile')
+    static function mapNativeFile(path:String):Int;
+
+    @:native('::linc::winhttp::nativeBufferLength')
+    static function nativeBufferLength(handle:Int):Float;
+
+    @:native('::linc::winhttp::nativeBufferData')
+    static function nativeBufferData(handle:Int):cpp.RawPointer<cpp.UInt8>;
+
+    @:native('::linc::winhttp::nativeBufferRead')
+    static function nativeBufferRead(handle:Int, offset:Float, length:Int):haxe.io.BytesData;
+
+    @:native('::linc::winhttp::releaseNativeBuffer')
+    static function releaseNativeBuffer(handle:Int):Void;
+
+    @:native('::linc::winhttp::setConcurrencyLimits')
+    static function setConcurrencyLimits(maxGlobal:Int, maxPerHost:Int):Void;
+
+    @:native('::linc::winhttp::setGlobalBandwidthLimit')
+    static function setGlobalBandwidthLimit(bytesPerSecond:Float, burst:Float):Void;
+
+    @:native('::linc::winhttp::setHostBandwidthLimit')
+    static function setHostBandwidthLimit(host:String, bytesPerSecond:Float, burst:Float):Void;
+
+    @:native('::linc::winhttp::setPriorityBandwidthLimit')
+    static function setPriorityBandwidthLimit(priority:Int, bytesPerSecond:Float, burst:Float):Void;
+
+    @:native('::linc::winhttp::setEndpointGroup')
+    static function setEndpointGroup(name:String, domains:Array<String>, ports:Array<Int>, secures:Array<Bool>):Bool;
+
+    @:native('::linc::winhttp::setEndpointSelection')
+    static function setEndpointSelection(exploration:Float, ejectAfterFailures:Int, ejectionMs:Int):Void;
+
+    @:native('::linc::winhttp::setRetryBudget')
+    static function setRetryBudget(ratio:Float, minPerSecond:Float):Void;
+
+    @:native('::linc::winhttp::setCircuitBreaker')
+    static function setCircuitBreaker(enabled:Bool, failureRate:Float, slowCallMs:Int, slowCallRate:Float, minCalls:Int, windowMs:Int, openMs:Int, halfOpenProbes:Int):Void;
+
+    @:native('::linc::winhttp::setMemoryLimits')
+    static function setMemoryLimits(maxBufferedBytes:Float, maxResponseBytes:Float):Void;
+
+    @:native('::linc::winhttp::setResponsePoolLimits')
+    static function setResponsePoolLimits(maxPooled:Int, maxRetainedBytes:Float):Void;
+
+    @:native('::linc::winhttp::recordTraffic')
+    static function recordTraffic(path:String):Bool;
+
+    @:native('::linc::winhttp::replayTraffic')
+    static function replayTraffic(path:String, paced:Bool):Bool;
+
+    @:native('::linc::winhttp::stopTraffic')
+    static function stopTraffic():Void;
+
+    @:native('::linc::winhttp::startTrace')
+    static function startTrace():Void;
+
+    @:native('::linc::winhttp::stopTrace')
+    static function stopTrace():Void;
+
+    @:native('::linc::winhttp::writeTrace')
+    static function writeTrace(path:String):Bool;
+
+    @:native('::linc::winhttp::getMetrics')
+    static function getMetrics():Dynamic;
+
+    @:native('::linc::winhttp::registerMimeType')
+    static function registerMimeType(type:String, binary:Bool):Void;
+
+    @:native('::linc::winhttp::setContentSniffing')
+    static function setContentSniffing(enabled:Bool):Void;
+
+    @:native('::linc::winhttp::createClient')
+    static function createClient(domain:String, port:Int, https:Bool, basePath:String, headers:String, proxy:String, username:String, password:String, priority:Int, timeout:Int, retryAttempts:Int, retryBaseDelayMs:Int, retryMaxDelayMs:Int):Int;
+
+    @:native('::linc::winhttp::destroyClient')
+    static function destroyClient(handle:Int):Void;
+
+    @:native('::linc::winhttp::cancelClient')
+    static function cancelClient(handle:Int):Void;
+
+    @:native('::linc::winhttp::createFollower')
+    static function createFollower(domain:String, port:Int, https:Bool, path:String, headers:String, proxy:String, priority:Int):Int;
+
+    @:native('::linc::winhttp::destroyFollower')
+    static function destroyFollower(handle:Int):Void;
+
+    @:native('::linc::winhttp::followerPoll')
+    static function followerPoll(handle:Int, responseType:Int, cancelToken:Int):Dynamic;
+
+    @:native('::linc::winhttp::prepareRequest')
+    static function prepareRequest(handle:Int, method:Int, pathTemplate:String, headers:String):Int;
+
+    @:native('::linc::winhttp::sendPrepared')
+    static function sendPrepared(handle:Int, id:Int, params:Array<String>, body:String, responseType:Int):Dynamic;
+
+    @:native('::linc::winhttp::sendPreparedBytes')
+    static function sendPreparedBytes(handle:Int, id:Int, params:Array<String>, body:haxe.io.BytesData, offset:Int, length:Int, responseType:Int):Dynamic;
+
+    @:native('::linc::winhttp::sendClientRequest')
+    static function sendClientRequest(handle:Int, method:Int, path:String, body:String, headers:String, responseType:Int):Dynamic;
+
+    @:native('::linc::winhttp::sendClientRequestBytes')
+    static function sendClientRequestBytes(handle:Int, method:Int, path:String, body:haxe.io.BytesData, offset:Int, length:Int, headers:String, responseType:Int):Dynamic;
+
+    @:native('::linc::winhttp::openWebSocket')
+    static function openWebSocket(domain:String, port:Int, https:Bool, path:String, headers:String, proxy:String, keepAliveInterval:Int):Dynamic;
+
+    @:native('::linc::winhttp::webSocketSendText')
+    static function webSocketSendText(handle:Int, text:String):Bool;
+
+    @:native('::linc::winhttp::webSocketSendBytes')
+    static function webSocketSendBytes(handle:Int, data:haxe.io.BytesData, offset:Int, length:Int):Bool;
+
+    @:native('::linc::winhttp::webSocketReceive')
+    static function webSocketReceive(handle:Int, timeoutMs:Int):Dynamic;
+
+    @:native('::linc::winhttp::webSocketState')
+    static function webSocketState(handle:Int):Dynamic;
+
+    @:native('::linc::winhttp::closeWebSocket')
+    static function closeWebSocket(handle:Int, status:Int, reason:String):Void;
+
+    @:native('::linc::winhttp::openEventSource')
+    static function openEventSource(domain:String, port:Int, https:Bool, path:String, headers:String, proxy:String, lastEventId:String):Int;
+
+    @:native('::linc::winhttp::eventSourceReceive')
+    static function eventSourceReceive(handle:Int, timeoutMs:Int):Dynamic;
+
+    @:native('::linc::winhttp::eventSourceState')
+    static function eventSourceState(handle:Int):Dynamic;
+
+    @:native('::linc::winhttp::closeEventSource')
+    static function closeEventSource(handle:Int):Void;
 
 }
@@ -0,0 +1,53 @@
+package winhttp;
+
+import winhttp.WinHttp;
+
+/**
+ * Cancels requests from any thread: pass it to `sendHttpRequest`,
+ * `sendMultipart` or `download`, then call `cancel()` to abort them, queued
+ * or in flight. They return with `cancelled` set. A token can be shared by
+ * many requests, and a child token is cancelled along with its parent.
+ * Call `dispose()` when done with it.
+ */
+@:allow(winhttp.WinHttp)
+class WinHttpCancelToken {
+
+    var handle:Int;
+
+    public function new(?parent:WinHttpCancelToken) {
+
+        handle = WinHttp_Extern.createCancelToken(parent != null ? parent.handle : 0);
+
+    }
+
+    /** New token cancelled along with this one */
+    public function child():WinHttpCancelToken {
+
+        return new WinHttpCancelToken(this);
+
+    }
+
+    public function cancel():Void {
+
+        WinHttp_Extern.cancelToken(handle);
+
+    }
+
+    public function isCancelled():Bool {
+
+        return WinHttp_Extern.isTokenCancelled(handle);
+
+    }
+
+    /**
+     * Release the native token. Requests already using it can still be
+     * cancelled through a parent, not through this token anymore.
+     */
+    public function dispose():Void {
+
+        WinHttp_Extern.releaseCancelToken(handle);
+        handle = 0;
+
+    }
+
+}
@@ -0,0 +1,138 @@
+package winhttp;
+
+import haxe.io.Bytes;
+import winhttp.WinHttp;
+
+/**
+ * Client bound to one server. The base URL, default headers, proxy and
+ * credentials are parsed and converted once, natively, instead of on every
+ * request. Call `close()` when done with it.
+ */
+class WinHttpClient {
+
+    var handle:Int;
+
+    /**
+     * @param baseUrl Scheme, host, optional port and base path, such as
+     * `https://api.example.com/v1`. Request paths are relative to it.
+     * @param timeout Time each request may take in seconds, retries
+     * included, 0 for no limit
+     * @param retry Retries of the idempotent requests, none by default
+     */
+    public function new(baseUrl:String, ?headers:Map<String,String>, ?proxy:String, ?username:String, ?password:String, priority:WinHttpPriority = NORMAL, timeout:Int = 0, ?retry:WinHttpRetryPolicy) {
+
+        final target = WinHttp.parseUrl(baseUrl);
+
+        handle = WinHttp_Extern.createClient(target.domain, target.port, target.https, target.path, WinHttp.buildRawHeaders(headers), proxy, username, password, priority,
+            timeout, WinHttp.retryAttempts(retry), WinHttp.retryDelay(retry, false), WinHttp.retryDelay(retry, true));
+
+    }
+
+    /**
+     * Prepare a request sent repeatedly with only its path parameters or
+     * its body changing. Each `{}` in `pathTemplate` is replaced, in order,
+     * by the parameters given to `WinHttpPreparedRequest.send()`.
+     */
+    public function prepare(method:WinHttpMethod, pathTemplate:String, ?headers:Map<String,String>):WinHttpPreparedRequest {
+
+        final id = WinHttp_Extern.prepareRequest(handle, method, pathTemplate, WinHttp.buildRawHeaders(headers));
+        if (id < 0) {
+            throw "Cannot prepare request on a closed client";
+        }
+
+        return new WinHttpPreparedRequest(this, id);
+
+    }
+
+    public function request(method:WinHttpMethod, path:String, ?body:String, ?headers:Map<String,String>, responseType:WinHttpResponseType = TEXT):WinHttpResponse {
+
+        final rawResponse:Dynamic = WinHttp_Extern.sendClientRequest(handle, method, path, body, WinHttp.buildRawHeaders(headers), responseType);
+
+        return WinHttp.toResponse(rawResponse);
+
+    }
+
+    /**
+     * Same as `request()`, with a binary body: the `len` bytes of `body`
+     * from `pos` (the rest of it by default). The bytes are sent from where
+     * they are, without being copied, and must not change until the call
+     * returns.
+     */
+    public function requestBytes(method:WinHttpMethod, path:String, body:Bytes, ?headers:Map<String,String>, responseType:WinHttpResponseType = TEXT, pos:Int = 0, ?len:Int):WinHttpResponse {
+
+        final rawResponse:Dynamic = WinHttp_Extern.sendClientRequestBytes(handle, method, path, body != null ? body.getData() : null, pos, len != null ? len : -1,
+            WinHttp.buildRawHeaders(headers), responseType);
+
+        return WinHttp.toResponse(rawResponse);
+
+    }
+
+    /**
+     * Abort every request of this client in flight or queued, from any
+     * thread. They return with `cancelled` set; later requests are sent as
+     * usual.
+     */
+    public function cancelAll():Void {
+
+        WinHttp_Extern.cancelClient(handle);
+
+    }
+
+    public function close():Void {
+
+        WinHttp_Extern.destroyClient(handle);
+        handle = 0;
+
+    }
+
+    @:allow(winhttp.WinHttpPreparedRequest)
+    function sendPrepared(id:Int, params:Array<String>, body:String, responseType:WinHttpResponseType):WinHttpResponse {
+
+        final rawResponse:Dynamic = WinHttp_Extern.sendPrepared(handle, id, params, body, responseType);
+
+        return WinHttp.toResponse(rawResponse);
+
+    }
+
+    @:allow(winhttp.WinHttpPreparedRequest)
+    function sendPreparedBytes(id:Int, params:Array<String>, body:Bytes, pos:Int, len:Int, responseType:WinHttpResponseType):WinHttpResponse {
+
+        final rawResponse:Dynamic = WinHttp_Extern.sendPreparedBytes(handle, id, params, body != null ? body.getData() : null, pos, len, responseType);
+
+        return WinHttp.toResponse(rawResponse);
+
+    }
+
+}
+
+class WinHttpPreparedRequest {
+
+    final client:WinHttpClient;
+
+    final id:Int;
+
+    @:allow(winhttp.WinHttpClient)
+    function new(client:WinHttpClient, id:Int) {
+
+        this.client = client;
+        this.id = id;
+
+    }
+
+    public function send(?params:Array<String>, ?body:String, responseType:WinHttpResponseType = TEXT):WinHttpResponse {
+
+        return client.sendPrepared(id, params, body, responseType);
+
+    }
+
+    /**
+     * Same as `send()`, with a binary body: the `len` bytes of `body` from
+     * `pos` (the rest of it by default), sent without being copied.
+     */
+    public function sendBytes(?params:Array<String>, body:Bytes, responseType:WinHttpResponseType = TEXT, pos:Int = 0, ?len:Int):WinHttpResponse {
+
+        return client.sendPreparedBytes(id, params, body, pos, len != null ? len : -1, responseType);
+
+    }
+
+}
@@ -0,0 +1,106 @@
+package winhttp;
+
+import winhttp.WinHttp;
+
+typedef WinHttpEvent = {
+
+    /** `message` unless the server named the event */
+    public var type:String;
+
+    public var data:String;
+
+    /** Last event ID when the event was received */
+    public var id:String;
+
+}
+
+/**
+ * Server-Sent Events (`text/event-stream`) subscription. Events are parsed
+ * natively as they arrive and queued until `receive()` takes them. Dropped
+ * connections are reopened with the `Last-Event-ID` of the last event.
+ * Call `close()` when done with it.
+ */
+class WinHttpEventSource {
+
+    var handle:Int;
+
+    /**
+     * @param lastEventId Resume from an event received by an earlier subscription
+     */
+    public function new(url:String, ?headers:Map<String,String>, ?proxy:String, ?lastEventId:String) {
+
+        final target = WinHttp.parseUrl(url);
+
+        handle = WinHttp_Extern.openEventSource(target.domain, target.port, target.https, target.path, WinHttp.buildRawHeaders(headers), proxy, lastEventId);
+
+    }
+
+    /**
+     * False once the subscription ended for good: the server answered with
+     * something other than an event stream, or `close()` was called.
+     */
+    public function isOpen():Bool {
+
+        final state:Dynamic = WinHttp_Extern.eventSourceState(handle);
+        return state.open;
+
+    }
+
+    /** Whether events are currently streaming, as opposed to reconnecting */
+    public function isConnected():Bool {
+
+        final state:Dynamic = WinHttp_Extern.eventSourceState(handle);
+        return state.connected;
+
+    }
+
+    /** Why the subscription ended, null while it is open or after a 204 */
+    public function getError():String {
+
+        final state:Dynamic = WinHttp_Extern.eventSourceState(handle);
+        return state.error;
+
+    }
+
+    /** Status of the last response */
+    public function getStatus():Int {
+
+        final state:Dynamic = WinHttp_Extern.eventSourceState(handle);
+        return state.status;
+
+    }
+
+    /**
+     * Take the next event, or null when none arrives within `timeoutMs`
+     * (0 returns immediately, -1 waits until one arrives or the
+     * subscription ends).
+     */
+    public function receive(timeoutMs:Int = 0):Null<WinHttpEvent> {
+
+        return WinHttp_Extern.eventSourceReceive(handle, timeoutMs);
+
+    }
+
+    /**
+     * Take every event received so far.
+     */
+    public function drain():Array<WinHttpEvent> {
+
+        final events = [];
+        var event = receive();
+        while (event != null) {
+            events.push(event);
+            event = receive();
+        }
+        return events;
+
+    }
+
+    public function close():Void {
+
+        WinHttp_Extern.closeEventSource(handle);
+        handle = 0;
+
+    }
+
+}
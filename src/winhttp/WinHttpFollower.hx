@@ -0,0 +1,51 @@
+package winhttp;
+
+import winhttp.WinHttp;
+
+/**
+ * Follows an append-only resource, such as a server log or a data feed:
+ * each `poll()` returns only the bytes appended since the last one, fetched
+ * with a Range request, so polling costs the new data rather than the whole
+ * resource. Status 304 means nothing was appended. When the resource was
+ * rotated or truncated, `poll()` reads it again from the start and sets
+ * `restarted`. Call `close()` when done with it.
+ */
+class WinHttpFollower {
+
+    var handle:Int;
+
+    /** Bytes of the resource read so far */
+    public var offset(default, null):Float = 0;
+
+    /** The last `poll()` found a new resource and read it from the start */
+    public var restarted(default, null):Bool = false;
+
+    public function new(url:String, ?headers:Map<String,String>, ?proxy:String, priority:WinHttpPriority = NORMAL) {
+
+        final target = WinHttp.parseUrl(url);
+
+        handle = WinHttp_Extern.createFollower(target.domain, target.port, target.https, target.path, WinHttp.buildRawHeaders(headers), proxy, priority);
+
+    }
+
+    /** `responseType` may be `TEXT` or `NATIVE` */
+    public function poll(responseType:WinHttpResponseType = TEXT, ?cancel:WinHttpCancelToken):WinHttpResponse {
+
+        final rawResponse:Dynamic = WinHttp_Extern.followerPoll(handle, responseType, WinHttp.cancelHandle(cancel));
+        if (rawResponse.offset != null) {
+            offset = rawResponse.offset;
+            restarted = rawResponse.restarted;
+        }
+
+        return WinHttp.toResponse(rawResponse);
+
+    }
+
+    public function close():Void {
+
+        WinHttp_Extern.destroyFollower(handle);
+        handle = 0;
+
+    }
+
+}
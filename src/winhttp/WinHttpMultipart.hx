@@ -0,0 +1,64 @@
+package winhttp;
+
+import haxe.io.Bytes;
+
+/**
+ * multipart/form-data body sent with `WinHttp.sendMultipart()`. Files are
+ * streamed from disk while sending instead of being loaded in memory.
+ */
+@:allow(winhttp.WinHttp)
+class WinHttpMultipart {
+
+    var kinds:Array<Int> = [];
+
+    var names:Array<String> = [];
+
+    var values:Array<String> = [];
+
+    var fileNames:Array<String> = [];
+
+    var contentTypes:Array<String> = [];
+
+    var datas:Array<Dynamic> = [];
+
+    public function new() {}
+
+    public function addField(name:String, value:String):WinHttpMultipart {
+
+        return add(0, name, value, null, null, null);
+
+    }
+
+    /**
+     * @param contentType Defaults to `application/octet-stream`
+     */
+    public function addBytes(name:String, bytes:Bytes, ?fileName:String, ?contentType:String):WinHttpMultipart {
+
+        return add(1, name, null, fileName != null ? fileName : name, contentType, bytes != null ? bytes.getData() : null);
+
+    }
+
+    /**
+     * @param fileName Defaults to the file name of `path`
+     * @param contentType Defaults to `application/octet-stream`
+     */
+    public function addFile(name:String, path:String, ?fileName:String, ?contentType:String):WinHttpMultipart {
+
+        return add(2, name, path, fileName, contentType, null);
+
+    }
+
+    function add(kind:Int, name:String, value:String, fileName:String, contentType:String, data:Dynamic):WinHttpMultipart {
+
+        kinds.push(kind);
+        names.push(name);
+        values.push(value);
+        fileNames.push(fileName);
+        contentTypes.push(contentType);
+        datas.push(data);
+
+        return this;
+
+    }
+
+}
@@ -0,0 +1,101 @@
+package winhttp;
+
+import haxe.io.Bytes;
+import winhttp.WinHttp;
+
+/**
+ * Bytes held in native memory, out of the GC heap: a response body received
+ * with `WinHttpResponseType.NATIVE`, or a file mapped with `mapFile()`. Hand
+ * `pointer()` to native code (decoders, GPU uploads) without copying, or copy
+ * the parts Haxe needs with `getBytes()`. Call `release()` when done with it;
+ * otherwise the memory is only freed once the GC collects this object.
+ *
+ * Neither `pointer()` nor `unsafeView()` keeps this object alive: the GC
+ * may collect it, and free the memory, while they are still in use. Keep a
+ * reference to the buffer itself for as long as any of them is used.
+ */
+@:allow(winhttp.WinHttp)
+class WinHttpNativeBuffer {
+
+    var handle:Int;
+
+    public var length(default, null):Float;
+
+    function new(handle:Int) {
+
+        this.handle = handle;
+        length = WinHttp_Extern.nativeBufferLength(handle);
+        cpp.vm.Gc.setFinalizer(this, cpp.Callable.fromStaticFunction(finalize));
+
+    }
+
+    /**
+     * Map a file, such as one written by `WinHttp.download`, without reading
+     * it in. Writes through the buffer never reach the file. Returns null if
+     * the file cannot be opened.
+     */
+    public static function mapFile(path:String):WinHttpNativeBuffer {
+
+        final handle = WinHttp_Extern.mapNativeFile(path);
+        return handle != 0 ? new WinHttpNativeBuffer(handle) : null;
+
+    }
+
+    /**
+     * Start of the bytes, valid until `release()` or until this object is
+     * collected, whichever comes first
+     */
+    public function pointer():cpp.Pointer<cpp.UInt8> {
+
+        if (handle == 0) {
+            throw "Native buffer was released";
+        }
+        return cpp.Pointer.fromRaw(WinHttp_Extern.nativeBufferData(handle));
+
+    }
+
+    /** Copy `len` bytes from `pos` into a new `Bytes` */
+    public function getBytes(pos:Float, len:Int):Bytes {
+
+        final data = handle != 0 ? WinHttp_Extern.nativeBufferRead(handle, pos, len) : null;
+        if (data == null) {
+            throw haxe.io.Error.OutsideBounds;
+        }
+        return Bytes.ofData(data);
+
+    }
+
+    /**
+     * `Bytes` over the native memory itself, without copying. Only valid
+     * until `release()` or until this object is collected: the view does
+     * not reference it, and using it afterwards reads freed memory. Buffers
+     * over 2GB cannot be viewed whole.
+     */
+    public function unsafeView():Bytes {
+
+        if (length > 0x7fffffff) {
+            throw haxe.io.Error.Overflow;
+        }
+        if (length == 0) {
+            return Bytes.alloc(0);
+        }
+        return Bytes.ofData(pointer().toUnmanagedArray(Std.int(length)));
+
+    }
+
+    public function release():Void {
+
+        if (handle != 0) {
+            WinHttp_Extern.releaseNativeBuffer(handle);
+            handle = 0;
+        }
+
+    }
+
+    @:void static function finalize(buffer:WinHttpNativeBuffer):Void {
+
+        buffer.release();
+
+    }
+
+}
@@ -0,0 +1,129 @@
+package winhttp;
+
+import haxe.io.Bytes;
+import winhttp.WinHttp;
+
+typedef WinHttpWebSocketMessage = {
+
+    public var binary:Bool;
+
+    /** Message text, when not `binary` */
+    @:optional public var text:String;
+
+    /** Message bytes, when `binary` */
+    @:optional public var bytes:Bytes;
+
+}
+
+/**
+ * WebSocket connection. Messages are received natively in the background
+ * and queued until `receive()` takes them; WinHTTP answers pings and keeps
+ * the connection alive by itself. Call `close()` when done with it, even
+ * after the server closed it.
+ */
+class WinHttpWebSocket {
+
+    var handle:Int;
+
+    /** Close status once the connection is closed (1006 when it dropped) */
+    public var closeStatus(default, null):Int = 0;
+
+    public var closeReason(default, null):String;
+
+    public var error(default, null):String;
+
+    /**
+     * Connect to a `ws://`, `wss://`, `http://` or `https://` URL. Throws
+     * when the server refuses the upgrade.
+     * @param keepAliveInterval Milliseconds between keep-alive frames
+     * (at least 15000, 0 for the WinHTTP default)
+     */
+    public function new(url:String, ?headers:Map<String,String>, ?proxy:String, keepAliveInterval:Int = 0) {
+
+        if (StringTools.startsWith(url, "ws://")) {
+            url = "http://" + url.substr(5);
+        } else if (StringTools.startsWith(url, "wss://")) {
+            url = "https://" + url.substr(6);
+        }
+        final target = WinHttp.parseUrl(url);
+
+        final result:Dynamic = WinHttp_Extern.openWebSocket(target.domain, target.port, target.https, target.path, WinHttp.buildRawHeaders(headers), proxy, keepAliveInterval);
+        handle = result.handle;
+        if (handle == 0) {
+            throw (result.error != null ? result.error : "WebSocket upgrade failed") + " (status " + result.status + ")";
+        }
+
+    }
+
+    public function isOpen():Bool {
+
+        final state:Dynamic = WinHttp_Extern.webSocketState(handle);
+        if (!state.open && handle != 0 && closeStatus == 0) {
+            closeStatus = state.closeStatus;
+            closeReason = state.closeReason;
+            error = state.error;
+        }
+        return state.open;
+
+    }
+
+    public function sendText(text:String):Bool {
+
+        return WinHttp_Extern.webSocketSendText(handle, text);
+
+    }
+
+    public function sendBytes(bytes:Bytes, offset:Int = 0, ?length:Int):Bool {
+
+        return WinHttp_Extern.webSocketSendBytes(handle, bytes.getData(), offset, length != null ? length : bytes.length - offset);
+
+    }
+
+    /**
+     * Take the next received message, or null when none arrives within
+     * `timeoutMs` (0 returns immediately, -1 waits until one arrives or the
+     * connection closes).
+     */
+    public function receive(timeoutMs:Int = 0):Null<WinHttpWebSocketMessage> {
+
+        final raw:Dynamic = WinHttp_Extern.webSocketReceive(handle, timeoutMs);
+        if (raw == null) {
+            return null;
+        }
+
+        return {
+            binary: raw.binary,
+            text: raw.text,
+            bytes: raw.bytes != null ? Bytes.ofData(raw.bytes) : null
+        };
+
+    }
+
+    /**
+     * Take every message received so far.
+     */
+    public function drain():Array<WinHttpWebSocketMessage> {
+
+        final messages = [];
+        var message = receive();
+        while (message != null) {
+            messages.push(message);
+            message = receive();
+        }
+        return messages;
+
+    }
+
+    /**
+     * Close the connection. Messages still queued are dropped, `drain()`
+     * them first if needed.
+     */
+    public function close(status:Int = 1000, reason:String = ""):Void {
+
+        isOpen();
+        WinHttp_Extern.closeWebSocket(handle, status, reason);
+        handle = 0;
+
+    }
+
+}
@@ -0,0 +1,54 @@
+// The MIT License (MIT)
+// Checks for the native tests of WinHTTP Wrapper
+//
+// http://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace Check
+{
+	inline int& Failures()
+	{
+		static int failures = 0;
+		return failures;
+	}
+
+	// Port of the fixture server given by fixture.py, 0 when not running
+	inline int Port(const char* name)
+	{
+		const char* value = getenv(name);
+		return value ? atoi(value) : 0;
+	}
+
+	// Scratch file in the fixture's temporary directory
+	inline std::wstring TempPath(const char* name)
+	{
+		const char* directory = getenv("FIXTURE_DIR");
+		std::string path = std::string(directory ? directory : "/tmp") + "/" + name;
+		return std::wstring(path.begin(), path.end());
+	}
+
+	// Exit code of the test
+	inline int Summary(const char* test)
+	{
+		if (Failures())
+			printf("%s: %d check(s) failed\n", test, Failures());
+		else
+			printf("%s: passed\n", test);
+		return Failures() ? 1 : 0;
+	}
+}
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			++Check::Failures(); \
+		} \
+	} while (0)
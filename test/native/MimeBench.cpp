@@ -0,0 +1,102 @@
+// The MIT License (MIT)
+// Benchmark of MIME classification
+//
+// http://opensource.org/licenses/MIT
+
+#include "WinHttpMime.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cwctype>
+
+using namespace WinHttpWrapper;
+
+namespace
+{
+	const wchar_t* const kContentTypes[] = {
+		L"application/json",
+		L"application/json; charset=utf-8",
+		L"text/html; charset=UTF-8",
+		L"image/png",
+		L"application/octet-stream",
+		L"application/problem+json",
+		L"application/vnd.api+json",
+		L"Application/JavaScript",
+		L"video/mp4",
+		L"application/x-custom; charset=utf-8",
+	};
+	const size_t kTypeCount = sizeof(kContentTypes) / sizeof(kContentTypes[0]);
+
+	// How HttpResponse::IsBinaryMimeType classified before the table: copy,
+	// trim and lowercase the type, then compare it with each text type
+	bool ClassifyByComparison(const std::wstring& contentType)
+	{
+		if (contentType.empty())
+			return false;
+		std::wstring type = contentType.substr(0, contentType.find(L';'));
+		size_t start = type.find_first_not_of(L" \t\r\n");
+		if (start == std::wstring::npos)
+			return false;
+		type = type.substr(start, type.find_last_not_of(L" \t\r\n") - start + 1);
+		std::transform(type.begin(), type.end(), type.begin(), ::towlower);
+		if (type.find(L"text/") == 0)
+			return false;
+		static const wchar_t* const textTypes[] = {
+			L"application/javascript", L"application/atom+xml", L"application/rss+xml",
+			L"application/xhtml+xml", L"application/xml", L"application/json",
+			L"application/x-javascript", L"application/ecmascript", L"application/x-www-form-urlencoded",
+			L"application/x-perl", L"application/x-sh", L"application/rtf", L"image/svg+xml",
+			L"application/xspf+xml",
+		};
+		for (const wchar_t* text : textTypes)
+		{
+			if (type == text)
+				return false;
+		}
+		return true;
+	}
+
+	template <class Classify>
+	void Run(const char* name, const std::wstring* types, Classify classify)
+	{
+		const int rounds = 200000;
+		size_t binary = 0;
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int round = 0; round < rounds; ++round)
+		{
+			for (size_t i = 0; i < kTypeCount; ++i)
+				binary += classify(types[i]) ? 1 : 0;
+		}
+		const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		printf("%-28s %7.1f ns per type (%zu binary)\n", name, ns / (static_cast<double>(rounds) * kTypeCount), binary);
+	}
+}
+
+int main()
+{
+	std::wstring types[kTypeCount];
+	for (size_t i = 0; i < kTypeCount; ++i)
+		types[i] = kContentTypes[i];
+
+	MimeClassifier table;
+	MimeClassifier overridden;
+	overridden.Add(L"application/x-custom", true);
+	overridden.Add(L"+cbor", false);
+
+	Run("table", types, [&](const std::wstring& type) { return table.IsBinary(type); });
+	Run("table with overrides", types, [&](const std::wstring& type) { return overridden.IsBinary(type); });
+	Run("string comparisons", types, ClassifyByComparison);
+
+	// Sniffing looks at the first 512 bytes at most
+	std::string text(4096, 'a');
+	for (size_t i = 0; i < text.size(); i += 64)
+		text[i] = '\n';
+	const int rounds = 200000;
+	size_t binary = 0;
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int round = 0; round < rounds; ++round)
+		binary += MimeClassifier::SniffBinary(reinterpret_cast<const uint8_t*>(text.data()), text.size()) ? 1 : 0;
+	const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	printf("%-28s %7.1f ns per body (%zu binary)\n", "sniff text body", ns / rounds, binary);
+	return 0;
+}
@@ -0,0 +1,190 @@
+// The MIT License (MIT)
+// MIME classification and content sniffing
+//
+// http://opensource.org/licenses/MIT
+
+#include "Check.h"
+#include "WinHttpWrapper.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace WinHttpWrapper;
+
+namespace
+{
+	bool Sniff(const std::string& data)
+	{
+		return MimeClassifier::SniffBinary(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+	}
+
+	void TestBuiltInRules()
+	{
+		MimeClassifier mime;
+
+		// Table entries, whatever their case, spacing and parameters
+		CHECK(!mime.IsBinary(L"application/json"));
+		CHECK(!mime.IsBinary(L"Application/JSON; charset=utf-8"));
+		CHECK(!mime.IsBinary(L"  application/javascript  "));
+		CHECK(!mime.IsBinary(L"application/x-ndjson"));
+		CHECK(!mime.IsBinary(L"application/x-www-form-urlencoded"));
+		CHECK(!mime.IsBinary(L"image/svg+xml"));
+		CHECK(mime.IsBinary(L"application/octet-stream"));
+		CHECK(mime.IsBinary(L"APPLICATION/PDF"));
+		CHECK(mime.IsBinary(L"application/wasm"));
+
+		// Every text/ type
+		CHECK(!mime.IsBinary(L"text/html"));
+		CHECK(!mime.IsBinary(L"text/x-unknown; charset=iso-8859-1"));
+
+		// Structured syntax suffixes of types not in the table
+		CHECK(!mime.IsBinary(L"application/problem+json"));
+		CHECK(!mime.IsBinary(L"application/vnd.api+json; ext=bulk"));
+		CHECK(!mime.IsBinary(L"application/soap+XML"));
+		CHECK(!mime.IsBinary(L"application/vnd.k8s+yaml"));
+		CHECK(mime.IsBinary(L"application/vnd.foo+cbor"));
+		CHECK(mime.IsBinary(L"application/vnd.foo+zip"));
+
+		// A charset only makes sense for text
+		CHECK(!mime.IsBinary(L"application/x-custom; charset=utf-8"));
+		CHECK(!mime.IsBinary(L"application/x-custom;CHARSET=utf-8"));
+		CHECK(mime.IsBinary(L"application/x-custom"));
+		CHECK(mime.IsBinary(L"image/png"));
+		CHECK(mime.IsBinary(L"video/mp4; codecs=\"avc1\""));
+
+		// Nothing to go by: text, the body may still be sniffed
+		CHECK(!mime.IsBinary(L""));
+		CHECK(!mime.IsBinary(L"   "));
+		CHECK(!mime.IsBinary(L"; charset=utf-8"));
+
+		// Near misses of table entries are not matches
+		CHECK(mime.IsBinary(L"application/jso"));
+		CHECK(mime.IsBinary(L"application/jsonx"));
+		CHECK(mime.IsBinary(L"application/j\x00E9son"));
+	}
+
+	void TestOverrides()
+	{
+		MimeClassifier mime;
+		mime.Add(L"application/x-custom", false);
+		mime.Add(L"+cbor", false);
+		mime.Add(L" Application/JSON ", true);
+		CHECK(!mime.IsBinary(L"application/x-custom"));
+		CHECK(!mime.IsBinary(L"APPLICATION/X-CUSTOM; v=1"));
+		CHECK(!mime.IsBinary(L"application/vnd.foo+cbor"));
+		CHECK(mime.IsBinary(L"application/json"));
+
+		// Adding a type again replaces its rule
+		mime.Add(L"application/x-custom", true);
+		CHECK(mime.IsBinary(L"application/x-custom"));
+		mime.Add(L"", false);
+		CHECK(mime.IsBinary(L"application/x-other"));
+
+		// Rules belong to their classifier
+		MimeClassifier other;
+		CHECK(!other.IsBinary(L"application/json"));
+		CHECK(other.IsBinary(L"application/vnd.foo+cbor"));
+	}
+
+	void TestSniffing()
+	{
+		MimeClassifier mime;
+		CHECK(mime.IsSniffing());
+		mime.SetSniffing(false);
+		CHECK(!mime.IsSniffing());
+
+		// Signatures
+		CHECK(Sniff("\x89PNG\r\n\x1A\n"));
+		CHECK(Sniff("\xFF\xD8\xFF\xE0"));
+		CHECK(Sniff("GIF89a"));
+		CHECK(Sniff("%PDF-1.7"));
+		CHECK(Sniff(std::string("PK\x03\x04", 4)));
+		CHECK(Sniff("\x1F\x8B\x08"));
+		CHECK(Sniff(std::string("\0asm\x01\0\0\0", 8)));
+		CHECK(Sniff(std::string("\0\0\0\x18" "ftypmp42", 12)));
+
+		// Text, including UTF-8 and the usual whitespace
+		CHECK(!Sniff(""));
+		CHECK(!Sniff("{\"a\": [1, 2]}\r\n"));
+		CHECK(!Sniff("\tcaf\xC3\xA9 \xE2\x82\xAC \xF0\x9F\x98\x80\f"));
+		CHECK(!Sniff("\x1B[31mred\x1B[0m"));
+
+		// Control bytes and invalid UTF-8
+		CHECK(Sniff(std::string("ab\0cd", 5)));
+		CHECK(Sniff("ab\x01"));
+		CHECK(Sniff("caf\xE9 au lait"));
+		CHECK(Sniff("\xC3("));
+		CHECK(Sniff("\xC0\xAF"));
+
+		// Only the first 512 bytes are looked at, and a sequence cut by
+		// the end of them is not an error
+		CHECK(!Sniff(std::string(512, 'a') + std::string("\0", 1)));
+		CHECK(!Sniff(std::string(511, 'a') + "\xE2\x82\xAC"));
+		CHECK(!Sniff("abc\xE2\x82"));
+	}
+
+	// Add() while other threads classify
+	void TestConcurrentAdd()
+	{
+		MimeClassifier mime;
+		std::atomic<bool> done(false);
+		std::atomic<int> wrong(0);
+		std::vector<std::thread> readers;
+		for (int i = 0; i < 4; ++i)
+		{
+			readers.emplace_back([&]
+			{
+				while (!done)
+				{
+					if (mime.IsBinary(L"application/json") || !mime.IsBinary(L"image/png"))
+						++wrong;
+					mime.IsBinary(L"application/x-type-17");
+				}
+			});
+		}
+		for (int i = 0; i < 200; ++i)
+			mime.Add(L"application/x-type-" + std::to_wstring(i), false);
+		done = true;
+		for (std::thread& reader : readers)
+			reader.join();
+
+		CHECK(wrong == 0);
+		CHECK(!mime.IsBinary(L"application/x-type-0"));
+		CHECK(!mime.IsBinary(L"application/x-type-199"));
+		CHECK(mime.IsBinary(L"application/x-type-200"));
+	}
+
+	// Responses without a Content-Type are classified from their body
+	void TestSniffedResponses(int port)
+	{
+		HttpRequest request(L"127.0.0.1", port, false);
+		HttpResponse response;
+
+		CHECK(request.Get(L"/untyped?png", L"", response));
+		CHECK(response.isBinary);
+		CHECK(response.binaryData.size() == 16);
+
+		CHECK(request.Get(L"/untyped", L"", response));
+		CHECK(!response.isBinary);
+		CHECK(response.text == "plain text body");
+
+		// Without sniffing, they are text
+		MimeClassifier mime;
+		mime.SetSniffing(false);
+		request.SetMimeClassifier(&mime);
+		CHECK(request.Get(L"/untyped?png", L"", response));
+		CHECK(!response.isBinary);
+		CHECK(response.text.size() == 16);
+	}
+}
+
+int main()
+{
+	TestBuiltInRules();
+	TestOverrides();
+	TestSniffing();
+	TestConcurrentAdd();
+	if (const int port = Check::Port("FIXTURE_PORT"))
+		TestSniffedResponses(port);
+	return Check::Summary("MimeTest");
+}
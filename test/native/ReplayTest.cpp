@@ -0,0 +1,288 @@
+// The MIT License (MIT)
+// Traffic record/replay through a TrafficLog
+//
+// http://opensource.org/licenses/MIT
+
+#include "Check.h"
+#include "WinHttpReplay.h"
+#include "WinHttpTransport.h"
+#include <chrono>
+#include <fstream>
+#include <iterator>
+
+using namespace WinHttpWrapper;
+
+namespace
+{
+	// Replays must not touch the network
+	class CountingTransport : public Transport
+	{
+	public:
+		CountingTransport() : sent(0) {}
+
+		bool Send(const TransportRequest&, HttpResponse& response) override
+		{
+			++sent;
+			response.error = L"Sent to the network!";
+			return false;
+		}
+
+		int sent;
+	};
+
+	std::string ReadFile(const std::wstring& path)
+	{
+		std::ifstream file(std::string(path.begin(), path.end()), std::ios::binary);
+		return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+
+	void WriteFile(const std::wstring& path, const std::string& data)
+	{
+		std::ofstream file(std::string(path.begin(), path.end()), std::ios::binary | std::ios::trunc);
+		file.write(data.data(), static_cast<std::streamsize>(data.size()));
+	}
+
+	long long Elapsed(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Records the exchanges the other tests replay
+	void Record(int port, const std::wstring& log, HttpResponse& chunked, HttpResponse& binary)
+	{
+		HttpRequest request(L"127.0.0.1", port, false);
+		HttpResponse response;
+
+		CHECK(TrafficLog::Instance().StartRecording(log));
+		CHECK(TrafficLog::Instance().GetMode() == TrafficLog::MODE_RECORD);
+		CHECK(request.Get(L"/chunked", L"", chunked));
+		CHECK(request.Get(L"/close", L"", binary));
+		CHECK(request.Get(L"/paced", L"", response));
+		CHECK(request.Get(L"/n?1", L"", response));
+		CHECK(request.Get(L"/n?2", L"", response));
+		CHECK(request.Get(L"/n?1", L"", response));
+		CHECK(request.Post(L"/post", L"Content-Type: text/plain\r\n", "posted body", response));
+		const char data[] = "in\0memory";
+		MemorySource source(data, sizeof(data) - 1);
+		CHECK(request.Upload(L"PUT", L"/put", L"", source, response));
+		CHECK(request.Get(L"/empty", L"", response));
+		CHECK(request.Get(L"/big", L"", response));
+		TrafficLog::Instance().Stop();
+		CHECK(TrafficLog::Instance().GetMode() == TrafficLog::MODE_OFF);
+	}
+
+	void TestRoundTrip(int port, const std::wstring& log, const HttpResponse& chunked, const HttpResponse& binary)
+	{
+		std::shared_ptr<CountingTransport> network = std::make_shared<CountingTransport>();
+		HttpRequest request(L"127.0.0.1", port, false);
+		request.SetTransport(network);
+		HttpResponse response;
+
+		CHECK(TrafficLog::Instance().StartReplay(log, false));
+		CHECK(TrafficLog::Instance().GetMode() == TrafficLog::MODE_REPLAY);
+
+		CHECK(request.Get(L"/chunked", L"", response));
+		CHECK(response.statusCode == chunked.statusCode);
+		CHECK(response.header == chunked.header);
+		CHECK(!response.isBinary);
+		CHECK(response.text == chunked.text);
+
+		CHECK(request.Get(L"/close", L"", response));
+		CHECK(response.isBinary);
+		CHECK(response.binaryData == binary.binaryData);
+
+		// The same request gets its recorded answers in order
+		CHECK(request.Get(L"/n?1", L"", response));
+		CHECK(response.text.compare(0, 9, "path=/n?1") == 0);
+		CHECK(request.Get(L"/n?2", L"", response));
+		CHECK(request.Get(L"/n?1", L"", response));
+		CHECK(response.text.compare(0, 9, "path=/n?1") == 0);
+		CHECK(!request.Get(L"/n?1", L"", response));
+		CHECK(response.error == L"No recorded exchange for this request!");
+
+		CHECK(request.Post(L"/post", L"", "", response));
+		CHECK(response.statusCode == 201);
+		CHECK(response.text == "got 11 bytes, sum 1117");
+		CHECK(request.Get(L"/empty", L"", response));
+		CHECK(response.statusCode == 204);
+
+		// Requests that were not recorded
+		CHECK(!request.Get(L"/other", L"", response));
+		CHECK(!request.Delete(L"/chunked", L"", "", response));
+
+		CHECK(network->sent == 0);
+		TrafficLog::Instance().Stop();
+	}
+
+	void TestRecordedRequests(const std::wstring& log)
+	{
+		const std::string data = ReadFile(log);
+		CHECK(data.compare(0, 4, "WHTL") == 0);
+
+		size_t pos = 5;
+		RecordedExchange exchange;
+		bool post = false;
+		bool put = false;
+		bool paced = false;
+		while (TrafficLog::Parse(data, pos, exchange))
+		{
+			if (exchange.verb == L"POST")
+			{
+				post = true;
+				CHECK(exchange.requestBody == "posted body");
+				CHECK(exchange.requestHeaders == L"Content-Type: text/plain\r\n");
+			}
+			else if (exchange.verb == L"PUT")
+			{
+				// Sent from memory, recorded all the same
+				put = true;
+				CHECK(exchange.requestBody == std::string("in\0memory", 9));
+			}
+			else if (exchange.path == L"/paced")
+			{
+				paced = true;
+				CHECK(exchange.chunks.size() >= 3);
+				DWORD delays = 0;
+				for (const RecordedExchange::Chunk& chunk : exchange.chunks)
+					delays += chunk.delay;
+				CHECK(delays >= 150000);
+			}
+			else if (exchange.path == L"/big")
+			{
+				CHECK(exchange.succeeded);
+				CHECK(exchange.responseBody.size() == 5000000);
+			}
+			exchange = RecordedExchange();
+		}
+		CHECK(pos == data.size());
+		CHECK(post && put && paced);
+
+		// Serialize() and Parse() agree
+		RecordedExchange original;
+		original.verb = L"GET";
+		original.host = L"h\x00F4st";
+		original.port = 8443;
+		original.secure = true;
+		original.path = L"/p";
+		original.succeeded = true;
+		original.statusCode = 200;
+		original.isBinary = true;
+		original.responseBody = std::string("\0\x01\xFF", 3);
+		original.chunks.push_back(RecordedExchange::Chunk{ 2, 300 });
+		original.chunks.push_back(RecordedExchange::Chunk{ 1, 70000 });
+		std::string record;
+		TrafficLog::Serialize(original, record);
+		RecordedExchange parsed;
+		pos = 0;
+		CHECK(TrafficLog::Parse(record, pos, parsed));
+		CHECK(pos == record.size());
+		CHECK(parsed.host == original.host && parsed.port == 8443 && parsed.secure);
+		CHECK(parsed.responseBody == original.responseBody);
+		CHECK(parsed.chunks.size() == 2 && parsed.chunks[1].size == 1 && parsed.chunks[1].delay == 70000);
+	}
+
+	void TestPacing(int port, const std::wstring& log)
+	{
+		HttpRequest request(L"127.0.0.1", port, false);
+		request.SetTransport(std::make_shared<CountingTransport>());
+		HttpResponse response;
+
+		// The fixture sends /paced in chunks 100 ms apart
+		CHECK(TrafficLog::Instance().StartReplay(log, true));
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		CHECK(request.Get(L"/paced", L"", response));
+		CHECK(Elapsed(start) >= 150);
+		CHECK(response.text == "one two three");
+		TrafficLog::Instance().Stop();
+
+		CHECK(TrafficLog::Instance().StartReplay(log, false));
+		start = std::chrono::steady_clock::now();
+		CHECK(request.Get(L"/paced", L"", response));
+		CHECK(Elapsed(start) < 100);
+		CHECK(response.text == "one two three");
+		TrafficLog::Instance().Stop();
+	}
+
+	void TestDamagedLogs(int port, const std::wstring& log)
+	{
+		const std::string data = ReadFile(log);
+		const std::wstring damaged = Check::TempPath("damaged.whtl");
+		HttpRequest request(L"127.0.0.1", port, false);
+		request.SetTransport(std::make_shared<CountingTransport>());
+		HttpResponse response;
+
+		// Not a log at all
+		CHECK(!TrafficLog::Instance().StartReplay(Check::TempPath("missing.whtl"), false));
+		WriteFile(damaged, "");
+		CHECK(!TrafficLog::Instance().StartReplay(damaged, false));
+		WriteFile(damaged, "XHTL" + data.substr(4));
+		CHECK(!TrafficLog::Instance().StartReplay(damaged, false));
+		std::string version = data;
+		version[4] = static_cast<char>(version[4] + 1);
+		WriteFile(damaged, version);
+		CHECK(!TrafficLog::Instance().StartReplay(damaged, false));
+		CHECK(TrafficLog::Instance().GetMode() == TrafficLog::MODE_OFF);
+
+		// Cut short, as by a crash while recording: the complete records replay
+		WriteFile(damaged, data.substr(0, data.size() - 10));
+		CHECK(TrafficLog::Instance().StartReplay(damaged, false));
+		CHECK(request.Get(L"/chunked", L"", response));
+		CHECK(request.Get(L"/empty", L"", response));
+		CHECK(!request.Get(L"/big", L"", response));
+		TrafficLog::Instance().Stop();
+
+		// Just the header
+		WriteFile(damaged, data.substr(0, 5));
+		CHECK(TrafficLog::Instance().StartReplay(damaged, false));
+		CHECK(!request.Get(L"/chunked", L"", response));
+		TrafficLog::Instance().Stop();
+
+		// A record length past the end of the log stops the replay there
+		std::string overlong = data.substr(0, 5) + std::string("\xFF\xFF\xFF\xFF\x0F", 5) + data.substr(5);
+		WriteFile(damaged, overlong);
+		CHECK(TrafficLog::Instance().StartReplay(damaged, false));
+		CHECK(!request.Get(L"/chunked", L"", response));
+		TrafficLog::Instance().Stop();
+
+		// Garbage inside the first record: its fields do not parse
+		std::string garbage = data;
+		for (size_t i = 8; i < 40 && i < garbage.size(); ++i)
+			garbage[i] = '\xFF';
+		WriteFile(damaged, garbage);
+		CHECK(TrafficLog::Instance().StartReplay(damaged, false));
+		CHECK(!request.Get(L"/chunked", L"", response));
+		TrafficLog::Instance().Stop();
+
+		// Every truncation of a record fails to parse rather than overrun
+		size_t pos = 5;
+		RecordedExchange exchange;
+		CHECK(TrafficLog::Parse(data, pos, exchange));
+		for (size_t end = 5; end < pos; ++end)
+		{
+			size_t at = 5;
+			RecordedExchange partial;
+			CHECK(!TrafficLog::Parse(data.substr(0, end), at, partial));
+			CHECK(at == 5);
+		}
+	}
+}
+
+int main()
+{
+	const int port = Check::Port("FIXTURE_PORT");
+	if (!port)
+	{
+		printf("FIXTURE_PORT is not set, run through fixture.py\n");
+		return 1;
+	}
+
+	const std::wstring log = Check::TempPath("replay.whtl");
+	HttpResponse chunked;
+	HttpResponse binary;
+	Record(port, log, chunked, binary);
+	TestRoundTrip(port, log, chunked, binary);
+	TestRecordedRequests(log);
+	TestPacing(port, log);
+	TestDamagedLogs(port, log);
+	return Check::Summary("ReplayTest");
+}
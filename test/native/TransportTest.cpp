@@ -0,0 +1,257 @@
+// The MIT License (MIT)
+// PosixTransport against the fixture server
+//
+// http://opensource.org/licenses/MIT
+
+#include "Check.h"
+#include "WinHttpClient.h"
+#include "WinHttpPosixTransport.h"
+#include "WinHttpReplay.h"
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <thread>
+
+using namespace WinHttpWrapper;
+
+namespace
+{
+	// "conn=<client port>" part of the fixture's default answer
+	std::string ClientPort(const HttpResponse& response)
+	{
+		size_t conn = response.text.find("conn=");
+		return conn == std::string::npos ? std::string() : response.text.substr(conn);
+	}
+
+	// Body made of a counter, streamed through Read()
+	class CountingSource : public BodySource
+	{
+	public:
+		explicit CountingSource(size_t size) : m_Size(size), m_Pos(0) {}
+
+		ULONGLONG Length() const override { return m_Size; }
+		bool Rewind() override { m_Pos = 0; return true; }
+		bool Read(uint8_t* buffer, DWORD size, DWORD& read) override
+		{
+			read = static_cast<DWORD>((std::min)(static_cast<size_t>(size), m_Size - m_Pos));
+			for (DWORD i = 0; i < read; ++i)
+				buffer[i] = static_cast<uint8_t>(m_Pos + i);
+			m_Pos += read;
+			return true;
+		}
+
+	private:
+		size_t m_Size;
+		size_t m_Pos;
+	};
+
+	void TestKeepAlive(int port)
+	{
+		std::shared_ptr<PosixTransport> transport = std::make_shared<PosixTransport>();
+		HttpRequest request(L"127.0.0.1", port, false);
+		request.SetTransport(transport);
+		HttpResponse response;
+
+		CHECK(request.Get(L"/a", L"", response));
+		CHECK(response.statusCode == 200);
+		const std::string first = ClientPort(response);
+		CHECK(!first.empty());
+
+		CHECK(request.Get(L"/b", L"X-Test: 1\r\n", response));
+		CHECK(ClientPort(response) == first);
+		CHECK(!response.GetHeaderDictionary()[L"Content-Length"].empty());
+
+		// Still reused after a chunked body, not after a close-delimited one
+		CHECK(request.Get(L"/chunked", L"", response));
+		CHECK(request.Get(L"/c", L"", response));
+		CHECK(ClientPort(response) == first);
+		CHECK(request.Get(L"/close", L"", response));
+		CHECK(request.Get(L"/d", L"", response));
+		CHECK(ClientPort(response) != first);
+
+		// Without idle connections every request connects anew
+		transport->SetMaxIdleConnections(0);
+		CHECK(request.Get(L"/e", L"", response));
+		const std::string unpooled = ClientPort(response);
+		CHECK(request.Get(L"/f", L"", response));
+		CHECK(ClientPort(response) != unpooled);
+	}
+
+	void TestBodies(int port)
+	{
+		HttpRequest request(L"127.0.0.1", port, false);
+		HttpResponse response;
+
+		// Chunk extensions and trailers are skipped
+		CHECK(request.Get(L"/chunked", L"", response));
+		CHECK(!response.isBinary);
+		CHECK(response.text.size() == 14 + 5000);
+		CHECK(response.text.compare(0, 14, "hello chunked ") == 0);
+
+		CHECK(request.Get(L"/close", L"", response));
+		CHECK(response.isBinary);
+		CHECK(response.binaryData.size() == 256 * 400);
+		CHECK(response.binaryData.size() > 255 && response.binaryData[255] == 255);
+
+		CHECK(request.Get(L"/big", L"", response));
+		CHECK(response.text.size() == 5000000);
+		CHECK(response.contentLength == 5000000);
+
+		request.SetMaxResponseSize(1000000);
+		CHECK(!request.Get(L"/big", L"", response));
+		CHECK(response.error == L"Response body exceeds the size limit!");
+		request.SetMaxResponseSize(0);
+	}
+
+	void TestNoBody(int port)
+	{
+		HttpRequest request(L"127.0.0.1", port, false);
+		HttpResponse response;
+
+		// The Content-Length of a HEAD response announces a body that is not sent
+		MemorySource none(NULL, 0);
+		CHECK(request.Upload(L"HEAD", L"/head", L"", none, response));
+		CHECK(response.statusCode == 200);
+		CHECK(response.text.empty());
+		CHECK(response.GetHeaderDictionary()[L"Content-Length"] == L"1234");
+
+		CHECK(request.Get(L"/empty", L"", response));
+		CHECK(response.statusCode == 204);
+		CHECK(response.text.empty() && response.binaryData.empty());
+
+		// The connection is still in step after both
+		CHECK(request.Get(L"/after", L"", response));
+		CHECK(response.text.compare(0, 11, "path=/after") == 0);
+	}
+
+	void TestUploads(int port)
+	{
+		HttpRequest request(L"127.0.0.1", port, false);
+		HttpResponse response;
+
+		CHECK(request.Post(L"/post", L"", std::string(100000, 'a'), response));
+		CHECK(response.statusCode == 201);
+		CHECK(response.text == "got 100000 bytes, sum 672");
+
+		CountingSource counting(1000000);
+		CHECK(request.Upload(L"PUT", L"/put", L"", counting, response));
+		CHECK(response.text == "got 1000000 bytes, sum 26336");
+
+		const char data[] = "abc\0def";
+		MemorySource memory(data, 7);
+		CHECK(request.Upload(L"POST", L"/memory", L"", memory, response));
+		CHECK(response.text == "got 7 bytes, sum 597");
+
+		// The same body through a client, NUL included
+		HttpClient client(request);
+		CHECK(client.Send(L"POST", L"/memory", L"", memory, response));
+		CHECK(response.text == "got 7 bytes, sum 597");
+		const int id = client.Prepare(L"PUT", L"/{}");
+		CHECK(client.Send(id, std::vector<std::wstring>(1, L"memory"), memory, response));
+		CHECK(response.text == "got 7 bytes, sum 597");
+		CHECK(!client.Send(id, std::vector<std::wstring>(), memory, response));
+		CHECK(response.error == L"Wrong number of path parameters!");
+	}
+
+	void TestAuthentication(int port)
+	{
+		HttpRequest request(L"127.0.0.1", port, false, L"WinHttpClient", L"", L"", L"user", L"pass");
+		HttpResponse response;
+		CHECK(request.Get(L"/auth", L"", response));
+		CHECK(response.statusCode == 200);
+	}
+
+	void TestTimeouts(int port)
+	{
+		std::shared_ptr<PosixTransport> transport = std::make_shared<PosixTransport>();
+		transport->SetTimeout(300);
+		HttpRequest request(L"127.0.0.1", port, false);
+		request.SetTransport(transport);
+		HttpResponse response;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		CHECK(!request.Get(L"/stall", L"", response));
+		CHECK(response.error == L"The operation timed out!");
+		CHECK(!request.Get(L"/slow", L"", response));
+		CHECK(response.error == L"The operation timed out!");
+		CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(1500));
+
+		// The request's own timeout, when shorter
+		transport->SetTimeout(30000);
+		request.SetTimeout(300);
+		start = std::chrono::steady_clock::now();
+		CHECK(!request.Get(L"/stall", L"", response));
+		CHECK(response.error == L"The operation timed out!");
+		CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(1500));
+
+		// Nothing listens on the port of a closed server
+		HttpRequest closed(L"127.0.0.1", 1, false);
+		CHECK(!closed.Get(L"/", L"", response));
+		CHECK(response.error == L"Failed to connect to server!");
+	}
+
+	void TestRecordReplay(int port)
+	{
+		const std::wstring log = Check::TempPath("transport.whtl");
+		HttpRequest request(L"127.0.0.1", port, false);
+		HttpResponse recorded;
+		HttpResponse replayed;
+
+		CHECK(TrafficLog::Instance().StartRecording(log));
+		CHECK(request.Get(L"/chunked", L"", recorded));
+		TrafficLog::Instance().Stop();
+
+		CHECK(TrafficLog::Instance().StartReplay(log, false));
+		CHECK(request.Get(L"/chunked", L"", replayed));
+		CHECK(replayed.statusCode == recorded.statusCode);
+		CHECK(replayed.text == recorded.text);
+		TrafficLog::Instance().Stop();
+	}
+
+	void TestTls(int port)
+	{
+#ifdef WINHTTP_WRAPPER_OPENSSL
+		std::shared_ptr<PosixTransport> transport = std::make_shared<PosixTransport>();
+		HttpRequest request(L"127.0.0.1", port, true);
+		request.SetTransport(transport);
+		HttpResponse response;
+
+		// The fixture's certificate is self-signed
+		CHECK(!request.Get(L"/tls", L"", response));
+		CHECK(response.error == L"Server certificate is not trusted!");
+
+		transport->SetVerifyCertificates(false);
+		CHECK(request.Get(L"/tls", L"", response));
+		const std::string first = ClientPort(response);
+		CHECK(request.Get(L"/chunked", L"", response));
+		CHECK(response.text.size() == 14 + 5000);
+		CHECK(request.Get(L"/tls", L"", response));
+		CHECK(ClientPort(response) == first);
+#else
+		(void)port;
+		printf("TLS checks skipped: built without WINHTTP_WRAPPER_OPENSSL\n");
+#endif
+	}
+}
+
+int main()
+{
+	signal(SIGPIPE, SIG_IGN);
+	const int port = Check::Port("FIXTURE_PORT");
+	if (!port)
+	{
+		printf("FIXTURE_PORT is not set, run through fixture.py\n");
+		return 1;
+	}
+
+	TestKeepAlive(port);
+	TestBodies(port);
+	TestNoBody(port);
+	TestUploads(port);
+	TestAuthentication(port);
+	TestTimeouts(port);
+	TestRecordReplay(port);
+	if (const int tlsPort = Check::Port("FIXTURE_TLS_PORT"))
+		TestTls(tlsPort);
+	return Check::Summary("TransportTest");
+}
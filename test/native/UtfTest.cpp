@@ -0,0 +1,210 @@
+// The MIT License (MIT)
+// UTF-8 / UTF-16 transcoding
+//
+// http://opensource.org/licenses/MIT
+
+#include "Check.h"
+#include "WinHttpUtf.h"
+#include <random>
+#include <vector>
+
+using namespace WinHttpWrapper;
+
+namespace
+{
+	const bool kWide16 = sizeof(wchar_t) == 2;
+	const wchar_t kReplacement = 0xFFFD;
+
+	// Straightforward encoders the transcoder is compared with
+	void AppendUtf8(std::string& out, char32_t cp)
+	{
+		if (cp < 0x80)
+			out += static_cast<char>(cp);
+		else if (cp < 0x800)
+		{
+			out += static_cast<char>(0xC0 | (cp >> 6));
+			out += static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		else if (cp < 0x10000)
+		{
+			out += static_cast<char>(0xE0 | (cp >> 12));
+			out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		else
+		{
+			out += static_cast<char>(0xF0 | (cp >> 18));
+			out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+			out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (cp & 0x3F));
+		}
+	}
+
+	void AppendWide(std::wstring& out, char32_t cp)
+	{
+		if (kWide16 && cp >= 0x10000)
+		{
+			out += static_cast<wchar_t>(0xD800 + ((cp - 0x10000) >> 10));
+			out += static_cast<wchar_t>(0xDC00 + ((cp - 0x10000) & 0x3FF));
+		}
+		else
+			out += static_cast<wchar_t>(cp);
+	}
+
+	std::wstring Replacements(size_t count)
+	{
+		return std::wstring(count, kReplacement);
+	}
+
+	// Mostly ASCII with some 2, 3 and 4 byte characters, so that the ASCII
+	// runs start and end at every offset of the 16 byte blocks
+	void TestRoundTrip()
+	{
+		std::mt19937 random(1234);
+		std::string utf8;
+		std::wstring wide;
+		std::wstring decoded;
+		std::string encoded;
+		for (int round = 0; round < 2000; ++round)
+		{
+			utf8.clear();
+			wide.clear();
+			const size_t length = random() % 80;
+			for (size_t i = 0; i < length; ++i)
+			{
+				char32_t cp;
+				switch (random() % 8)
+				{
+				case 0: cp = 0x80 + random() % (0x800 - 0x80); break;
+				case 1: cp = 0x800 + random() % (0xD800 - 0x800); break;
+				case 2: cp = 0xE000 + random() % (0x10000 - 0xE000); break;
+				case 3: cp = 0x10000 + random() % (0x110000 - 0x10000); break;
+				default: cp = random() % 0x80; break;
+				}
+				AppendUtf8(utf8, cp);
+				AppendWide(wide, cp);
+			}
+
+			Utf8ToWide(utf8.data(), utf8.size(), decoded);
+			CHECK(decoded == wide);
+			WideToUtf8(decoded.data(), decoded.size(), encoded);
+			CHECK(encoded == utf8);
+		}
+
+		// Boundaries of the ranges
+		const char32_t edges[] = { 0x7F, 0x80, 0x7FF, 0x800, 0xD7FF, 0xE000, 0xFFFD, 0xFFFF, 0x10000, 0x10FFFF };
+		for (char32_t cp : edges)
+		{
+			utf8.clear();
+			wide.clear();
+			AppendUtf8(utf8, cp);
+			AppendWide(wide, cp);
+			CHECK(Utf8ToWide(utf8) == wide);
+			CHECK(WideToUtf8(wide) == utf8);
+		}
+
+		CHECK(Utf8ToWide(std::string()).empty());
+		CHECK(WideToUtf8(std::wstring()).empty());
+	}
+
+	void TestFourByteSequences()
+	{
+		// U+1F600, between ASCII at both ends of a 16 byte block
+		const std::string utf8 = std::string(15, 'a') + "\xF0\x9F\x98\x80" + std::string(17, 'b');
+		std::wstring expected = std::wstring(15, L'a');
+		AppendWide(expected, 0x1F600);
+		expected += std::wstring(17, L'b');
+		CHECK(Utf8ToWide(utf8) == expected);
+		CHECK(WideToUtf8(expected) == utf8);
+		CHECK(Utf8ToWide("\xF4\x8F\xBF\xBF").size() == (kWide16 ? 2u : 1u));
+	}
+
+	void TestInvalidUtf8()
+	{
+		// Overlong forms: each byte that cannot start or continue one is replaced
+		CHECK(Utf8ToWide("\xC0\xAF") == Replacements(2));
+		CHECK(Utf8ToWide("\xC1\xBF") == Replacements(2));
+		CHECK(Utf8ToWide("\xE0\x80\xAF") == Replacements(3));
+		CHECK(Utf8ToWide("\xE0\x9F\xBF") == Replacements(3));
+		CHECK(Utf8ToWide("\xF0\x80\x80\xAF") == Replacements(4));
+		CHECK(Utf8ToWide("\xF0\x8F\xBF\xBF") == Replacements(4));
+
+		// Encoded surrogates, lone or paired, are not characters
+		CHECK(Utf8ToWide("\xED\xA0\x80") == Replacements(3));
+		CHECK(Utf8ToWide("\xED\xBF\xBF") == Replacements(3));
+		CHECK(Utf8ToWide("\xED\xA0\xBD\xED\xB8\x80") == Replacements(6));
+		CHECK(Utf8ToWide("\xED\x9F\xBF") == std::wstring(1, static_cast<wchar_t>(0xD7FF)));
+
+		// Above U+10FFFF, and bytes that never appear
+		CHECK(Utf8ToWide("\xF4\x90\x80\x80") == Replacements(4));
+		CHECK(Utf8ToWide("\xF5\x80\x80\x80") == Replacements(4));
+		CHECK(Utf8ToWide("\xFE\xFF") == Replacements(2));
+
+		// Stray continuation bytes
+		CHECK(Utf8ToWide("a\x80" "b\xBF") == L"a\xFFFD" L"b\xFFFD");
+
+		// A truncated sequence is one replacement, and does not swallow
+		// what follows it
+		CHECK(Utf8ToWide("\xE2\x82") == Replacements(1));
+		CHECK(Utf8ToWide("\xE2\x82" "A") == L"\xFFFD" L"A");
+		CHECK(Utf8ToWide("\xF0\x9F\x98" "\xC3\xA9") == L"\xFFFD\x00E9");
+		CHECK(Utf8ToWide(std::string(20, 'x') + "\xF0\x9F") == std::wstring(20, L'x') + Replacements(1));
+	}
+
+	void TestInvalidWide()
+	{
+		const std::string replacement = "\xEF\xBF\xBD";
+
+		// Lone surrogates, at the end or before something else
+		std::wstring lone;
+		lone += static_cast<wchar_t>(0xD800);
+		lone += L'a';
+		lone += static_cast<wchar_t>(0xDC00);
+		lone += static_cast<wchar_t>(0xDBFF);
+		CHECK(WideToUtf8(lone) == replacement + "a" + replacement + replacement);
+
+		// A low surrogate before a high one is not a pair
+		std::wstring reversed;
+		reversed += static_cast<wchar_t>(0xDC00);
+		reversed += static_cast<wchar_t>(0xD800);
+		CHECK(WideToUtf8(reversed) == replacement + replacement);
+
+		if (!kWide16)
+		{
+			// UTF-32: surrogates are never paired, and values above U+10FFFF are invalid
+			std::wstring pair;
+			pair += static_cast<wchar_t>(0xD83D);
+			pair += static_cast<wchar_t>(0xDE00);
+			CHECK(WideToUtf8(pair) == replacement + replacement);
+			CHECK(WideToUtf8(std::wstring(1, static_cast<wchar_t>(0x110000))) == replacement);
+		}
+	}
+
+	void TestBufferReuse()
+	{
+		// The output is overwritten, keeping its capacity
+		std::wstring wide(100, L'z');
+		const size_t capacity = wide.capacity();
+		Utf8ToWide("abc", 3, wide);
+		CHECK(wide == L"abc");
+		CHECK(wide.capacity() == capacity);
+
+		std::string utf8(100, 'z');
+		WideToUtf8(L"\x00E9t\x00E9", 3, utf8);
+		CHECK(utf8 == "\xC3\xA9t\xC3\xA9");
+
+		// Embedded NULs are kept
+		const std::string withNul("a\0b", 3);
+		CHECK(Utf8ToWide(withNul) == std::wstring(L"a\0b", 3));
+	}
+}
+
+int main()
+{
+	TestRoundTrip();
+	TestFourByteSequences();
+	TestInvalidUtf8();
+	TestInvalidWide();
+	TestBufferReuse();
+	return Check::Summary("UtfTest");
+}
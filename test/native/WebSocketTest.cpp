@@ -0,0 +1,246 @@
+// The MIT License (MIT)
+// WebSockets over PosixTransport, against the fixture's echo server
+//
+// http://opensource.org/licenses/MIT
+
+#include "Check.h"
+#include "WinHttpPosixTransport.h"
+#include "WinHttpWebSocket.h"
+#include <chrono>
+#include <csignal>
+#include <thread>
+
+using namespace WinHttpWrapper;
+
+namespace
+{
+	bool Open(int port, WebSocket& socket, const std::wstring& path = L"/ws")
+	{
+		HttpRequest request(L"127.0.0.1", port, false);
+		HttpResponse response;
+		if (!request.OpenWebSocket(path, L"", socket, response))
+		{
+			printf("OpenWebSocket failed: %ls\n", response.error.c_str());
+			return false;
+		}
+		return response.statusCode == 101 && socket.IsOpen();
+	}
+
+	bool SendText(WebSocket& socket, const std::string& text)
+	{
+		return socket.Send(text.data(), text.size(), false);
+	}
+
+	// Next message, as text
+	std::string Next(WebSocket& socket)
+	{
+		WebSocketMessage message;
+		return socket.Wait(message, 5000) ? message.data : std::string("<none>");
+	}
+
+	void TestEcho(int port)
+	{
+		WebSocket socket;
+		CHECK(Open(port, socket, L"/ws?greet"));
+
+		// Sent with the 101 response, in the same packet
+		CHECK(Next(socket) == "hello");
+
+		WebSocketMessage message;
+		CHECK(!socket.Poll(message));
+		CHECK(SendText(socket, "hi"));
+		CHECK(socket.Wait(message, 5000));
+		CHECK(message.data == "hi" && !message.binary);
+
+		std::string bytes;
+		for (int i = 0; i < 256; ++i)
+			bytes += static_cast<char>(i);
+		CHECK(socket.Send(bytes.data(), bytes.size(), true));
+		CHECK(socket.Wait(message, 5000));
+		CHECK(message.binary && message.data == bytes);
+
+		CHECK(socket.Send("", 0, false));
+		CHECK(socket.Wait(message, 5000));
+		CHECK(message.data.empty() && !message.binary);
+
+		// 16 and 64 bit lengths; the large one goes out in fragments and
+		// comes back as one frame
+		const std::string medium(1000, 'm');
+		CHECK(SendText(socket, medium));
+		CHECK(Next(socket) == medium);
+		std::string large(300000, '\0');
+		for (size_t i = 0; i < large.size(); ++i)
+			large[i] = static_cast<char>('a' + i % 26);
+		CHECK(SendText(socket, large));
+		CHECK(Next(socket) == large);
+
+		// Fragments from the server with a ping between them, which is answered
+		CHECK(SendText(socket, "frag"));
+		CHECK(Next(socket) == "one two three");
+		CHECK(Next(socket) == "pong:frag");
+
+		CHECK(SendText(socket, "big:70000"));
+		CHECK(socket.Wait(message, 5000));
+		CHECK(message.binary && message.data.size() == 70000);
+		CHECK(static_cast<unsigned char>(message.data[69999]) == 69999 % 256);
+
+		// Closing handshake started by us
+		socket.Close(WINHTTP_WEB_SOCKET_SUCCESS_CLOSE_STATUS, "done");
+		CHECK(!socket.IsOpen());
+		CHECK(socket.CloseStatus() == WINHTTP_WEB_SOCKET_SUCCESS_CLOSE_STATUS);
+		CHECK(socket.CloseReason() == "done");
+		CHECK(socket.Error().empty());
+		CHECK(!SendText(socket, "after"));
+	}
+
+	void TestServerClose(int port)
+	{
+		WebSocket socket;
+		CHECK(Open(port, socket));
+		CHECK(SendText(socket, "queued"));
+		CHECK(SendText(socket, "close:4001:bye"));
+
+		// Messages received before the close can still be taken
+		WebSocketMessage message;
+		CHECK(socket.Wait(message, 5000) && message.data == "queued");
+		CHECK(!socket.Wait(message, INFINITE));
+		CHECK(!socket.IsOpen());
+		CHECK(socket.CloseStatus() == 4001);
+		CHECK(socket.CloseReason() == "bye");
+		CHECK(socket.Error().empty());
+
+		WebSocket dropped;
+		CHECK(Open(port, dropped));
+		CHECK(SendText(dropped, "drop"));
+		CHECK(!dropped.Wait(message, 5000));
+		CHECK(dropped.CloseStatus() == WINHTTP_WEB_SOCKET_ABORTED_CLOSE_STATUS);
+		CHECK(dropped.Error() == L"WebSocket connection lost!");
+	}
+
+	void TestLimits(int port)
+	{
+		WebSocket socket;
+		socket.SetMaxMessageSize(1000);
+		CHECK(Open(port, socket));
+		CHECK(SendText(socket, "big:1000"));
+		CHECK(Next(socket).size() == 1000);
+		CHECK(SendText(socket, "big:1001"));
+		WebSocketMessage message;
+		CHECK(!socket.Wait(message, 5000));
+		CHECK(socket.CloseStatus() == WINHTTP_WEB_SOCKET_MESSAGE_TOO_BIG_CLOSE_STATUS);
+		CHECK(socket.Error() == L"WebSocket message exceeds the size limit!");
+
+		WebSocket invalid;
+		CHECK(Open(port, invalid));
+		CHECK(SendText(invalid, "bad"));
+		CHECK(!invalid.Wait(message, 5000));
+		CHECK(invalid.CloseStatus() == 1002);
+		CHECK(invalid.Error() == L"Invalid WebSocket frame!");
+
+		// Reading pauses while the queue is full, nothing is lost
+		WebSocket slow;
+		slow.SetMaxQueuedBytes(2000);
+		CHECK(Open(port, slow));
+		CHECK(SendText(slow, "burst:50"));
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		for (int i = 0; i < 50; ++i)
+		{
+			const std::string next = Next(slow);
+			CHECK(next.size() == 500 && atoi(next.c_str()) == i);
+		}
+	}
+
+	void TestKeepAlive(int port)
+	{
+		WebSocket socket;
+		socket.SetKeepAliveInterval(100);
+		CHECK(Open(port, socket));
+		std::this_thread::sleep_for(std::chrono::milliseconds(450));
+		CHECK(SendText(socket, "pings?"));
+		CHECK(atoi(Next(socket).c_str()) >= 3);
+	}
+
+	// Sends from one thread while another receives
+	void TestConcurrentSend(int port)
+	{
+		WebSocket socket;
+		CHECK(Open(port, socket));
+		const int count = 200;
+		std::thread sender([&]
+		{
+			for (int i = 0; i < count; ++i)
+				SendText(socket, std::to_string(i) + std::string(i * 37, 'x'));
+		});
+		bool ordered = true;
+		for (int i = 0; i < count; ++i)
+			ordered = ordered && Next(socket) == std::to_string(i) + std::string(i * 37, 'x');
+		sender.join();
+		CHECK(ordered);
+	}
+
+	void TestRefused(int port)
+	{
+		HttpRequest request(L"127.0.0.1", port, false);
+		HttpResponse response;
+		WebSocket socket;
+		CHECK(!request.OpenWebSocket(L"/plain", L"", socket, response));
+		CHECK(response.statusCode == 200);
+		CHECK(response.error == L"WebSocket upgrade refused!");
+		CHECK(!socket.IsOpen());
+
+		CHECK(!request.OpenWebSocket(L"/ws?bad-accept", L"", socket, response));
+		CHECK(response.statusCode == 101);
+		CHECK(response.error == L"Failed to complete WebSocket upgrade!");
+
+		HttpRequest nowhere(L"127.0.0.1", 1, false);
+		CHECK(!nowhere.OpenWebSocket(L"/ws", L"", socket, response));
+		CHECK(response.error == L"Failed to connect to server!");
+	}
+
+	void TestTls(int port)
+	{
+#ifdef WINHTTP_WRAPPER_OPENSSL
+		std::shared_ptr<PosixTransport> transport = std::make_shared<PosixTransport>();
+		transport->SetVerifyCertificates(false);
+		HttpRequest request(L"localhost", port, true);
+		request.SetTransport(transport);
+		HttpResponse response;
+		WebSocket socket;
+		CHECK(request.OpenWebSocket(L"/ws?greet", L"", socket, response));
+		CHECK(Next(socket) == "hello");
+		const std::string large(200000, 's');
+		CHECK(SendText(socket, large));
+		CHECK(Next(socket) == large);
+		CHECK(SendText(socket, "frag"));
+		CHECK(Next(socket) == "one two three");
+		CHECK(Next(socket) == "pong:frag");
+		socket.Close(4000, "tls");
+		CHECK(socket.CloseStatus() == 4000);
+		CHECK(socket.CloseReason() == "tls");
+#else
+		(void)port;
+		printf("TLS checks skipped: built without WINHTTP_WRAPPER_OPENSSL\n");
+#endif
+	}
+}
+
+int main()
+{
+	signal(SIGPIPE, SIG_IGN);
+	const int port = Check::Port("FIXTURE_PORT");
+	if (!port)
+	{
+		printf("FIXTURE_PORT is not set, run through fixture.py\n");
+		return 1;
+	}
+
+	TestEcho(port);
+	TestServerClose(port);
+	TestLimits(port);
+	TestKeepAlive(port);
+	TestConcurrentSend(port);
+	TestRefused(port);
+	if (const int tlsPort = Check::Port("FIXTURE_TLS_PORT"))
+		TestTls(tlsPort);
+	return Check::Summary("WebSocketTest");
+}
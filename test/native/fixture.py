@@ -0,0 +1,292 @@
+#!/usr/bin/env python3
+# Local HTTP server for the native tests, and their runner:
+#
+#   python3 fixture.py build/TransportTest build/ReplayTest ...
+#
+# starts the server on a free port (and a TLS one when the openssl command
+# is available), runs each test with FIXTURE_PORT / FIXTURE_TLS_PORT set,
+# and exits with the number of tests that failed.
+
+import base64
+import hashlib
+import http.server
+import os
+import shutil
+import socketserver
+import ssl
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, *args):
+        pass
+
+    def send_body(self, body, content_type="text/plain", status=200):
+        self.send_response(status)
+        self.send_header("Content-Type", content_type)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def send_chunks(self, parts, delay=0):
+        self.send_response(200)
+        self.send_header("Content-Type", "text/plain")
+        self.send_header("Transfer-Encoding", "chunked")
+        self.end_headers()
+        for part in parts:
+            self.wfile.write(b"%x;ext=1\r\n%s\r\n" % (len(part), part))
+            self.wfile.flush()
+            time.sleep(delay)
+        self.wfile.write(b"0\r\nX-Trailer: 1\r\n\r\n")
+
+    def do_GET(self):
+        path = self.path.split("?")[0]
+        if path == "/chunked":
+            self.send_chunks([b"hello ", b"chunked ", b"world" * 1000])
+        elif path == "/paced":
+            # Chunks 100 ms apart, for replays at the recorded pace
+            self.send_chunks([b"one ", b"two ", b"three"], 0.1)
+        elif path == "/close":
+            # Delimited by the end of the connection
+            self.send_response(200)
+            self.send_header("Content-Type", "application/octet-stream")
+            self.send_header("Connection", "close")
+            self.end_headers()
+            self.wfile.write(bytes(range(256)) * 400)
+            self.close_connection = True
+        elif path == "/empty":
+            self.send_response(204)
+            self.end_headers()
+        elif path == "/big":
+            self.send_body(b"x" * 5000000)
+        elif path == "/stall":
+            # The head comes too late
+            time.sleep(2)
+            self.send_body(b"late")
+        elif path == "/slow":
+            # The body stops halfway
+            self.send_response(200)
+            self.send_header("Content-Length", "100")
+            self.end_headers()
+            self.wfile.write(b"x" * 10)
+            self.wfile.flush()
+            time.sleep(2)
+            self.wfile.write(b"y" * 90)
+        elif path == "/untyped":
+            # No Content-Type: the client sniffs the body
+            body = b"\x89PNG\r\n\x1a\n" + bytes(8) if self.path.endswith("?png") else b"plain text body"
+            self.send_response(200)
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+        elif path == "/ws":
+            self.websocket()
+        elif path == "/auth":
+            authorization = self.headers.get("Authorization", "")
+            self.send_body(authorization.encode(), status=200 if authorization == "Basic dXNlcjpwYXNz" else 401)
+        else:
+            # The client port tells whether a connection was reused
+            self.send_body(("path=%s conn=%d" % (self.path, self.client_address[1])).encode())
+
+    def websocket(self):
+        key = self.headers.get("Sec-WebSocket-Key", "")
+        if self.headers.get("Upgrade", "").lower() != "websocket" or not key:
+            self.send_body(b"not a websocket request", status=400)
+            return
+        accept = base64.b64encode(hashlib.sha1((key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11").encode()).digest())
+        if self.path.endswith("?bad-accept"):
+            accept = base64.b64encode(b"x" * 20)
+        head = b"HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+        head += b"Sec-WebSocket-Accept: %s\r\n\r\n" % accept
+        # A first message in the same packet as the head
+        if self.path.endswith("?greet"):
+            head += ws_frame(0x1, b"hello")
+        self.wfile.write(head)
+        self.wfile.flush()
+        self.close_connection = True
+        WebSocketEcho(self.rfile, self.wfile).run()
+
+    def do_HEAD(self):
+        self.send_response(200)
+        self.send_header("Content-Type", "text/plain")
+        self.send_header("Content-Length", "1234")
+        self.end_headers()
+
+    def do_POST(self):
+        length = int(self.headers.get("Content-Length", "0"))
+        body = self.rfile.read(length)
+        self.send_body(b"got %d bytes, sum %d" % (len(body), sum(body) % 65536), status=201)
+
+    do_PUT = do_POST
+
+
+def ws_frame(opcode, payload, final=True, masked=False):
+    head = bytes([(0x80 if final else 0) | opcode])
+    mask = 0x80 if masked else 0
+    if len(payload) < 126:
+        head += bytes([mask | len(payload)])
+    elif len(payload) < 65536:
+        head += bytes([mask | 126]) + struct.pack("!H", len(payload))
+    else:
+        head += bytes([mask | 127]) + struct.pack("!Q", len(payload))
+    if masked:
+        head += b"\0\0\0\0"
+    return head + payload
+
+
+class WebSocketEcho:
+    """Echoes messages back, and answers a few commands:
+
+    close:<status>:<reason>  closes with status and reason
+    drop                     drops the connection without closing
+    frag                     sends "one two three" in 3 fragments, with a ping between them
+    big:<size>               sends a binary message of size bytes
+    burst:<count>            sends count messages of 500 bytes
+    pings?                   tells how many pings were received
+    bad                      sends a masked frame, which servers may not
+    """
+
+    def __init__(self, rfile, wfile):
+        self.rfile = rfile
+        self.wfile = wfile
+        self.pings = 0
+
+    def send(self, opcode, payload, final=True, masked=False):
+        self.wfile.write(ws_frame(opcode, payload, final, masked))
+        self.wfile.flush()
+
+    def read_frame(self):
+        head = self.rfile.read(2)
+        if len(head) < 2:
+            return None
+        length = head[1] & 0x7F
+        if length == 126:
+            length = struct.unpack("!H", self.rfile.read(2))[0]
+        elif length == 127:
+            length = struct.unpack("!Q", self.rfile.read(8))[0]
+        if not head[1] & 0x80:
+            return head[0] & 0x80, head[0] & 0x0F, None
+        mask = self.rfile.read(4)
+        payload = bytearray(self.rfile.read(length))
+        for i in range(len(payload)):
+            payload[i] ^= mask[i & 3]
+        return head[0] & 0x80, head[0] & 0x0F, bytes(payload)
+
+    def run(self):
+        message = b""
+        opcode = 0
+        while True:
+            frame = self.read_frame()
+            if frame is None:
+                return
+            final, frame_opcode, payload = frame
+            if payload is None:
+                # Clients must mask their frames
+                self.send(0x8, struct.pack("!H", 1002))
+                return
+            if frame_opcode == 0x8:
+                self.send(0x8, payload)
+                return
+            if frame_opcode == 0x9:
+                self.pings += 1
+                self.send(0xA, payload)
+                continue
+            if frame_opcode == 0xA:
+                self.send(0x1, b"pong:" + payload)
+                continue
+            if frame_opcode != 0:
+                opcode = frame_opcode
+            message += payload
+            if not final:
+                continue
+            if not self.command(opcode, message):
+                return
+            message = b""
+
+    def command(self, opcode, message):
+        if opcode == 0x1 and message.startswith(b"close:"):
+            _, status, reason = message.split(b":", 2)
+            self.send(0x8, struct.pack("!H", int(status)) + reason)
+            self.read_frame()
+            return False
+        if opcode == 0x1 and message == b"drop":
+            return False
+        if opcode == 0x1 and message == b"frag":
+            self.send(0x1, b"one ", final=False)
+            self.send(0x9, b"frag")
+            self.send(0x0, b"two ", final=False)
+            self.send(0x0, b"three")
+        elif opcode == 0x1 and message.startswith(b"big:"):
+            self.send(0x2, bytes(i & 0xFF for i in range(int(message[4:]))))
+        elif opcode == 0x1 and message.startswith(b"burst:"):
+            for i in range(int(message[6:])):
+                self.send(0x1, b"%03d" % i + b"." * 497)
+        elif opcode == 0x1 and message == b"pings?":
+            self.send(0x1, b"%d" % self.pings)
+        elif opcode == 0x1 and message == b"bad":
+            self.send(0x1, b"masked", masked=True)
+        else:
+            self.send(opcode, message)
+        return True
+
+
+class Server(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+
+    def handle_error(self, request, client_address):
+        # Tests hang up on purpose (timeouts, size limits)
+        if not isinstance(sys.exc_info()[1], (ConnectionError, ssl.SSLError)):
+            super().handle_error(request, client_address)
+
+
+def serve(context=None):
+    server = Server(("127.0.0.1", 0), Handler)
+    if context:
+        server.socket = context.wrap_socket(server.socket, server_side=True)
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    return server.server_address[1]
+
+
+def tls_context(directory):
+    if not shutil.which("openssl"):
+        return None
+    cert = os.path.join(directory, "cert.pem")
+    key = os.path.join(directory, "key.pem")
+    made = subprocess.run(["openssl", "req", "-x509", "-newkey", "rsa:2048", "-nodes", "-days", "1",
+                           "-subj", "/CN=localhost", "-keyout", key, "-out", cert],
+                          stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    if made.returncode != 0:
+        return None
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.load_cert_chain(cert, key)
+    return context
+
+
+def main(tests):
+    env = dict(os.environ)
+    env["FIXTURE_PORT"] = str(serve())
+    with tempfile.TemporaryDirectory() as directory:
+        context = tls_context(directory)
+        if context:
+            env["FIXTURE_TLS_PORT"] = str(serve(context))
+        env["FIXTURE_DIR"] = directory
+
+        failed = 0
+        for test in tests:
+            print("== %s" % test, flush=True)
+            if subprocess.run([test], env=env).returncode != 0:
+                print("== %s FAILED" % test, flush=True)
+                failed += 1
+        print("== %d of %d test(s) failed" % (failed, len(tests)))
+        return failed
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))